@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include "bodies.h"
+
+using glm::mat4;
+using glm::vec4;
+
+static const double TwoPi = 6.283185307179586;
+
+template<typename T>
+static void Grow(T *&array, Uint32 count, Uint32 capacity)
+{
+    array = (T*)realloc(array, capacity * sizeof(T));
+    std::fill(array + count, array + capacity, T(0));
+}
+
+// Takes chunks until none are left, called with the mutex locked and returns with it locked
+static void RunChunks(BodyStore *store)
+{
+    while (store->nextChunk < store->chunkCount)
+    {
+        Uint32 chunk = store->nextChunk++;
+        double time = store->updateTime;
+        SDL_UnlockMutex(store->mutex);
+        Uint32 first = chunk * BODY_CHUNK;
+        Bodies::UpdateRange(store, time, first, std::min(Uint32(BODY_CHUNK), store->count - first));
+        SDL_LockMutex(store->mutex);
+
+        if (++store->doneChunks == store->chunkCount)
+            SDL_CondSignal(store->workDone);
+    }
+}
+
+static int UpdateThread(void *data)
+{
+    BodyStore *store = (BodyStore*)data;
+    SDL_LockMutex(store->mutex);
+    while (true)
+    {
+        while (store->nextChunk == store->chunkCount && !store->quit)
+        {
+            SDL_CondWait(store->workQueued, store->mutex);
+        }
+        if (store->quit)
+            break;
+        RunChunks(store);
+    }
+    SDL_UnlockMutex(store->mutex);
+    return 0;
+}
+
+bool Bodies::Init(BodyStore *store, Uint32 threadCount)
+{
+    *store = {};
+    if (threadCount == 0)
+        return true;
+
+    store->mutex = SDL_CreateMutex();
+    store->workQueued = SDL_CreateCond();
+    store->workDone = SDL_CreateCond();
+    if (!store->mutex || !store->workQueued || !store->workDone)
+    {
+        Release(store);
+        return false;
+    }
+    for (Uint32 i = 0; i < std::min(threadCount, Uint32(BODY_MAX_THREADS)); ++i)
+    {
+        store->threads[i] = SDL_CreateThread(UpdateThread, "BodyUpdate", store);
+        if (!store->threads[i])
+        {
+            Release(store);
+            return false;
+        }
+        ++store->threadCount;
+    }
+    return true;
+}
+
+void Bodies::Release(BodyStore *store)
+{
+    if (store->threadCount > 0)
+    {
+        SDL_LockMutex(store->mutex);
+        store->quit = true;
+        SDL_CondBroadcast(store->workQueued);
+        SDL_UnlockMutex(store->mutex);
+        for (Uint32 i = 0; i < store->threadCount; ++i)
+        {
+            SDL_WaitThread(store->threads[i], NULL);
+        }
+    }
+    if (store->workDone)
+        SDL_DestroyCond(store->workDone);
+    if (store->workQueued)
+        SDL_DestroyCond(store->workQueued);
+    if (store->mutex)
+        SDL_DestroyMutex(store->mutex);
+
+    free(store->distances);
+    free(store->angularSpeeds);
+    free(store->phases);
+    free(store->radii);
+    free(store->meshes);
+    free(store->angles);
+    free(store->positionsX);
+    free(store->positionsZ);
+    free(store->orbitMatrices);
+    *store = {};
+}
+
+Uint32 Bodies::Add(BodyStore *store, float distance, float angularSpeed, double phase, float radius, Uint32 mesh)
+{
+    if (store->count == store->capacity)
+    {
+        // The padding lanes stay zero, they orbit nothing at distance 0
+        Uint32 capacity = std::max(store->capacity * 2, Uint32(SIMD_WIDTH));
+        Grow(store->distances, store->count, capacity);
+        Grow(store->angularSpeeds, store->count, capacity);
+        Grow(store->phases, store->count, capacity);
+        Grow(store->radii, store->count, capacity);
+        Grow(store->meshes, store->count, capacity);
+        Grow(store->angles, store->count, capacity);
+        Grow(store->positionsX, store->count, capacity);
+        Grow(store->positionsZ, store->count, capacity);
+        Grow(store->orbitMatrices, store->count, capacity);
+        store->capacity = capacity;
+    }
+
+    Uint32 body = store->count++;
+    store->distances[body] = distance;
+    store->angularSpeeds[body] = angularSpeed;
+    store->phases[body] = phase;
+    store->radii[body] = radius;
+    store->meshes[body] = mesh;
+    store->orbitMatrices[body] = mat4(1.0f);
+    return body;
+}
+
+void Bodies::Update(BodyStore *store, double time)
+{
+    if (store->threadCount == 0 || store->count < BODY_PARALLEL_MIN)
+    {
+        UpdateRange(store, time, 0, store->count);
+        return;
+    }
+
+    SDL_LockMutex(store->mutex);
+    store->updateTime = time;
+    store->chunkCount = (store->count + BODY_CHUNK - 1) / BODY_CHUNK;
+    store->nextChunk = 0;
+    store->doneChunks = 0;
+    SDL_CondBroadcast(store->workQueued);
+    RunChunks(store);
+    while (store->doneChunks < store->chunkCount)
+    {
+        SDL_CondWait(store->workDone, store->mutex);
+    }
+    SDL_UnlockMutex(store->mutex);
+}
+
+void Bodies::UpdateRange(BodyStore *store, double time, Uint32 first, Uint32 count)
+{
+    // Whole vectors, the last one runs into the padding
+    Uint32 end = std::min(first + (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH, store->capacity);
+
+    // A function of the time alone. Wrapped to one turn in double precision, the angles of long running
+    // animations keep their precision as floats.
+    for (Uint32 i = first; i < end; ++i)
+    {
+        double angle = store->phases[i] + double(store->angularSpeeds[i]) * time;
+        angle -= floor(angle * (1.0 / TwoPi)) * TwoPi;
+        store->angles[i] = float(angle);
+    }
+
+    for (Uint32 i = first; i < end; i += SIMD_WIDTH)
+    {
+        VFloat sine, cosine;
+        Simd::SinCos(Simd::Load(store->angles + i), sine, cosine);
+        VFloat distance = Simd::Load(store->distances + i);
+        Simd::Store(store->positionsX + i, Simd::Mul(cosine, distance));
+        Simd::Store(store->positionsZ + i, Simd::Mul(Simd::Sub(Simd::Set(0.0f), sine), distance));
+
+        // The rotation's columns around the translation, as rotate(angle, y) * translate(distance, 0, 0)
+        float sines[SIMD_WIDTH];
+        float cosines[SIMD_WIDTH];
+        Simd::Store(sines, sine);
+        Simd::Store(cosines, cosine);
+        for (Uint32 lane = 0; lane < SIMD_WIDTH; ++lane)
+        {
+            mat4 &matrix = store->orbitMatrices[i + lane];
+            matrix[0] = vec4(cosines[lane], 0.0f, -sines[lane], 0.0f);
+            matrix[1] = vec4(0.0f, 1.0f, 0.0f, 0.0f);
+            matrix[2] = vec4(sines[lane], 0.0f, cosines[lane], 0.0f);
+            matrix[3] = vec4(store->positionsX[i + lane], 0.0f, store->positionsZ[i + lane], 1.0f);
+        }
+    }
+}
+
+Uint32 Bodies::DefaultThreadCount()
+{
+    return Uint32(std::max(0, std::min(SDL_GetCPUCount() - 1, BODY_MAX_THREADS)));
+}
@@ -0,0 +1,60 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+#include "simd.h"
+
+#define BODY_MAX_THREADS 16
+#define BODY_CHUNK 16384            // Bodies per task of the update threads, a multiple of SIMD_WIDTH
+#define BODY_PARALLEL_MIN 65536     // Smaller stores update on the calling thread alone
+
+/*  Bodies orbiting the origin in the y = 0 plane, stored as parallel arrays so the per frame update runs over
+    contiguous memory: the angles in double precision, sine and cosine SIMD_WIDTH bodies at a time, then the
+    positions and orbit matrices. The arrays are padded to whole vectors. Large stores are updated in chunks by
+    a pool of threads together with the calling thread. */
+struct BodyStore
+{
+    Uint32 count;
+    Uint32 capacity;            // A multiple of SIMD_WIDTH
+
+    // Orbits
+    float *distances;
+    float *angularSpeeds;       // Radians per second, 0 keeps the body at its phase
+    double *phases;             // Angle at time 0
+    float *radii;               // Of the bounding sphere around the position
+    Uint32 *meshes;             // Mesh handles, what they index is up to the owner of the store
+
+    // Results of the last Update
+    float *angles;              // In [0, 2 pi)
+    float *positionsX;          // The positions' y is 0
+    float *positionsZ;
+    glm::mat4 *orbitMatrices;   // Rotation about the y axis by the angle times the translation by the distance along x
+
+    SDL_Thread *threads[BODY_MAX_THREADS];
+    Uint32 threadCount;
+    SDL_mutex *mutex;
+    SDL_cond *workQueued;
+    SDL_cond *workDone;
+    double updateTime;
+    Uint32 chunkCount;
+    Uint32 nextChunk;
+    Uint32 doneChunks;
+    bool quit;
+};
+
+namespace Bodies
+{
+    // threadCount 0 updates on the calling thread, returns false when the threads could not be started
+    bool Init(BodyStore *store, Uint32 threadCount);
+    void Release(BodyStore *store);
+    // Returns the index of the body
+    Uint32 Add(BodyStore *store, float distance, float angularSpeed, double phase, float radius, Uint32 mesh);
+    void Update(BodyStore *store, double time);
+    // The bodies in [first, first + count), first a multiple of SIMD_WIDTH. Ranges may be updated concurrently.
+    void UpdateRange(BodyStore *store, double time, Uint32 first, Uint32 count);
+    // The update threads to use for the machine, the calling thread takes part as well
+    Uint32 DefaultThreadCount();
+}
+
+#endif
@@ -0,0 +1,365 @@
+#include <float.h>
+#include <string.h>
+#include <algorithm>
+#include "bvh.h"
+
+using glm::vec3;
+using glm::vec4;
+
+static bool IsEmpty(const vec3 &boundsMin, const vec3 &boundsMax)
+{
+    return boundsMin.x > boundsMax.x;
+}
+
+static float SurfaceArea(const vec3 &boundsMin, const vec3 &boundsMax)
+{
+    if (IsEmpty(boundsMin, boundsMax))
+        return 0.0f;
+    vec3 size = boundsMax - boundsMin;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static void Grow(vec3 &boundsMin, vec3 &boundsMax, const vec3 &otherMin, const vec3 &otherMax)
+{
+    if (IsEmpty(otherMin, otherMax))
+        return;
+    boundsMin = glm::min(boundsMin, otherMin);
+    boundsMax = glm::max(boundsMax, otherMax);
+}
+
+static void UpdateBounds(Bvh *bvh, BvhNode &node)
+{
+    node.boundsMin = vec3(FLT_MAX);
+    node.boundsMax = vec3(-FLT_MAX);
+    if (node.count > 0)
+    {
+        for (Uint32 i = node.first; i < node.first + node.count; ++i)
+        {
+            Uint32 item = bvh->items[i];
+            Grow(node.boundsMin, node.boundsMax, bvh->itemMin[item], bvh->itemMax[item]);
+        }
+    }
+    else
+    {
+        const BvhNode &left = bvh->nodes[node.first];
+        const BvhNode &right = bvh->nodes[node.first + 1];
+        Grow(node.boundsMin, node.boundsMax, left.boundsMin, left.boundsMax);
+        Grow(node.boundsMin, node.boundsMax, right.boundsMin, right.boundsMax);
+    }
+}
+
+
+struct Bin
+{
+    vec3 boundsMin;
+    vec3 boundsMax;
+    Uint32 count;
+};
+
+// Position along the axis that splits the node's items with the lowest SAH cost, the items are binned by their centroids.
+// Returns false when all centroids are in one point.
+static bool FindSplit(const Bvh *bvh, const vec3 *centroids, const BvhNode &node, Uint32 &splitAxis, float &splitPosition)
+{
+    vec3 centroidMin = vec3(FLT_MAX);
+    vec3 centroidMax = vec3(-FLT_MAX);
+    for (Uint32 i = node.first; i < node.first + node.count; ++i)
+    {
+        const vec3 &centroid = centroids[bvh->items[i]];
+        centroidMin = glm::min(centroidMin, centroid);
+        centroidMax = glm::max(centroidMax, centroid);
+    }
+
+    float bestCost = FLT_MAX;
+    for (Uint32 axis = 0; axis < 3; ++axis)
+    {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f)
+            continue;
+
+        Bin bins[BVH_BINS];
+        for (Uint32 b = 0; b < BVH_BINS; ++b)
+        {
+            bins[b] = Bin{ vec3(FLT_MAX), vec3(-FLT_MAX), 0 };
+        }
+        float scale = float(BVH_BINS) / extent;
+        for (Uint32 i = node.first; i < node.first + node.count; ++i)
+        {
+            Uint32 item = bvh->items[i];
+            Uint32 b = std::min(Uint32((centroids[item][axis] - centroidMin[axis]) * scale), Uint32(BVH_BINS - 1));
+            Grow(bins[b].boundsMin, bins[b].boundsMax, bvh->itemMin[item], bvh->itemMax[item]);
+            bins[b].count++;
+        }
+
+        // Areas and counts left of each plane in a forward sweep, right of it in a backward one
+        float leftArea[BVH_BINS - 1];
+        Uint32 leftCount[BVH_BINS - 1];
+        vec3 boundsMin = vec3(FLT_MAX);
+        vec3 boundsMax = vec3(-FLT_MAX);
+        Uint32 count = 0;
+        for (Uint32 b = 0; b < BVH_BINS - 1; ++b)
+        {
+            Grow(boundsMin, boundsMax, bins[b].boundsMin, bins[b].boundsMax);
+            count += bins[b].count;
+            leftArea[b] = SurfaceArea(boundsMin, boundsMax);
+            leftCount[b] = count;
+        }
+        boundsMin = vec3(FLT_MAX);
+        boundsMax = vec3(-FLT_MAX);
+        count = 0;
+        for (Uint32 b = BVH_BINS - 1; b > 0; --b)
+        {
+            Grow(boundsMin, boundsMax, bins[b].boundsMin, bins[b].boundsMax);
+            count += bins[b].count;
+            if (leftCount[b - 1] == 0 || count == 0)
+                continue;
+
+            float cost = leftArea[b - 1] * leftCount[b - 1] + SurfaceArea(boundsMin, boundsMax) * count;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                splitAxis = axis;
+                splitPosition = centroidMin[axis] + b / scale;
+            }
+        }
+    }
+
+    return bestCost != FLT_MAX;
+}
+
+// Splits nodes until their items fit in a leaf, children are appended after all existing nodes
+static void Subdivide(Bvh *bvh, const vec3 *centroids, Uint32 root)
+{
+    std::vector<Uint32> stack(1, root);
+    while (!stack.empty())
+    {
+        Uint32 index = stack.back();
+        stack.pop_back();
+        UpdateBounds(bvh, bvh->nodes[index]);
+
+        BvhNode &node = bvh->nodes[index];
+        if (node.count <= BVH_MAX_LEAF_ITEMS)
+            continue;
+
+        Uint32 *first = &bvh->items[node.first];
+        Uint32 *last = first + node.count;
+        Uint32 *middle = NULL;
+        Uint32 axis = 0;
+        float position = 0.0f;
+        if (FindSplit(bvh, centroids, node, axis, position))
+        {
+            middle = std::partition(first, last, [centroids, axis, position](Uint32 item) {
+                return centroids[item][axis] < position;
+            });
+        }
+        // All centroids in one point, any halves will do
+        if (middle == NULL || middle == first || middle == last)
+            middle = first + node.count / 2;
+
+        Uint32 leftCount = Uint32(middle - first);
+        Uint32 left = Uint32(bvh->nodes.size());
+        BvhNode child = {};
+        child.parent = index;
+        child.first = node.first;
+        child.count = leftCount;
+        bvh->nodes.push_back(child);
+        child.first = node.first + leftCount;
+        child.count = bvh->nodes[index].count - leftCount;
+        bvh->nodes.push_back(child);
+
+        bvh->nodes[index].first = left;
+        bvh->nodes[index].count = 0;
+        stack.push_back(left + 1);
+        stack.push_back(left);
+    }
+}
+
+Uint32 BoundingVolumes::ItemCount(const Bvh *bvh)
+{
+    return Uint32(bvh->itemMin.size());
+}
+
+void BoundingVolumes::SetItemCount(Bvh *bvh, Uint32 itemCount)
+{
+    bvh->nodes.clear();
+    bvh->dirtyNodes.clear();
+    bvh->items.resize(itemCount);
+    bvh->itemLeaves.assign(itemCount, BVH_NONE);
+    bvh->itemMin.assign(itemCount, vec3(FLT_MAX));
+    bvh->itemMax.assign(itemCount, vec3(-FLT_MAX));
+}
+
+void BoundingVolumes::SetBounds(Bvh *bvh, Uint32 item, const vec3 &boundsMin, const vec3 &boundsMax)
+{
+    if (memcmp(&bvh->itemMin[item], &boundsMin, sizeof(vec3)) == 0 &&
+        memcmp(&bvh->itemMax[item], &boundsMax, sizeof(vec3)) == 0)
+        return;
+    bvh->itemMin[item] = boundsMin;
+    bvh->itemMax[item] = boundsMax;
+
+    // Up to the first ancestor that is flagged already, the rest of the path is
+    for (Uint32 node = bvh->itemLeaves[item]; node != BVH_NONE && !bvh->nodes[node].dirty; node = bvh->nodes[node].parent)
+    {
+        bvh->nodes[node].dirty = true;
+        bvh->dirtyNodes.push_back(node);
+    }
+}
+
+void BoundingVolumes::Build(Bvh *bvh)
+{
+    Uint32 itemCount = ItemCount(bvh);
+    bvh->nodes.clear();
+    bvh->dirtyNodes.clear();
+    bvh->area = 0.0;
+    bvh->builtCost = 0.0;
+    bvh->refittedNodes = 0;
+    if (itemCount == 0)
+        return;
+
+    // Centers of the item boxes, empty ones at the origin
+    std::vector<vec3> centroids(itemCount);
+    for (Uint32 i = 0; i < itemCount; ++i)
+    {
+        bvh->items[i] = i;
+        const vec3 &boundsMin = bvh->itemMin[i];
+        const vec3 &boundsMax = bvh->itemMax[i];
+        centroids[i] = IsEmpty(boundsMin, boundsMax) ? vec3(0.0f) : (boundsMin + boundsMax) * 0.5f;
+    }
+    bvh->nodes.reserve(2 * itemCount - 1);
+    BvhNode root = {};
+    root.parent = BVH_NONE;
+    root.count = itemCount;
+    bvh->nodes.push_back(root);
+    Subdivide(bvh, centroids.data(), 0);
+
+    for (Uint32 i = 0; i < bvh->nodes.size(); ++i)
+    {
+        const BvhNode &node = bvh->nodes[i];
+        if (node.count == 0)
+            bvh->area += SurfaceArea(node.boundsMin, node.boundsMax);
+        for (Uint32 j = node.first; j < node.first + node.count; ++j)
+        {
+            bvh->itemLeaves[bvh->items[j]] = i;
+        }
+    }
+    float rootArea = SurfaceArea(bvh->nodes[0].boundsMin, bvh->nodes[0].boundsMax);
+    bvh->builtCost = rootArea > 0.0f ? bvh->area / rootArea : 0.0;
+}
+
+void BoundingVolumes::Refit(Bvh *bvh)
+{
+    // Children come after their parent, higher indices first refits every child before its parent
+    std::sort(bvh->dirtyNodes.begin(), bvh->dirtyNodes.end(), [](Uint32 a, Uint32 b) { return a > b; });
+    for (Uint32 i = 0; i < bvh->dirtyNodes.size(); ++i)
+    {
+        BvhNode &node = bvh->nodes[bvh->dirtyNodes[i]];
+        bool inner = node.count == 0;
+        if (inner)
+            bvh->area -= SurfaceArea(node.boundsMin, node.boundsMax);
+        UpdateBounds(bvh, node);
+        if (inner)
+            bvh->area += SurfaceArea(node.boundsMin, node.boundsMax);
+        node.dirty = false;
+    }
+    bvh->refittedNodes = Uint32(bvh->dirtyNodes.size());
+    bvh->dirtyNodes.clear();
+}
+
+bool BoundingVolumes::NeedsRebuild(const Bvh *bvh)
+{
+    if (bvh->nodes.empty())
+        return ItemCount(bvh) > 0;
+
+    float rootArea = SurfaceArea(bvh->nodes[0].boundsMin, bvh->nodes[0].boundsMax);
+    return rootArea > 0.0f && bvh->area / rootArea > BVH_REBUILD_RATIO * bvh->builtCost;
+}
+
+void BoundingVolumes::Clear(Bvh *bvh)
+{
+    SetItemCount(bvh, 0);
+    bvh->area = 0.0;
+    bvh->builtCost = 0.0;
+    bvh->refittedNodes = 0;
+}
+
+// Distance from the eye to the nearest point of the box, 0 inside it
+static float Distance(const vec3 &eye, const vec3 &boundsMin, const vec3 &boundsMax)
+{
+    return glm::length(glm::max(glm::max(boundsMin - eye, eye - boundsMax), vec3(0.0f)));
+}
+
+/*  Clears the planes of the mask that the box is entirely inside of. Returns false when it is entirely behind one,
+    tested with the corner furthest along the plane normal. */
+static bool ClipPlanes(const vec4 planes[5], const vec3 &boundsMin, const vec3 &boundsMax, Uint32 &mask)
+{
+    if (IsEmpty(boundsMin, boundsMax))
+        return false;
+
+    for (Uint32 i = 0; i < 5; ++i)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+
+        const vec4 &plane = planes[i];
+        vec3 furthest = vec3(plane.x >= 0.0f ? boundsMax.x : boundsMin.x,
+                             plane.y >= 0.0f ? boundsMax.y : boundsMin.y,
+                             plane.z >= 0.0f ? boundsMax.z : boundsMin.z);
+        if (glm::dot(vec3(plane), furthest) + plane.w < 0.0f)
+            return false;
+
+        vec3 nearest = vec3(plane.x >= 0.0f ? boundsMin.x : boundsMax.x,
+                            plane.y >= 0.0f ? boundsMin.y : boundsMax.y,
+                            plane.z >= 0.0f ? boundsMin.z : boundsMax.z);
+        if (glm::dot(vec3(plane), nearest) + plane.w >= 0.0f)
+            mask &= ~(1u << i);
+    }
+    return true;
+}
+
+struct QueryEntry
+{
+    Uint32 node;
+    Uint32 mask;
+};
+
+void BoundingVolumes::QueryFrustum(const Bvh *bvh, const vec4 planes[5], const vec3 &eye, std::vector<BvhHit> &hits)
+{
+    hits.clear();
+    if (bvh->nodes.empty())
+        return;
+
+    // Nearer children are visited first, the hits come out roughly sorted
+    std::vector<QueryEntry> stack;
+    stack.reserve(64);
+    stack.push_back(QueryEntry{ 0, 0x1F });
+    while (!stack.empty())
+    {
+        QueryEntry entry = stack.back();
+        stack.pop_back();
+        const BvhNode &node = bvh->nodes[entry.node];
+        if (!ClipPlanes(planes, node.boundsMin, node.boundsMax, entry.mask))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (Uint32 i = node.first; i < node.first + node.count; ++i)
+            {
+                Uint32 item = bvh->items[i];
+                Uint32 mask = entry.mask;
+                if (ClipPlanes(planes, bvh->itemMin[item], bvh->itemMax[item], mask))
+                    hits.push_back(BvhHit{ Distance(eye, bvh->itemMin[item], bvh->itemMax[item]), item });
+            }
+            continue;
+        }
+
+        const BvhNode &left = bvh->nodes[node.first];
+        const BvhNode &right = bvh->nodes[node.first + 1];
+        bool leftFirst = Distance(eye, left.boundsMin, left.boundsMax) <= Distance(eye, right.boundsMin, right.boundsMax);
+        stack.push_back(QueryEntry{ leftFirst ? node.first + 1 : node.first, entry.mask });
+        stack.push_back(QueryEntry{ leftFirst ? node.first : node.first + 1, entry.mask });
+    }
+
+    // Ties by index, the order does not depend on the shape of the tree
+    std::sort(hits.begin(), hits.end(), [](const BvhHit &a, const BvhHit &b) {
+        return a.distance < b.distance || (a.distance == b.distance && a.item < b.item);
+    });
+}
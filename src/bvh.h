@@ -0,0 +1,66 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+#include <vector>
+
+#define BVH_NONE 0xFFFFFFFFu
+#define BVH_MAX_LEAF_ITEMS 4
+#define BVH_BINS 16
+#define BVH_REBUILD_RATIO 1.5   // Refits may let the SAH cost grow this much over the built tree's
+
+struct BvhNode
+{
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    Uint32 first;       // Leaves: first of Bvh::items, inner nodes: left child, the right one follows it
+    Uint32 count;       // Items of a leaf, 0 for inner nodes
+    Uint32 parent;      // BVH_NONE for the root
+    bool dirty;         // An item below moved since the last Refit
+};
+
+/*  Bounding volume hierarchy over the boxes of a scene's draws, by their index. Built top down with binned SAH
+    splits, children always come after their parent. Moving items only flags the path to the root, Refit recomputes
+    the flagged nodes bottom up and tracks the SAH cost, NeedsRebuild tells when the refitted tree has become
+    loose enough that building it again pays off. */
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<Uint32> items;          // Item indices, leaves own consecutive ranges
+    std::vector<Uint32> itemLeaves;     // Leaf of each item
+    std::vector<glm::vec3> itemMin;     // Empty boxes (min > max) are never visible
+    std::vector<glm::vec3> itemMax;
+    std::vector<Uint32> dirtyNodes;
+    double area;                        // Sum of the inner nodes' surface areas
+    double builtCost;                   // area over the root's area after the last Build
+    Uint32 refittedNodes;               // By the last Refit
+};
+
+// A visible item and the distance from the eye to its box
+struct BvhHit
+{
+    float distance;
+    Uint32 item;
+};
+
+namespace BoundingVolumes
+{
+    Uint32 ItemCount(const Bvh *bvh);
+    // Drops the tree, the items need their bounds and a Build
+    void SetItemCount(Bvh *bvh, Uint32 itemCount);
+    // Flags the item's leaf and its ancestors only when the box differs from the current one
+    void SetBounds(Bvh *bvh, Uint32 item, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+    // From the current item bounds
+    void Build(Bvh *bvh);
+    void Refit(Bvh *bvh);
+    // Without a tree or when refits made it too loose
+    bool NeedsRebuild(const Bvh *bvh);
+    void Clear(Bvh *bvh);
+
+    // Items whose box is not entirely behind one of the planes (see SceneGraph::FrustumPlanes), sorted near to far.
+    // Subtrees entirely inside a plane stop testing it.
+    void QueryFrustum(const Bvh *bvh, const glm::vec4 planes[5], const glm::vec3 &eye, std::vector<BvhHit> &hits);
+}
+
+#endif
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include "encoder.h"
+
+static bool WriteJob(EncoderPool *pool, const EncodeJob *job)
+{
+    bool written;
+    if (pool->fileNamePattern)
+    {
+        char fileName[1024];
+        snprintf(fileName, sizeof(fileName), pool->fileNamePattern, job->frame);
+        FILE *file = fopen(fileName, "wb");
+        written = file && UtilImage::Write(file, &job->image);
+        if (file)
+            written = (fclose(file) == 0) && written;
+    }
+    else
+    {
+        written = UtilImage::Write(pool->stream, &job->image);
+    }
+
+    if (!written)
+        fprintf(stderr, "Could not write frame %u\n", job->frame);
+    return written;
+}
+
+static int EncoderThread(void *data)
+{
+    EncoderPool *pool = (EncoderPool*)data;
+    SDL_LockMutex(pool->mutex);
+    while (true)
+    {
+        while (pool->startedFrames == pool->submittedFrames && !pool->quit)
+        {
+            SDL_CondWait(pool->jobQueued, pool->mutex);
+        }
+        if (pool->startedFrames == pool->submittedFrames)
+            break;
+
+        EncodeJob *job = &pool->jobs[pool->startedFrames % pool->jobCount];
+        ++pool->startedFrames;
+        SDL_UnlockMutex(pool->mutex);
+        UtilImage::Encode(&job->image, pool->format, job->pixels, job->width, job->height);
+        SDL_LockMutex(pool->mutex);
+
+        // Frames of one stream are written in order, the earlier ones are already taken by other encoders
+        while (!pool->fileNamePattern && pool->writtenFrames != job->frame)
+        {
+            SDL_CondWait(pool->jobDone, pool->mutex);
+        }
+        SDL_UnlockMutex(pool->mutex);
+        bool written = WriteJob(pool, job);
+        SDL_LockMutex(pool->mutex);
+
+        pool->failed = pool->failed || !written;
+        ++pool->writtenFrames;
+        job->busy = false;
+        SDL_CondBroadcast(pool->jobDone);
+    }
+    SDL_UnlockMutex(pool->mutex);
+    return 0;
+}
+
+bool Encoding::Init(EncoderPool *pool, Uint32 threadCount, Uint32 format, const char *fileNamePattern, FILE *stream)
+{
+    *pool = {};
+    if (fileNamePattern && !IsValidFileNamePattern(fileNamePattern))
+        return false;
+    pool->format = format;
+    pool->fileNamePattern = fileNamePattern;
+    pool->stream = stream;
+    pool->jobCount = std::max(1u, std::min(threadCount, Uint32(ENCODER_MAX_THREADS)) * ENCODER_FRAMES_PER_THREAD);
+    pool->jobs = (EncodeJob*)calloc(pool->jobCount, sizeof(EncodeJob));
+    if (threadCount == 0)
+        return true;
+
+    pool->mutex = SDL_CreateMutex();
+    pool->jobQueued = SDL_CreateCond();
+    pool->jobDone = SDL_CreateCond();
+    if (!pool->mutex || !pool->jobQueued || !pool->jobDone)
+    {
+        Release(pool);
+        return false;
+    }
+    for (Uint32 i = 0; i < std::min(threadCount, Uint32(ENCODER_MAX_THREADS)); ++i)
+    {
+        pool->threads[i] = SDL_CreateThread(EncoderThread, "Encoder", pool);
+        if (!pool->threads[i])
+        {
+            Release(pool);
+            return false;
+        }
+        ++pool->threadCount;
+    }
+    return true;
+}
+
+void Encoding::Release(EncoderPool *pool)
+{
+    if (pool->threadCount > 0)
+    {
+        SDL_LockMutex(pool->mutex);
+        pool->quit = true;
+        SDL_CondBroadcast(pool->jobQueued);
+        SDL_UnlockMutex(pool->mutex);
+        for (Uint32 i = 0; i < pool->threadCount; ++i)
+        {
+            SDL_WaitThread(pool->threads[i], NULL);
+        }
+    }
+    if (pool->jobDone)
+        SDL_DestroyCond(pool->jobDone);
+    if (pool->jobQueued)
+        SDL_DestroyCond(pool->jobQueued);
+    if (pool->mutex)
+        SDL_DestroyMutex(pool->mutex);
+
+    for (Uint32 i = 0; i < pool->jobCount && pool->jobs; ++i)
+    {
+        free(pool->jobs[i].pixels);
+        UtilImage::Release(&pool->jobs[i].image);
+    }
+    free(pool->jobs);
+    *pool = {};
+}
+
+bool Encoding::Submit(EncoderPool *pool, const Uint32 *pixels, Uint32 width, Uint32 height)
+{
+    if (pool->threadCount == 0)
+    {
+        EncodeJob *job = &pool->jobs[0];
+        job->frame = pool->submittedFrames++;
+        UtilImage::Encode(&job->image, pool->format, pixels, width, height);
+        pool->failed = pool->failed || !WriteJob(pool, job);
+        pool->writtenFrames = pool->submittedFrames;
+        return !pool->failed;
+    }
+
+    SDL_LockMutex(pool->mutex);
+    EncodeJob *job = &pool->jobs[pool->submittedFrames % pool->jobCount];
+    if (job->busy)
+    {
+        Uint64 waitStart = SDL_GetPerformanceCounter();
+        while (job->busy)
+        {
+            SDL_CondWait(pool->jobDone, pool->mutex);
+        }
+        pool->waitTicks += SDL_GetPerformanceCounter() - waitStart;
+    }
+    bool failed = pool->failed;
+    SDL_UnlockMutex(pool->mutex);
+    if (failed)
+        return false;
+
+    // No encoder touches a free slot
+    Uint32 pixelCount = width * height;
+    if (pixelCount > job->pixelCapacity)
+    {
+        free(job->pixels);
+        job->pixels = (Uint32*)malloc(pixelCount * sizeof(Uint32));
+        job->pixelCapacity = pixelCount;
+    }
+    memcpy(job->pixels, pixels, pixelCount * sizeof(Uint32));
+    job->width = width;
+    job->height = height;
+
+    SDL_LockMutex(pool->mutex);
+    job->frame = pool->submittedFrames++;
+    job->busy = true;
+    SDL_CondSignal(pool->jobQueued);
+    SDL_UnlockMutex(pool->mutex);
+    return true;
+}
+
+bool Encoding::Finish(EncoderPool *pool)
+{
+    if (pool->threadCount == 0)
+        return !pool->failed;
+
+    SDL_LockMutex(pool->mutex);
+    while (pool->writtenFrames != pool->submittedFrames)
+    {
+        SDL_CondWait(pool->jobDone, pool->mutex);
+    }
+    bool failed = pool->failed;
+    SDL_UnlockMutex(pool->mutex);
+    return !failed;
+}
+
+Uint32 Encoding::DefaultThreadCount()
+{
+    return Uint32(std::max(1, std::min(SDL_GetCPUCount() - 1, ENCODER_MAX_THREADS)));
+}
+
+bool Encoding::IsValidFileNamePattern(const char *pattern)
+{
+    // The pattern is handed to snprintf, anything else would read arguments that are not there
+    Uint32 conversions = 0;
+    for (const char *c = pattern; *c; ++c)
+    {
+        if (*c != '%')
+            continue;
+        if (*++c == '%')
+            continue;
+
+        Uint32 digits = 0;
+        while (*c >= '0' && *c <= '9' && digits < ENCODER_MAX_PATTERN_WIDTH)
+        {
+            ++c;
+            ++digits;
+        }
+        if ((*c != 'd' && *c != 'u') || ++conversions > 1)
+            return false;
+    }
+    return conversions == 1;
+}
@@ -0,0 +1,68 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "image.h"
+
+#define ENCODER_MAX_THREADS 16
+#define ENCODER_FRAMES_PER_THREAD 2     // Ring slots per encoder thread
+#define ENCODER_MAX_PATTERN_WIDTH 2     // Digits of the frame index's field width in a file name pattern
+
+// A copy of a finished frame waiting for or going through an encoder
+struct EncodeJob
+{
+    Uint32 *pixels;
+    Uint32 pixelCapacity;
+    Uint32 width;
+    Uint32 height;
+    Uint32 frame;
+    bool busy;              // Queued, encoding or waiting for its turn to be written
+    ImageBuffer image;
+};
+
+/*  Encodes and writes frames on a pool of threads while the next frames are rendered. Submitted frames are copied
+    into a ring of jobs, when every slot is still busy Submit waits for the oldest one, so memory stays bounded when
+    the encoders fall behind. Frames appended to one stream are written in order, frames going to their own files
+    are written by whichever encoder finishes them. Without threads Submit encodes and writes right away. */
+struct EncoderPool
+{
+    Uint32 format;              // IMAGE_FORMAT_*
+    const char *fileNamePattern;    // printf pattern with the frame index, or NULL to append to stream
+    FILE *stream;
+
+    SDL_Thread *threads[ENCODER_MAX_THREADS];
+    Uint32 threadCount;
+    SDL_mutex *mutex;
+    SDL_cond *jobQueued;
+    SDL_cond *jobDone;          // A job was written and its slot is free again
+
+    EncodeJob *jobs;
+    Uint32 jobCount;
+    Uint32 submittedFrames;
+    Uint32 startedFrames;
+    Uint32 writtenFrames;
+    bool failed;
+    bool quit;
+
+    Uint64 waitTicks;           // Time Submit spent blocked on a full ring, SDL performance counter ticks
+};
+
+namespace Encoding
+{
+    /*  threadCount 0 encodes on the calling thread. Returns false when the threads could not be started or
+        fileNamePattern is not a valid one. */
+    bool Init(EncoderPool *pool, Uint32 threadCount, Uint32 format, const char *fileNamePattern, FILE *stream);
+    // Waits for the frames in flight
+    void Release(EncoderPool *pool);
+    // Copies the frame, returns false once a frame could not be written
+    bool Submit(EncoderPool *pool, const Uint32 *pixels, Uint32 width, Uint32 height);
+    // Waits until every submitted frame is written, returns false when one of them failed
+    bool Finish(EncoderPool *pool);
+    // The encoder threads to use for the machine, leaves one core to the renderer
+    Uint32 DefaultThreadCount();
+    // One %d, %u or %0Nd for the frame index and no other conversion, a literal % is written %%
+    bool IsValidFileNamePattern(const char *pattern);
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "framereader.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+bool FrameReading::Open(FrameReader *reader, const char *name)
+{
+    *reader = {};
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && size_t(status.st_size) >= sizeof(FrameRingHeader))
+        memory = mmap(NULL, size_t(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+
+    const FrameRingHeader *header = (const FrameRingHeader*)memory;
+    if (header->magic != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION || header->slotCount != FRAME_RING_SLOTS ||
+        header->size > uint64_t(status.st_size))
+    {
+        munmap(memory, size_t(status.st_size));
+        return false;
+    }
+    reader->header = header;
+    reader->size = uint64_t(status.st_size);
+    return true;
+}
+
+void FrameReading::Close(FrameReader *reader)
+{
+    if (reader->header)
+        munmap((void*)reader->header, size_t(reader->size));
+    *reader = {};
+}
+
+bool FrameReading::Wait(FrameReader *reader, uint32_t timeoutMs)
+{
+    const FrameRingHeader *header = reader->header;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (true)
+    {
+        // The count and the closed bit change the same word, so closing wakes the waiters too
+        uint32_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+        if ((published & ~FRAME_RING_CLOSED) != reader->seenFrames)
+            return true;
+        if (published & FRAME_RING_CLOSED)
+            return false;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t elapsed = (now.tv_sec - start.tv_sec) * 1000000000ll + (now.tv_nsec - start.tv_nsec);
+        int64_t remaining = int64_t(timeoutMs) * 1000000ll - elapsed;
+        if (remaining <= 0)
+            return false;
+
+        // Returns right away when published changed after it was loaded, the renderer wakes every waiter
+        struct timespec timeout = { time_t(remaining / 1000000000ll), long(remaining % 1000000000ll) };
+        syscall(SYS_futex, &header->published, FUTEX_WAIT, published, &timeout, NULL, 0);
+    }
+}
+
+static bool ReadSlot(const FrameReader *reader, uint32_t slot, FrameView *view)
+{
+    const FrameRingSlot &ringSlot = reader->header->slots[slot];
+    uint32_t sequence = __atomic_load_n(&ringSlot.sequence, __ATOMIC_ACQUIRE);
+    if (sequence & 1)
+        return false;
+
+    view->width = __atomic_load_n(&ringSlot.width, __ATOMIC_RELAXED);
+    view->height = __atomic_load_n(&ringSlot.height, __ATOMIC_RELAXED);
+    view->pitch = __atomic_load_n(&ringSlot.pitch, __ATOMIC_RELAXED);
+    view->format = __atomic_load_n(&ringSlot.format, __ATOMIC_RELAXED);
+    view->frame = __atomic_load_n(&ringSlot.frame, __ATOMIC_RELAXED);
+    view->timestamp = __atomic_load_n(&ringSlot.timestamp, __ATOMIC_RELAXED);
+    uint64_t offset = __atomic_load_n(&ringSlot.offset, __ATOMIC_RELAXED);
+    view->slot = slot;
+    view->sequence = sequence;
+    if (!FrameReading::Validate(reader, view) || offset + uint64_t(view->pitch) * view->height > reader->size)
+        return false;
+
+    view->pixels = (const uint32_t*)((const uint8_t*)reader->header + offset);
+    return true;
+}
+
+bool FrameReading::Acquire(FrameReader *reader, FrameView *view)
+{
+    const FrameRingHeader *header = reader->header;
+    uint32_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+    int32_t slot = __atomic_load_n(&header->latestSlot, __ATOMIC_ACQUIRE);
+    if (slot < 0 || slot >= FRAME_RING_SLOTS || !ReadSlot(reader, uint32_t(slot), view))
+        return false;
+
+    reader->seenFrames = published & ~FRAME_RING_CLOSED;
+    return true;
+}
+
+bool FrameReading::AcquireSlot(FrameReader *reader, uint32_t slot, uint32_t frame, FrameView *view)
+{
+    if (slot >= FRAME_RING_SLOTS || !ReadSlot(reader, slot, view))
+        return false;
+    return view->frame == frame;
+}
+
+bool FrameReading::Validate(const FrameReader *reader, const FrameView *view)
+{
+    // Orders the reads of the slot before the second look at its sequence
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&reader->header->slots[view->slot].sequence, __ATOMIC_RELAXED) == view->sequence;
+}
+
+#else
+
+// Shared memory export is only implemented for Linux
+bool FrameReading::Open(FrameReader *reader, const char *)
+{
+    *reader = {};
+    return false;
+}
+
+void FrameReading::Close(FrameReader *reader)
+{
+    *reader = {};
+}
+
+bool FrameReading::Wait(FrameReader *, uint32_t)
+{
+    return false;
+}
+
+bool FrameReading::Acquire(FrameReader *, FrameView *)
+{
+    return false;
+}
+
+bool FrameReading::AcquireSlot(FrameReader *, uint32_t, uint32_t, FrameView *)
+{
+    return false;
+}
+
+bool FrameReading::Validate(const FrameReader *, const FrameView *)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef FRAMEREADER_H
+#define FRAMEREADER_H
+
+#include <stdint.h>
+
+/*  Frames exported by the renderer through shared memory (see SharedFrames), read in place by other processes.
+    Only needs this header and framereader.cpp, no SDL:
+
+        FrameReader reader;
+        if (FrameReading::Open(&reader, "/swrasterizer"))
+        {
+            FrameView view;
+            while (FrameReading::Wait(&reader, 1000))
+            {
+                if (!FrameReading::Acquire(&reader, &view))
+                    continue;
+                Consume(view.pixels, view.width, view.height, view.pitch);
+                // false when the renderer reused the slot meanwhile, what was read may be torn
+                bool intact = FrameReading::Validate(&reader, &view);
+            }
+            FrameReading::Close(&reader);
+        }
+
+    The renderer never waits for readers. A slot may be rendered into again as soon as the frame after it is
+    published, a reader that is still busy with it by then sees Validate fail. */
+
+#define FRAME_RING_MAGIC 0x47525246     // "FRRG"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SLOTS 3
+#define FRAME_RING_ALIGNMENT 4096       // Of the slot pixels within the mapping
+#define FRAME_RING_CLOSED 0x80000000u   // Set in FrameRingHeader::published once the renderer is gone
+
+// One frame buffer of the ring. The fields are written by the renderer only and read with atomics.
+struct FrameRingSlot
+{
+    uint32_t sequence;      // Seqlock, odd while the renderer writes the slot
+    uint32_t frame;         // Counts the published frames
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;         // Bytes per row
+    uint32_t format;        // SDL_PIXELFORMAT_*, 32 bits per pixel
+    uint64_t offset;        // Of the pixels from the start of the mapping
+    uint64_t timestamp;     // CLOCK_MONOTONIC nanoseconds when the frame was published
+    uint8_t padding[24];    // One cache line per slot
+};
+
+struct FrameRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotCapacity;  // Pixels that fit in a slot
+    uint64_t size;          // Of the whole mapping
+    uint32_t published;     // Futex word, frames published so far and FRAME_RING_CLOSED
+    int32_t latestSlot;     // -1 until the first frame is published
+    int32_t writerPid;      // Of the renderer, a ring whose renderer is gone may be replaced
+    uint32_t reserved[7];
+    FrameRingSlot slots[FRAME_RING_SLOTS];
+};
+
+// A published frame, the pixels point into the mapping
+struct FrameView
+{
+    const uint32_t *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t format;
+    uint32_t frame;
+    uint64_t timestamp;
+    uint32_t slot;
+    uint32_t sequence;
+};
+
+struct FrameReader
+{
+    const FrameRingHeader *header;
+    uint64_t size;
+    uint32_t seenFrames;    // Frames published when the last one was acquired
+};
+
+namespace FrameReading
+{
+    // Maps the ring read only, false when it does not exist or has a different version
+    bool Open(FrameReader *reader, const char *name);
+    void Close(FrameReader *reader);
+    // Sleeps until a frame newer than the last acquired one is published, false on timeout or once the renderer closed
+    bool Wait(FrameReader *reader, uint32_t timeoutMs);
+    // The latest frame, false when there is none yet or the renderer just started to reuse its slot
+    bool Acquire(FrameReader *reader, FrameView *view);
+    /*  A given frame, such as the one a render server response points to (see renderprotocol.h). False when the
+        slot already holds a later frame or the renderer is writing it. */
+    bool AcquireSlot(FrameReader *reader, uint32_t slot, uint32_t frame, FrameView *view);
+    // Call after reading the pixels, false when the renderer started writing the slot in the meantime
+    bool Validate(const FrameReader *reader, const FrameView *view);
+}
+
+#endif
@@ -0,0 +1,740 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include "headless.h"
+#include "renderer.h"
+#include "image.h"
+#include "encoder.h"
+#include "sharedframes.h"
+#include "recording.h"
+
+#define HEADLESS_DEFAULT_WIDTH 960
+#define HEADLESS_DEFAULT_HEIGHT 540
+#define HEADLESS_DEFAULT_FRAMES 60
+#define HEADLESS_MAX_JOBS 64
+#define HEADLESS_RANDOM_SEED 1      // rand()'s own default, every job builds the same scene as a single one
+#define HEADLESS_NO_FRAME 0xFFFFFFFFu
+#define HEADLESS_MAX_VIEWS 6
+#define HEADLESS_STEREO_SEPARATION 0.2f    // World units between the eyes
+#define TEXTURE_BENCHMARK_SIZE 512
+#define TEXTURE_BENCHMARK_PASSES 20
+
+// Views written in place of the frame
+#define HEADLESS_VIEWS_NONE 0
+#define HEADLESS_VIEWS_CUBE 1       // Faces along +x, -x, +y, -y, +z, -z from the camera position
+#define HEADLESS_VIEWS_STEREO 2     // Left and right eye
+
+// Mouse input of one frame, the camera is driven the same way as in the window
+struct CameraStep
+{
+    Sint32 relX;
+    Sint32 relY;
+    Sint32 wheel;
+};
+
+struct HeadlessOptions
+{
+    Uint32 width;
+    Uint32 height;
+    Uint32 frames;
+    double deltaTime;
+    const char *output;     // printf pattern with the frame index, "-" for stdout, NULL to not write frames
+    Uint32 format;          // IMAGE_FORMAT_*
+    Uint32 encoderThreads;
+    const char *exportName; // Shared memory ring the frames are rendered into, NULL to not export
+    CameraStep orbit;       // Applied every frame when there is no camera path
+    std::vector<CameraStep> cameraPath;
+    const char *replayFile; // Input recorded in the window replaces the camera movement, NULL for none
+    InputRecording replay;
+    Uint32 jobs;            // Frames rendered at once, each by its own context
+    Uint32 views;           // HEADLESS_VIEWS_*
+
+    // Scene
+    const char *sceneFile;          // Replaces the solar system, NULL for the built-in one
+    const char *binarySceneFile;    // The scene is written to it in the binary format, NULL to not write it
+    bool solarSystem;
+    Uint32 shading;
+    Uint32 pointLightCount;
+    bool shadowsOn;
+    bool textureBenchmark;  // Only measures sampling the texture formats
+};
+
+struct HeadlessBatch;
+
+// Renders every jobCount-th frame from firstFrame on and hands each one to the main thread
+struct HeadlessJob
+{
+    HeadlessBatch *batch;
+    RenderContext context;
+    InputRecording replay;  // A copy with its own position
+    SDL_Thread *thread;
+    Uint32 firstFrame;
+    Uint32 readyFrame;      // Waiting in pixels for the main thread, HEADLESS_NO_FRAME while rendering
+    Uint32 *pixels;
+    double renderSeconds;
+};
+
+/*  Contexts share no state, so whole frames render in parallel. The frames are passed on in order, a job
+    continues once the main thread took its frame. */
+struct HeadlessBatch
+{
+    const HeadlessOptions *options;
+    HeadlessJob jobs[HEADLESS_MAX_JOBS];
+    Uint32 jobCount;
+    SDL_mutex *mutex;
+    SDL_cond *changed;      // Broadcast when a frame is ready or was taken
+    bool quit;
+};
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "Usage: SWRasterizer --headless [options]\n"
+        "  --frames N          Frames to render (%u)\n"
+        "  --size WxH          Frame size (%ux%u)\n"
+        "  --dt SECONDS        Fixed time step (1/60)\n"
+        "  --output PATH       File name pattern such as frame%%04d.png, - for stdout. Without a %% in the\n"
+        "                      pattern all frames are appended to one file.\n"
+        "  --format FORMAT     raw (RGB24), ppm, png, qoi or y4m (YUV 4:2:0 video), taken from the extension by default\n"
+        "  --encoders N        Threads encoding frames while the next ones render, 0 encodes in between (%u)\n"
+        "  --jobs N            Frames rendered at once, each by its own renderer (1). Checkerboard rendering\n"
+        "                      and automatic shading rates then build on the job's previous frame.\n"
+        "  --export NAME       Render into a shared memory ring other processes read, such as /swrasterizer\n"
+        "  --views MODE        Write views of each frame in its place, one image after the other: cube for the six\n"
+        "                      cube map faces around the camera, square at the smaller side, stereo for both eyes\n"
+        "  --orbit DX[,DY]     Camera rotation per frame in mouse pixels\n"
+        "  --camera-path FILE  One \"dx dy wheel\" line of mouse input per frame, repeated when it runs out\n"
+        "  --replay FILE       Input recorded with --record in the window, its size, time step and length are\n"
+        "                      the defaults. The renderer starts from the window's settings, resizes are skipped.\n"
+        "  --solar             Render the solar system instead of the test scene\n"
+        "  --scene FILE        Text or binary scene file replacing the solar system, implies --solar\n"
+        "  --write-scene FILE  Write the scene in the binary format, loads faster than the text\n"
+        "  --shading MODE      flat, gouraud or phong (phong)\n"
+        "  --lights N          Point lights in the solar system\n"
+        "  --shadows           Enable shadow maps\n"
+        "  --texture-bench     Measure sampling each texture format and exit\n",
+        HEADLESS_DEFAULT_FRAMES, HEADLESS_DEFAULT_WIDTH, HEADLESS_DEFAULT_HEIGHT, Encoding::DefaultThreadCount());
+}
+
+static bool LoadCameraPath(const char *fileName, std::vector<CameraStep> &path)
+{
+    FILE *file = fopen(fileName, "r");
+    if (!file)
+        return false;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        CameraStep step = {};
+        if (line[0] == '#' || sscanf(line, "%d %d %d", &step.relX, &step.relY, &step.wheel) < 2)
+            continue;
+        path.push_back(step);
+    }
+    fclose(file);
+    return !path.empty();
+}
+
+static bool ParseOptions(int argc, char *argv[], HeadlessOptions &options)
+{
+    options.width = HEADLESS_DEFAULT_WIDTH;
+    options.height = HEADLESS_DEFAULT_HEIGHT;
+    options.frames = HEADLESS_DEFAULT_FRAMES;
+    options.deltaTime = 1.0 / 60.0;
+    options.output = NULL;
+    options.format = 0;
+    options.encoderThreads = Encoding::DefaultThreadCount();
+    options.exportName = NULL;
+    options.orbit = {};
+    options.replayFile = NULL;
+    Recording::Init(&options.replay, 0, 0, RECORDING_DEFAULT_DELTA_TIME);
+    options.sceneFile = NULL;
+    options.binarySceneFile = NULL;
+    options.solarSystem = false;
+    options.shading = 0;
+    options.pointLightCount = 0;
+    options.shadowsOn = false;
+    options.textureBenchmark = false;
+    options.jobs = 1;
+    options.views = HEADLESS_VIEWS_NONE;
+
+    bool sizeSet = false, framesSet = false, deltaTimeSet = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--headless") == 0)
+            continue;
+        if (strcmp(arg, "--solar") == 0)
+        {
+            options.solarSystem = true;
+            continue;
+        }
+        if (strcmp(arg, "--shadows") == 0)
+        {
+            options.shadowsOn = true;
+            continue;
+        }
+        if (strcmp(arg, "--texture-bench") == 0)
+        {
+            options.textureBenchmark = true;
+            continue;
+        }
+
+        // The rest take a value
+        const char *value = (i + 1 < argc) ? argv[++i] : "";
+        bool valid = true;
+        if (strcmp(arg, "--frames") == 0)
+            valid = framesSet = sscanf(value, "%u", &options.frames) == 1;
+        else if (strcmp(arg, "--size") == 0)
+            valid = sizeSet = sscanf(value, "%ux%u", &options.width, &options.height) == 2 && options.width >= 16 && options.height >= 16;
+        else if (strcmp(arg, "--dt") == 0)
+            valid = deltaTimeSet = sscanf(value, "%lf", &options.deltaTime) == 1;
+        else if (strcmp(arg, "--output") == 0)
+            valid = (options.output = value)[0] != 0;
+        else if (strcmp(arg, "--format") == 0)
+            valid = (options.format = UtilImage::FormatFromString(value)) != 0;
+        else if (strcmp(arg, "--encoders") == 0)
+            valid = sscanf(value, "%u", &options.encoderThreads) == 1;
+        else if (strcmp(arg, "--jobs") == 0)
+            valid = sscanf(value, "%u", &options.jobs) == 1 && options.jobs >= 1 && options.jobs <= HEADLESS_MAX_JOBS;
+        else if (strcmp(arg, "--export") == 0)
+            valid = (options.exportName = value)[0] != 0;
+        else if (strcmp(arg, "--views") == 0)
+        {
+            if (strcmp(value, "cube") == 0)
+                options.views = HEADLESS_VIEWS_CUBE;
+            else if (strcmp(value, "stereo") == 0)
+                options.views = HEADLESS_VIEWS_STEREO;
+            else
+                valid = false;
+        }
+        else if (strcmp(arg, "--orbit") == 0)
+            valid = sscanf(value, "%d,%d", &options.orbit.relX, &options.orbit.relY) >= 1;
+        else if (strcmp(arg, "--camera-path") == 0)
+            valid = LoadCameraPath(value, options.cameraPath);
+        else if (strcmp(arg, "--replay") == 0)
+        {
+            // Prints its own error
+            if (!Recording::Load(value, &options.replay))
+                return false;
+            options.replayFile = value;
+        }
+        else if (strcmp(arg, "--scene") == 0)
+            valid = (options.sceneFile = value)[0] != 0;
+        else if (strcmp(arg, "--write-scene") == 0)
+            valid = (options.binarySceneFile = value)[0] != 0;
+        else if (strcmp(arg, "--lights") == 0)
+            valid = sscanf(value, "%u", &options.pointLightCount) == 1;
+        else if (strcmp(arg, "--shading") == 0)
+        {
+            if (strcmp(value, "flat") == 0)
+                options.shading = FLAT_SHADING;
+            else if (strcmp(value, "gouraud") == 0)
+                options.shading = GOURAUD_SHADING;
+            else
+                valid = strcmp(value, "phong") == 0;
+        }
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid option %s %s\n", arg, value);
+            return false;
+        }
+    }
+
+    if (options.sceneFile)
+        options.solarSystem = true;
+    if (options.replayFile)
+    {
+        if (!sizeSet && options.replay.width > 0)
+        {
+            options.width = std::max(options.replay.width, 16u);
+            options.height = std::max(options.replay.height, 16u);
+        }
+        if (!framesSet)
+            options.frames = options.replay.frameCount;
+        if (!deltaTimeSet)
+            options.deltaTime = options.replay.deltaTime;
+    }
+    // Replays start from the settings of the window, phong otherwise
+    else if (!options.shading)
+    {
+        options.shading = PHONG_SHADING;
+    }
+    if (options.output && !options.format)
+        options.format = UtilImage::FormatFromPath(options.output);
+    if (!options.format)
+        options.format = IMAGE_FORMAT_PPM;
+    if (options.output && strchr(options.output, '%') && !Encoding::IsValidFileNamePattern(options.output))
+    {
+        fprintf(stderr, "%s: a file name pattern takes one %%d, %%u or %%0Nd for the frame index, write %% as %%%%\n",
+                options.output);
+        return false;
+    }
+    if (options.format == IMAGE_FORMAT_Y4M && options.output && strchr(options.output, '%'))
+    {
+        fprintf(stderr, "y4m is a video stream, write it to one file or stdout\n");
+        return false;
+    }
+    if (options.jobs > 1 && options.exportName)
+    {
+        fprintf(stderr, "--export renders into the frame buffers of one renderer, it takes no --jobs\n");
+        return false;
+    }
+    if (options.jobs > 1 && options.views)
+    {
+        fprintf(stderr, "--views renders the draws of one renderer's frames, it takes no --jobs\n");
+        return false;
+    }
+    if (options.deltaTime <= 0.0)
+    {
+        fprintf(stderr, "Invalid time step %g\n", options.deltaTime);
+        return false;
+    }
+    return true;
+}
+
+static void InitContext(RenderContext *context, const HeadlessOptions &options, const SceneDescription *scene)
+{
+    // Scenes place their bodies with rand(), every context starts from the same seed
+    srand(HEADLESS_RANDOM_SEED);
+    *context = {};
+    Renderer::Init(context, options.width, options.height);
+    // The jobs keep the cores busy already, each updates its bodies on its own thread
+    if (options.jobs > 1)
+        context->bodyThreadCount = 0;
+    if (options.sceneFile)
+        Renderer::LoadScene(context, scene);
+    context->solarSystem = options.solarSystem;
+    if (options.shading)
+        context->shading = options.shading;
+    context->pointLightCount = options.pointLightCount;
+    context->shadowsOn = options.shadowsOn;
+}
+
+static void SetFrameInput(RenderContext *context, const HeadlessOptions &options, InputRecording *replay, Uint32 frame)
+{
+    if (options.replayFile)
+    {
+        context->mouseRelX = 0;
+        context->mouseRelY = 0;
+        context->mouseWheel = 0;
+        Recording::Apply(replay, frame, context, false);
+        return;
+    }
+
+    const CameraStep &step = options.cameraPath.empty() ? options.orbit : options.cameraPath[frame % options.cameraPath.size()];
+    context->mouseRelX = step.relX;
+    context->mouseRelY = step.relY;
+    context->mouseWheel = step.wheel;
+}
+
+static Uint32 ViewCount(const HeadlessOptions &options)
+{
+    return options.views == HEADLESS_VIEWS_CUBE ? 6 : options.views == HEADLESS_VIEWS_STEREO ? 2 : 0;
+}
+
+// Of the images written, the views' targets or the frame
+static void GetOutputSize(const HeadlessOptions &options, Uint32 &width, Uint32 &height)
+{
+    width = options.views == HEADLESS_VIEWS_CUBE ? std::min(options.width, options.height) : options.width;
+    height = options.views == HEADLESS_VIEWS_CUBE ? width : options.height;
+}
+
+// From the camera of the frame, the eyes are moved apart along its right vector
+static void SetViews(const HeadlessOptions &options, const Camera *camera, RasterView *views)
+{
+    if (options.views == HEADLESS_VIEWS_STEREO)
+    {
+        for (Uint32 eye = 0; eye < 2; ++eye)
+        {
+            float offset = (eye == 0 ? 0.5f : -0.5f) * HEADLESS_STEREO_SEPARATION;
+            views[eye].viewMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(offset, 0.0f, 0.0f)) * camera->viewMatrix;
+            views[eye].projectionMatrix = camera->projectionMatrix;
+        }
+        return;
+    }
+
+    // 90 degrees and square with the up vectors of OpenGL cube maps, the depth range stays the camera's
+    static const glm::vec3 directions[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+    static const glm::vec3 ups[6] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+    glm::mat4 projection = camera->projectionMatrix;
+    projection[0][0] = 1.0f;
+    projection[1][1] = 1.0f;
+    for (Uint32 face = 0; face < 6; ++face)
+    {
+        views[face].viewMatrix = glm::lookAt(camera->position, camera->position + directions[face], ups[face]);
+        views[face].projectionMatrix = projection;
+    }
+}
+
+static int JobThread(void *data)
+{
+    HeadlessJob *job = (HeadlessJob*)data;
+    HeadlessBatch *batch = job->batch;
+    const HeadlessOptions &options = *batch->options;
+    double frequency = double(SDL_GetPerformanceFrequency());
+
+    for (Uint32 frame = job->firstFrame; frame < options.frames; frame += batch->jobCount)
+    {
+        // The frames of the other jobs since this one's last only move the camera and the animation on
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        for (Uint32 skipped = frame == job->firstFrame ? 0 : frame - batch->jobCount + 1; skipped < frame; ++skipped)
+        {
+            SetFrameInput(&job->context, options, &job->replay, skipped);
+            Renderer::Advance(&job->context, options.deltaTime);
+        }
+        SetFrameInput(&job->context, options, &job->replay, frame);
+        Renderer::Update(&job->context, options.deltaTime, true);
+        Uint32 *pixels = Renderer::Present(&job->context);
+        job->renderSeconds += (SDL_GetPerformanceCounter() - frameStart) / frequency;
+
+        SDL_LockMutex(batch->mutex);
+        job->pixels = pixels;
+        job->readyFrame = frame;
+        SDL_CondBroadcast(batch->changed);
+        while (job->readyFrame != HEADLESS_NO_FRAME && !batch->quit)
+        {
+            SDL_CondWait(batch->changed, batch->mutex);
+        }
+        bool quit = batch->quit;
+        SDL_UnlockMutex(batch->mutex);
+        if (quit)
+            break;
+    }
+    return 0;
+}
+
+static void StopJobs(HeadlessBatch *batch)
+{
+    SDL_LockMutex(batch->mutex);
+    batch->quit = true;
+    SDL_CondBroadcast(batch->changed);
+    SDL_UnlockMutex(batch->mutex);
+    for (Uint32 i = 0; i < batch->jobCount; ++i)
+    {
+        if (batch->jobs[i].thread)
+            SDL_WaitThread(batch->jobs[i].thread, NULL);
+        Renderer::Release(&batch->jobs[i].context);
+    }
+    SDL_DestroyCond(batch->changed);
+    SDL_DestroyMutex(batch->mutex);
+}
+
+// Returns false when a frame could not be encoded or the threads could not be started
+static bool RenderJobs(const HeadlessOptions &options, const SceneDescription *scene, EncoderPool *encoder, double *renderSeconds)
+{
+    HeadlessBatch *batch = new HeadlessBatch();
+    batch->options = &options;
+    batch->jobCount = std::min(options.jobs, std::max(options.frames, 1u));
+    batch->mutex = SDL_CreateMutex();
+    batch->changed = SDL_CreateCond();
+
+    // One context at a time, the scenes take their random numbers in the same order
+    bool result = batch->mutex && batch->changed;
+    for (Uint32 i = 0; i < batch->jobCount; ++i)
+    {
+        HeadlessJob *job = &batch->jobs[i];
+        job->batch = batch;
+        job->firstFrame = i;
+        job->readyFrame = HEADLESS_NO_FRAME;
+        job->replay = options.replay;
+        InitContext(&job->context, options, scene);
+    }
+    for (Uint32 i = 0; result && i < batch->jobCount; ++i)
+    {
+        batch->jobs[i].thread = SDL_CreateThread(JobThread, "HeadlessJob", &batch->jobs[i]);
+        result = batch->jobs[i].thread != NULL;
+    }
+    if (!result)
+        fprintf(stderr, "Could not start the render jobs\n");
+
+    for (Uint32 frame = 0; result && frame < options.frames; ++frame)
+    {
+        HeadlessJob *job = &batch->jobs[frame % batch->jobCount];
+        SDL_LockMutex(batch->mutex);
+        while (job->readyFrame != frame)
+        {
+            SDL_CondWait(batch->changed, batch->mutex);
+        }
+        SDL_UnlockMutex(batch->mutex);
+
+        // The job waits until the pixels are copied
+        if (options.output && !Encoding::Submit(encoder, job->pixels, options.width, options.height))
+            result = false;
+
+        SDL_LockMutex(batch->mutex);
+        job->readyFrame = HEADLESS_NO_FRAME;
+        SDL_CondBroadcast(batch->changed);
+        SDL_UnlockMutex(batch->mutex);
+    }
+
+    for (Uint32 i = 0; i < batch->jobCount; ++i)
+    {
+        *renderSeconds += batch->jobs[i].renderSeconds;
+    }
+    StopJobs(batch);
+    delete batch;
+    return result;
+}
+
+/*  Fetches every texel of a gradient in scanline order, the way the rasterizer walks a magnified texture, from
+    each format. The compressed ones hit the decoded block cache for all but the first texel of a block row. */
+static int RunTextureBenchmark()
+{
+    Texture source = {};
+    source.width = TEXTURE_BENCHMARK_SIZE;
+    source.height = TEXTURE_BENCHMARK_SIZE;
+    source.format = TEX_FORMAT_RGBA8;
+    source.levelCount = 1;
+    source.data = (Uint8*)malloc(TEXTURE_BENCHMARK_SIZE * TEXTURE_BENCHMARK_SIZE * 4);
+    for (Uint32 y = 0; y < TEXTURE_BENCHMARK_SIZE; ++y)
+    {
+        for (Uint32 x = 0; x < TEXTURE_BENCHMARK_SIZE; ++x)
+        {
+            Uint8 *texel = &source.data[(y * TEXTURE_BENCHMARK_SIZE + x) * 4];
+            texel[0] = Uint8(x / 2);
+            texel[1] = Uint8(y / 2);
+            texel[2] = Uint8(x ^ y);
+            texel[3] = 255;
+        }
+    }
+
+    const Uint32 formats[] = { TEX_FORMAT_RGBA8, TEX_FORMAT_R8, TEX_FORMAT_BC1, TEX_FORMAT_BC3, TEX_FORMAT_BC4 };
+    double frequency = double(SDL_GetPerformanceFrequency());
+    float sum = 0.0f;
+    printf("%ux%u texels, %u passes\n", TEXTURE_BENCHMARK_SIZE, TEXTURE_BENCHMARK_SIZE, TEXTURE_BENCHMARK_PASSES);
+    for (Uint32 format : formats)
+    {
+        Texture texture = UtilTexture::MakeConverted(&source, format);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (Uint32 pass = 0; pass < TEXTURE_BENCHMARK_PASSES; ++pass)
+        {
+            for (Uint32 y = 0; y < TEXTURE_BENCHMARK_SIZE; ++y)
+            {
+                for (Uint32 x = 0; x < TEXTURE_BENCHMARK_SIZE; ++x)
+                {
+                    sum += UtilTexture::Fetch(&texture, 0, x, y).x;
+                }
+            }
+        }
+        double seconds = (SDL_GetPerformanceCounter() - start) / frequency;
+        double samples = double(TEXTURE_BENCHMARK_PASSES) * TEXTURE_BENCHMARK_SIZE * TEXTURE_BENCHMARK_SIZE;
+        printf("  %-6s %5u KiB %6.1f ns/sample\n", UtilTexture::FormatToString(format), UtilTexture::DataSize(&texture) / 1024,
+               seconds * 1e9 / samples);
+        UtilTexture::Release(texture);
+    }
+    UtilTexture::Release(source);
+
+    // Keeps the fetches from being optimized away
+    return sum < 0.0f ? 1 : 0;
+}
+
+// Closes the file --output opened, stdout is only flushed
+static void CloseStream(FILE *stream)
+{
+    if (stream && stream != stdout)
+        fclose(stream);
+    else if (stream)
+        fflush(stream);
+}
+
+bool Headless::IsRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            return true;
+    }
+    return false;
+}
+
+int Headless::Run(int argc, char *argv[])
+{
+    Uint64 startTime = SDL_GetPerformanceCounter();
+    double frequency = double(SDL_GetPerformanceFrequency());
+
+    HeadlessOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (options.textureBenchmark)
+        return RunTextureBenchmark();
+
+    // Before any output is opened, a broken scene file leaves nothing behind
+    SceneDescription scene;
+    if (options.sceneFile && !SceneFiles::Load(options.sceneFile, &scene))
+        return 1;
+    if (options.binarySceneFile)
+    {
+        if (!options.sceneFile)
+            SceneFiles::MakeSolarSystem(&scene);
+        if (!SceneFiles::WriteBinary(options.binarySceneFile, &scene))
+        {
+            fprintf(stderr, "Could not write %s\n", options.binarySceneFile);
+            return 1;
+        }
+    }
+
+    // Frames go into one stream unless the pattern has a place for the frame index
+    FILE *stream = NULL;
+    bool perFrameFiles = options.output && strchr(options.output, '%');
+    if (options.output && strcmp(options.output, "-") == 0)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        stream = stdout;
+    }
+    else if (options.output && !perFrameFiles)
+    {
+        stream = fopen(options.output, "wb");
+        if (!stream)
+        {
+            fprintf(stderr, "Could not open %s\n", options.output);
+            return 1;
+        }
+    }
+
+    // Video streams start with a header, the frame rate follows the time step
+    if (stream)
+    {
+        Uint32 numerator = Uint32(1.0 / options.deltaTime + 0.5), denominator = 1;
+        if (fabs(numerator * options.deltaTime - 1.0) > 1e-6)
+        {
+            numerator = 1000000;
+            denominator = std::max(1u, Uint32(options.deltaTime * 1000000.0 + 0.5));
+        }
+        ImageBuffer header = {};
+        Uint32 width, height;
+        GetOutputSize(options, width, height);
+        UtilImage::EncodeStreamHeader(&header, options.format, width, height, numerator, denominator);
+        bool written = UtilImage::Write(stream, &header);
+        UtilImage::Release(&header);
+        if (!written)
+        {
+            fprintf(stderr, "Could not write to %s\n", options.output);
+            CloseStream(stream);
+            return 1;
+        }
+    }
+
+    RenderContext context = {};
+    InputRecording replay = options.replay;
+    if (options.jobs == 1)
+        InitContext(&context, options, &scene);
+
+    SharedFrames sharedFrames = {};
+    if (options.exportName && !FrameSharing::Init(&sharedFrames, options.exportName, options.width, options.height, &context.rasterizer))
+    {
+        Renderer::Release(&context);
+        CloseStream(stream);
+        return 1;
+    }
+
+    EncoderPool encoder = {};
+    if (options.output && !Encoding::Init(&encoder, options.encoderThreads, options.format, perFrameFiles ? options.output : NULL, stream))
+    {
+        fprintf(stderr, "Could not start the encoder threads\n");
+        if (options.jobs == 1)
+            Renderer::Release(&context);
+        FrameSharing::Release(&sharedFrames);
+        CloseStream(stream);
+        return 1;
+    }
+
+    Rasterizer viewTargets[HEADLESS_MAX_VIEWS];
+    RasterView views[HEADLESS_MAX_VIEWS];
+    Uint32 viewCount = ViewCount(options);
+    Uint32 viewWidth, viewHeight;
+    GetOutputSize(options, viewWidth, viewHeight);
+    for (Uint32 i = 0; i < viewCount; ++i)
+    {
+        viewTargets[i] = {};
+        Rasterization::Init(&viewTargets[i], viewWidth, viewHeight, -context.rasterizer.zNear);
+        views[i].target = &viewTargets[i];
+    }
+
+    double renderSeconds = 0.0, viewSeconds = 0.0;
+    double startupSeconds = (SDL_GetPerformanceCounter() - startTime) / frequency;
+    int result = 0;
+    if (options.jobs > 1 && !RenderJobs(options, &scene, &encoder, &renderSeconds))
+        result = 1;
+    for (Uint32 frame = 0; options.jobs == 1 && frame < options.frames; ++frame)
+    {
+        SetFrameInput(&context, options, &replay, frame);
+
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        FrameSharing::BeginFrame(&sharedFrames, &context.rasterizer);
+        Renderer::Update(&context, options.deltaTime, true);
+        Uint32 *pixels = Renderer::Present(&context);
+        renderSeconds += (SDL_GetPerformanceCounter() - frameStart) / frequency;
+
+        // Readers get the previous frames a little longer, the ring has a slot per frame buffer
+        if (options.exportName)
+        {
+            FrameSharing::Publish(&sharedFrames, &context.rasterizer);
+            Rasterization::SetFrameBuffer(&context.rasterizer, (context.rasterizer.frameIndex + 1) % RASTERIZER_FRAME_BUFFERS);
+        }
+
+        if (viewCount)
+        {
+            Uint64 viewStart = SDL_GetPerformanceCounter();
+            SetViews(options, &context.camera, views);
+            Renderer::RenderViews(&context, views, viewCount);
+            viewSeconds += (SDL_GetPerformanceCounter() - viewStart) / frequency;
+        }
+
+        // Encoded while the next frames render, blocks only when all encoders are behind
+        bool submitted = true;
+        for (Uint32 i = 0; options.output && submitted && i < viewCount; ++i)
+        {
+            submitted = Encoding::Submit(&encoder, viewTargets[i].frameBuffer, viewWidth, viewHeight);
+        }
+        if (options.output && !viewCount)
+            submitted = Encoding::Submit(&encoder, pixels, options.width, options.height);
+        if (!submitted)
+        {
+            result = 1;
+            break;
+        }
+    }
+    // Wall clock, with --jobs the frames overlap and renderSeconds adds up the time of each
+    double loopSeconds = (SDL_GetPerformanceCounter() - startTime) / frequency - startupSeconds;
+    if (options.output && !Encoding::Finish(&encoder))
+        result = 1;
+    double encoderWaitSeconds = encoder.waitTicks / frequency;
+    Encoding::Release(&encoder);
+    CloseStream(stream);
+
+    double totalSeconds = (SDL_GetPerformanceCounter() - startTime) / frequency;
+    fprintf(stderr, "%u frames at %ux%u: startup %.1f ms, rendering %.2f ms/frame, waiting for encoders %.1f ms, total %.1f ms\n",
+            options.frames, options.width, options.height, startupSeconds * 1000.0,
+            options.frames ? renderSeconds * 1000.0 / options.frames : 0.0, encoderWaitSeconds * 1000.0, totalSeconds * 1000.0);
+    fprintf(stderr, "%u job%s: %.1f frames/s\n", options.jobs, options.jobs == 1 ? "" : "s",
+            loopSeconds > 0.0 ? options.frames / loopSeconds : 0.0);
+    if (viewCount)
+        fprintf(stderr, "%u views at %ux%u: %.2f ms/frame\n", viewCount, viewWidth, viewHeight,
+                options.frames ? viewSeconds * 1000.0 / options.frames : 0.0);
+
+    for (Uint32 i = 0; i < viewCount; ++i)
+    {
+        Rasterization::Release(&viewTargets[i]);
+    }
+    if (options.jobs == 1)
+        Renderer::Release(&context);
+    FrameSharing::Release(&sharedFrames);
+    return result;
+}
@@ -0,0 +1,27 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+/*  Offscreen rendering for machines without a display. Neither the SDL video subsystem nor the fonts are
+    initialized, frames are rendered with a fixed time step and optionally written to files or stdout:
+
+        SWRasterizer --headless --frames 120 --size 1280x720 --orbit 4 --output frames/%04d.png
+        SWRasterizer --headless --frames 360 --orbit 8 --encoders 6 --output turntable/%04d.qoi
+        SWRasterizer --headless --frames 600 --output - --format raw | ffmpeg -f rawvideo -pix_fmt rgb24 ...
+        SWRasterizer --headless --frames 600 --output - --format y4m | ffmpeg -i - turntable.mp4
+        SWRasterizer --headless --frames 100000 --export /swrasterizer
+        SWRasterizer --headless --frames 600 --scene scenes/asteroids.txt --write-scene asteroids.swsc
+        SWRasterizer --headless --frames 5000 --size 256x256 --jobs 8 --output thumbs/%05d.qoi
+        SWRasterizer --headless --replay session.rec --output - --format raw | md5sum
+        SWRasterizer --headless --texture-bench
+
+    --jobs renders that many frames at once, each in its own context, for batches of frames too small to
+    spread over the cores one by one. --replay renders the input recorded in the window (SWRasterizer --record
+    session.rec), the same frames on every run. Run without --output to only measure the rendering. */
+namespace Headless
+{
+    bool IsRequested(int argc, char *argv[]);
+    // Returns the process exit code
+    int Run(int argc, char *argv[]);
+}
+
+#endif
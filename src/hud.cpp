@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include "hud.h"
+
+bool UtilHud::Init(Hud *hud, TTF_Font *font)
+{
+    *hud = {};
+    GlyphAtlas &atlas = hud->atlas;
+    atlas.height = TTF_FontHeight(font);
+
+    // Rendered one by one like TTF_RenderText_Solid would, so the advance matches the previous HUD
+    SDL_Surface *glyphs[HUD_GLYPH_COUNT] = {};
+    SDL_Color white = { 255, 255, 255, 255 };
+    for (Uint32 i = 0; i < HUD_GLYPH_COUNT; ++i)
+    {
+        char text[2] = { char(HUD_FIRST_GLYPH + i), 0 };
+        glyphs[i] = TTF_RenderText_Solid(font, text, white);
+        atlas.glyphX[i] = atlas.width;
+        atlas.glyphWidth[i] = glyphs[i] ? glyphs[i]->w : 0;
+        atlas.width += atlas.glyphWidth[i];
+    }
+
+    atlas.coverage = (Uint8*)calloc(atlas.width * atlas.height, 1);
+    for (Uint32 i = 0; i < HUD_GLYPH_COUNT; ++i)
+    {
+        SDL_Surface *glyph = glyphs[i];
+        if (!glyph)
+            continue;
+
+        // 8 bit palettized, index 0 is the background
+        Uint32 height = std::min(Uint32(glyph->h), atlas.height);
+        for (Uint32 y = 0; y < height; ++y)
+        {
+            const Uint8 *source = (const Uint8*)glyph->pixels + y * glyph->pitch;
+            Uint8 *destination = atlas.coverage + y * atlas.width + atlas.glyphX[i];
+            for (Uint32 x = 0; x < atlas.glyphWidth[i]; ++x)
+            {
+                destination[x] = source[x] != 0;
+            }
+        }
+        SDL_FreeSurface(glyph);
+    }
+    return atlas.width > 0;
+}
+
+void UtilHud::Release(Hud *hud)
+{
+    free(hud->atlas.coverage);
+    for (Uint32 i = 0; i < HUD_MAX_LINES; ++i)
+    {
+        free(hud->lines[i].runs);
+    }
+    *hud = {};
+}
+
+static void AddRun(HudLine *line, Uint32 x, Uint32 y, Uint32 length)
+{
+    // Glyphs touching each other continue the run
+    if (line->runCount > 0)
+    {
+        HudRun &last = line->runs[line->runCount - 1];
+        if (last.y == y && last.x + last.length == x)
+        {
+            last.length += Uint16(length);
+            return;
+        }
+    }
+
+    if (line->runCount == line->runCapacity)
+    {
+        line->runCapacity = std::max(64u, line->runCapacity * 2);
+        line->runs = (HudRun*)realloc(line->runs, line->runCapacity * sizeof(HudRun));
+    }
+    line->runs[line->runCount++] = { Uint16(x), Uint16(y), Uint16(length) };
+}
+
+static void BuildRuns(const GlyphAtlas *atlas, HudLine *line)
+{
+    line->runCount = 0;
+    for (Uint32 y = 0; y < atlas->height; ++y)
+    {
+        const Uint8 *row = atlas->coverage + y * atlas->width;
+        Uint32 penX = 0;
+        for (const char *c = line->text; *c; ++c)
+        {
+            Uint32 glyph = Uint32(Uint8(*c)) - HUD_FIRST_GLYPH;
+            if (glyph >= HUD_GLYPH_COUNT)
+                glyph = '?' - HUD_FIRST_GLYPH;
+
+            const Uint8 *coverage = row + atlas->glyphX[glyph];
+            Uint32 width = atlas->glyphWidth[glyph];
+            for (Uint32 x = 0; x < width;)
+            {
+                if (!coverage[x])
+                {
+                    ++x;
+                    continue;
+                }
+                Uint32 start = x;
+                while (x < width && coverage[x])
+                {
+                    ++x;
+                }
+                AddRun(line, penX + start, y, x - start);
+            }
+            penX += width;
+        }
+        line->textWidth = penX;
+    }
+}
+
+void UtilHud::SetLine(Hud *hud, Uint32 index, Sint32 x, Sint32 y, const char *text)
+{
+    if (index >= HUD_MAX_LINES)
+        return;
+
+    HudLine *line = &hud->lines[index];
+    if (line->x != x || line->y != y)
+        line->extent = 0;
+    line->x = x;
+    line->y = y;
+    hud->lineCount = std::max(hud->lineCount, index + 1);
+    if (!line->runs || strncmp(line->text, text, HUD_LINE_LENGTH - 1) != 0)
+    {
+        strncpy(line->text, text, HUD_LINE_LENGTH - 1);
+        line->text[HUD_LINE_LENGTH - 1] = 0;
+        BuildRuns(&hud->atlas, line);
+    }
+    line->extent = std::max(line->extent, line->textWidth);
+}
+
+SDL_Rect UtilHud::LineRect(const Hud *hud, Uint32 index)
+{
+    const HudLine &line = hud->lines[index];
+    return SDL_Rect{ line.x, line.y, Sint32(line.extent), Sint32(hud->atlas.height) };
+}
+
+void UtilHud::Draw(const Hud *hud, Uint32 *pixels, Uint32 width, Uint32 height, Uint32 color)
+{
+    for (Uint32 i = 0; i < hud->lineCount; ++i)
+    {
+        const HudLine &line = hud->lines[i];
+        for (Uint32 r = 0; r < line.runCount; ++r)
+        {
+            const HudRun &run = line.runs[r];
+            Sint32 y = line.y + run.y;
+            Sint32 x0 = std::max(line.x + run.x, 0);
+            Sint32 x1 = std::min(line.x + run.x + run.length, Sint32(width));
+            if (y < 0 || y >= Sint32(height) || x0 >= x1)
+                continue;
+
+            std::fill(pixels + y * width + x0, pixels + y * width + x1, color);
+        }
+    }
+}
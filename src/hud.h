@@ -0,0 +1,62 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <SDL2/SDL.h>
+#include "SDL_ttf.h"
+
+#define HUD_MAX_LINES 16
+#define HUD_LINE_LENGTH 128
+#define HUD_FIRST_GLYPH 32      // Printable ASCII, other characters are drawn as '?'
+#define HUD_GLYPH_COUNT 95
+
+// Glyphs of one font size side by side, 1 where a glyph covers the pixel
+struct GlyphAtlas
+{
+    Uint8 *coverage;
+    Uint32 width;
+    Uint32 height;
+    Uint32 glyphX[HUD_GLYPH_COUNT];
+    Uint32 glyphWidth[HUD_GLYPH_COUNT];     // Advance, includes the spacing
+};
+
+// Horizontal run of covered pixels, relative to the line origin
+struct HudRun
+{
+    Uint16 x;
+    Uint16 y;
+    Uint16 length;
+};
+
+struct HudLine
+{
+    char text[HUD_LINE_LENGTH];
+    Sint32 x;
+    Sint32 y;
+    HudRun *runs;
+    Uint32 runCount;
+    Uint32 runCapacity;
+    Uint32 textWidth;
+    Uint32 extent;          // Widest text drawn since the line was moved to x, y
+};
+
+/*  Text overlay drawn straight into the framebuffer. The glyphs are rasterized once, a line's runs are only rebuilt
+    when its text changes, so drawing the HUD is a few fills per row of text and allocates nothing. */
+struct Hud
+{
+    GlyphAtlas atlas;
+    HudLine lines[HUD_MAX_LINES];
+    Uint32 lineCount;
+};
+
+namespace UtilHud
+{
+    bool Init(Hud *hud, TTF_Font *font);
+    void Release(Hud *hud);
+    void SetLine(Hud *hud, Uint32 index, Sint32 x, Sint32 y, const char *text);
+    // color is packed in the framebuffer's format
+    void Draw(const Hud *hud, Uint32 *pixels, Uint32 width, Uint32 height, Uint32 color);
+    // Covers every text the line drew at its current position, so the rect also clears longer earlier texts
+    SDL_Rect LineRect(const Hud *hud, Uint32 index);
+}
+
+#endif
@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "simd.h"
+
+// Largest payload of a stored deflate block
+#define DEFLATE_STORED_BLOCK 65535
+
+static void Reserve(ImageBuffer *buffer, Uint32 size)
+{
+    if (size > buffer->capacity)
+    {
+        buffer->capacity = std::max(size, buffer->capacity + buffer->capacity / 2);
+        buffer->data = (Uint8*)realloc(buffer->data, buffer->capacity);
+    }
+}
+
+static Uint8* WriteRGBRow(Uint8 *out, const Uint32 *pixels, Uint32 width)
+{
+    for (Uint32 x = 0; x < width; ++x)
+    {
+        Uint32 color = pixels[x];
+        out[0] = Uint8(color);
+        out[1] = Uint8(color >> 8);
+        out[2] = Uint8(color >> 16);
+        out += 3;
+    }
+    return out;
+}
+
+static Uint8* WriteBigEndian(Uint8 *out, Uint32 value)
+{
+    out[0] = Uint8(value >> 24);
+    out[1] = Uint8(value >> 16);
+    out[2] = Uint8(value >> 8);
+    out[3] = Uint8(value);
+    return out + 4;
+}
+
+// Slicing by 8 CRC-32 (the zlib/PNG polynomial), processes 8 bytes per step with a table per byte position
+struct CrcTables
+{
+    Uint32 t[8][256];
+};
+
+static CrcTables MakeCrcTables()
+{
+    CrcTables tables;
+    for (Uint32 i = 0; i < 256; ++i)
+    {
+        Uint32 crc = i;
+        for (Uint32 bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+        }
+        tables.t[0][i] = crc;
+    }
+    for (Uint32 i = 0; i < 256; ++i)
+    {
+        for (Uint32 slice = 1; slice < 8; ++slice)
+        {
+            Uint32 previous = tables.t[slice - 1][i];
+            tables.t[slice][i] = tables.t[0][previous & 0xff] ^ (previous >> 8);
+        }
+    }
+    return tables;
+}
+
+static Uint32 Crc32(const Uint8 *data, Uint32 size)
+{
+    static const CrcTables tables = MakeCrcTables();
+    const Uint32 (*t)[256] = tables.t;
+
+    Uint32 crc = 0xffffffff;
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        Uint32 low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | Uint32(data[3]) << 24);
+        Uint32 high = data[4] | data[5] << 8 | data[6] << 16 | Uint32(data[7]) << 24;
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+    }
+    for (; size > 0; --size, ++data)
+    {
+        crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+// The sums are reduced every 5552 bytes, the most that cannot overflow 32 bits
+static Uint32 Adler32(const Uint8 *data, Uint32 size)
+{
+    Uint32 a = 1, b = 0;
+    while (size > 0)
+    {
+        Uint32 count = std::min(size, 5552u);
+        size -= count;
+        for (; count > 0; --count)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+/*  The filtered scanlines (filter byte 0 and RGB) are written behind the PNG first, then copied into stored deflate
+    blocks of at most 64KB. No compression keeps the encoder at memory speed, the files are as large as PPMs. */
+static void EncodePNG(ImageBuffer *buffer, const Uint32 *pixels, Uint32 width, Uint32 height)
+{
+    Uint32 rowSize = 1 + 3 * width;
+    Uint32 rawSize = rowSize * height;
+    Uint32 blockCount = (rawSize + DEFLATE_STORED_BLOCK - 1) / DEFLATE_STORED_BLOCK;
+    Uint32 idatSize = 2 + 5 * blockCount + rawSize + 4;
+    Uint32 pngSize = 8 + (12 + 13) + (12 + idatSize) + 12;
+    Reserve(buffer, pngSize + rawSize);
+
+    Uint8 *raw = buffer->data + pngSize;
+    Uint8 *out = raw;
+    for (Uint32 y = 0; y < height; ++y)
+    {
+        *out++ = 0;
+        out = WriteRGBRow(out, pixels + y * width, width);
+    }
+
+    const Uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out = buffer->data;
+    memcpy(out, signature, 8);
+    out += 8;
+
+    Uint8 *chunk = out + 4;
+    out = WriteBigEndian(out, 13);
+    memcpy(out, "IHDR", 4);
+    out = WriteBigEndian(out + 4, width);
+    out = WriteBigEndian(out, height);
+    const Uint8 header[5] = { 8, 2, 0, 0, 0 };  // 8 bits per channel, RGB, deflate, no filtering, not interlaced
+    memcpy(out, header, 5);
+    out = WriteBigEndian(out + 5, Crc32(chunk, 4 + 13));
+
+    chunk = out + 4;
+    out = WriteBigEndian(out, idatSize);
+    memcpy(out, "IDAT", 4);
+    out += 4;
+    *out++ = 0x78;  // Deflate with a 32KB window
+    *out++ = 0x01;  // No preset dictionary, the lowest level, header checksum
+    for (Uint32 offset = 0; offset < rawSize; offset += DEFLATE_STORED_BLOCK)
+    {
+        Uint32 size = std::min(rawSize - offset, Uint32(DEFLATE_STORED_BLOCK));
+        *out++ = (offset + size == rawSize) ? 1 : 0;
+        out[0] = Uint8(size);
+        out[1] = Uint8(size >> 8);
+        out[2] = Uint8(~size);
+        out[3] = Uint8(~size >> 8);
+        memcpy(out + 4, raw + offset, size);
+        out += 4 + size;
+    }
+    out = WriteBigEndian(out, Adler32(raw, rawSize));
+    out = WriteBigEndian(out, Crc32(chunk, 4 + idatSize));
+
+    out = WriteBigEndian(out, 0);
+    memcpy(out, "IEND", 4);
+    out = WriteBigEndian(out + 4, Crc32(out, 4));
+    buffer->size = pngSize;
+}
+
+/*  QOI (https://qoiformat.org): every pixel becomes a run, an index into the 64 most recent colors, a small
+    difference to the previous pixel or the plain RGB value, whichever comes first. */
+static void EncodeQOI(ImageBuffer *buffer, const Uint32 *pixels, Uint32 width, Uint32 height)
+{
+    Uint32 pixelCount = width * height;
+    Reserve(buffer, 14 + pixelCount * 4 + 8);
+
+    Uint8 *out = buffer->data;
+    memcpy(out, "qoif", 4);
+    out = WriteBigEndian(out + 4, width);
+    out = WriteBigEndian(out, height);
+    *out++ = 3;     // RGB
+    *out++ = 0;     // sRGB with linear alpha
+
+    // Alpha stays 255 so it never has to be written, the index starts out with transparent black
+    Uint32 index[64];
+    std::fill(index, index + 64, 0xff000000);
+    Uint32 previous = 0;
+    Uint32 run = 0;
+    for (Uint32 i = 0; i < pixelCount; ++i)
+    {
+        Uint32 color = pixels[i] & 0x00ffffff;
+        if (color == previous)
+        {
+            if (++run == 62 || i + 1 == pixelCount)
+            {
+                *out++ = Uint8(0xc0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0)
+        {
+            *out++ = Uint8(0xc0 | (run - 1));
+            run = 0;
+        }
+
+        Uint8 r = Uint8(color), g = Uint8(color >> 8), b = Uint8(color >> 16);
+        Uint32 hash = (r * 3 + g * 5 + b * 7 + 255 * 11) & 63;
+        if (index[hash] == color)
+        {
+            *out++ = Uint8(hash);
+        }
+        else
+        {
+            index[hash] = color;
+            Sint32 dr = Sint8(r - Uint8(previous));
+            Sint32 dg = Sint8(g - Uint8(previous >> 8));
+            Sint32 db = Sint8(b - Uint8(previous >> 16));
+            Sint32 drg = dr - dg;
+            Sint32 dbg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+                *out++ = Uint8(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            }
+            else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+            {
+                *out++ = Uint8(0x80 | (dg + 32));
+                *out++ = Uint8((drg + 8) << 4 | (dbg + 8));
+            }
+            else
+            {
+                out[0] = 0xfe;
+                out[1] = r;
+                out[2] = g;
+                out[3] = b;
+                out += 4;
+            }
+        }
+        previous = color;
+    }
+
+    const Uint8 end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(out, end, 8);
+    buffer->size = Uint32(out + 8 - buffer->data);
+}
+
+/*  BT.601 limited range in 8 bit fixed point. Chroma takes the sums of 2x2 blocks (10 bit) and is offset so the
+    intermediate stays positive for the logical shift. */
+#define YUV_LUMA_BIAS (128 + (16 << 8))
+#define YUV_CHROMA_BIAS ((128 << 10) + 512)
+
+static Uint8 LumaFromColor(Uint32 color)
+{
+    Uint32 r = color & 0xff, g = (color >> 8) & 0xff, b = (color >> 16) & 0xff;
+    return Uint8((66 * r + 129 * g + 25 * b + YUV_LUMA_BIAS) >> 8);
+}
+
+static void ChromaFromBlock(Uint32 c00, Uint32 c01, Uint32 c10, Uint32 c11, Uint8 &u, Uint8 &v)
+{
+    Uint32 rb = (c00 & 0x00ff00ff) + (c01 & 0x00ff00ff) + (c10 & 0x00ff00ff) + (c11 & 0x00ff00ff);
+    Sint32 g = ((c00 >> 8) & 0xff) + ((c01 >> 8) & 0xff) + ((c10 >> 8) & 0xff) + ((c11 >> 8) & 0xff);
+    Sint32 r = rb & 0x3ff, b = rb >> 16;
+    u = Uint8((YUV_CHROMA_BIAS - 38 * r - 74 * g + 112 * b) >> 10);
+    v = Uint8((YUV_CHROMA_BIAS + 112 * r - 94 * g - 18 * b) >> 10);
+}
+
+/*  Red and blue share one multiply: (r + b * 2^16) * (25 + 66 * 2^16) has 66 * r + 25 * b in its upper 16 bits, the
+    25 * r below never carries into them. 129 * g is a shift and an add. */
+static VInt LumaFromColors(VInt colors)
+{
+    using namespace Simd;
+    VInt rb = And(colors, SetInt(0x00ff00ff));
+    VInt g = And(ShiftRight(colors, 8), SetInt(0xff));
+    VInt redBlue = ShiftRight(MulInt(rb, SetInt(25 | 66 << 16)), 16);
+    VInt green = AddInt(ShiftLeft(g, 7), g);
+    return ShiftRight(AddInt(AddInt(redBlue, green), SetInt(YUV_LUMA_BIAS)), 8);
+}
+
+/*  Two rows at a time, the luma of both and their chroma in the same pass. The vector loop converts 2 * SIMD_WIDTH
+    pixels per row, the 2x2 blocks are summed from the even and the odd pixels of both rows. */
+static void ConvertRowPair(const Uint32 *row0, const Uint32 *row1, Uint32 width, Uint8 *y0, Uint8 *y1, Uint8 *u, Uint8 *v)
+{
+    using namespace Simd;
+    VInt rbMask = SetInt(0x00ff00ff);
+    VInt byteMask = SetInt(0xff);
+
+    Uint32 x = 0;
+    for (; x + 2 * SIMD_WIDTH <= width; x += 2 * SIMD_WIDTH)
+    {
+        VInt a0 = LoadInt((const Sint32*)row0 + x), b0 = LoadInt((const Sint32*)row0 + x + SIMD_WIDTH);
+        VInt a1 = LoadInt((const Sint32*)row1 + x), b1 = LoadInt((const Sint32*)row1 + x + SIMD_WIDTH);
+        StoreBytes(y0 + x, LumaFromColors(a0));
+        StoreBytes(y0 + x + SIMD_WIDTH, LumaFromColors(b0));
+        if (y1)
+        {
+            StoreBytes(y1 + x, LumaFromColors(a1));
+            StoreBytes(y1 + x + SIMD_WIDTH, LumaFromColors(b1));
+        }
+
+        // Red and blue are summed side by side, 10 bits each
+        VInt rbA = AddInt(And(a0, rbMask), And(a1, rbMask)), rbB = AddInt(And(b0, rbMask), And(b1, rbMask));
+        VInt gA = AddInt(And(ShiftRight(a0, 8), byteMask), And(ShiftRight(a1, 8), byteMask));
+        VInt gB = AddInt(And(ShiftRight(b0, 8), byteMask), And(ShiftRight(b1, 8), byteMask));
+        VInt even, odd;
+        Deinterleave(rbA, rbB, even, odd);
+        VInt rb = AddInt(even, odd);
+        Deinterleave(gA, gB, even, odd);
+        VInt g = AddInt(even, odd);
+        VInt r = And(rb, SetInt(0x3ff));
+        VInt b = ShiftRight(rb, 16);
+
+        VInt cb = AddInt(SubInt(SetInt(YUV_CHROMA_BIAS), AddInt(MulInt(r, SetInt(38)), MulInt(g, SetInt(74)))), MulInt(b, SetInt(112)));
+        VInt cr = SubInt(AddInt(SetInt(YUV_CHROMA_BIAS), MulInt(r, SetInt(112))), AddInt(MulInt(g, SetInt(94)), MulInt(b, SetInt(18))));
+        StoreBytes(u + x / 2, ShiftRight(cb, 10));
+        StoreBytes(v + x / 2, ShiftRight(cr, 10));
+    }
+
+    for (; x < width; x += 2)
+    {
+        Uint32 x1 = std::min(x + 1, width - 1);
+        y0[x] = LumaFromColor(row0[x]);
+        if (x1 != x)
+            y0[x1] = LumaFromColor(row0[x1]);
+        if (y1)
+        {
+            y1[x] = LumaFromColor(row1[x]);
+            if (x1 != x)
+                y1[x1] = LumaFromColor(row1[x1]);
+        }
+        ChromaFromBlock(row0[x], row0[x1], row1[x], row1[x1], u[x / 2], v[x / 2]);
+    }
+}
+
+void UtilImage::ConvertToYUV420(const Uint32 *pixels, Uint32 width, Uint32 height, Uint8 *y, Uint8 *u, Uint8 *v)
+{
+    Uint32 chromaWidth = (width + 1) / 2;
+    for (Uint32 row = 0; row < height; row += 2)
+    {
+        // An odd last row is its own pair
+        bool pair = row + 1 < height;
+        const Uint32 *row0 = pixels + row * width;
+        const Uint32 *row1 = pair ? row0 + width : row0;
+        ConvertRowPair(row0, row1, width, y + row * width, pair ? y + (row + 1) * width : NULL, u + (row / 2) * chromaWidth,
+                       v + (row / 2) * chromaWidth);
+    }
+}
+
+static void EncodeY4M(ImageBuffer *buffer, const Uint32 *pixels, Uint32 width, Uint32 height)
+{
+    Uint32 lumaSize = width * height;
+    Uint32 chromaSize = ((width + 1) / 2) * ((height + 1) / 2);
+    Reserve(buffer, 6 + lumaSize + 2 * chromaSize);
+
+    memcpy(buffer->data, "FRAME\n", 6);
+    Uint8 *y = buffer->data + 6;
+    UtilImage::ConvertToYUV420(pixels, width, height, y, y + lumaSize, y + lumaSize + chromaSize);
+    buffer->size = 6 + lumaSize + 2 * chromaSize;
+}
+
+void UtilImage::EncodeStreamHeader(ImageBuffer *buffer, Uint32 format, Uint32 width, Uint32 height, Uint32 frameRateNumerator,
+                                   Uint32 frameRateDenominator)
+{
+    buffer->size = 0;
+    if (format != IMAGE_FORMAT_Y4M)
+        return;
+
+    // Chroma sited between the luma samples like the 2x2 averages, square pixels, progressive
+    char header[128];
+    int size = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C420jpeg\n", width, height, frameRateNumerator,
+                        frameRateDenominator);
+    Reserve(buffer, size);
+    memcpy(buffer->data, header, size);
+    buffer->size = size;
+}
+
+void UtilImage::Encode(ImageBuffer *buffer, Uint32 format, const Uint32 *pixels, Uint32 width, Uint32 height)
+{
+    if (format == IMAGE_FORMAT_Y4M)
+    {
+        EncodeY4M(buffer, pixels, width, height);
+        return;
+    }
+    if (format == IMAGE_FORMAT_PNG)
+    {
+        EncodePNG(buffer, pixels, width, height);
+        return;
+    }
+    if (format == IMAGE_FORMAT_QOI)
+    {
+        EncodeQOI(buffer, pixels, width, height);
+        return;
+    }
+
+    char header[32] = "";
+    if (format == IMAGE_FORMAT_PPM)
+        snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+    Uint32 headerSize = Uint32(strlen(header));
+
+    Reserve(buffer, headerSize + 3 * width * height);
+    memcpy(buffer->data, header, headerSize);
+    Uint8 *out = buffer->data + headerSize;
+    for (Uint32 y = 0; y < height; ++y)
+    {
+        out = WriteRGBRow(out, pixels + y * width, width);
+    }
+    buffer->size = headerSize + 3 * width * height;
+}
+
+bool UtilImage::Write(FILE *file, const ImageBuffer *buffer)
+{
+    return fwrite(buffer->data, 1, buffer->size, file) == buffer->size;
+}
+
+void UtilImage::Release(ImageBuffer *buffer)
+{
+    free(buffer->data);
+    *buffer = {};
+}
+
+Uint32 UtilImage::FormatFromPath(const char *path)
+{
+    const char *extension = strrchr(path, '.');
+    return extension ? FormatFromString(extension + 1) : 0;
+}
+
+Uint32 UtilImage::FormatFromString(const char *name)
+{
+    if (SDL_strcasecmp(name, "raw") == 0 || SDL_strcasecmp(name, "rgb") == 0)
+        return IMAGE_FORMAT_RAW;
+    if (SDL_strcasecmp(name, "ppm") == 0)
+        return IMAGE_FORMAT_PPM;
+    if (SDL_strcasecmp(name, "png") == 0)
+        return IMAGE_FORMAT_PNG;
+    if (SDL_strcasecmp(name, "qoi") == 0)
+        return IMAGE_FORMAT_QOI;
+    if (SDL_strcasecmp(name, "y4m") == 0)
+        return IMAGE_FORMAT_Y4M;
+    return 0;
+}
+
+const char* UtilImage::FormatToString(Uint32 format)
+{
+    switch (format)
+    {
+    case IMAGE_FORMAT_RAW:
+        return "raw";
+    case IMAGE_FORMAT_PPM:
+        return "ppm";
+    case IMAGE_FORMAT_PNG:
+        return "png";
+    case IMAGE_FORMAT_QOI:
+        return "qoi";
+    case IMAGE_FORMAT_Y4M:
+        return "y4m";
+    default:
+        return NULL;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <SDL2/SDL.h>
+
+// Image file formats for frame dumps, all 8 bit
+#define IMAGE_FORMAT_RAW 1  // Rows of RGB triplets without a header
+#define IMAGE_FORMAT_PPM 2  // Binary PPM (P6)
+#define IMAGE_FORMAT_PNG 3  // Uncompressed (stored deflate blocks), fast to write and readable everywhere
+#define IMAGE_FORMAT_QOI 4  // "Quite OK Image" format, lossless and compressed at about memory speed
+#define IMAGE_FORMAT_Y4M 5  // YUV4MPEG2 video frames, 4:2:0 BT.601 limited range, a stream needs EncodeStreamHeader first
+
+// Growable output of the encoders, reused between frames
+struct ImageBuffer
+{
+    Uint8 *data;
+    Uint32 size;
+    Uint32 capacity;
+};
+
+namespace UtilImage
+{
+    // Encodes framebuffer pixels (0x00BBGGRR) into buffer, replacing its contents
+    void Encode(ImageBuffer *buffer, Uint32 format, const Uint32 *pixels, Uint32 width, Uint32 height);
+    // The header written once before the frames of a stream, empty for formats without one
+    void EncodeStreamHeader(ImageBuffer *buffer, Uint32 format, Uint32 width, Uint32 height, Uint32 frameRateNumerator,
+                            Uint32 frameRateDenominator);
+    bool Write(FILE *file, const ImageBuffer *buffer);
+    // Planar 4:2:0, each chroma sample is the average of a 2x2 block, the last row or column is repeated for odd sizes
+    void ConvertToYUV420(const Uint32 *pixels, Uint32 width, Uint32 height, Uint8 *y, Uint8 *u, Uint8 *v);
+    void Release(ImageBuffer *buffer);
+
+    // Format from the file extension, 0 when it is not known
+    Uint32 FormatFromPath(const char *path);
+    Uint32 FormatFromString(const char *name);
+    const char* FormatToString(Uint32 format);
+}
+
+#endif
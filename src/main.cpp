@@ -1,13 +1,21 @@
 #include <SDL2/SDL.h> 
+#include <algorithm>
 #include <iostream>
 
 #include "renderer.h"
+#include "headless.h"
+#include "server.h"
+#include "present.h"
+#include "sharedframes.h"
+#include "hud.h"
+#include "recording.h"
+#include "simd.h"
 #include "main.h"
 #include "common.h"
 #include "SDL_ttf.h"
 #include <stdio.h>
-#include <sstream> 
-#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
 
 #define SCREEN_WIDTH 960
 #define SCREEN_HEIGHT 540
@@ -17,6 +25,9 @@ float gAverageFPS = 0.0f;
 SDL_Window* gWindow = NULL;
 unsigned gWindowID = 0;
 TTF_Font* gFont = nullptr;
+PresentQueue gPresentQueue = {};
+SharedFrames gSharedFrames = {};
+Hud gHud = {};
 
 float CalcAverageTick(float newtick);
 
@@ -45,7 +56,7 @@ bool InitFonts()
         return false;
     }
 
-    return true;
+    return UtilHud::Init(&gHud, gFont);
 }
 
 bool Init()
@@ -68,61 +79,93 @@ bool Init()
     return InitFonts();
 }
 
-void RenderText(const char *text, SDL_Color color, SDL_Rect textRect, SDL_Surface *destSurface)
-{
-    SDL_Surface *textSurface = TTF_RenderText_Solid(gFont, text, color);
-    SDL_BlitSurface(textSurface, &textRect, destSurface, NULL);
-    SDL_FreeSurface(textSurface);
-}
-
 void RenderScreen(RenderContext *context, double dt)
 {
-    // Create SDL_Surface from our framebuffer
-    SDL_Surface *pixelSurface = SDL_CreateRGBSurfaceFrom(context->rasterizer.frameBuffer,
-                                                         context->width,
-                                                         context->height,
-                                                         8 * 4,										   // depth in bits (BitsPerByte * BytesPerPixel)
-                                                         context->width * 4,						   // pitch (row length * BytesPerPixel)
-                                                         0x000000ff,                                   // red mask
-                                                         0x0000ff00,                                   // green mask
-                                                         0x00ff0000,                                   // blue mask
-                                                         0);                                           // alpha mask
-
-    SDL_Color color = SDL_Color{ 200, 200, 200 };
-    SDL_Rect textRect = {};
-    textRect.w = context->width;
-    textRect.x = 0;
-    textRect.y = 0;
-    textRect.h = context->height;
-
-    std::stringstream ss;
-    ss << "  Shading: " << Renderer::ShadingToString(context->shading) << " (1)";
-    RenderText(ss.str().c_str(), color, textRect, pixelSurface);
-
-    textRect.x = -context->width + 150;
-    textRect.y = -5;
-    textRect.h = context->height;
-    std::stringstream ss7;
-    ss7 << " (S) Secret: " <<  (context->solarSystem ? "on" : "off");
-    RenderText(ss7.str().c_str(), color, textRect, pixelSurface);
-
-    textRect.x = 0;
-    textRect.y = -25;
-    std::stringstream ss2;	
-    ss2 << "  Shininess: " << context->shininess << " (2)(3)"; 
-    RenderText(ss2.str().c_str(), color, textRect, pixelSurface);
-
-    textRect.x = 0;
-    textRect.y = -50;
+    // The HUD is drawn at the window resolution, straight into the presented frame
+    Rasterizer &rasterizer = context->rasterizer;
+    Uint32 *pixels = Renderer::Present(context);
+    char text[HUD_LINE_LENGTH];
+
+    snprintf(text, sizeof(text), "  Shading: %s (1) ", Renderer::ShadingToString(context->shading));
+    if (context->vectorShading)
+        snprintf(text + strlen(text), sizeof(text) - strlen(text), "SIMD x%d (V)", SIMD_WIDTH);
+    else
+        snprintf(text + strlen(text), sizeof(text) - strlen(text), "scalar (V)");
+    UtilHud::SetLine(&gHud, 0, 0, 0, text);
+
+    snprintf(text, sizeof(text), " (S) Secret: %s", context->solarSystem ? "on" : "off");
+    UtilHud::SetLine(&gHud, 1, context->width - 150, 5, text);
+
+    snprintf(text, sizeof(text), "  Shininess: %d (2)(3) Fast math: %s (F)", context->shininess, context->fastMath ? "on" : "off");
+    UtilHud::SetLine(&gHud, 2, 0, 25, text);
+
     unsigned numSphereTris = (context->sphereSubdivisions * 2 + ((context->sphereSubdivisions - 2) * context->sphereSubdivisions * 2));
-    std::stringstream ss4;
-    ss4 << "  Sphere Triangles: " << numSphereTris << " (4)(5)";
-    RenderText(ss4.str().c_str(), color, textRect, pixelSurface);
+    snprintf(text, sizeof(text), "  Sphere Triangles: %u (4)(5)", numSphereTris);
+    UtilHud::SetLine(&gHud, 3, 0, 50, text);
+
+    snprintf(text, sizeof(text), "  Texture: %s (6) %s (9)", UtilTexture::FormatToString(context->textureFormat),
+             UtilTexture::FilterToString(context->textureFilter));
+    UtilHud::SetLine(&gHud, 4, 0, 75, text);
+
+    RasterStats &stats = rasterizer.stats;
+    float helperPercent = stats.quads ? 100.0f * stats.helperLanes / (4.0f * stats.quads) : 0.0f;
+    snprintf(text, sizeof(text), "  Helper lanes: %.1f%%", helperPercent);
+    UtilHud::SetLine(&gHud, 5, 0, 100, text);
+
+    LightGrid &grid = rasterizer.lightGrid;
+    Uint32 tileCount = grid.tilesX * grid.tilesY;
+    float lightsPerTile = (grid.lightCount && tileCount) ? float(grid.tileOffsets[tileCount]) / tileCount : 0.0f;
+    snprintf(text, sizeof(text), "  Point lights: %u (L), %.1f per tile", context->pointLightCount, lightsPerTile);
+    UtilHud::SetLine(&gHud, 6, 0, 125, text);
+
+    snprintf(text, sizeof(text), "  Shadows: %s (H) %upx (M)", context->shadowsOn ? "on" : "off", context->shadowMapSize);
+    UtilHud::SetLine(&gHud, 7, 0, 150, text);
+
+    Uint64 writtenLanes = stats.shadedLanes + stats.broadcastLanes;
+    float shadedPercent = writtenLanes ? 100.0f * stats.shadedLanes / writtenLanes : 0.0f;
+    snprintf(text, sizeof(text), "  Shading rate: %s (R), %.1f%% of pixels shaded", Renderer::ShadingRateToString(context->shadingRate),
+             shadedPercent);
+    UtilHud::SetLine(&gHud, 8, 0, 175, text);
+
+    TemporalState &temporal = context->temporal;
+    snprintf(text, sizeof(text), "  Checkerboard: %s (C), %u reprojected, %u filled", Temporal::ModeToString(context->checkerboard),
+             temporal.reprojectedPixels, temporal.filledPixels);
+    UtilHud::SetLine(&gHud, 9, 0, 200, text);
+
+    snprintf(text, sizeof(text), "  Resolution: %ux%u dynamic %s (D), target %.1f ms (T)", rasterizer.width, rasterizer.height,
+             context->dynamicResolution ? "on" : "off", context->targetFrameTime * 1000.0f);
+    UtilHud::SetLine(&gHud, 10, 0, 225, text);
+
+    snprintf(text, sizeof(text), "  Presented frames: %u, %u dropped", gPresentQueue.presentedFrames, gPresentQueue.droppedFrames);
+    UtilHud::SetLine(&gHud, 11, 0, 250, text);
+
+    DirtyTiles &tiles = rasterizer.dirtyTiles;
+    snprintf(text, sizeof(text), "  Partial redraw: %s (P), %u of %u tiles rendered", context->dirtyTracking ? "on" : "off",
+             tiles.renderTileCount, tiles.tilesX * tiles.tilesY);
+    UtilHud::SetLine(&gHud, 12, 0, 275, text);
+
+    Uint32 color = 200u << rasterizer.redShift | 200u << 8 | 200u << rasterizer.blueShift;
+    UtilHud::Draw(&gHud, pixels, context->width, context->height, color);
+
+    // The HUD is presented every frame. Drawn into a frame buffer, its tiles are rendered again when the buffer is
+    // reused, whether the scene under them changed or not.
+    SDL_Rect rects[PRESENT_MAX_RECTS];
+    Uint32 rectCount = Renderer::ChangedRects(context, rects, PRESENT_MAX_RECTS - HUD_MAX_LINES);
+    for (Uint32 i = 0; i < gHud.lineCount; ++i)
+    {
+        SDL_Rect lineRect = UtilHud::LineRect(&gHud, i);
+        if (rectCount > 0)
+            rects[rectCount++] = lineRect;
+        if (pixels == rasterizer.frameBuffer)
+            Rasterization::InvalidateRect(&rasterizer, lineRect);
+    }
 
-    // Blit (copy) it to the window
-    SDL_BlitSurface(pixelSurface, NULL, SDL_GetWindowSurface(gWindow), NULL);
+    // Other processes read it where it was rendered, with the HUD unless it was drawn over the upscaled copy
+    FrameSharing::Publish(&gSharedFrames, &rasterizer);
 
-    SDL_FreeSurface(pixelSurface);
+    // The present thread copies it to the window while the next frame goes into another buffer
+    Uint32 slot = Presentation::Submit(&gPresentQueue, pixels, context->width, context->height, rects, rectCount);
+    Rasterization::SetFrameBuffer(&rasterizer, slot);
 }
 
 void onWindowResized(int w, int h, RenderContext *context)
@@ -164,53 +207,13 @@ void onMouseUp(Uint8 button, unsigned /*x*/, unsigned /*y*/)
     }
 }
 
-void onKeyDown(SDL_Keycode key, RenderContext *context)
+// Returns whether the key changed a setting of the renderer
+bool onKeyDown(SDL_Keycode key, RenderContext *context)
 {
-    switch (key) 
-    {
-        case SDLK_ESCAPE: gIsRunning = false; return;
-        case SDLK_UP:
-            break;
-        case SDLK_DOWN:
-            break;
-        case SDLK_1:
-            switch (context->shading)
-            {
-                case FLAT_SHADING:
-                    context->shading = GOURAUD_SHADING;
-                    break;
-                case GOURAUD_SHADING:
-                    context->shading = PHONG_SHADING;
-                    break;
-                case PHONG_SHADING:
-                    context->shading = FLAT_SHADING;
-                    break;
-            }
-            break;
-        case SDLK_2:
-            context->shininess = (context->shininess == 2) ? context->shininess : context->shininess / 2;
-            break;
-        case SDLK_3:
-            context->shininess = (context->shininess == 2 << 10) ? context->shininess : context->shininess *2;
-            break;
-        case SDLK_4:
-            context->sphereSubdivisions = (context->sphereSubdivisions == 5) ? context->sphereSubdivisions : context->sphereSubdivisions - 5;
-            break;
-        case SDLK_5:
-            context->sphereSubdivisions = (context->sphereSubdivisions == 150) ? context->sphereSubdivisions : context->sphereSubdivisions + 5;
-            break;
-        case SDLK_7:
-            context->texCoordWrap = (context->texCoordWrap == TEX_COORD_CLAMP) ? TEX_COORD_REPEAT : TEX_COORD_CLAMP;
-            break;
-        case SDLK_8:
-            context->backFaceCulling = !context->backFaceCulling;
-            break;
-        case SDLK_s:
-            context->solarSystem = !context->solarSystem;
-            break;
-        default:
-            break;
-    }
+    if (key != SDLK_ESCAPE)
+        return Renderer::HandleKey(context, key);
+    gIsRunning = false;
+    return false;
 }
 
 // Source: http://stackoverflow.com/questions/87304/calculating-frames-per-second-in-a-game
@@ -232,13 +235,84 @@ float CalcAverageTick(float newtick)
 
 int main(int argc, char *argv[])
 {
+    // No window, video subsystem or fonts
+    if (Headless::IsRequested(argc, argv))
+        return Headless::Run(argc, argv);
+    if (Server::IsRequested(argc, argv))
+        return Server::Run(argc, argv);
+
+    /*  --record FILE saves the input frame by frame, --replay FILE renders it again in place of the live input and
+        quits at its end, a recording is not recorded again. Both run at a fixed time step, --dt SECONDS sets it without
+        recording. */
+    InputRecording recording;
+    Recording::Init(&recording, SCREEN_WIDTH, SCREEN_HEIGHT, 0.0);
+    const char *recordFile = NULL;
+    bool replaying = false;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--record") == 0)
+            recordFile = argv[i + 1];
+        else if (strcmp(argv[i], "--dt") == 0)
+            recording.deltaTime = std::max(atof(argv[i + 1]), 0.0);
+        else if (strcmp(argv[i], "--replay") == 0 && !(replaying = Recording::Load(argv[i + 1], &recording)))
+            return -1;
+    }
+    if (replaying)
+    {
+        recordFile = NULL;
+        if (recording.width == 0)
+        {
+            recording.width = SCREEN_WIDTH;
+            recording.height = SCREEN_HEIGHT;
+        }
+    }
+    else if (recordFile && recording.deltaTime == 0.0)
+        recording.deltaTime = RECORDING_DEFAULT_DELTA_TIME;
+
     if (!Init())
         return -1;
 
     //SDL_SetRelativeMouseMode(SDL_TRUE);	// Capture mouse in window
 
+    // Replays start at the size the recording did
+    if (replaying)
+        SDL_SetWindowSize(gWindow, recording.width, recording.height);
     RenderContext context = {};
-    Renderer::Init(&context, SCREEN_WIDTH, SCREEN_HEIGHT);
+    Renderer::Init(&context, recording.width, recording.height);
+
+    // Render in the window's channel order so presenting is a plain copy
+    SDL_Surface *windowSurface = SDL_GetWindowSurface(gWindow);
+    if (windowSurface)
+        Rasterization::SetPixelFormat(&context.rasterizer, windowSurface->format->format);
+
+    // --scene FILE replaces the solar system and starts in it
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--scene") != 0)
+            continue;
+
+        SceneDescription scene;
+        if (!SceneFiles::Load(argv[i + 1], &scene))
+            return -1;
+        Renderer::LoadScene(&context, &scene);
+        context.solarSystem = true;
+    }
+
+    // --export NAME renders into shared memory, sized for the window maximized on its display
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--export") != 0)
+            continue;
+
+        SDL_DisplayMode mode = {};
+        SDL_GetDesktopDisplayMode(std::max(SDL_GetWindowDisplayIndex(gWindow), 0), &mode);
+        Uint32 maxWidth = std::max(mode.w, SCREEN_WIDTH);
+        Uint32 maxHeight = std::max(mode.h, SCREEN_HEIGHT);
+        if (!FrameSharing::Init(&gSharedFrames, argv[i + 1], maxWidth, maxHeight, &context.rasterizer))
+            return -1;
+    }
+    if (!Presentation::Init(&gPresentQueue, gWindow, context.rasterizer.pixelFormat))
+        return -1;
 
     Uint64 performanceFrequency = SDL_GetPerformanceFrequency();
 
@@ -248,15 +322,23 @@ int main(int argc, char *argv[])
     SDL_Event event;
 
     double updateFPSTimer = 0.0f;
+    Uint32 frame = 0;
+    Uint64 replayStart = currentTime;
 
     while (gIsRunning)
     {
         while (SDL_PollEvent(&event) != 0)
         {
+            // The recording stands in for the input, it can only be stopped
+            if (replaying && event.type != SDL_QUIT && event.type != SDL_WINDOWEVENT &&
+                (event.type != SDL_KEYDOWN || event.key.keysym.sym != SDLK_ESCAPE))
+                continue;
+
             switch (event.type)
             {
                 case SDL_KEYDOWN:
-                    onKeyDown(event.key.keysym.sym, &context);
+                    if (onKeyDown(event.key.keysym.sym, &context) && recordFile)
+                        Recording::Add(&recording, frame, INPUT_EVENT_KEY, event.key.keysym.sym, 0, 0);
                     break;
                 case SDL_MOUSEMOTION:
                     onMouseMove(event, &context);
@@ -276,8 +358,15 @@ int main(int argc, char *argv[])
                 case SDL_WINDOWEVENT:
                     switch (event.window.event)
                     {
+                        case SDL_WINDOWEVENT_SIZE_CHANGED:
+                            Presentation::Resize(&gPresentQueue);
+                            break;
                         case SDL_WINDOWEVENT_RESIZED:
+                            if (replaying)
+                                break;
                             onWindowResized(event.window.data1, event.window.data2, &context);
+                            if (recordFile)
+                                Recording::Add(&recording, frame, INPUT_EVENT_RESIZE, context.width, context.height, 0);
                             break;
                         default:
                             break;
@@ -299,17 +388,49 @@ int main(int argc, char *argv[])
         }
         updateFPSTimer += dt;
 
-        Renderer::Update(&context, dt, gIsRunning);
+        if (replaying)
+        {
+            if (frame == recording.frameCount)
+                break;
+            Recording::Apply(&recording, frame, &context, true);
+            int windowWidth, windowHeight;
+            SDL_GetWindowSize(gWindow, &windowWidth, &windowHeight);
+            if (windowWidth != int(context.width) || windowHeight != int(context.height))
+                SDL_SetWindowSize(gWindow, context.width, context.height);
+        }
+        else if (recordFile)
+        {
+            Recording::AddMouse(&recording, frame, &context);
+        }
+
+        FrameSharing::BeginFrame(&gSharedFrames, &context.rasterizer);
+        Renderer::Update(&context, recording.deltaTime > 0.0 ? recording.deltaTime : dt, gIsRunning);
+        ++frame;
 
         context.mouseRelX = 0;
         context.mouseRelY = 0;
         context.mouseWheel = 0;
 
         RenderScreen(&context, dt);
-        SDL_UpdateWindowSurface(gWindow);
     }
 
+    if (replaying)
+    {
+        double seconds = (SDL_GetPerformanceCounter() - replayStart) / double(performanceFrequency);
+        printf("Replayed %u of %u frames in %.1f ms, %.2f ms/frame\n", frame, recording.frameCount, seconds * 1000.0,
+               frame ? seconds * 1000.0 / frame : 0.0);
+    }
+    if (recordFile)
+    {
+        recording.frameCount = frame;
+        if (!Recording::Save(recordFile, &recording))
+            printf("Could not write %s\n", recordFile);
+    }
+
+    Presentation::Release(&gPresentQueue);
     Renderer::Release(&context);
+    FrameSharing::Release(&gSharedFrames);
+    UtilHud::Release(&gHud);
     SDL_DestroyWindow(gWindow);
     gWindow = NULL;
     SDL_Quit();	// Quit SDL subsystems
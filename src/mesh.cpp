@@ -1,3 +1,4 @@
+#include <float.h>
 #include "mesh.h"
 #include "common.h"
 #include "bunny.h"
@@ -292,12 +293,25 @@ Mesh UtilMesh::MakeMeshCopy(Mesh *original)
 {
 	Mesh mesh = {};
 	mesh.isTexturable = original->isTexturable;
+	memcpy(mesh.textures, original->textures, sizeof(original->textures));
 	mesh.vertexCount = original->vertexCount;
 	mesh.vertices = (Vertex*)malloc(original->vertexCount * sizeof(Vertex));
 	memcpy(mesh.vertices, original->vertices, original->vertexCount * sizeof(Vertex));
 	return mesh;
 }
 
+void UtilMesh::Bounds(const Mesh *mesh, glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+{
+	boundsMin = vec3(FLT_MAX);
+	boundsMax = vec3(-FLT_MAX);
+	for (Uint32 i = 0; i < mesh->vertexCount; ++i)
+	{
+		vec3 position = vec3(mesh->vertices[i].position);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+}
+
 void UtilMesh::UpdateVertices(Mesh *mesh, Vertex *newVertices, Uint32 newVertexCount)
 {
 	free(mesh->vertices);
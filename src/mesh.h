@@ -5,6 +5,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <SDL2/SDL.h>
+#include "texture.h"
 
 struct Vertex
 {
@@ -24,6 +25,9 @@ struct Mesh
     Vertex *vertices;
     Uint32 vertexCount;
     bool isTexturable;
+
+    // Texture objects bound to the texture units when the mesh is drawn. Not owned by the mesh.
+    Texture *textures[MAX_TEXTURE_UNITS];
 };
 
 namespace UtilMesh
@@ -38,6 +42,8 @@ namespace UtilMesh
     Mesh MakeBunnyMesh();
     void UpdateVertices(Mesh *mesh, Vertex *newVertices, Uint32 newVertexCount);
     void AddTriangle(Mesh *mesh, Vertex v0, Vertex v1, Vertex v2);
+    // Axis aligned box around the vertex positions, empty (min > max) without vertices
+    void Bounds(const Mesh *mesh, glm::vec3 &boundsMin, glm::vec3 &boundsMax);
     void Release(Mesh mesh);
 }
 
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include "present.h"
+
+// Writes the frame into the surface, clipped returns the rects of the window to update unless all of it is
+static void CopyToSurface(PresentQueue *queue, const PresentFrame &frame, SDL_Surface *surface, SDL_Rect *clipped,
+                          Uint32 &clippedCount, bool &wholeFrame)
+{
+
+    // The window may have been resized since the frame was rendered
+    Uint32 width = std::min(frame.width, Uint32(surface->w));
+    Uint32 height = std::min(frame.height, Uint32(surface->h));
+    Uint32 pitch = frame.width * sizeof(Uint32);
+
+    // The rects only apply on top of the previous frame at the same size
+    SDL_Rect whole = { 0, 0, Sint32(width), Sint32(height) };
+    const SDL_Rect *rects = frame.rects;
+    Uint32 rectCount = frame.rectCount;
+    wholeFrame = rectCount == 0 || surface != queue->copiedSurface || Uint32(surface->w) != queue->surfaceWidth ||
+        Uint32(surface->h) != queue->surfaceHeight || frame.width != queue->frameWidth || frame.height != queue->frameHeight;
+    if (wholeFrame)
+    {
+        rects = &whole;
+        rectCount = 1;
+    }
+
+    clippedCount = 0;
+    if (SDL_MUSTLOCK(surface))
+        SDL_LockSurface(surface);
+    for (Uint32 i = 0; i < rectCount; ++i)
+    {
+        Sint32 x0 = std::max(rects[i].x, 0);
+        Sint32 y0 = std::max(rects[i].y, 0);
+        Sint32 x1 = std::min(rects[i].x + rects[i].w, Sint32(width));
+        Sint32 y1 = std::min(rects[i].y + rects[i].h, Sint32(height));
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        const Uint32 *source = frame.pixels + y0 * frame.width + x0;
+        Uint8 *destination = (Uint8*)surface->pixels + y0 * surface->pitch + x0 * surface->format->BytesPerPixel;
+        if (surface->format->format == queue->pixelFormat)
+        {
+            for (Sint32 y = y0; y < y1; ++y)
+            {
+                memcpy(destination + (y - y0) * surface->pitch, source + (y - y0) * frame.width, (x1 - x0) * sizeof(Uint32));
+            }
+        }
+        else
+        {
+            // Only when the rasterizer cannot write the window's format
+            SDL_ConvertPixels(x1 - x0, y1 - y0, queue->pixelFormat, source, pitch, surface->format->format, destination, surface->pitch);
+        }
+        clipped[clippedCount++] = SDL_Rect{ x0, y0, x1 - x0, y1 - y0 };
+    }
+    if (SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
+
+    queue->copiedSurface = surface;
+    queue->surfaceWidth = surface->w;
+    queue->surfaceHeight = surface->h;
+    queue->frameWidth = frame.width;
+    queue->frameHeight = frame.height;
+}
+
+static int PresentThread(void *data)
+{
+    PresentQueue *queue = (PresentQueue*)data;
+    SDL_LockMutex(queue->mutex);
+    while (true)
+    {
+        while ((queue->readySlot < 0 || queue->updatePending || !queue->surface) && !queue->quit)
+        {
+            SDL_CondWait(queue->frameReady, queue->mutex);
+        }
+        if (queue->quit)
+            break;
+
+        queue->frontSlot = Uint32(queue->readySlot);
+        queue->readySlot = -1;
+        PresentFrame frame = queue->frames[queue->frontSlot];
+        SDL_Surface *surface = queue->surface;
+        queue->copying = true;
+
+        // The renderer keeps going meanwhile, it never gets the front buffer
+        SDL_Rect rects[PRESENT_MAX_RECTS];
+        Uint32 rectCount;
+        bool wholeFrame;
+        SDL_UnlockMutex(queue->mutex);
+        CopyToSurface(queue, frame, surface, rects, rectCount, wholeFrame);
+        SDL_LockMutex(queue->mutex);
+
+        queue->copying = false;
+        queue->updatePending = wholeFrame || rectCount > 0;
+        queue->updateWhole = wholeFrame;
+        queue->updateRectCount = rectCount;
+        memcpy(queue->updateRects, rects, rectCount * sizeof(SDL_Rect));
+        SDL_CondSignal(queue->copyDone);
+        ++queue->presentedFrames;
+    }
+    SDL_UnlockMutex(queue->mutex);
+    return 0;
+}
+
+bool Presentation::Init(PresentQueue *queue, SDL_Window *window, Uint32 pixelFormat)
+{
+    *queue = {};
+    queue->window = window;
+    queue->pixelFormat = pixelFormat;
+    queue->readySlot = -1;
+    queue->backSlot = 0;
+    queue->frontSlot = RASTERIZER_FRAME_BUFFERS - 1;
+
+    queue->surface = SDL_GetWindowSurface(window);
+
+    queue->mutex = SDL_CreateMutex();
+    queue->frameReady = SDL_CreateCond();
+    queue->copyDone = SDL_CreateCond();
+    if (queue->mutex && queue->frameReady && queue->copyDone)
+        queue->thread = SDL_CreateThread(PresentThread, "Present", queue);
+    if (!queue->thread)
+    {
+        printf("Present thread could not be created! SDL_Error: %s\n", SDL_GetError());
+        Release(queue);
+        return false;
+    }
+    return true;
+}
+
+void Presentation::Release(PresentQueue *queue)
+{
+    if (queue->thread)
+    {
+        SDL_LockMutex(queue->mutex);
+        queue->quit = true;
+        SDL_CondSignal(queue->frameReady);
+        SDL_UnlockMutex(queue->mutex);
+        SDL_WaitThread(queue->thread, NULL);
+    }
+    if (queue->copyDone)
+        SDL_DestroyCond(queue->copyDone);
+    if (queue->frameReady)
+        SDL_DestroyCond(queue->frameReady);
+    if (queue->mutex)
+        SDL_DestroyMutex(queue->mutex);
+    *queue = {};
+}
+
+Uint32 Presentation::Submit(PresentQueue *queue, const Uint32 *pixels, Uint32 width, Uint32 height, const SDL_Rect *rects, Uint32 rectCount)
+{
+    SDL_LockMutex(queue->mutex);
+
+    // The copy is done, the present thread waits for the update before it writes the surface again
+    if (queue->updatePending)
+    {
+        if (queue->updateWhole)
+            SDL_UpdateWindowSurface(queue->window);
+        else
+            SDL_UpdateWindowSurfaceRects(queue->window, queue->updateRects, queue->updateRectCount);
+        queue->updatePending = false;
+    }
+
+    Uint32 slot = queue->backSlot;
+    PresentFrame &frame = queue->frames[slot];
+    frame.pixels = pixels;
+    frame.width = width;
+    frame.height = height;
+    frame.rectCount = rectCount <= PRESENT_MAX_RECTS ? rectCount : 0;
+    if (frame.rectCount > 0)
+        memcpy(frame.rects, rects, frame.rectCount * sizeof(SDL_Rect));
+
+    // Reuse the frame the present thread did not get to, otherwise the buffer that is neither shown nor queued
+    Uint32 nextSlot;
+    if (queue->readySlot >= 0)
+    {
+        nextSlot = Uint32(queue->readySlot);
+        ++queue->droppedFrames;
+
+        // The window still shows the frame before the dropped one
+        const PresentFrame &dropped = queue->frames[nextSlot];
+        if (frame.rectCount > 0 && dropped.rectCount > 0 && frame.rectCount + dropped.rectCount <= PRESENT_MAX_RECTS)
+        {
+            memcpy(frame.rects + frame.rectCount, dropped.rects, dropped.rectCount * sizeof(SDL_Rect));
+            frame.rectCount += dropped.rectCount;
+        }
+        else
+        {
+            frame.rectCount = 0;
+        }
+    }
+    else
+    {
+        nextSlot = 0;
+        while (nextSlot == slot || nextSlot == queue->frontSlot)
+        {
+            ++nextSlot;
+        }
+    }
+    queue->readySlot = Sint32(slot);
+    queue->backSlot = nextSlot;
+    SDL_CondSignal(queue->frameReady);
+    SDL_UnlockMutex(queue->mutex);
+    return nextSlot;
+}
+
+void Presentation::Resize(PresentQueue *queue)
+{
+    SDL_LockMutex(queue->mutex);
+    while (queue->copying)
+    {
+        SDL_CondWait(queue->copyDone, queue->mutex);
+    }
+
+    // A copy into the old surface is not shown, the next one covers the new surface whole
+    queue->updatePending = false;
+    queue->surface = SDL_GetWindowSurface(queue->window);
+    SDL_CondSignal(queue->frameReady);
+    SDL_UnlockMutex(queue->mutex);
+}
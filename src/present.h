@@ -0,0 +1,75 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <SDL2/SDL.h>
+#include "rasterizer.h"
+
+#define PRESENT_MAX_RECTS 64
+
+// A finished frame, pixels belong to the renderer
+struct PresentFrame
+{
+    const Uint32 *pixels;
+    Uint32 width;
+    Uint32 height;
+    SDL_Rect rects[PRESENT_MAX_RECTS];  // Where the frame differs from the one submitted before it
+    Uint32 rectCount;                   // 0 copies the whole frame
+};
+
+/*  Copies finished frames into the window surface on its own thread, so rendering never waits for the copy. The
+    renderer owns RASTERIZER_FRAME_BUFFERS buffers, one is on screen (front), one waits to be presented (ready) and
+    the renderer fills the last one (back). A ready frame that was not presented yet is replaced by the next one and
+    counted as dropped, its changed rects are added to the next frame's. Only the changed rects are copied and
+    updated when the window still shows the frame before.
+
+    SDL's window functions stay on the main thread: it gets the surface in Init and Resize while no copy is running
+    and updates the window with the copied rects in the next Submit. The present thread only writes the pixels. */
+struct PresentQueue
+{
+    SDL_Window *window;
+    Uint32 pixelFormat;     // Of the submitted frames
+    SDL_Thread *thread;
+    SDL_mutex *mutex;
+    SDL_cond *frameReady;
+
+    PresentFrame frames[RASTERIZER_FRAME_BUFFERS];
+    Sint32 readySlot;       // -1 when there is no new frame
+    Uint32 frontSlot;
+    Uint32 backSlot;
+    bool quit;
+
+    SDL_cond *copyDone;
+    SDL_Surface *surface;   // Of the window, replaced by the main thread while copying is false
+    bool copying;
+
+    // Copied and waiting for the main thread to update the window with them, no copy starts meanwhile
+    bool updatePending;
+    bool updateWhole;
+    SDL_Rect updateRects[PRESENT_MAX_RECTS];
+    Uint32 updateRectCount;
+
+    // What the window surface holds, only used by the present thread
+    SDL_Surface *copiedSurface;
+    Uint32 surfaceWidth;
+    Uint32 surfaceHeight;
+    Uint32 frameWidth;
+    Uint32 frameHeight;
+
+    Uint32 presentedFrames;
+    Uint32 droppedFrames;
+};
+
+namespace Presentation
+{
+    // Returns false when the thread could not be started
+    bool Init(PresentQueue *queue, SDL_Window *window, Uint32 pixelFormat);
+    void Release(PresentQueue *queue);
+    /*  Queues the frame in the back buffer and returns the buffer to render the next frame into, never waits for a
+        copy. rects are where the frame differs from the previous one, rectCount 0 presents all of it. Shows the
+        frame copied last, call it from the main thread. */
+    Uint32 Submit(PresentQueue *queue, const Uint32 *pixels, Uint32 width, Uint32 height, const SDL_Rect *rects, Uint32 rectCount);
+    // Gets the window surface again after SDL_WINDOWEVENT_SIZE_CHANGED, from the main thread
+    void Resize(PresentQueue *queue);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <vector>
 #include <SDL2/SDL.h>
 #include "rasterizer.h"
+#include "shading.h"
 #include "renderer.h"
 #include "main.h"
 #include "common.h"
@@ -17,78 +18,646 @@ using std::max;
 using glm::normalize;
 using glm::clamp;
 
-mat4 U::modelMatrix;
-mat4 U::viewMatrix;
-mat4 U::mvpMatrix;
-vec3 U::worldCameraPosition;
-vec3 U::worldLightDirection;
-vec3 U::worldLightPosition;
-bool U::directionalLightOn;
-bool U::texturingOn;
-bool U::sunMesh;
-int U::shading;
-int U::shininess;
-int U::texCoordWrap;
-
 float EdgeFunction(vec4 &v0, vec4 &v1, vec2 &p);
 void SwapVec4(vec4 &a, vec4 &b);
-Uint32 Vec3ColorToUint32(vec3 col);
+Uint32 Vec3ColorToUint32(const Rasterizer *rasterizer, vec3 col);
 void RasterizeLines(Rasterizer *rasterizer, Mesh *mesh);
-void VertexShader(Vertex &vertex);
 void RasterizeTriangles(Rasterizer *rasterizer, Mesh *mesh);
 void RasterizeLines(Rasterizer *rasterizer, Mesh *mesh);
-vec3 SampleTexture(Rasterizer *rasterizer, Uint32 u, Uint32 v);
+vec3 SampleTexture(Rasterizer *rasterizer, Uint32 unit, vec2 texCoords, vec2 ddx, vec2 ddy);
+
+// Every tile starts at full rate until a frame has been rendered
+static void AllocateShadingRates(Rasterizer *rasterizer)
+{
+    rasterizer->rateTilesX = (rasterizer->width + SHADING_RATE_TILE_SIZE - 1) / SHADING_RATE_TILE_SIZE;
+    rasterizer->rateTilesY = (rasterizer->height + SHADING_RATE_TILE_SIZE - 1) / SHADING_RATE_TILE_SIZE;
+    Uint32 tileCount = rasterizer->rateTilesX * rasterizer->rateTilesY;
+    if (tileCount > rasterizer->rateTileCapacity)
+    {
+        rasterizer->rateTileCapacity = tileCount;
+        rasterizer->shadingRates = (Uint8*)realloc(rasterizer->shadingRates, tileCount);
+    }
+    memset(rasterizer->shadingRates, SHADING_RATE_1X1, tileCount);
+
+    Uint32 blockCount = (rasterizer->width + 3) / 4;
+    if (blockCount > rasterizer->coarseBlockCapacity)
+    {
+        rasterizer->coarseBlockCapacity = blockCount;
+        rasterizer->coarseBlocks = (CoarseBlock*)realloc(rasterizer->coarseBlocks, blockCount * sizeof(CoarseBlock));
+    }
+    memset(rasterizer->coarseBlocks, 0, blockCount * sizeof(CoarseBlock));
+    rasterizer->coarseStamp = 0;
+}
+
+static void ReleaseFrameBuffers(Rasterizer *rasterizer)
+{
+    for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+    {
+        if (!rasterizer->externalFrameBuffers)
+            free(rasterizer->frameBuffers[i]);
+        rasterizer->frameBuffers[i] = NULL;
+        rasterizer->frameBufferCapacities[i] = 0;
+        rasterizer->dirtyTiles.bufferFrames[i] = 0;
+    }
+    rasterizer->externalFrameBuffers = false;
+}
+
+static void AllocateFrameBuffer(Rasterizer *rasterizer)
+{
+    Uint32 index = rasterizer->frameIndex;
+    Uint32 pixelCount = rasterizer->width * rasterizer->height;
+    if (pixelCount > rasterizer->frameBufferCapacities[index] && rasterizer->externalFrameBuffers)
+        ReleaseFrameBuffers(rasterizer);
+    if (pixelCount > rasterizer->frameBufferCapacities[index])
+    {
+        free(rasterizer->frameBuffers[index]);
+        rasterizer->frameBuffers[index] = (Uint32*)malloc(pixelCount * sizeof(Uint32));
+        rasterizer->frameBufferCapacities[index] = pixelCount;
+        rasterizer->dirtyTiles.bufferFrames[index] = 0;
+    }
+    rasterizer->frameBuffer = rasterizer->frameBuffers[index];
+}
 
 void Rasterization::Init(Rasterizer *rasterizer, Uint32 width, Uint32 height, float zNear)
 {
-    rasterizer->frameBuffer = (Uint32*)malloc(width * height * sizeof(Uint32));
     rasterizer->depthBuffer = (float*)malloc(width * height * sizeof(float));
     rasterizer->width = width;
     rasterizer->height = height;
+    rasterizer->pixelCapacity = width * height;
+    for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+    {
+        rasterizer->frameBuffers[i] = NULL;
+        rasterizer->frameBufferCapacities[i] = 0;
+    }
+    rasterizer->externalFrameBuffers = false;
+    rasterizer->frameIndex = 0;
+    rasterizer->dirtyTiles = {};
+    AllocateFrameBuffer(rasterizer);
+    SetPixelFormat(rasterizer, SDL_PIXELFORMAT_ABGR8888);
     rasterizer->backFaceCulling = true;
+    rasterizer->vectorShading = true;
     rasterizer->zNear = -zNear;
+
+    for (Uint32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+    {
+        rasterizer->textureUnits[unit].texture = NULL;
+        rasterizer->textureUnits[unit].sampler = Sampler{ TEX_COORD_REPEAT, TEX_FILTER_NEAREST };
+    }
+    rasterizer->lightGrid = {};
+    rasterizer->shadingRates = NULL;
+    rasterizer->rateTileCapacity = 0;
+    rasterizer->coarseBlocks = NULL;
+    rasterizer->coarseBlockCapacity = 0;
+    AllocateShadingRates(rasterizer);
+    rasterizer->uniforms = {};
+    rasterizer->uniforms.shadingRate = SHADING_RATE_1X1;
+    rasterizer->shadePattern = 0xf;
+    rasterizer->pixelTags = NULL;
+    rasterizer->tagSpans = NULL;
 }
 
-void Rasterization::SetTexture(Rasterizer *rasterizer, Texture *texture)
+// The unit holds a reference to the bound texture object. Passing NULL unbinds the unit.
+void Rasterization::BindTexture(Rasterizer *rasterizer, Uint32 unit, Texture *texture)
 {
-    rasterizer->texture.width = texture->width;
-    rasterizer->texture.height = texture->height;
-    rasterizer->texture.data = (Uint8*)malloc(texture->width * texture->height * sizeof(Uint8));
-    memcpy(rasterizer->texture.data, texture->data, texture->width * texture->height * sizeof(Uint8));
+    TextureUnit &textureUnit = rasterizer->textureUnits[unit];
+    if (textureUnit.texture == texture)
+        return;
+
+    UtilTexture::AddRef(texture);
+    UtilTexture::Unref(textureUnit.texture);
+    textureUnit.texture = texture;
+}
+
+void Rasterization::SetSampler(Rasterizer *rasterizer, Uint32 unit, Sampler sampler)
+{
+    rasterizer->textureUnits[unit].sampler = sampler;
+}
+
+// Screen space tile rectangle (inclusive) covered by the light sphere, false if it is not visible
+static bool LightTileRect(Rasterizer *rasterizer, const PointLight &light, const mat4 &viewMatrix, const mat4 &projectionMatrix, Sint32 rect[4])
+{
+    vec3 center = vec3(viewMatrix * vec4(light.position, 1.0f));
+    float radius = light.radius;
+
+    // Behind the near plane
+    if (center.z - radius > rasterizer->zNear)
+        return false;
+
+    float minX = 0.0f;
+    float minY = 0.0f;
+    float maxX = float(rasterizer->width - 1);
+    float maxY = float(rasterizer->height - 1);
+
+    // Spheres crossing the near plane conservatively cover the whole screen, otherwise take the bounds of the
+    // projected corners of the view space bounding box
+    if (center.z + radius < rasterizer->zNear)
+    {
+        minX = minY = FLT_MAX;
+        maxX = maxY = -FLT_MAX;
+        for (Uint32 corner = 0; corner < 8; ++corner)
+        {
+            vec3 offset = vec3(corner & 1 ? radius : -radius, corner & 2 ? radius : -radius, corner & 4 ? radius : -radius);
+            vec4 clip = projectionMatrix * vec4(center + offset, 1.0f);
+            float x = (clip.x / clip.w * 0.5f + 0.5f) * float(rasterizer->width);
+            float y = (clip.y / clip.w * -0.5f + 0.5f) * float(rasterizer->height);
+            minX = min(minX, x);
+            maxX = max(maxX, x);
+            minY = min(minY, y);
+            maxY = max(maxY, y);
+        }
+
+        if (maxX < 0.0f || maxY < 0.0f || minX >= float(rasterizer->width) || minY >= float(rasterizer->height))
+            return false;
+    }
+
+    rect[0] = Sint32(clamp(minX, 0.0f, float(rasterizer->width - 1))) / LIGHT_TILE_SIZE;
+    rect[1] = Sint32(clamp(minY, 0.0f, float(rasterizer->height - 1))) / LIGHT_TILE_SIZE;
+    rect[2] = Sint32(clamp(maxX, 0.0f, float(rasterizer->width - 1))) / LIGHT_TILE_SIZE;
+    rect[3] = Sint32(clamp(maxY, 0.0f, float(rasterizer->height - 1))) / LIGHT_TILE_SIZE;
+    return true;
+}
+
+void Rasterization::SetPointLights(Rasterizer *rasterizer, const PointLight *lights, Uint32 count, const mat4 &viewMatrix, const mat4 &projectionMatrix)
+{
+    LightGrid &grid = rasterizer->lightGrid;
+    grid.lights = lights;
+    grid.lightCount = count;
+    grid.tilesX = (rasterizer->width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    grid.tilesY = (rasterizer->height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+
+    Uint32 tileCount = grid.tilesX * grid.tilesY;
+    if (tileCount + 1 > grid.tileCapacity)
+    {
+        grid.tileCapacity = tileCount + 1;
+        grid.tileOffsets = (Uint32*)realloc(grid.tileOffsets, grid.tileCapacity * sizeof(Uint32));
+        grid.tileCursors = (Uint32*)realloc(grid.tileCursors, grid.tileCapacity * sizeof(Uint32));
+    }
+    memset(grid.tileOffsets, 0, (tileCount + 1) * sizeof(Uint32));
+
+    // First pass counts the lights of each tile, the second one writes their indices
+    for (Uint32 pass = 0; pass < 2; ++pass)
+    {
+        for (Uint32 i = 0; i < count; ++i)
+        {
+            Sint32 rect[4];
+            if (!LightTileRect(rasterizer, lights[i], viewMatrix, projectionMatrix, rect))
+                continue;
+
+            for (Sint32 y = rect[1]; y <= rect[3]; ++y)
+            {
+                for (Sint32 x = rect[0]; x <= rect[2]; ++x)
+                {
+                    Uint32 tile = y * grid.tilesX + x;
+                    if (pass == 0)
+                        grid.tileOffsets[tile + 1]++;
+                    else
+                        grid.indices[grid.tileCursors[tile]++] = i;
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (Uint32 tile = 0; tile < tileCount; ++tile)
+            {
+                grid.tileOffsets[tile + 1] += grid.tileOffsets[tile];
+            }
+            memcpy(grid.tileCursors, grid.tileOffsets, tileCount * sizeof(Uint32));
+
+            Uint32 indexCount = grid.tileOffsets[tileCount];
+            if (indexCount > grid.indexCapacity)
+            {
+                grid.indexCapacity = indexCount;
+                grid.indices = (Uint32*)realloc(grid.indices, grid.indexCapacity * sizeof(Uint32));
+            }
+        }
+    }
+}
+
+static LightList TileLights(Rasterizer *rasterizer, Uint32 tile)
+{
+    LightGrid &grid = rasterizer->lightGrid;
+    if (grid.lightCount == 0)
+        return LightList{ NULL, NULL, 0 };
+
+    Uint32 offset = grid.tileOffsets[tile];
+    return LightList{ grid.lights, grid.indices + offset, grid.tileOffsets[tile + 1] - offset };
 }
 
 void Rasterization::Resize(Rasterizer *rasterizer, Uint32 width, Uint32 height)
 {
     if (rasterizer)
     {
-        free(rasterizer->frameBuffer);
-        free(rasterizer->depthBuffer);
         rasterizer->width = width;
         rasterizer->height = height;
+        if (width * height > rasterizer->pixelCapacity)
+        {
+            free(rasterizer->depthBuffer);
+            rasterizer->pixelCapacity = width * height;
+            rasterizer->depthBuffer = (float*)malloc(width * height * sizeof(float));
+        }
+        AllocateFrameBuffer(rasterizer);
 
-        rasterizer->frameBuffer = (Uint32*)malloc(width * height * sizeof(Uint32));
-        rasterizer->depthBuffer = (float*)malloc(width * height * sizeof(float));
+        // The light tiles no longer match the screen
+        rasterizer->lightGrid.lightCount = 0;
+        AllocateShadingRates(rasterizer);
     }
 }
 
-void Rasterization::Clear(Rasterizer *rasterizer, Uint32 flags)
+void Rasterization::SetFrameBuffer(Rasterizer *rasterizer, Uint32 index)
+{
+    rasterizer->frameIndex = index;
+    AllocateFrameBuffer(rasterizer);
+}
+
+void Rasterization::SetFrameBuffers(Rasterizer *rasterizer, Uint32 *const buffers[RASTERIZER_FRAME_BUFFERS], Uint32 capacity)
+{
+    ReleaseFrameBuffers(rasterizer);
+    if (buffers)
+    {
+        for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+        {
+            rasterizer->frameBuffers[i] = buffers[i];
+            rasterizer->frameBufferCapacities[i] = capacity;
+        }
+        rasterizer->externalFrameBuffers = true;
+    }
+    AllocateFrameBuffer(rasterizer);
+}
+
+bool Rasterization::SetPixelFormat(Rasterizer *rasterizer, Uint32 pixelFormat)
+{
+    switch (pixelFormat)
+    {
+    case SDL_PIXELFORMAT_ABGR8888:
+    case SDL_PIXELFORMAT_BGR888:
+        rasterizer->pixelFormat = pixelFormat;
+        rasterizer->redShift = 0;
+        rasterizer->blueShift = 16;
+        return true;
+    case SDL_PIXELFORMAT_ARGB8888:
+    case SDL_PIXELFORMAT_RGB888:
+        rasterizer->pixelFormat = pixelFormat;
+        rasterizer->redShift = 16;
+        rasterizer->blueShift = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Luminance range thresholds (0-255) below which a tile is shaded per 4x4 or 2x2 block
+#define SHADING_RATE_CONTRAST_4X4 6
+#define SHADING_RATE_CONTRAST_2X2 20
+
+// Smooth tiles of the last frame get a coarse rate. Every other pixel of every other row is enough to estimate the
+// contrast, sharp edges and highlights span more than a pixel.
+void Rasterization::UpdateShadingRates(Rasterizer *rasterizer)
+{
+    Uint32 width = rasterizer->width;
+    Uint32 height = rasterizer->height;
+    Uint32 redShift = rasterizer->redShift;
+    Uint32 blueShift = rasterizer->blueShift;
+    for (Uint32 tileY = 0; tileY < rasterizer->rateTilesY; ++tileY)
+    {
+        for (Uint32 tileX = 0; tileX < rasterizer->rateTilesX; ++tileX)
+        {
+            Uint32 minLuma = 255;
+            Uint32 maxLuma = 0;
+            Uint32 endY = min((tileY + 1) * SHADING_RATE_TILE_SIZE, height);
+            Uint32 endX = min((tileX + 1) * SHADING_RATE_TILE_SIZE, width);
+            for (Uint32 y = tileY * SHADING_RATE_TILE_SIZE; y < endY; y += 2)
+            {
+                const Uint32 *row = rasterizer->frameBuffer + y * width;
+                for (Uint32 x = tileX * SHADING_RATE_TILE_SIZE; x < endX; x += 2)
+                {
+                    Uint32 color = row[x];
+                    Uint32 luma = (2 * ((color >> redShift) & 0xff) + 5 * ((color >> 8) & 0xff) + ((color >> blueShift) & 0xff)) >> 3;
+                    minLuma = min(minLuma, luma);
+                    maxLuma = max(maxLuma, luma);
+                }
+            }
+
+            Uint32 contrast = maxLuma - minLuma;
+            Uint8 rate = SHADING_RATE_1X1;
+            if (contrast < SHADING_RATE_CONTRAST_4X4)
+                rate = SHADING_RATE_4X4;
+            else if (contrast < SHADING_RATE_CONTRAST_2X2)
+                rate = SHADING_RATE_2X2;
+            rasterizer->shadingRates[tileY * rasterizer->rateTilesX + tileX] = rate;
+        }
+    }
+}
+
+// Blends two colors with weight / 256 of b, red and blue share one multiply as they cannot overflow into each other
+static inline Uint32 LerpColor(Uint32 a, Uint32 b, Uint32 weight)
+{
+    Uint32 rb = (a & 0xff00ff) * (256 - weight) + (b & 0xff00ff) * weight;
+    Uint32 g = (a & 0xff00) * (256 - weight) + (b & 0xff00) * weight;
+    return ((rb >> 8) & 0xff00ff) | ((g >> 8) & 0xff00);
+}
+
+// Vector version of LerpColor
+static inline VInt LerpColors(VInt a, VInt b, VInt weight, VInt inverseWeight)
+{
+    using namespace Simd;
+    VInt rb = AddInt(MulInt(And(a, SetInt(0xff00ff)), inverseWeight), MulInt(And(b, SetInt(0xff00ff)), weight));
+    VInt g = AddInt(MulInt(And(a, SetInt(0xff00)), inverseWeight), MulInt(And(b, SetInt(0xff00)), weight));
+    return Or(And(ShiftRight(rb, 8), SetInt(0xff00ff)), And(ShiftRight(g, 8), SetInt(0xff00)));
+}
+
+/*  Pixels sample at their integer coordinates, so destination pixel x maps to x * width / destination width. The
+    source position is stepped in 16.16 fixed point and the filter weights are rounded to 8 bits. Every destination
+    row first blends its two source rows into rowBuffer and then filters that row horizontally. */
+void Rasterization::Upscale(const Rasterizer *rasterizer, Uint32 *destination, Uint32 width, Uint32 height, Uint32 *rowBuffer)
+{
+    Uint32 sourceWidth = rasterizer->width;
+    Uint32 sourceHeight = rasterizer->height;
+    Uint32 stepX = Uint32((Uint64(sourceWidth) << 16) / width);
+    Uint32 stepY = Uint32((Uint64(sourceHeight) << 16) / height);
+
+    Sint32 laneOffsets[SIMD_WIDTH];
+    for (Uint32 lane = 0; lane < SIMD_WIDTH; ++lane)
+    {
+        laneOffsets[lane] = Sint32(lane * stepX);
+    }
+    VInt laneSteps = Simd::LoadInt(laneOffsets);
+
+    Uint32 sourceY = 0;
+    for (Uint32 y = 0; y < height; ++y, sourceY += stepY)
+    {
+        Uint32 y0 = sourceY >> 16;
+        Uint32 weightY = (sourceY >> 8) & 0xff;
+        const Uint32 *row0 = rasterizer->frameBuffer + y0 * sourceWidth;
+        const Uint32 *row1 = rasterizer->frameBuffer + min(y0 + 1, sourceHeight - 1) * sourceWidth;
+
+        Uint32 x = 0;
+        VInt weight = Simd::SetInt(weightY);
+        VInt inverseWeight = Simd::SetInt(256 - weightY);
+        for (; x + SIMD_WIDTH <= sourceWidth; x += SIMD_WIDTH)
+        {
+            VInt top = Simd::LoadInt((const Sint32*)row0 + x);
+            VInt bottom = Simd::LoadInt((const Sint32*)row1 + x);
+            Simd::Store((Sint32*)rowBuffer + x, LerpColors(top, bottom, weight, inverseWeight));
+        }
+        for (; x < sourceWidth; ++x)
+        {
+            rowBuffer[x] = LerpColor(row0[x], row1[x], weightY);
+        }
+        // The last column blends with itself
+        rowBuffer[sourceWidth] = rowBuffer[sourceWidth - 1];
+
+        // Neighbouring destination pixels read the same few source pixels, the gathers stay in L1
+        Uint32 *out = destination + y * width;
+        Uint32 sourceX = 0;
+        for (x = 0; x + SIMD_WIDTH <= width; x += SIMD_WIDTH, sourceX += SIMD_WIDTH * stepX)
+        {
+            VInt position = Simd::AddInt(laneSteps, Simd::SetInt(Sint32(sourceX)));
+            VInt index = Simd::ShiftRight(position, 16);
+            VInt weightX = Simd::And(Simd::ShiftRight(position, 8), Simd::SetInt(0xff));
+            VInt left = Simd::GatherInt((const Sint32*)rowBuffer, index);
+            VInt right = Simd::GatherInt((const Sint32*)rowBuffer + 1, index);
+            Simd::Store((Sint32*)out + x, LerpColors(left, right, weightX, Simd::SubInt(Simd::SetInt(256), weightX)));
+        }
+        for (; x < width; ++x, sourceX += stepX)
+        {
+            Uint32 x0 = sourceX >> 16;
+            out[x] = LerpColor(rowBuffer[x0], rowBuffer[x0 + 1], (sourceX >> 8) & 0xff);
+        }
+    }
+}
+
+static void ClearSpan(Rasterizer *rasterizer, Uint32 flags, Uint32 offset, Uint32 count)
 {
     if (flags & COLOR_BIT)
     {
         Uint32 bytesPerPixel = 4;
-        memset(rasterizer->frameBuffer, Vec3ColorToUint32(rasterizer->clearColor), rasterizer->width * rasterizer->height * bytesPerPixel);
+        memset(rasterizer->frameBuffer + offset, Vec3ColorToUint32(rasterizer, rasterizer->clearColor), count * bytesPerPixel);
     }
     if (flags & DEPTH_BIT)
     {
-        std::fill(rasterizer->depthBuffer, rasterizer->depthBuffer + (rasterizer->width * rasterizer->height), FLT_MAX);
+        std::fill(rasterizer->depthBuffer + offset, rasterizer->depthBuffer + offset + count, FLT_MAX);
+    }
+}
+
+// Tile range of the rect clipped to the screen, false when nothing is left
+static bool TileRange(const DirtyTiles &tiles, const SDL_Rect &rect, Uint32 range[4])
+{
+    Sint32 x0 = std::max(rect.x, 0);
+    Sint32 y0 = std::max(rect.y, 0);
+    Sint32 x1 = std::min(rect.x + rect.w, Sint32(tiles.width));
+    Sint32 y1 = std::min(rect.y + rect.h, Sint32(tiles.height));
+    if (x0 >= x1 || y0 >= y1)
+        return false;
+
+    range[0] = Uint32(x0) >> DIRTY_TILE_SHIFT;
+    range[1] = Uint32(y0) >> DIRTY_TILE_SHIFT;
+    range[2] = Uint32(x1 - 1) >> DIRTY_TILE_SHIFT;
+    range[3] = Uint32(y1 - 1) >> DIRTY_TILE_SHIFT;
+    return true;
+}
+
+void Rasterization::BeginDirtyTiles(Rasterizer *rasterizer, bool wholeFrame)
+{
+    DirtyTiles &tiles = rasterizer->dirtyTiles;
+    if (tiles.width != rasterizer->width || tiles.height != rasterizer->height)
+    {
+        // The rows of every buffer moved, none of them can be kept
+        tiles.width = rasterizer->width;
+        tiles.height = rasterizer->height;
+        tiles.tilesX = (tiles.width + DIRTY_TILE_SIZE - 1) >> DIRTY_TILE_SHIFT;
+        tiles.tilesY = (tiles.height + DIRTY_TILE_SIZE - 1) >> DIRTY_TILE_SHIFT;
+        Uint32 tileCount = tiles.tilesX * tiles.tilesY;
+        if (tileCount > tiles.tileCapacity)
+        {
+            tiles.tileCapacity = tileCount;
+            tiles.changeFrames = (Uint32*)realloc(tiles.changeFrames, tileCount * sizeof(Uint32));
+            tiles.renderTiles = (Uint8*)realloc(tiles.renderTiles, tileCount);
+            for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+            {
+                tiles.validTiles[i] = (Uint8*)realloc(tiles.validTiles[i], tileCount);
+            }
+        }
+        for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+        {
+            tiles.bufferFrames[i] = 0;
+        }
+        wholeFrame = true;
+    }
+
+    ++tiles.frame;
+    if (wholeFrame)
+        std::fill(tiles.changeFrames, tiles.changeFrames + tiles.tilesX * tiles.tilesY, tiles.frame);
+}
+
+void Rasterization::MarkChanged(Rasterizer *rasterizer, const SDL_Rect &rect)
+{
+    DirtyTiles &tiles = rasterizer->dirtyTiles;
+    Uint32 range[4];
+    if (!TileRange(tiles, rect, range))
+        return;
+
+    for (Uint32 tileY = range[1]; tileY <= range[3]; ++tileY)
+    {
+        std::fill(tiles.changeFrames + tileY * tiles.tilesX + range[0], tiles.changeFrames + tileY * tiles.tilesX + range[2] + 1, tiles.frame);
+    }
+}
+
+void Rasterization::ResolveDirtyTiles(Rasterizer *rasterizer)
+{
+    DirtyTiles &tiles = rasterizer->dirtyTiles;
+    Uint32 index = rasterizer->frameIndex;
+    Uint8 *validTiles = tiles.validTiles[index];
+    Uint32 bufferFrame = tiles.bufferFrames[index];
+    Uint32 tileCount = tiles.tilesX * tiles.tilesY;
+
+    // A tile is kept when the buffer holds it from a frame after its last change
+    tiles.renderTileCount = 0;
+    for (Uint32 tile = 0; tile < tileCount; ++tile)
+    {
+        bool render = bufferFrame == 0 || !validTiles[tile] || tiles.changeFrames[tile] > bufferFrame;
+        tiles.renderTiles[tile] = render;
+        tiles.renderTileCount += render;
+        validTiles[tile] = 1;
+    }
+    tiles.bufferFrames[index] = tiles.frame;
+}
+
+bool Rasterization::NeedsRender(const Rasterizer *rasterizer, const SDL_Rect &rect)
+{
+    const DirtyTiles &tiles = rasterizer->dirtyTiles;
+    if (!tiles.renderTiles)
+        return true;
+
+    Uint32 range[4];
+    if (!TileRange(tiles, rect, range))
+        return false;
+
+    for (Uint32 tileY = range[1]; tileY <= range[3]; ++tileY)
+    {
+        for (Uint32 tileX = range[0]; tileX <= range[2]; ++tileX)
+        {
+            if (tiles.renderTiles[tileY * tiles.tilesX + tileX])
+                return true;
+        }
+    }
+    return false;
+}
+
+void Rasterization::InvalidateRect(Rasterizer *rasterizer, const SDL_Rect &rect)
+{
+    DirtyTiles &tiles = rasterizer->dirtyTiles;
+    Uint8 *validTiles = tiles.validTiles[rasterizer->frameIndex];
+    Uint32 range[4];
+    if (!validTiles || !TileRange(tiles, rect, range))
+        return;
+
+    for (Uint32 tileY = range[1]; tileY <= range[3]; ++tileY)
+    {
+        memset(validTiles + tileY * tiles.tilesX + range[0], 0, range[2] - range[0] + 1);
+    }
+}
+
+Uint32 Rasterization::ChangedRects(const Rasterizer *rasterizer, SDL_Rect *rects, Uint32 maxRects)
+{
+    const DirtyTiles &tiles = rasterizer->dirtyTiles;
+    if (!tiles.changeFrames)
+        return 0;
+
+    Uint32 rectCount = 0;
+    for (Uint32 tileY = 0; tileY < tiles.tilesY; ++tileY)
+    {
+        const Uint32 *changeFrames = tiles.changeFrames + tileY * tiles.tilesX;
+        Sint32 y = tileY << DIRTY_TILE_SHIFT;
+        Sint32 h = std::min(y + DIRTY_TILE_SIZE, Sint32(tiles.height)) - y;
+        for (Uint32 tileX = 0; tileX < tiles.tilesX;)
+        {
+            if (changeFrames[tileX] != tiles.frame)
+            {
+                ++tileX;
+                continue;
+            }
+            Sint32 x = tileX << DIRTY_TILE_SHIFT;
+            while (tileX < tiles.tilesX && changeFrames[tileX] == tiles.frame)
+            {
+                ++tileX;
+            }
+            Sint32 w = std::min(Sint32(tileX << DIRTY_TILE_SHIFT), Sint32(tiles.width)) - x;
+
+            // Grow the rect of the same span ending at the row above
+            bool merged = false;
+            for (Uint32 i = 0; i < rectCount && !merged; ++i)
+            {
+                if (rects[i].x == x && rects[i].w == w && rects[i].y + rects[i].h == y)
+                {
+                    rects[i].h += h;
+                    merged = true;
+                }
+            }
+            if (merged)
+                continue;
+            if (rectCount == maxRects)
+                return 0;
+            rects[rectCount++] = SDL_Rect{ x, y, w, h };
+        }
+    }
+    return rectCount;
+}
+
+void Rasterization::Clear(Rasterizer *rasterizer, Uint32 flags)
+{
+    const DirtyTiles &tiles = rasterizer->dirtyTiles;
+    if (!tiles.renderTiles || tiles.renderTileCount == tiles.tilesX * tiles.tilesY)
+    {
+        ClearSpan(rasterizer, flags, 0, rasterizer->width * rasterizer->height);
+        return;
+    }
+
+    // Only the tiles that are rendered again, one span per run of them along each row
+    for (Uint32 tileY = 0; tileY < tiles.tilesY; ++tileY)
+    {
+        const Uint8 *renderTiles = tiles.renderTiles + tileY * tiles.tilesX;
+        Uint32 y1 = std::min((tileY + 1) << DIRTY_TILE_SHIFT, rasterizer->height);
+        for (Uint32 tileX = 0; tileX < tiles.tilesX;)
+        {
+            if (!renderTiles[tileX])
+            {
+                ++tileX;
+                continue;
+            }
+            Uint32 x0 = tileX << DIRTY_TILE_SHIFT;
+            while (tileX < tiles.tilesX && renderTiles[tileX])
+            {
+                ++tileX;
+            }
+            Uint32 x1 = std::min(tileX << DIRTY_TILE_SHIFT, rasterizer->width);
+            for (Uint32 y = tileY << DIRTY_TILE_SHIFT; y < y1; ++y)
+            {
+                ClearSpan(rasterizer, flags, y * rasterizer->width + x0, x1 - x0);
+            }
+        }
     }
 }
 
 void Rasterization::Release(Rasterizer *rasterizer)
 {
-    free(rasterizer->frameBuffer);
+    ReleaseFrameBuffers(rasterizer);
     free(rasterizer->depthBuffer);
-    free(rasterizer->texture.data);
+    for (Uint32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+    {
+        BindTexture(rasterizer, unit, NULL);
+    }
+    free(rasterizer->lightGrid.tileOffsets);
+    free(rasterizer->lightGrid.tileCursors);
+    free(rasterizer->lightGrid.indices);
+    free(rasterizer->shadingRates);
+    free(rasterizer->coarseBlocks);
+    free(rasterizer->dirtyTiles.changeFrames);
+    free(rasterizer->dirtyTiles.renderTiles);
+    for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+    {
+        free(rasterizer->dirtyTiles.validTiles[i]);
+    }
 }
 
 void Rasterization::DrawLineMesh(Rasterizer *rasterizer, Mesh *mesh)
@@ -98,7 +667,7 @@ void Rasterization::DrawLineMesh(Rasterizer *rasterizer, Mesh *mesh)
         vec4 &vertexPos = mesh->vertices[i].position;
 
         // Clip space - Model(object) space -> World space -> View(camera space -> Perspective projection
-        vertexPos = U::mvpMatrix * vertexPos;
+        vertexPos = rasterizer->uniforms.mvpMatrix * vertexPos;
 
         // Normalized Device Coordinates - (Perspective) Division by the w coordinate (OpenGL does this for us after the VS)
         vertexPos.x /= vertexPos.w;
@@ -122,6 +691,8 @@ static Vertex LerpVertices(Vertex v0, Vertex v1, float t)
     result.normal = v0.normal + t * (v1.normal - v0.normal);
     result.textureCoords = v0.textureCoords + t * (v1.textureCoords - v0.textureCoords);
     result.vsOutColor = v0.vsOutColor + t * (v1.vsOutColor - v0.vsOutColor);
+    result.vsOutWorldPos = v0.vsOutWorldPos + t * (v1.vsOutWorldPos - v0.vsOutWorldPos);
+    result.vsOutWorldNormal = v0.vsOutWorldNormal + t * (v1.vsOutWorldNormal - v0.vsOutWorldNormal);
 
     return result;
 }
@@ -267,10 +838,10 @@ static void ClipTriangle(Vertex *inTriangle, Mesh *outMesh, float zn)
     return Clip1Vertex(codes, inTriangle, outMesh, zn);
 }
 
-static void ClipToNear(Mesh *mesh, float zNear)
+static void ClipToNear(const Uniforms *uniforms, Mesh *mesh, float zNear)
 {
-    mat4 modelView = U::viewMatrix * U::modelMatrix;
-    mat4 inverseModelView = glm::inverse(U::viewMatrix * U::modelMatrix);
+    mat4 modelView = uniforms->viewMatrix * uniforms->modelMatrix;
+    mat4 inverseModelView = glm::inverse(uniforms->viewMatrix * uniforms->modelMatrix);
     
     // To View Space
     for (Uint32 i = 0; i < mesh->vertexCount; ++i)
@@ -281,6 +852,7 @@ static void ClipToNear(Mesh *mesh, float zNear)
     // Worst case scenario - result has 2 times as many vertices
     Mesh clippedMesh = {};
     clippedMesh.isTexturable = mesh->isTexturable;
+    memcpy(clippedMesh.textures, mesh->textures, sizeof(mesh->textures));
     clippedMesh.vertices = (Vertex*)malloc(2 * mesh->vertexCount * sizeof(Vertex));
     clippedMesh.vertexCount = 0;
 
@@ -301,14 +873,39 @@ static void ClipToNear(Mesh *mesh, float zNear)
     *mesh = clippedMesh;
 }
 
+// The world space part of the vertex shader, the position is left in object space
+static void WorldShader(const Uniforms *uniforms, Vertex &vertex)
+{
+    // NOTE: Should really use a inverse transpose matrix to transform normals, but it is not necessary in our case (we don't have non-uniform scaling)
+    if (uniforms->shading == FLAT_SHADING || uniforms->shading == GOURAUD_SHADING)
+    {
+        // Light is computed in world space coordinates. Vectors and positions have to be transformed by the model matrix.
+        vec4 worldPos = uniforms->modelMatrix * vertex.position;
+        vec3 worldNormal = uniforms->modelMatrix * vec4(vertex.normal, 0.0f);
+        vertex.vsOutColor = Shading::Phong(uniforms, vertex.vsOutColor, vec3(worldPos), worldNormal, NULL);
+    }
+    else // PHONG_SHADING
+    {
+        vertex.vsOutWorldPos = uniforms->modelMatrix * vertex.position;
+        vertex.vsOutWorldNormal = uniforms->modelMatrix * vec4(vertex.normal, 0.0f);
+        vertex.vsOutColor = vertex.vsOutColor;
+    }
+}
+
+static void VertexShader(const Uniforms *uniforms, Vertex &vertex)
+{
+    WorldShader(uniforms, vertex);
+    vertex.position = uniforms->mvpMatrix * vertex.position;
+}
+
 void Rasterization::DrawTriangleMesh(Rasterizer *rasterizer, Mesh *original)
 {
     Mesh mesh = UtilMesh::MakeMeshCopy(original);
-    ClipToNear(&mesh, rasterizer->zNear);
+    ClipToNear(&rasterizer->uniforms, &mesh, rasterizer->zNear);
 
     for (Uint32 i = 0; i < mesh.vertexCount; ++i)
     {
-        VertexShader(mesh.vertices[i]);
+        VertexShader(&rasterizer->uniforms, mesh.vertices[i]);
         
         vec4 &vertexPos = mesh.vertices[i].position;
 
@@ -326,68 +923,353 @@ void Rasterization::DrawTriangleMesh(Rasterizer *rasterizer, Mesh *original)
     UtilMesh::Release(mesh);
 }
 
-static void VertexShader(Vertex &vertex)
+// All three clip space positions on the outer side of one of the left, right, bottom or top planes
+static bool OutsideFrustumSide(const vec4 clip[3])
 {
-    // NOTE: Should really use a inverse transpose matrix to transform normals, but it is not necessary in our case (we don't have non-uniform scaling)
-    if (U::shading == FLAT_SHADING || U::shading == GOURAUD_SHADING)
+    for (Uint32 axis = 0; axis < 2; ++axis)
     {
-        // Light is computed in world space coordinates. Vectors and positions have to be transformed by the model matrix.
+        if (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w)
+            return true;
+        if (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w)
+            return true;
+    }
+    return false;
+}
 
-        // Phong reflection model
-        vec4 worldPos = U::modelMatrix * vertex.position;
-        vec3 worldNormal = U::modelMatrix * vec4(vertex.normal, 0.0f);
-        vec3 N = normalize(worldNormal);
-        vec3 V = normalize(U::worldCameraPosition - vec3(worldPos));
-
-        vec3 albedo = vertex.vsOutColor;
-        vec3 specColor = vec3(1.0f, 1.0f, 1.0f);
-        float ambient = 0.2f;
-        vec3 L;
-        if (U::directionalLightOn)
-        {
-            L = U::worldLightDirection;
-        }
-        else // Solar system
+void Rasterization::DrawTriangleMesh(Rasterizer *rasterizer, const RasterView *views, Uint32 viewCount, Mesh *original)
+{
+    // Shared by the views, the lit vertices in object space. Copied, a target may be the rasterizer itself.
+    Uniforms uniforms = rasterizer->uniforms;
+    Mesh shaded = UtilMesh::MakeMeshCopy(original);
+    for (Uint32 i = 0; i < shaded.vertexCount; ++i)
+    {
+        WorldShader(&uniforms, shaded.vertices[i]);
+    }
+
+    // Clipping at most doubles the vertices
+    Mesh mesh = {};
+    mesh.isTexturable = shaded.isTexturable;
+    memcpy(mesh.textures, shaded.textures, sizeof(shaded.textures));
+    mesh.vertices = (Vertex*)malloc(2 * shaded.vertexCount * sizeof(Vertex));
+
+    for (Uint32 v = 0; v < viewCount; ++v)
+    {
+        const RasterView &view = views[v];
+        Rasterizer *target = view.target;
+        mat4 modelView = view.viewMatrix * uniforms.modelMatrix;
+
+        // To view space, where the near plane is clipped. Triangles off one side of the view are dropped first,
+        // most of them in the faces of a cube map.
+        mesh.vertexCount = 0;
+        for (Uint32 i = 0; i < shaded.vertexCount; i += 3)
         {
-            L = normalize(worldPos - vec4(U::worldLightPosition, 1.0f));
-            if (U::sunMesh)
+            Vertex triangle[3] = { shaded.vertices[i], shaded.vertices[i + 1], shaded.vertices[i + 2] };
+            vec4 clip[3];
+            for (Uint32 k = 0; k < 3; ++k)
             {
-                L = -V;
-                ambient += 0.4f;
+                triangle[k].position = modelView * triangle[k].position;
+                clip[k] = view.projectionMatrix * triangle[k].position;
             }
-            specColor = vec3(0, 0, 0);
+            if (!OutsideFrustumSide(clip))
+                ClipTriangle(triangle, &mesh, target->zNear);
         }
 
-        float NLdot = max(dot(-L, N), 0.0f);
-        float diffuse = NLdot;
+        for (Uint32 i = 0; i < mesh.vertexCount; ++i)
+        {
+            vec4 &vertexPos = mesh.vertices[i].position;
+            vertexPos = view.projectionMatrix * vertexPos;
+            vertexPos.x /= vertexPos.w;
+            vertexPos.y /= vertexPos.w;
+            vertexPos.z /= vertexPos.w;
+            vertexPos.x = (vertexPos.x * 0.5f + 0.5f) * float(target->width);
+            vertexPos.y = (vertexPos.y * -0.5f + 0.5f) * float(target->height);
+        }
+
+        // Per pixel lighting looks from the view's eye
+        target->uniforms = uniforms;
+        target->uniforms.viewMatrix = view.viewMatrix;
+        target->uniforms.mvpMatrix = view.projectionMatrix * modelView;
+        target->uniforms.worldCameraPosition = vec3(glm::inverse(view.viewMatrix)[3]);
+        RasterizeTriangles(target, &mesh);
+    }
+
+    UtilMesh::Release(mesh);
+    UtilMesh::Release(shaded);
+}
+
+// Interpolated vertex shader outputs of a single fragment
+struct Fragment
+{
+    vec3 color;
+    vec3 worldPos;
+    vec3 worldNormal;
+    vec2 texCoords;
+};
+
+/* Fragments are rasterized and shaded in 2x2 quads so that screen space derivatives can be taken by differencing
+   neighbouring lanes (like a GPU does). Lanes are ordered 0 = (x, y), 1 = (x + 1, y), 2 = (x, y + 1), 3 = (x + 1, y + 1).
+   Lanes outside the triangle or failing the depth test may still be interpolated as helper lanes, but are never written. */
+struct Quad
+{
+    Fragment fragments[4];
+    float w[4][3];      // Barycentric coordinates of each lane
+    Uint32 writeMask;   // Lanes inside the triangle that passed the depth test
+
+    vec2 texCoordsDdx;
+    vec2 texCoordsDdy;
 
-        vec3 R = normalize(glm::reflect(L, N));
-        float specular = NLdot * pow(max(dot(R, V), 0.0f), U::shininess);
-        vec3 shadedColor = (ambient + diffuse) * albedo + specular * specColor;
+    LightList lights;   // Point lights of the tile containing the quad
+    Uint32 blockStamp;  // Identifies the triangle and the row of 4x4 blocks
+};
 
-        // Clamp and set value
-        vertex.vsOutColor = clamp(shadedColor, 0.0f, 1.0f);
+static vec3 FragmentAlbedo(Rasterizer *rasterizer, Mesh *mesh, Fragment &fragment, Quad &quad)
+{
+    vec3 albedo = fragment.color;
+    if (rasterizer->uniforms.texturingOn && mesh->isTexturable)
+    {
+        // Unit 0 holds the base color, unit 1 an optional detail map modulating it
+        if (rasterizer->textureUnits[0].texture)
+            albedo = SampleTexture(rasterizer, 0, fragment.texCoords, quad.texCoordsDdx, quad.texCoordsDdy);
+        if (rasterizer->textureUnits[1].texture)
+            albedo *= SampleTexture(rasterizer, 1, fragment.texCoords, quad.texCoordsDdx, quad.texCoordsDdy);
     }
-    else // PHONG_SHADING
+    return albedo;
+}
+
+static Uint32 FragmentShader(Rasterizer *rasterizer, Mesh *mesh, Vertex *triangle, Fragment &fragment, Quad &quad)
+{
+    if (rasterizer->uniforms.shading == FLAT_SHADING)
     {
-        vertex.vsOutWorldPos = U::modelMatrix * vertex.position;
-        vertex.vsOutWorldNormal = U::modelMatrix * vec4(vertex.normal, 0.0f);
-        vertex.vsOutColor = vertex.vsOutColor;
+        return Vec3ColorToUint32(rasterizer, triangle[0].vsOutColor);
+    }
+    else if (rasterizer->uniforms.shading == GOURAUD_SHADING)
+    {
+        return Vec3ColorToUint32(rasterizer, fragment.color);
+    }
+
+    // PHONG_SHADING
+    vec3 albedo = FragmentAlbedo(rasterizer, mesh, fragment, quad);
+    return Vec3ColorToUint32(rasterizer, Shading::Phong(&rasterizer->uniforms, albedo, fragment.worldPos, fragment.worldNormal, &quad.lights));
+}
+
+/*
+    See OpenGL Spec 4.4 page 427
+    Perspective correct vertex attribute interpolation for a fragment on a triangle
+    f = (w0*f0/v0.w + w1*f1/v1.w + w2*f2/v2.x) /
+            (w0/v0.w + w1/v1.w + w2/v2.v)
+ */
+template <typename T>
+static T Interpolate(const T &f0, const T &f1, const T &f2, float w0, float w1, float w2, vec3 &recW, float recInterpolationDenominator)
+{
+    return (w0 * (f0 * recW.x) + w1 * (f1 * recW.y) + w2 * (f2 * recW.z)) * recInterpolationDenominator;
+}
+
+// Interpolates the shaded lanes of the quad. When the fragment shader needs derivatives, the texture coordinates
+// of the other lanes 0-2 are interpolated as well (helper lanes) and the coarse derivatives are taken.
+static Uint32 InterpolateQuad(const Uniforms *uniforms, Mesh *mesh, Vertex *triangle, vec3 recW, Quad &quad, Uint32 shadeMask)
+{
+    if (uniforms->shading == FLAT_SHADING)
+        return 0;
+
+    bool needDerivatives = uniforms->shading == PHONG_SHADING && uniforms->texturingOn && mesh->isTexturable;
+    Uint32 helperMask = needDerivatives ? (~shadeMask & 0x7) : 0;
+
+    for (Uint32 lane = 0; lane < 4; ++lane)
+    {
+        bool written = (shadeMask & (1 << lane)) != 0;
+        bool helper = (helperMask & (1 << lane)) != 0;
+        if (!written && !helper)
+            continue;
+
+        float w0 = quad.w[lane][0];
+        float w1 = quad.w[lane][1];
+        float w2 = quad.w[lane][2];
+        float recInterpolationDenominator = 1.0f / (w0 * recW.x + w1 * recW.y + w2 * recW.z);
+
+        Fragment &fragment = quad.fragments[lane];
+        fragment.texCoords = Interpolate(triangle[0].textureCoords, triangle[1].textureCoords, triangle[2].textureCoords, w0, w1, w2, recW, recInterpolationDenominator);
+        if (helper)
+            continue;
+
+        fragment.color = Interpolate(triangle[0].vsOutColor, triangle[1].vsOutColor, triangle[2].vsOutColor, w0, w1, w2, recW, recInterpolationDenominator);
+        if (uniforms->shading == GOURAUD_SHADING)
+            continue;
+
+        fragment.worldPos = Interpolate(triangle[0].vsOutWorldPos, triangle[1].vsOutWorldPos, triangle[2].vsOutWorldPos, w0, w1, w2, recW, recInterpolationDenominator);
+        fragment.worldNormal = Interpolate(triangle[0].vsOutWorldNormal, triangle[1].vsOutWorldNormal, triangle[2].vsOutWorldNormal, w0, w1, w2, recW, recInterpolationDenominator);
+    }
+
+    // Coarse derivatives, shared by the whole quad
+    if (needDerivatives)
+    {
+        quad.texCoordsDdx = quad.fragments[1].texCoords - quad.fragments[0].texCoords;
+        quad.texCoordsDdy = quad.fragments[2].texCoords - quad.fragments[0].texCoords;
+    }
+
+    return helperMask;
+}
+
+static Uint32 QuadShadingRate(Rasterizer *rasterizer, Sint32 x, Sint32 y)
+{
+    if (rasterizer->uniforms.shading != PHONG_SHADING)
+        return SHADING_RATE_1X1;
+    if (rasterizer->uniforms.shadingRate != SHADING_RATE_AUTO)
+        return rasterizer->uniforms.shadingRate;
+    return rasterizer->shadingRates[(y / SHADING_RATE_TILE_SIZE) * rasterizer->rateTilesX + x / SHADING_RATE_TILE_SIZE];
+}
+
+static Uint32 LaneCount(Uint32 mask)
+{
+    return (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3 & 1);
+}
+
+// Written lanes as 4x4 block coverage bits (row * 4 + column), the quad sits at (offsetX, offsetY) in the block
+static Uint32 QuadCoverage(Uint32 writeMask, Uint32 offsetX, Uint32 offsetY)
+{
+    Uint32 coverage = 0;
+    for (Uint32 lane = 0; lane < 4; ++lane)
+    {
+        if (writeMask & (1 << lane))
+            coverage |= 1 << (((lane >> 1) + offsetY) * 4 + (lane & 1) + offsetX);
+    }
+    return coverage;
+}
+
+/*  Shades one written lane per 2x2 quad or 4x4 block and broadcasts its color to the other written pixels. The two
+    quad rows of a 4x4 block are rasterized one after the other, the second one reuses the color of the first: it is
+    either still pending in the batch, then its coverage grows, or already written to the framebuffer. */
+static void ShadeCoarseQuad(Rasterizer *rasterizer, Mesh *mesh, Vertex *triangle, vec3 recW, Quad &quad, Sint32 x, Sint32 y, Uint32 rate, PhongBatch *batch)
+{
+    Uint32 width = rasterizer->width;
+    Uint32 *origin = rasterizer->frameBuffer + y * width + x;
+    Uint32 coverage = QuadCoverage(quad.writeMask, 0, 0);
+    CoarseBlock *block = NULL;
+
+    if (rate == SHADING_RATE_4X4)
+    {
+        origin = rasterizer->frameBuffer + (y & ~3) * width + (x & ~3);
+        coverage = QuadCoverage(quad.writeMask, x & 2, y & 2);
+        block = &rasterizer->coarseBlocks[x >> 2];
+        if (block->stamp == quad.blockStamp)
+        {
+            if (rasterizer->vectorShading && block->batchGeneration == batch->generation)
+                batch->coverage[block->batchLane] |= coverage;
+            else
+                Shading::WriteCoverage(origin, width, coverage, *block->pixel);
+            rasterizer->stats.broadcastLanes += LaneCount(quad.writeMask);
+            rasterizer->stats.quads++;
+            return;
+        }
     }
 
-    vertex.position = U::mvpMatrix * vertex.position;
+    Uint32 lane = 0;
+    while (!(quad.writeMask & (1 << lane)))
+        lane++;
+    Uint32 helperMask = InterpolateQuad(&rasterizer->uniforms, mesh, triangle, recW, quad, 1 << lane);
+
+    // The shaded lane stands for rate x rate pixels
+    quad.texCoordsDdx *= float(rate);
+    quad.texCoordsDdy *= float(rate);
+
+    if (block)
+    {
+        block->stamp = quad.blockStamp;
+        block->batchGeneration = batch->generation;
+        block->batchLane = batch->count;
+        block->pixel = origin + ((lane >> 1) + (y & 2)) * width + (lane & 1) + (x & 2);
+    }
+
+    Fragment &fragment = quad.fragments[lane];
+    if (rasterizer->vectorShading)
+        Shading::AddFragment(batch, FragmentAlbedo(rasterizer, mesh, fragment, quad), fragment.worldPos, fragment.worldNormal, origin, coverage);
+    else
+        Shading::WriteCoverage(origin, width, coverage, FragmentShader(rasterizer, mesh, triangle, fragment, quad));
+
+    rasterizer->stats.shadedLanes++;
+    rasterizer->stats.broadcastLanes += LaneCount(quad.writeMask) - 1;
+    rasterizer->stats.helperLanes += LaneCount(helperMask);
+    rasterizer->stats.quads++;
+}
+
+// Phong lanes are only textured here, the lighting is deferred to the vectorized batch when enabled
+static void ShadeQuad(Rasterizer *rasterizer, Mesh *mesh, Vertex *triangle, vec3 recW, Quad &quad, Sint32 x, Sint32 y, PhongBatch *batch)
+{
+    bool batched = rasterizer->uniforms.shading == PHONG_SHADING && rasterizer->vectorShading;
+
+    // Checkerboard rendering skips part of the 1x1 lanes, they are reconstructed after the frame
+    Uint32 rate = QuadShadingRate(rasterizer, x, y);
+    Uint32 shadeMask = rate == SHADING_RATE_1X1 ? quad.writeMask & rasterizer->shadePattern : quad.writeMask;
+    if (rasterizer->pixelTags)
+    {
+        Uint32 *tags = rasterizer->pixelTags + y * rasterizer->width + x;
+        for (Uint32 lane = 0; lane < 4; ++lane)
+        {
+            if (shadeMask & (1 << lane))
+                tags[(lane >> 1) * rasterizer->width + (lane & 1)] |= PIXEL_TAG_SHADED;
+        }
+    }
+    if (!shadeMask)
+        return;
+
+    if (rasterizer->uniforms.shading == PHONG_SHADING)
+    {
+        Uint32 tile = (y / LIGHT_TILE_SIZE) * rasterizer->lightGrid.tilesX + x / LIGHT_TILE_SIZE;
+        quad.lights = TileLights(rasterizer, tile);
+        if (batched)
+            Shading::SetLights(batch, tile, &quad.lights);
+    }
+
+    if (rate != SHADING_RATE_1X1)
+    {
+        ShadeCoarseQuad(rasterizer, mesh, triangle, recW, quad, x, y, rate, batch);
+        return;
+    }
+
+    Uint32 helperMask = InterpolateQuad(&rasterizer->uniforms, mesh, triangle, recW, quad, shadeMask);
+    Uint32 width = rasterizer->width;
+    Uint32 *frameBuffer = rasterizer->frameBuffer + y * width + x;
+    for (Uint32 lane = 0; lane < 4; ++lane)
+    {
+        if (shadeMask & (1 << lane))
+        {
+            Uint32 *destination = &frameBuffer[(lane >> 1) * width + (lane & 1)];
+            Fragment &fragment = quad.fragments[lane];
+            if (batched)
+                Shading::AddFragment(batch, FragmentAlbedo(rasterizer, mesh, fragment, quad), fragment.worldPos, fragment.worldNormal, destination, 1);
+            else
+                *destination = FragmentShader(rasterizer, mesh, triangle, fragment, quad);
+            rasterizer->stats.shadedLanes++;
+        }
+        else if (helperMask & (1 << lane))
+        {
+            rasterizer->stats.helperLanes++;
+        }
+    }
+
+    rasterizer->stats.quads++;
 }
 
 static void RasterizeTriangles(Rasterizer *rasterizer, Mesh *mesh)
 {
-    unsigned width = rasterizer->width;
-    unsigned height = rasterizer->height;
+    Sint32 width = rasterizer->width;
+    Sint32 height = rasterizer->height;
+    Quad quad;
+    PhongBatch batch;
+    batch.count = 0;
+    batch.tile = 0xffffffff;
+    batch.stride = width;
+    batch.redShift = rasterizer->redShift;
+    batch.blueShift = rasterizer->blueShift;
+    batch.generation = 0;
+    batch.uniforms = &rasterizer->uniforms;
     for (unsigned i = 0; i < mesh->vertexCount; i += 3)	// 3 vertices per triangle
     {
+        Vertex *triangle = &mesh->vertices[i];
+
         // Triangle vertices (positions)
-        vec4 v0 = mesh->vertices[i].position;
-        vec4 v1 = mesh->vertices[i + 1].position;
-        vec4 v2 = mesh->vertices[i + 2].position;
+        vec4 v0 = triangle[0].position;
+        vec4 v1 = triangle[1].position;
+        vec4 v2 = triangle[2].position;
 
         vec2 pointC = vec2(v2.x, v2.y);
         float triangleArea = EdgeFunction(v0, v1, pointC);
@@ -395,10 +1277,10 @@ static void RasterizeTriangles(Rasterizer *rasterizer, Mesh *mesh)
         if (rasterizer->backFaceCulling && triangleArea < 0)
             continue;
 
-        // Iterate just over triangle Minimum Bounding Box
-        Sint32 minX = (Sint32)clamp(min(v0.x, min(v1.x, v2.x)), 0.0f, float(width - 1));
+        // Iterate just over triangle Minimum Bounding Box, extended to whole quads (even coordinates)
+        Sint32 minX = (Sint32)clamp(min(v0.x, min(v1.x, v2.x)), 0.0f, float(width - 1)) & ~1;
         Sint32 maxX = (Sint32)clamp(max(v0.x, max(v1.x, v2.x)), 0.0f, float(width - 1));
-        Sint32 minY = (Sint32)clamp(min(v0.y, min(v1.y, v2.y)), 0.0f, float(height - 1));
+        Sint32 minY = (Sint32)clamp(min(v0.y, min(v1.y, v2.y)), 0.0f, float(height - 1)) & ~1;
         Sint32 maxY = (Sint32)clamp(max(v0.y, max(v1.y, v2.y)), 0.0f, float(height - 1));
 
         const float x0 = v0.x;
@@ -429,171 +1311,207 @@ static void RasterizeTriangles(Rasterizer *rasterizer, Mesh *mesh)
         float e1_y = e1_diffX * (minY - y1) - e1_diffY * (minX - x1);
         float e2_y = e2_diffX * (minY - y2) - e2_diffY * (minX - x2);
 
-        // Precompute interpolation constants
-        float v0RecW = (1.0f / v0.w);
-        float v1RecW = (1.0f / v1.w);
-        float v2RecW = (1.0f / v2.w);
+        // Edge function offsets of the quad lanes from the top left lane
+        const float e0_lane[4] = { 0.0f, -e0_diffY, e0_diffX, e0_diffX - e0_diffY };
+        const float e1_lane[4] = { 0.0f, -e1_diffY, e1_diffX, e1_diffX - e1_diffY };
+        const float e2_lane[4] = { 0.0f, -e2_diffY, e2_diffX, e2_diffX - e2_diffY };
 
-        unsigned *frameBuffer = rasterizer->frameBuffer + minY * width;
+        // Precompute interpolation constants
+        float recTriangleArea = 1.0f / triangleArea;
+        vec3 recW = vec3(1.0f / v0.w, 1.0f / v1.w, 1.0f / v2.w);
 
-        for (Sint32 y = minY; y <= maxY; ++y)
+        for (Sint32 y = minY; y <= maxY; y += 2)
         {
+            // Both quad rows of a 4x4 block share a stamp, the first row may be the lower half of one
+            if ((y & 3) == 0 || y == minY)
+                quad.blockStamp = ++rasterizer->coarseStamp;
+
+            if (rasterizer->pixelTags)
+            {
+                for (Sint32 row = y; row <= min(y + 1, height - 1); ++row)
+                {
+                    rasterizer->tagSpans[2 * row] = min(rasterizer->tagSpans[2 * row], minX);
+                    rasterizer->tagSpans[2 * row + 1] = max(rasterizer->tagSpans[2 * row + 1], min(maxX + 1, width - 1));
+                }
+            }
+
             float e0 = e0_y;
             float e1 = e1_y;
             float e2 = e2_y;
 
-            for (Sint32 x = minX; x <= maxX; ++x)
-            {
-                float area0 = e0;
-                float area1 = e1;
-                float area2 = e2;
-
-                unsigned col32 = 0;
+            const Uint8 *renderTiles = rasterizer->dirtyTiles.renderTiles;
+            if (renderTiles)
+                renderTiles += (y >> DIRTY_TILE_SHIFT) * rasterizer->dirtyTiles.tilesX;
 
-                if (area0 >= 0 && area1 >= 0 && area2 >= 0 || (!rasterizer->backFaceCulling && area0 <= 0 && area1 <= 0 && area2 <= 0))
+            for (Sint32 x = minX; x <= maxX; x += 2)
+            {
+                // Lanes past the right or bottom edge of the screen are never covered, neither are tiles kept from
+                // an earlier frame
+                Uint32 screenMask = 0xf;
+                if (renderTiles && !renderTiles[x >> DIRTY_TILE_SHIFT])
+                    screenMask = 0;
+                if (x + 1 >= width)
+                    screenMask &= ~0xa;
+                if (y + 1 >= height)
+                    screenMask &= ~0xc;
+
+                // Step the edge functions to the lanes and find the ones inside the triangle
+                float area0[4], area1[4], area2[4];
+                Uint32 coverageMask = 0;
+                for (Uint32 lane = 0; lane < 4; ++lane)
                 {
-                    // Barycentric coordinates
-                    float w0 = area1 / triangleArea;
-                    float w1 = area2 / triangleArea;
-                    float w2 = area0 / triangleArea;
+                    area0[lane] = e0 + e0_lane[lane];
+                    area1[lane] = e1 + e1_lane[lane];
+                    area2[lane] = e2 + e2_lane[lane];
 
-                    /*
-                        See OpenGL Spec 4.4 page 427
-                        Perspective correct vertex attribute interpolation for a fragment on a triangle
-                        f = (w0*f0/v0.w + w1*f1/v1.w + w2*f2/v2.x) / 
-                                (w0/v0.w + w1/v1.w + w2/v2.v)
-                     */
-
-                    // TODO: Move to the beginning, also remove division by W from code below
-                    float recInterpolationDenominator = 1.0f / (w0 * v0RecW + w1 * v1RecW + w2 * v2RecW);
+                    if (area0[lane] >= 0 && area1[lane] >= 0 && area2[lane] >= 0 ||
+                        (!rasterizer->backFaceCulling && area0[lane] <= 0 && area1[lane] <= 0 && area2[lane] <= 0))
+                    {
+                        coverageMask |= 1 << lane;
+                    }
+                }
+                coverageMask &= screenMask;
 
-                    float depth = w0 * v0.z + w1 * v1.z + w2 * v2.z;
-                    float &currentDepth = rasterizer->depthBuffer[y * width + x];
+                if (coverageMask)
+                {
+                    quad.writeMask = 0;
 
-                    if (depth < 1.0f && depth < currentDepth)
+                    for (Uint32 lane = 0; lane < 4; ++lane)
                     {
-                        currentDepth = depth;	// Depth write
-
-                        /// Attribute Interpolation Block
-                        // Color
-                        vec3 &col0 = mesh->vertices[i].vsOutColor;
-                        vec3 &col1 = mesh->vertices[i + 1].vsOutColor;
-                        vec3 &col2 = mesh->vertices[i + 2].vsOutColor;
-
-                        vec3 col;
-                        col.r = (w0 * (col0.r * v0RecW)  + w1 * (col1.r * v1RecW) + w2 * (col2.r * v2RecW)) * recInterpolationDenominator;
-                        col.g = (w0 * (col0.g * v0RecW)  + w1 * (col1.g * v1RecW) + w2 * (col2.g * v2RecW)) * recInterpolationDenominator;
-                        col.b = (w0 * (col0.b * v0RecW)  + w1 * (col1.b * v1RecW) + w2 * (col2.b * v2RecW)) * recInterpolationDenominator;
-                        
-                        // World position (transformed by model matrix)
-                        vec3 &v0Pos = mesh->vertices[i].vsOutWorldPos;
-                        vec3 &v1Pos = mesh->vertices[i + 1].vsOutWorldPos;
-                        vec3 &v2Pos = mesh->vertices[i + 2].vsOutWorldPos;
-
-                        vec3 worldPos;
-                        worldPos.x = (w0 * (v0Pos.x * v0RecW) + w1 * (v1Pos.x * v1RecW) + w2 * (v2Pos.x * v2RecW)) * recInterpolationDenominator;
-                        worldPos.y = (w0 * (v0Pos.y * v0RecW) + w1 * (v1Pos.y * v1RecW) + w2 * (v2Pos.y * v2RecW)) * recInterpolationDenominator;
-                        worldPos.z = (w0 * (v0Pos.z * v0RecW) + w1 * (v1Pos.z * v1RecW) + w2 * (v2Pos.z * v2RecW)) * recInterpolationDenominator;
-
-                        // World normal (transformed by model matrix)
-                        vec3 &v0Normal = mesh->vertices[i].vsOutWorldNormal;
-                        vec3 &v1Normal = mesh->vertices[i + 1].vsOutWorldNormal;
-                        vec3 &v2Normal = mesh->vertices[i + 2].vsOutWorldNormal;
-
-                        vec3 worldNormal;
-                        worldNormal.x = (w0 * (v0Normal.x * v0RecW) + w1 * (v1Normal.x * v1RecW) + w2 * (v2Normal.x * v2RecW)) * recInterpolationDenominator;
-                        worldNormal.y = (w0 * (v0Normal.y * v0RecW) + w1 * (v1Normal.y * v1RecW) + w2 * (v2Normal.y * v2RecW)) * recInterpolationDenominator;
-                        worldNormal.z = (w0 * (v0Normal.z * v0RecW) + w1 * (v1Normal.z * v1RecW) + w2 * (v2Normal.z * v2RecW)) * recInterpolationDenominator;
-
-                        // Texture coords
-                        vec2 &v0Tex = mesh->vertices[i].textureCoords;
-                        vec2 &v1Tex = mesh->vertices[i + 1].textureCoords;
-                        vec2 &v2Tex = mesh->vertices[i + 2].textureCoords;
-
-                        vec2 texCoords;
-                        texCoords.x = (w0 * (v0Tex.x * v0RecW) + w1 * (v1Tex.x * v1RecW) + w2 * (v2Tex.x * v2RecW)) * recInterpolationDenominator;
-                        texCoords.y = (w0 * (v0Tex.y * v0RecW) + w1 * (v1Tex.y * v1RecW) + w2 * (v2Tex.y * v2RecW)) * recInterpolationDenominator;
-
-                        if (U::texCoordWrap == TEX_COORD_CLAMP)
+                        // Barycentric coordinates
+                        float w0 = area1[lane] * recTriangleArea;
+                        float w1 = area2[lane] * recTriangleArea;
+                        float w2 = area0[lane] * recTriangleArea;
+                        quad.w[lane][0] = w0;
+                        quad.w[lane][1] = w1;
+                        quad.w[lane][2] = w2;
+
+                        if (coverageMask & (1 << lane))
                         {
-                            texCoords.x = clamp(texCoords.x, 0.0f, 1.0f);
-                            texCoords.y = clamp(texCoords.y, 0.0f, 1.0f);
-
-                        }
-                        else // TEX_COORD_REPEAT
-                        {	
-                            texCoords.x = texCoords.x - floorf(texCoords.x);
-                            texCoords.y = texCoords.y - floorf(texCoords.y);
-                        }
+                            float depth = w0 * v0.z + w1 * v1.z + w2 * v2.z;
+                            float &currentDepth = rasterizer->depthBuffer[(y + (lane >> 1)) * width + x + (lane & 1)];
 
-                        unsigned u = (Uint32)(texCoords.x * (rasterizer->texture.width - 1));
-                        Uint32 v = (Uint32)(texCoords.y * (rasterizer->texture.height - 1));
-                        
-						/// Fragment shader
-                        if (U::shading == FLAT_SHADING)
-                        {
-                            col32 = Vec3ColorToUint32(col0);
-                        }
-                        else if (U::shading == GOURAUD_SHADING) 
-                        {
-                            // Alpha is not used
-                            col32 = Uint8(col.b * 255.0f) << 16 | Uint8(col.g * 255.0f) << 8 | Uint8(col.r * 255.0f);
-                        }
-                        else // PHONG_SHADING
-                        {
-                            // Phong reflection model
-                            
-                            vec3 albedo = col;
-                            if (U::texturingOn && mesh->isTexturable)
+                            if (depth < 1.0f && depth < currentDepth)
                             {
-                                albedo = SampleTexture(rasterizer, u, v);
+                                currentDepth = depth;	// Depth write
+                                quad.writeMask |= 1 << lane;
+                                if (rasterizer->pixelTags)
+                                    rasterizer->pixelTags[(y + (lane >> 1)) * width + x + (lane & 1)] = rasterizer->uniforms.drawTag;
                             }
-                            vec3 specColor = vec3(1.0f, 1.0f, 1.0f);
+                        }
+                    }
 
-                            vec3 N = normalize(worldNormal);
-                            vec3 V = normalize(U::worldCameraPosition - worldPos);
-                            vec3 L;
-                            float ambient = 0.2f;
+                    if (quad.writeMask)
+                    {
+                        ShadeQuad(rasterizer, mesh, triangle, recW, quad, x, y, &batch);
+                    }
+                }
 
-                            if (U::directionalLightOn)
-                            {
-                                L = U::worldLightDirection;
-                            }
-                            else // Solar system
-                            {
-                                L = normalize(worldPos - U::worldLightPosition);
-                                if (U::sunMesh)
-                                {
-                                    L = -V;
-                                    ambient += 0.4f;
-                                }
-                                specColor = vec3(0, 0, 0);
-                            }
+                e0 -= 2 * e0_diffY;
+                e1 -= 2 * e1_diffY;
+                e2 -= 2 * e2_diffY;
+            }
+            e0_y += 2 * e0_diffX;
+            e1_y += 2 * e1_diffX;
+            e2_y += 2 * e2_diffX;
+        }
+    }
 
-                            float NLdot = max(dot(-L, N), 0.0f);
-                            float diffuse = NLdot;
+    // Uniforms change between draws, light the remaining fragments now
+    Shading::Flush(&batch);
+}
 
-                            vec3 R = normalize(glm::reflect(L, N));
-                            float specular = NLdot * pow(max(dot(R, V), 0.0f), U::shininess);
-                            vec3 shadedColor = (ambient + diffuse) * albedo + specular * specColor;
+/*  Depth only variant of RasterizeTriangles for shadow maps. Only positions are transformed, there is no near plane
+    clipping (triangles reaching behind the near plane are dropped, casters are never that close to the light), no
+    varyings, no shading and no color writes. Front faces are culled, drawing the back faces of closed meshes keeps
+    the depths away from the lit surfaces. */
+void Rasterization::DrawDepthMesh(ShadowMap *shadowMap, Uint32 face, Mesh *mesh, const mat4 &modelMatrix)
+{
+    mat4 mvp = shadowMap->viewProjection[face] * modelMatrix;
+    Sint32 size = shadowMap->size;
+    float *depthBuffer = shadowMap->depth + face * size * size;
 
-                            // Clamp
-                            shadedColor = clamp(shadedColor, 0.0f, 1.0f);
-                            col32 = Vec3ColorToUint32(shadedColor);
-                        }
+    for (Uint32 i = 0; i < mesh->vertexCount; i += 3)
+    {
+        vec4 v[3];
+        bool dropped = false;
+        for (Uint32 k = 0; k < 3; ++k)
+        {
+            v[k] = mvp * mesh->vertices[i + k].position;
+            if (v[k].z < -v[k].w)
+                dropped = true;
+
+            float recW = 1.0f / v[k].w;
+            v[k].x = (v[k].x * recW * 0.5f + 0.5f) * float(size);
+            v[k].y = (v[k].y * recW * -0.5f + 0.5f) * float(size);
+            v[k].z = v[k].z * recW;
+        }
+        if (dropped)
+            continue;
+
+        // Keep the back faces, flipped so that the edge functions are positive inside
+        vec2 pointC = vec2(v[2].x, v[2].y);
+        float triangleArea = EdgeFunction(v[0], v[1], pointC);
+        if (triangleArea >= 0)
+            continue;
+        SwapVec4(v[1], v[2]);
+        triangleArea = -triangleArea;
+
+        float minXf = min(v[0].x, min(v[1].x, v[2].x));
+        float maxXf = max(v[0].x, max(v[1].x, v[2].x));
+        float minYf = min(v[0].y, min(v[1].y, v[2].y));
+        float maxYf = max(v[0].y, max(v[1].y, v[2].y));
+        if (maxXf < 0.0f || maxYf < 0.0f || minXf > float(size - 1) || minYf > float(size - 1))
+            continue;
+
+        Sint32 minX = (Sint32)clamp(minXf, 0.0f, float(size - 1));
+        Sint32 maxX = (Sint32)clamp(maxXf, 0.0f, float(size - 1));
+        Sint32 minY = (Sint32)clamp(minYf, 0.0f, float(size - 1));
+        Sint32 maxY = (Sint32)clamp(maxYf, 0.0f, float(size - 1));
+
+        const float e0_diffX = v[0].x - v[1].x;
+        const float e1_diffX = v[1].x - v[2].x;
+        const float e2_diffX = v[2].x - v[0].x;
+        const float e0_diffY = v[0].y - v[1].y;
+        const float e1_diffY = v[1].y - v[2].y;
+        const float e2_diffY = v[2].y - v[0].y;
+
+        float e0_y = e0_diffX * (minY - v[0].y) - e0_diffY * (minX - v[0].x);
+        float e1_y = e1_diffX * (minY - v[1].y) - e1_diffY * (minX - v[1].x);
+        float e2_y = e2_diffX * (minY - v[2].y) - e2_diffY * (minX - v[2].x);
+
+        // Depth is affine in screen space, step it like the edge functions
+        float recTriangleArea = 1.0f / triangleArea;
+        float z0 = v[0].z * recTriangleArea;
+        float z1 = v[1].z * recTriangleArea;
+        float z2 = v[2].z * recTriangleArea;
+        float depth_y = e1_y * z0 + e2_y * z1 + e0_y * z2;
+        float depth_diffX = -(e1_diffY * z0 + e2_diffY * z1 + e0_diffY * z2);
+        float depth_diffY = e1_diffX * z0 + e2_diffX * z1 + e0_diffX * z2;
+
+        float *depthRow = depthBuffer + minY * size;
+        for (Sint32 y = minY; y <= maxY; ++y)
+        {
+            float e0 = e0_y;
+            float e1 = e1_y;
+            float e2 = e2_y;
+            float depth = depth_y;
+
+            for (Sint32 x = minX; x <= maxX; ++x)
+            {
+                if (e0 >= 0 && e1 >= 0 && e2 >= 0 && depth < depthRow[x])
+                    depthRow[x] = depth;
 
-                        frameBuffer[x] = col32;
-                    }
-                }
                 e0 -= e0_diffY;
                 e1 -= e1_diffY;
                 e2 -= e2_diffY;
+                depth += depth_diffX;
             }
             e0_y += e0_diffX;
             e1_y += e1_diffX;
             e2_y += e2_diffX;
-
-            frameBuffer += width;
+            depth_y += depth_diffY;
+            depthRow += size;
         }
     }
 }
@@ -614,14 +1532,14 @@ static void SwapVec4(vec4 &a, vec4 &b)
     b = tmp;
 }
 
-static Uint32 Vec3ColorToUint32(vec3 col)
+// Alpha is not used
+static Uint32 Vec3ColorToUint32(const Rasterizer *rasterizer, vec3 col)
 {
-    Uint8 a8 = 0;
     Uint8 r8 = Uint8(col.r * 255.0f);
     Uint8 g8 = Uint8(col.g * 255.0f);
     Uint8 b8 = Uint8(col.b * 255.0f);
 
-    unsigned col32 = a8 << 24 | b8 << 16 | g8 << 8 | r8;
+    unsigned col32 = Uint32(b8) << rasterizer->blueShift | g8 << 8 | Uint32(r8) << rasterizer->redShift;
     return col32;
 }
 
@@ -634,7 +1552,7 @@ static void RasterizeLines(Rasterizer *rasterizer, Mesh *mesh)
     {
         vec4 v0 = mesh->vertices[i].position;
         vec4 v1 = mesh->vertices[i + 1].position;
-        Uint32 lineColor = Vec3ColorToUint32(mesh->vertices[i + 1].vsOutColor);
+        Uint32 lineColor = Vec3ColorToUint32(rasterizer, mesh->vertices[i + 1].vsOutColor);
 
         if (v0.x > v1.x)
             SwapVec4(v0, v1);
@@ -662,10 +1580,8 @@ static void RasterizeLines(Rasterizer *rasterizer, Mesh *mesh)
     }
 }
 
-static vec3 SampleTexture(Rasterizer *rasterizer, Uint32 u, Uint32 v)
+static vec3 SampleTexture(Rasterizer *rasterizer, Uint32 unit, vec2 texCoords, vec2 ddx, vec2 ddy)
 {
-    int coord = v * rasterizer->texture.width + u;
-    Uint8 texColor = Uint8(rasterizer->texture.data[coord]);
-    vec3 color = vec3(float(texColor) / 255.0f, float(texColor) / 255.0f, float(texColor) / 255.0f);
-    return color;
+    TextureUnit &textureUnit = rasterizer->textureUnits[unit];
+    return UtilTexture::Sample(textureUnit.texture, &textureUnit.sampler, texCoords, ddx, ddy);
 }
\ No newline at end of file
@@ -6,6 +6,9 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <SDL2/SDL.h>
 #include "mesh.h"
+#include "texture.h"
+#include "shading.h"
+#include "shadow.h"
 
 #define COLOR_BIT 1
 #define DEPTH_BIT 2
@@ -14,57 +17,182 @@
 #define GOURAUD_SHADING 2
 #define PHONG_SHADING 3
 
-#define TEX_COORD_CLAMP 1
-#define TEX_COORD_REPEAT 2
+#define LIGHT_TILE_SIZE 16  // In pixels, a multiple of the 2x2 quad
 
-struct Texture
+// Phong fragments shaded per pixel, per 2x2 or per 4x4 pixel block. Depth is always tested per pixel.
+#define SHADING_RATE_AUTO 0     // Per screen tile, from the contrast of the previous frame
+#define SHADING_RATE_1X1 1
+#define SHADING_RATE_2X2 2
+#define SHADING_RATE_4X4 4
+#define SHADING_RATE_TILE_SIZE 16
+
+#define PIXEL_TAG_SHADED 0x80000000     // Set in Rasterizer::pixelTags for pixels shaded by the current frame
+
+// Frames rendered, waiting and on screen, see PresentQueue
+#define RASTERIZER_FRAME_BUFFERS 3
+
+#define DIRTY_TILE_SIZE 32      // In pixels, a multiple of the shading rate tiles
+#define DIRTY_TILE_SHIFT 5
+
+// A texture unit references a shared texture object, binding one is just a pointer swap.
+struct TextureUnit
 {
-    Uint8 *data;
-    Uint32 width;
+    Texture *texture;
+    Sampler sampler;
+};
+
+// Fragments are shaded in 2x2 quads. Helper lanes are not written, they are only interpolated to provide
+// screen space derivatives.
+struct RasterStats
+{
+    Uint64 quads;
+    Uint64 shadedLanes;
+    Uint64 helperLanes;
+    Uint64 broadcastLanes;  // Written with the color of another lane by coarse shading
+};
+
+// The 4x4 block of the current triangle shaded last in a column of blocks
+struct CoarseBlock
+{
+    Uint32 stamp;           // Triangle and block row
+    Uint32 batchGeneration;
+    Uint32 batchLane;
+    Uint32 *pixel;          // Holds the block color once it is written
+};
+
+/*  Point lights binned into screen tiles by their projected bounds. The indices of the lights touching tile t are
+    indices[tileOffsets[t]] .. indices[tileOffsets[t + 1] - 1]. The arrays only grow, they are reused every frame. */
+struct LightGrid
+{
+    const PointLight *lights;
+    Uint32 lightCount;
+    Uint32 tilesX;
+    Uint32 tilesY;
+    Uint32 *tileOffsets;
+    Uint32 *tileCursors;
+    Uint32 *indices;
+    Uint32 tileCapacity;
+    Uint32 indexCapacity;
+};
+
+/*  Tracks which screen tiles changed since each frame buffer was last rendered. A tile changes when a draw that
+    covers it moves, appears or disappears. Tiles of the current buffer that hold the latest content are neither
+    cleared nor rasterized. changeFrames and bufferFrames count frames since the tracking started. */
+struct DirtyTiles
+{
+    Uint32 width;           // Of the frames the buffers hold
     Uint32 height;
+    Uint32 tilesX;
+    Uint32 tilesY;
+    Uint32 tileCapacity;
+    Uint32 frame;
+    Uint32 *changeFrames;   // Last frame that changed the tile
+    Uint8 *validTiles[RASTERIZER_FRAME_BUFFERS];    // 0 where something else was drawn over the buffer
+    Uint32 bufferFrames[RASTERIZER_FRAME_BUFFERS];  // Frame the buffer was rendered at, 0 when it holds none
+    Uint8 *renderTiles;     // Tiles the current frame clears and rasterizes, NULL renders everything
+    Uint32 renderTileCount;
 };
 
 struct Rasterizer
 {
-    Uint32 *frameBuffer;
+    Uint32 *frameBuffer;    // frameBuffers[frameIndex]
     float *depthBuffer;
     Uint32 width;
     Uint32 height;
-    Texture texture;
+    Uint32 pixelCapacity;   // Size of the depth buffer, it only grows
+
+    /*  Each frame buffer is only (re)allocated while it is the current one, so the others can be presented
+        meanwhile. They all use the channel order of pixelFormat. */
+    Uint32 *frameBuffers[RASTERIZER_FRAME_BUFFERS];
+    Uint32 frameBufferCapacities[RASTERIZER_FRAME_BUFFERS];
+    bool externalFrameBuffers;  // Set with SetFrameBuffers, not freed or reallocated by the rasterizer
+    Uint32 frameIndex;
+    Uint32 pixelFormat;     // SDL_PIXELFORMAT_ABGR8888 by default, alpha is always 0
+    Uint32 redShift;
+    Uint32 blueShift;
+    TextureUnit textureUnits[MAX_TEXTURE_UNITS];
+    RasterStats stats;
+    LightGrid lightGrid;
+
+    Uint8 *shadingRates;    // Per SHADING_RATE_TILE_SIZE tile, used by SHADING_RATE_AUTO
+    Uint32 rateTilesX;
+    Uint32 rateTilesY;
+    Uint32 rateTileCapacity;
+    CoarseBlock *coarseBlocks;  // One per column of 4x4 blocks
+    Uint32 coarseBlockCapacity;
+    Uint32 coarseStamp;
+
+    // Checkerboard rendering, see TemporalState
+    Uint32 shadePattern;    // Quad lanes shaded at the 1x1 rate, 0xf shades every pixel
+    Uint32 *pixelTags;      // Uniforms::drawTag of the nearest draw per pixel, NULL when not needed
+    Sint32 *tagSpans;       // First and last pixel per row that may have been tagged
+
+    DirtyTiles dirtyTiles;
+
+    Uniforms uniforms;
 
     glm::vec3 clearColor;
     bool backFaceCulling;
+    bool vectorShading;     // Light Phong fragments in SIMD batches instead of one at a time
     float zNear;
 };
 
+// A camera of a multi-view draw and the rasterizer it renders into
+struct RasterView
+{
+    Rasterizer *target;
+    glm::mat4 viewMatrix;
+    glm::mat4 projectionMatrix;
+};
+
 namespace Rasterization
 {
     void Init(Rasterizer *rasterizer, Uint32 width, Uint32 height, float zNear);
     void Clear(Rasterizer *rasterizer, Uint32 flags);
     void Release(Rasterizer *rasterizer);
+    // Only reallocates when the new size does not fit, so the render resolution can change every few frames
     void Resize(Rasterizer *rasterizer, Uint32 newWidth, Uint32 newHeight);
+    // Renders the following frames into frameBuffers[index]
+    void SetFrameBuffer(Rasterizer *rasterizer, Uint32 index);
+    /*  Renders into memory owned by the caller, capacity pixels each. A frame that does not fit anymore moves all
+        buffers back to the rasterizer's own memory, NULL buffers return to it right away. Frees the current
+        buffers, so call it before any frame is presented. */
+    void SetFrameBuffers(Rasterizer *rasterizer, Uint32 *const buffers[RASTERIZER_FRAME_BUFFERS], Uint32 capacity);
+    // Packs colors in the given channel order, returns false for formats other than 32 bit RGB with either order
+    bool SetPixelFormat(Rasterizer *rasterizer, Uint32 pixelFormat);
+
+    void BindTexture(Rasterizer *rasterizer, Uint32 unit, Texture *texture);
+    void SetSampler(Rasterizer *rasterizer, Uint32 unit, Sampler sampler);
+
+    // Culls the lights against the screen tiles, call again when the lights, camera or size change
+    void SetPointLights(Rasterizer *rasterizer, const PointLight *lights, Uint32 count, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix);
+
+    // Call once a frame is complete, the rates are used by the next one
+    void UpdateShadingRates(Rasterizer *rasterizer);
+    // Bilinear scaling of the frame to a width x height destination, rowBuffer holds rasterizer->width + 1 pixels
+    void Upscale(const Rasterizer *rasterizer, Uint32 *destination, Uint32 width, Uint32 height, Uint32 *rowBuffer);
 
-    void SetTexture(Rasterizer *rasterizer, Texture *texture);
+    // Starts tracking the next frame, wholeFrame marks every tile as changed
+    void BeginDirtyTiles(Rasterizer *rasterizer, bool wholeFrame);
+    // The content under the rect differs from the previous frame
+    void MarkChanged(Rasterizer *rasterizer, const SDL_Rect &rect);
+    // Picks the tiles of the current frame buffer to render, call after marking the changes of the frame
+    void ResolveDirtyTiles(Rasterizer *rasterizer);
+    // Whether a draw within the rect touches any tile that is rendered this frame
+    bool NeedsRender(const Rasterizer *rasterizer, const SDL_Rect &rect);
+    // Something other than the renderer was drawn over the rect of the current frame buffer
+    void InvalidateRect(Rasterizer *rasterizer, const SDL_Rect &rect);
+    // Rects covering the tiles changed this frame, merged along rows, returns 0 when they do not fit in maxRects
+    Uint32 ChangedRects(const Rasterizer *rasterizer, SDL_Rect *rects, Uint32 maxRects);
 
     void DrawTriangleMesh(Rasterizer *rasterizer, Mesh *mesh);
+    /*  Draws the mesh with the uniforms of rasterizer into every view. The world space vertex work, the lighting of
+        flat and Gouraud shading included, is done once from its camera position, only the projection, the clipping
+        and the rasterization are repeated per view. Each target takes the uniforms with the matrices and eye of its
+        view and shades with its own textures, samplers and point light grid. */
+    void DrawTriangleMesh(Rasterizer *rasterizer, const RasterView *views, Uint32 viewCount, Mesh *mesh);
     void DrawLineMesh(Rasterizer *rasterizer, Mesh *mesh);
-}
-
-// Shader uniforms
-namespace U
-{
-    extern glm::mat4 modelMatrix;
-    extern glm::mat4 viewMatrix;
-    extern glm::mat4 mvpMatrix;
-    extern glm::vec3 worldCameraPosition;
-    extern glm::vec3 worldLightDirection;
-    extern glm::vec3 worldLightPosition;
-    extern bool directionalLightOn;
-    extern bool sunMesh;
-    extern int shading;
-    extern bool texturingOn;
-    extern int shininess;
-    extern int texCoordWrap;
+    void DrawDepthMesh(ShadowMap *shadowMap, Uint32 face, Mesh *mesh, const glm::mat4 &modelMatrix);
 }
 
 #endif
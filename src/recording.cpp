@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "recording.h"
+#include "renderer.h"
+
+#define RECORDING_LINE_LENGTH 256
+#define RECORDING_MAX_TOKENS 8
+
+static bool ParseInt(const char *token, long long low, long long high, long long &value)
+{
+    char *end;
+    value = strtoll(token, &end, 10);
+    return end != token && *end == 0 && value >= low && value <= high;
+}
+
+static bool ParseLine(InputRecording *recording, char *line)
+{
+    char *tokens[RECORDING_MAX_TOKENS];
+    Uint32 tokenCount = 0;
+    for (char *token = strtok(line, " \t\r\n"); token && token[0] != '#'; token = strtok(NULL, " \t\r\n"))
+    {
+        if (tokenCount == RECORDING_MAX_TOKENS)
+            return false;
+        tokens[tokenCount++] = token;
+    }
+    if (tokenCount == 0)
+        return true;
+
+    long long values[3] = {};
+    if (strcmp(tokens[0], "dt") == 0)
+    {
+        char *end;
+        recording->deltaTime = tokenCount == 2 ? strtod(tokens[1], &end) : 0.0;
+        return tokenCount == 2 && end != tokens[1] && *end == 0 && recording->deltaTime > 0.0;
+    }
+    if (strcmp(tokens[0], "size") == 0)
+    {
+        if (tokenCount != 3 || !ParseInt(tokens[1], 1, 65535, values[0]) || !ParseInt(tokens[2], 1, 65535, values[1]))
+            return false;
+        recording->width = Uint32(values[0]);
+        recording->height = Uint32(values[1]);
+        return true;
+    }
+    if (strcmp(tokens[0], "frames") == 0)
+    {
+        if (tokenCount != 2 || !ParseInt(tokens[1], 0, 0xFFFFFFFFll, values[0]))
+            return false;
+        recording->frameCount = Uint32(values[0]);
+        return true;
+    }
+
+    // Events: FRAME TYPE VALUES
+    InputEvent event = {};
+    long long frame;
+    if (tokenCount < 2 || !ParseInt(tokens[0], 0, 0xFFFFFFFEll, frame))
+        return false;
+    if (strcmp(tokens[1], "mouse") == 0)
+        event.type = INPUT_EVENT_MOUSE;
+    else if (strcmp(tokens[1], "key") == 0)
+        event.type = INPUT_EVENT_KEY;
+    else if (strcmp(tokens[1], "resize") == 0)
+        event.type = INPUT_EVENT_RESIZE;
+    else
+        return false;
+    Uint32 valueCount = (event.type == INPUT_EVENT_MOUSE) ? 3 : (event.type == INPUT_EVENT_KEY) ? 1 : 2;
+    if (tokenCount != 2 + valueCount)
+        return false;
+    for (Uint32 i = 0; i < valueCount; ++i)
+    {
+        if (!ParseInt(tokens[2 + i], event.type == INPUT_EVENT_RESIZE ? 1 : -0x7FFFFFFFll, 0x7FFFFFFFll, values[i]))
+            return false;
+    }
+
+    event.frame = Uint32(frame);
+    event.a = Sint32(values[0]);
+    event.b = Sint32(values[1]);
+    event.c = Sint32(values[2]);
+    if (!recording->events.empty() && event.frame < recording->events.back().frame)
+        return false;
+    recording->events.push_back(event);
+    return true;
+}
+
+void Recording::Init(InputRecording *recording, Uint32 width, Uint32 height, double deltaTime)
+{
+    recording->width = width;
+    recording->height = height;
+    recording->deltaTime = deltaTime;
+    recording->frameCount = 0;
+    recording->events.clear();
+    recording->nextEvent = 0;
+}
+
+bool Recording::Load(const char *fileName, InputRecording *recording)
+{
+    Init(recording, 0, 0, RECORDING_DEFAULT_DELTA_TIME);
+    FILE *file = fopen(fileName, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Could not open %s\n", fileName);
+        return false;
+    }
+
+    char line[RECORDING_LINE_LENGTH];
+    Uint32 lineNumber = 0;
+    bool loaded = true;
+    while (loaded && fgets(line, sizeof(line), file))
+    {
+        ++lineNumber;
+        loaded = ParseLine(recording, line);
+    }
+    fclose(file);
+    if (!loaded)
+    {
+        fprintf(stderr, "%s:%u: invalid statement\n", fileName, lineNumber);
+        Init(recording, 0, 0, RECORDING_DEFAULT_DELTA_TIME);
+        return false;
+    }
+
+    // A recording cut short still replays the frames it has events for
+    if (!recording->events.empty())
+        recording->frameCount = std::max(recording->frameCount, recording->events.back().frame + 1);
+    return true;
+}
+
+bool Recording::Save(const char *fileName, const InputRecording *recording)
+{
+    FILE *file = fopen(fileName, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "# SWRasterizer input, replay with --replay\n");
+    fprintf(file, "size %u %u\n", recording->width, recording->height);
+    fprintf(file, "dt %.17g\n", recording->deltaTime);
+    fprintf(file, "frames %u\n", recording->frameCount);
+    for (const InputEvent &event : recording->events)
+    {
+        switch (event.type)
+        {
+        case INPUT_EVENT_MOUSE:
+            fprintf(file, "%u mouse %d %d %d\n", event.frame, event.a, event.b, event.c);
+            break;
+        case INPUT_EVENT_KEY:
+            fprintf(file, "%u key %d\n", event.frame, event.a);
+            break;
+        case INPUT_EVENT_RESIZE:
+            fprintf(file, "%u resize %d %d\n", event.frame, event.a, event.b);
+            break;
+        }
+    }
+    bool written = !ferror(file);
+    return (fclose(file) == 0) && written;
+}
+
+void Recording::Add(InputRecording *recording, Uint32 frame, Uint32 type, Sint32 a, Sint32 b, Sint32 c)
+{
+    InputEvent event = { frame, type, a, b, c };
+    recording->events.push_back(event);
+    recording->frameCount = std::max(recording->frameCount, frame + 1);
+}
+
+void Recording::AddMouse(InputRecording *recording, Uint32 frame, const RenderContext *context)
+{
+    if (context->mouseRelX != 0 || context->mouseRelY != 0 || context->mouseWheel != 0)
+        Add(recording, frame, INPUT_EVENT_MOUSE, context->mouseRelX, context->mouseRelY, context->mouseWheel);
+}
+
+void Recording::Apply(InputRecording *recording, Uint32 frame, RenderContext *context, bool applyResize)
+{
+    while (recording->nextEvent < recording->events.size() && recording->events[recording->nextEvent].frame <= frame)
+    {
+        const InputEvent &event = recording->events[recording->nextEvent++];
+        if (event.frame < frame)
+            continue;
+
+        switch (event.type)
+        {
+        case INPUT_EVENT_MOUSE:
+            context->mouseRelX += event.a;
+            context->mouseRelY += event.b;
+            context->mouseWheel += event.c;
+            break;
+        case INPUT_EVENT_KEY:
+            Renderer::HandleKey(context, SDL_Keycode(event.a));
+            break;
+        case INPUT_EVENT_RESIZE:
+            if (applyResize)
+            {
+                context->width = event.a;
+                context->height = event.b;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+#define RECORDING_DEFAULT_DELTA_TIME (1.0 / 60.0)
+
+// Event types
+#define INPUT_EVENT_MOUSE 0     // a, b: camera drag in pixels, c: wheel
+#define INPUT_EVENT_KEY 1       // a: SDL_Keycode, see Renderer::HandleKey
+#define INPUT_EVENT_RESIZE 2    // a, b: window size
+
+struct RenderContext;
+
+struct InputEvent
+{
+    Uint32 frame;           // Applied before the frame is rendered
+    Uint32 type;            // INPUT_EVENT_*
+    Sint32 a;
+    Sint32 b;
+    Sint32 c;
+};
+
+/*  The input of a run of the window, frame by frame, with the fixed time step it was rendered at. Replayed with
+    the same time step, the same build renders the same frames on any machine whatever the frame rate, so
+    builds are compared on the same work. The text file has one statement per line after its header:
+
+        size 960 540
+        dt 0.016666666666666666
+        frames 1800
+        12 mouse 4 -1 0
+        40 key 108
+        300 resize 1280 720
+
+    The mouse is what the camera took in the frame, drags only. The renderer starts from its defaults and the
+    scene of --scene, give the same one when replaying. */
+struct InputRecording
+{
+    Uint32 width;           // Of the window when the recording started
+    Uint32 height;
+    double deltaTime;
+    Uint32 frameCount;
+    std::vector<InputEvent> events;     // In frame order
+    Uint32 nextEvent;       // Replay position
+};
+
+namespace Recording
+{
+    void Init(InputRecording *recording, Uint32 width, Uint32 height, double deltaTime);
+    // Prints the first error with its line and returns false
+    bool Load(const char *fileName, InputRecording *recording);
+    bool Save(const char *fileName, const InputRecording *recording);
+    void Add(InputRecording *recording, Uint32 frame, Uint32 type, Sint32 a, Sint32 b, Sint32 c);
+    // Adds the camera input the context collected for the frame, when there is any
+    void AddMouse(InputRecording *recording, Uint32 frame, const RenderContext *context);
+    // Applies the events of the frame to the context, frames in increasing order. Resizes are skipped without applyResize.
+    void Apply(InputRecording *recording, Uint32 frame, RenderContext *context, bool applyResize);
+}
+
+#endif
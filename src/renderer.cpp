@@ -1,5 +1,7 @@
 #include <algorithm>
+#include <float.h>
 #include <stdlib.h>
+#include <string.h>
 #include "renderer.h"
 #include "rasterizer.h"
 #include "Camera.h"
@@ -9,6 +11,13 @@
 #define Z_NEAR 0.1f
 #define Z_FAR 500.0f
 
+// Dynamic resolution controller
+#define RESOLUTION_FRAME_TIME_SMOOTHING 0.2f	// Weight of the newest frame in the average
+#define RESOLUTION_COOLDOWN_FRAMES 8			// Lets the average settle after a change
+#define RESOLUTION_MIN_SIZE 64
+
+#define DRAW_RECT_PADDING 2		// Pixels around the projected bounds, covers rounding and the quads past the edges
+
 using std::min;
 using std::max;
 using glm::vec2;
@@ -19,6 +28,23 @@ using glm::scale;
 using glm::rotate;
 using glm::translate;
 
+const char* Renderer::ShadingRateToString(int shadingRate)
+{
+	switch (shadingRate)
+	{
+	case SHADING_RATE_AUTO:
+		return "auto";
+	case SHADING_RATE_1X1:
+		return "1x1";
+	case SHADING_RATE_2X2:
+		return "2x2";
+	case SHADING_RATE_4X4:
+		return "4x4";
+	default:
+		return NULL;
+	}
+}
+
 const char* Renderer::ShadingToString(int shading)
 {
 	switch (shading)
@@ -54,34 +80,105 @@ const char* Renderer::TexWrapToString(int texCoordWrap)
 	}
 }
 
-static Object CreateObject(RenderContext *context, vec3 color, float diameter, float distFromSun, float orbitalPeriod)
+// The material replaces the colors of the mesh, textured ones show the checkerboard where the mesh has texture coordinates
+static Mesh MakeSceneMesh(RenderContext *context, const SceneDescription *scene, const SceneMesh &sceneMesh)
+{
+	const SceneMaterial *material = sceneMesh.material != SCENE_FILE_NONE ? &scene->materials[sceneMesh.material] : NULL;
+	Mesh mesh;
+	switch (sceneMesh.type)
+	{
+	case SCENE_MESH_CUBE:
+		mesh = UtilMesh::MakeCubeCentered(sceneMesh.size);
+		break;
+	case SCENE_MESH_SPHERE:
+		mesh = UtilMesh::MakeUVSphere(sceneMesh.subdivisions, material ? material->color : vec3(0.0f, 0.0f, 1.0f));
+		break;
+	default:
+		mesh = UtilMesh::MakeBunnyMesh();
+		break;
+	}
+
+	for (Uint32 i = 0; material && i < mesh.vertexCount; ++i)
+	{
+		mesh.vertices[i].vsOutColor = material->color;
+	}
+	mesh.isTexturable = mesh.isTexturable && material && (material->flags & SCENE_MATERIAL_TEXTURED);
+	if (mesh.isTexturable)
+		mesh.textures[0] = context->checkerTexture;
+	return mesh;
+}
+
+// Rotation in degrees about x, then y, then z
+static mat4 Placement(const SceneInstance &instance)
+{
+	mat4 placement = translate(mat4(1.0f), instance.position);
+	placement = rotate(placement, glm::radians(instance.rotation.z), vec3(0.0f, 0.0f, 1.0f));
+	placement = rotate(placement, glm::radians(instance.rotation.y), vec3(0.0f, 1.0f, 0.0f));
+	return rotate(placement, glm::radians(instance.rotation.x), vec3(1.0f, 0.0f, 0.0f));
+}
+
+static void ReleaseSolarSystem(RenderContext *context)
 {
-	Object object = {};
-	object.color = color;
-	object.diameter = diameter;
-	object.distanceFromSun = distFromSun;
-	object.orbitalPeriod = orbitalPeriod;
-	object.currentSunRotation = float(std::rand()) / RAND_MAX * 2 * 3.1415f;
-
-	object.mesh = UtilMesh::MakeUVSphere(context->sphereSubdivisions, color);
-	return object;
+	for (Uint32 i = 0; i < context->sceneMeshes.size(); ++i)
+	{
+		UtilMesh::Release(context->sceneMeshes[i]);
+	}
+	context->sceneMeshes.clear();
+	context->instancePivots.clear();
+	context->instanceNodes.clear();
+	context->instanceEmissive.clear();
+	context->instanceShadingRates.clear();
+	context->bodyPivots.clear();
+	context->bodyPlacements.clear();
+	Bodies::Release(&context->bodies);
 }
 
 void Renderer::Init(RenderContext* context, Uint32 width, Uint32 height)
 {
+	Uniforms *uniforms = &context->rasterizer.uniforms;
 	context->width = width;
 	context->height = height;
 	context->shading = FLAT_SHADING;
 	context->solarSystem = false;
 	context->previousSolarSystem = false;
 	context->texCoordWrap = TEX_COORD_REPEAT;
+	context->textureFilter = TEX_FILTER_NEAREST;
 	context->texturingOn = true;
+	context->textureFormat = TEX_FORMAT_R8;
+	context->previousTextureFormat = context->textureFormat;
 	context->shininess = 16;
+	context->fastMath = false;
+	context->shadingRate = SHADING_RATE_1X1;
+	context->checkerboard = CHECKERBOARD_OFF;
+	Temporal::Init(&context->temporal);
+	context->dynamicResolution = false;
+	context->targetFrameTime = 1.0f / 60.0f;
+	context->minResolutionScale = 0.5f;
+	context->maxResolutionScale = 1.0f;
+	context->resolutionScale = 1.0f;
+	context->averageFrameTime = 0.0f;
+	context->resolutionCooldown = 0;
+	for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
+	{
+		context->presentBuffers[i] = NULL;
+		context->presentCapacities[i] = 0;
+	}
+	context->pointLightCount = 0;
+	context->shadowsOn = false;
+	context->shadowMapSize = 512;
+	Shadows::Init(&context->directionalShadowMap, context->shadowMapSize, 1);
+	Shadows::Init(&context->pointShadowMap, context->shadowMapSize, SHADOW_MAX_FACES);
 	context->sphereSubdivisions = 20;
 	context->previousSphereSubdivisions = context->sphereSubdivisions;
 	context->backFaceCulling = true;
+	context->vectorShading = true;
+	context->dirtyTracking = true;
+	context->previousState = {};
+	context->fixedCamera = false;
+	context->time = 0.0;
 	context->sceneCameraPos = vec3(-4.8f, 2.56f, 6.51f);
 	context->solarCameraPos = vec3(-22.0f, 15.0f, 33.0f);
+	context->bodyThreadCount = Bodies::DefaultThreadCount();
 
 	Rasterization::Init(&context->rasterizer, width, height, Z_NEAR);
 
@@ -93,47 +190,122 @@ void Renderer::Init(RenderContext* context, Uint32 width, Uint32 height)
 	context->sphereMesh = UtilMesh::MakeUVSphere(context->sphereSubdivisions, vec3(0.0f, 0.0f, 1.0f));
 	context->bunnyMesh = UtilMesh::MakeBunnyMesh();
 
-	U::worldLightDirection = glm::normalize(vec3(0.0f, 0.0f, -1.0f));
-	U::directionalLightOn = true;
-	U::worldLightPosition = vec3(0.0f, 0.0f, 0.0f);
-	U::sunMesh = false;
+	uniforms->worldLightDirection = glm::normalize(vec3(0.0f, 0.0f, -1.0f));
+	uniforms->directionalLightOn = true;
+	uniforms->worldLightPosition = vec3(0.0f, 0.0f, 0.0f);
+	uniforms->sunMesh = false;
+	uniforms->shadingRate = SHADING_RATE_1X1;
+
+	// Set checkerboard texture. The uncompressed source is kept around so it can be re-encoded when the
+	// texture format is switched.
+	Texture checkerboard = UtilTexture::MakeCheckerboard(32, 32, 8);
+	context->sourceTexture = UtilTexture::MakeMipmapped(&checkerboard);
+	UtilTexture::Release(checkerboard);
+	Texture texture = UtilTexture::MakeConverted(&context->sourceTexture, context->textureFormat);
+	context->checkerTexture = UtilTexture::Upload(&texture);
+	UtilTexture::Release(texture);
+	context->cubeMesh.textures[0] = context->checkerTexture;
+
+	SceneDescription solarSystem;
+	SceneFiles::MakeSolarSystem(&solarSystem);
+	Renderer::LoadScene(context, &solarSystem);
+}
 
-	// Set checkerboard texture
-	Texture texture = {};
-	texture.width = 32;
-	texture.height = 32;
-	texture.data = (Uint8*)malloc(texture.width * texture.height * sizeof(Uint8));
-	for (Uint32 j = 0; j < texture.height; ++j)
+void Renderer::LoadScene(RenderContext *context, const SceneDescription *scene)
+{
+	ReleaseSolarSystem(context);
+
+	// Nodes cannot be removed, the test scene is added again in front of the new content
+	SceneGraph::Clear(&context->scene);
+	context->cubeNode = SceneGraph::AddNode(&context->scene, SCENE_NO_PARENT, &context->cubeMesh, mat4(1.0f));
+	context->sphereNode = SceneGraph::AddNode(&context->scene, SCENE_NO_PARENT, &context->sphereMesh, mat4(1.0f));
+	context->bunnyNode = SceneGraph::AddNode(&context->scene, SCENE_NO_PARENT, &context->bunnyMesh, mat4(1.0f));
+
+	for (Uint32 i = 0; i < scene->meshes.size(); ++i)
 	{
-		Uint8 *P = &texture.data[j * texture.width];
-		for (Uint32 i = 0; i < texture.width; ++i)
+		context->sceneMeshes.push_back(MakeSceneMesh(context, scene, scene->meshes[i]));
+	}
+
+	// A handful of bodies updates faster on the calling thread
+	Bodies::Init(&context->bodies, scene->instances.size() >= BODY_PARALLEL_MIN ? context->bodyThreadCount : 0);
+	for (Uint32 i = 0; i < scene->instances.size(); ++i)
+	{
+		const SceneInstance &instance = scene->instances[i];
+		Uint32 parent = instance.parent != SCENE_FILE_NONE ? context->instancePivots[instance.parent] : SCENE_NO_PARENT;
+		Uint32 pivot = SceneGraph::AddNode(&context->scene, parent, NULL, Placement(instance));
+		if (instance.flags & SCENE_INSTANCE_ORBIT)
 		{
-			int c = (((i & 0x08) == 0) ^ ((j & 0x08) == 0)) * 0xff;
-			*P = (Uint8)c;
-			*P++;
+			float angularSpeed = instance.orbitPeriod != 0.0f ? 1.5f / instance.orbitPeriod : 0.0f;
+			double phase = instance.orbitPhase;
+			if (instance.flags & SCENE_INSTANCE_RANDOM_PHASE)
+				phase = float(std::rand()) / RAND_MAX * 2 * 3.1415f;
+			float radius = max(max(instance.scale.x, instance.scale.y), instance.scale.z);
+			Bodies::Add(&context->bodies, instance.orbitDistance, angularSpeed, phase, radius, instance.mesh);
+			context->bodyPivots.push_back(pivot);
+			context->bodyPlacements.push_back(Placement(instance));
 		}
-	}
 
-	Rasterization::SetTexture(&context->rasterizer, &texture);
-	free(texture.data);
+		const SceneMesh &mesh = scene->meshes[instance.mesh];
+		context->instancePivots.push_back(pivot);
+		context->instanceNodes.push_back(SceneGraph::AddNode(&context->scene, pivot, &context->sceneMeshes[instance.mesh],
+			scale(mat4(1.0f), instance.scale)));
+		Uint32 flags = (mesh.material != SCENE_FILE_NONE) ? scene->materials[mesh.material].flags : 0;
+		context->instanceEmissive.push_back((flags & SCENE_MATERIAL_EMISSIVE) != 0);
+		if (flags & SCENE_MATERIAL_RATE_1X1)
+			context->instanceShadingRates.push_back(SHADING_RATE_1X1);
+		else if (flags & SCENE_MATERIAL_RATE_2X2)
+			context->instanceShadingRates.push_back(SHADING_RATE_2X2);
+		else if (flags & SCENE_MATERIAL_RATE_4X4)
+			context->instanceShadingRates.push_back(SHADING_RATE_4X4);
+		else
+			context->instanceShadingRates.push_back(DRAW_SHADING_RATE_CONTEXT);
+	}
 
-	// The Solar System
-	context->objects.push_back(CreateObject(context, vec3(252 / 255.f, 224 / 255.0f, 32 / 255.0f), 4.2f, 0.0f, 0.0f));		// sun
-	context->objects.push_back(CreateObject(context, vec3(250 / 255.f, 251 / 255.0f, 186 / 255.0f), 0.8f, 4.0f, 0.241f));	// mercury 
-	context->objects.push_back(CreateObject(context, vec3(234 / 255.f, 201 / 255.0f, 134 / 255.0f), 1.2f, 6.0f, 0.615f));	// venus 
-	context->objects.push_back(CreateObject(context, vec3(51 / 255.f, 62 / 255.0f, 91 / 255.0f), 1.3f, 8.0f, 1.0f));		// earth
-	context->objects.push_back(CreateObject(context, vec3(116 / 255.f, 18 / 255.0f, 3 / 255.0f), 0.7f, 10.0f, 1.88f));		// mars
-	context->objects.push_back(CreateObject(context, vec3(125 / 255.f, 58 / 255.0f, 26 / 255.0f), 2.3f, 13.0f, 11.9f));		// jupiter
-	context->objects.push_back(CreateObject(context, vec3(251 / 255.f, 238 / 255.0f, 186 / 255.0f), 2.1f, 17.0f, 29.4f));	// saturn
-	context->objects.push_back(CreateObject(context, vec3(110 / 255.f, 207 / 255.0f, 250 / 255.0f), 1.8f, 20.0f, 83.7f));	// uranus
-	context->objects.push_back(CreateObject(context, vec3(99 / 255.f, 138 / 255.0f, 241 / 255.0f), 1.6f, 23.0f, 163.7f));	// neptune
+	context->solarDirectionalLight = false;
+	context->solarLightDirection = vec3(0.0f, 0.0f, -1.0f);
+	context->solarLightPosition = vec3(0.0f);
+	context->solarPointLights.clear();
+	for (Uint32 i = 0; i < scene->lights.size(); ++i)
+	{
+		const SceneLight &light = scene->lights[i];
+		if (light.type == SCENE_LIGHT_DIRECTIONAL)
+		{
+			context->solarDirectionalLight = true;
+			context->solarLightDirection = light.vector;
+		}
+		else if (light.type == SCENE_LIGHT_SUN)
+			context->solarLightPosition = light.vector;
+		else
+			context->solarPointLights.push_back(PointLight{ light.vector, light.color, light.radius });
+	}
+	context->solarClearColor = scene->clearColor;
+	context->solarCameraPos = scene->cameraPosition;
+	context->solarCameraTarget = scene->cameraTarget;
+	context->solarCameraPath = scene->cameraKeys;
+
+	// The meshes of the old draws are gone, nothing is kept or reprojected from them. In the solar system the new
+	// scene's lights and camera are applied by the next update.
+	context->previousState = {};
+	context->previousDrawCalls.clear();
+	Temporal::Release(&context->temporal);
+	Temporal::Init(&context->temporal);
+	if (context->solarSystem)
+		context->previousSolarSystem = false;
 }
 
-static void DrawTriangleMesh(RenderContext *context, Mesh *mesh, mat4 modelMatrix)
+static void DrawTriangleMesh(RenderContext *context, const DrawCall &drawCall)
 {
-	U::modelMatrix = modelMatrix;
-	U::viewMatrix = context->camera.viewMatrix;
-	U::mvpMatrix = context->camera.projectionMatrix * context->camera.viewMatrix * modelMatrix;
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	Mesh *mesh = drawCall.mesh;
+	uniforms->modelMatrix = drawCall.modelMatrix;
+	uniforms->viewMatrix = context->camera.viewMatrix;
+	uniforms->mvpMatrix = drawCall.mvpMatrix;
+	uniforms->drawTag = drawCall.drawTag;
+
+	for (Uint32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+	{
+		Rasterization::BindTexture(&context->rasterizer, unit, mesh->textures[unit]);
+	}
 
 	Rasterization::DrawTriangleMesh(&context->rasterizer, mesh);
 }
@@ -141,8 +313,9 @@ static void DrawTriangleMesh(RenderContext *context, Mesh *mesh, mat4 modelMatri
 // Debug functionality
 static void DrawNormalMesh(RenderContext *context, Mesh *mesh, mat4 modelMatrix)
 {
-	U::modelMatrix = modelMatrix;
-	U::mvpMatrix = context->camera.projectionMatrix * context->camera.viewMatrix * modelMatrix;
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	uniforms->modelMatrix = modelMatrix;
+	uniforms->mvpMatrix = context->camera.projectionMatrix * context->camera.viewMatrix * modelMatrix;
 
 	Mesh normalMesh = UtilMesh::MakeNormalMesh(mesh, 1.0f);
 	Rasterization::DrawLineMesh(&context->rasterizer, &normalMesh);
@@ -152,8 +325,9 @@ static void DrawNormalMesh(RenderContext *context, Mesh *mesh, mat4 modelMatrix)
 // Debug functionality
 static void DrawLineMesh(RenderContext *context, Mesh *mesh, mat4 modelMatrix)
 {
-	U::modelMatrix = modelMatrix;
-	U::mvpMatrix = context->camera.projectionMatrix * context->camera.viewMatrix * modelMatrix;
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	uniforms->modelMatrix = modelMatrix;
+	uniforms->mvpMatrix = context->camera.projectionMatrix * context->camera.viewMatrix * modelMatrix;
 
 	Mesh copyMesh = UtilMesh::MakeMeshCopy(mesh);
 	Rasterization::DrawLineMesh(&context->rasterizer, &copyMesh);
@@ -162,26 +336,50 @@ static void DrawLineMesh(RenderContext *context, Mesh *mesh, mat4 modelMatrix)
 
 static void UpdateContext(RenderContext *context, double dt)
 {
+	Uniforms *uniforms = &context->rasterizer.uniforms;
 	Camera *camera = &context->camera;
-	CameraControl::UpdateCamera(camera, dt, context->mouseRelX, context->mouseRelY, context->mouseWheel);
+	if (!context->fixedCamera)
+		CameraControl::UpdateCamera(camera, dt, context->mouseRelX, context->mouseRelY, context->mouseWheel);
 
 	if (context->solarSystem && !context->previousSolarSystem)
 	{
-		U::directionalLightOn = false;
+		uniforms->directionalLightOn = context->solarDirectionalLight;
+		uniforms->worldLightDirection = glm::normalize(context->solarLightDirection);
+		uniforms->worldLightPosition = context->solarLightPosition;
 		context->previousSolarSystem = true;
-		CameraControl::SetCameraViewMatrix(&context->camera, context->solarCameraPos, vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+		if (!context->fixedCamera)
+			CameraControl::SetCameraViewMatrix(&context->camera, context->solarCameraPos, context->solarCameraTarget, vec3(0.0f, 1.0f, 0.0f));
 	}
 	else if (!context->solarSystem && context->previousSolarSystem)
 	{
-		U::sunMesh = false;
-		U::directionalLightOn = true;
+		uniforms->sunMesh = false;
+		uniforms->directionalLightOn = true;
+		uniforms->worldLightDirection = glm::normalize(vec3(0.0f, 0.0f, -1.0f));
 		context->previousSolarSystem = false;
-		CameraControl::SetCameraViewMatrix(&context->camera, context->sceneCameraPos, vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+		if (!context->fixedCamera)
+			CameraControl::SetCameraViewMatrix(&context->camera, context->sceneCameraPos, vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	// Camera paths loop, the key times are increasing
+	const std::vector<SceneCameraKey> &path = context->solarCameraPath;
+	if (context->solarSystem && !context->fixedCamera && !path.empty())
+	{
+		float time = path.size() > 1 ? fmodf(float(context->time), path.back().time) : 0.0f;
+		Uint32 key = 0;
+		while (key + 2 < path.size() && path[key + 1].time <= time)
+		{
+			++key;
+		}
+		const SceneCameraKey &from = path[key];
+		const SceneCameraKey &to = path[min(key + 1, Uint32(path.size() - 1))];
+		float t = to.time > from.time ? glm::clamp((time - from.time) / (to.time - from.time), 0.0f, 1.0f) : 0.0f;
+		CameraControl::SetCameraViewMatrix(camera, glm::mix(from.position, to.position, t), glm::mix(from.target, to.target, t),
+			vec3(0.0f, 1.0f, 0.0f));
 	}
 
 	if (context->solarSystem)
 	{
-		context->rasterizer.clearColor = vec3(0, 0, 0);
+		context->rasterizer.clearColor = context->solarClearColor;
 	}
 	else
 	{
@@ -192,89 +390,603 @@ static void UpdateContext(RenderContext *context, double dt)
 	{
 		UtilMesh::Release(context->sphereMesh);
 		context->sphereMesh = UtilMesh::MakeUVSphere(context->sphereSubdivisions, vec3(0, 0, 1));
+		SceneGraph::SetMesh(&context->scene, context->sphereNode, &context->sphereMesh);
 		context->previousSphereSubdivisions = context->sphereSubdivisions;
 	}
 
-	if (context->width != context->rasterizer.width || context->height != context->rasterizer.height)
+	if (context->textureFormat != context->previousTextureFormat)
+	{
+		// Units still referencing the old texture object keep it alive until they are rebound
+		// The meshes hold no reference of their own, so they are rebound before the old texture may be freed
+		Texture texture = UtilTexture::MakeConverted(&context->sourceTexture, context->textureFormat);
+		Texture *oldTexture = context->checkerTexture;
+		context->checkerTexture = UtilTexture::Upload(&texture);
+		UtilTexture::Release(texture);
+		for (Uint32 i = 0; i < context->sceneMeshes.size(); ++i)
+		{
+			if (context->sceneMeshes[i].textures[0] == oldTexture)
+				context->sceneMeshes[i].textures[0] = context->checkerTexture;
+		}
+		context->cubeMesh.textures[0] = context->checkerTexture;
+		UtilTexture::Unref(oldTexture);
+		context->previousTextureFormat = context->textureFormat;
+	}
+
+	// The aspect ratio stays the window's, the rounded render size is stretched back to it
+	Uint32 renderWidth = max(Uint32(float(context->width) * context->resolutionScale + 0.5f), Uint32(RESOLUTION_MIN_SIZE));
+	Uint32 renderHeight = max(Uint32(float(context->height) * context->resolutionScale + 0.5f), Uint32(RESOLUTION_MIN_SIZE));
+	if (renderWidth != context->rasterizer.width || renderHeight != context->rasterizer.height)
 	{
 		CameraControl::SetCameraProjectionMatrix(&context->camera, float(context->width) / float(context->height), 45.0f, Z_NEAR, Z_FAR);
-		Rasterization::Resize(&context->rasterizer, context->width, context->height);
+		Rasterization::Resize(&context->rasterizer, renderWidth, renderHeight);
 	}
 
 	if (context->backFaceCulling != context->rasterizer.backFaceCulling)
 	{
 		context->rasterizer.backFaceCulling = context->backFaceCulling;
 	}
+	context->rasterizer.vectorShading = context->vectorShading;
 
-	U::worldCameraPosition = context->camera.position;
-	U::shading = context->shading;
-	U::texturingOn = context->texturingOn;
-	U::shininess = context->shininess;
-	U::texCoordWrap = context->texCoordWrap;
+	uniforms->worldCameraPosition = context->camera.position;
+	uniforms->shading = context->shading;
+	uniforms->texturingOn = context->texturingOn;
+	uniforms->shininess = context->shininess;
+	uniforms->fastMath = context->fastMath;
+
+	for (Uint32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+	{
+		Rasterization::SetSampler(&context->rasterizer, unit, Sampler{ context->texCoordWrap, context->textureFilter });
+	}
 }
 
-static void RenderObject(RenderContext *context, Object object, double dt)
+static void AddDrawCall(RenderContext *context, Uint32 node, bool sun, int shadingRate)
 {
-	if (object.orbitalPeriod != 0.0f)
-		object.currentSunRotation += 1.5f * dt / object.orbitalPeriod;
-
-	float s = (object.diameter / 2.0f);
-	mat4 scaleMat = scale(mat4(1.0f), vec3(s, s, s));
-	mat4 translMat = translate(mat4(1.0f), vec3(1, 0, 0) * object.distanceFromSun);
-	mat4 rotateMat = rotate(mat4(1.0f), float(object.currentSunRotation), vec3(0, 1, 0));
-	mat4 model = rotateMat * translMat * scaleMat;
-
-	DrawTriangleMesh(context, &context->sphereMesh, model);
+	const SceneNode &sceneNode = context->scene.nodes[node];
+	DrawCall drawCall = {};
+	drawCall.mesh = sceneNode.mesh;
+	drawCall.modelMatrix = sceneNode.worldMatrix;
+	drawCall.sun = sun;
+	drawCall.shadingRate = (shadingRate == DRAW_SHADING_RATE_CONTEXT) ? context->shadingRate : shadingRate;
+	drawCall.localBoundsMin = sceneNode.localBoundsMin;
+	drawCall.localBoundsMax = sceneNode.localBoundsMax;
+	drawCall.worldBoundsMin = sceneNode.worldBoundsMin;
+	drawCall.worldBoundsMax = sceneNode.worldBoundsMax;
+	context->drawCalls.push_back(drawCall);
 }
 
-static void RenderObjects(RenderContext *context, double dt)
+// Animates the scene graph, collects this frame's draw calls from it and culls them against the view frustum
+static void CollectDrawCalls(RenderContext *context)
 {
-	static float time = 0.0f;
-	time += float(dt);
+	float time = float(context->time);
+	Scene *scene = &context->scene;
 
+	// Nodes whose matrix comes out the same keep their cached world matrix and bounds
 	if (context->solarSystem)
 	{
-		for (Uint32 i = 0; i < context->objects.size(); ++i)
+		Bodies::Update(&context->bodies, context->time);
+		for (Uint32 i = 0; i < context->bodies.count; ++i)
 		{
-			Object &object = context->objects[i];
+			SceneGraph::SetLocalMatrix(scene, context->bodyPivots[i], context->bodies.orbitMatrices[i] * context->bodyPlacements[i]);
+		}
+	}
+	else
+	{
+		mat4 model = rotate(translate(mat4(1.0f), vec3(0.0f, 0.0f, -4.0f)), 0.0f, vec3(0.0f, 1.0f, 0.0f));
+		SceneGraph::SetLocalMatrix(scene, context->cubeNode, model);
+
+		model = rotate(scale(translate(mat4(1.0f), vec3(5, 0, 0)), vec3(2.f, 2.f, 2.f)), 1.8f*float(time), vec3(0, 1, 0));
+		SceneGraph::SetLocalMatrix(scene, context->sphereNode, model);
+
+		model = rotate(scale(translate(mat4(1.0f), vec3(0.0f, 0.0f, 0.0f)), vec3(1.4f, 1.4f, 1.4f)), 0.2f*float(time), glm::normalize(vec3(cosf(time), cosf(time), sinf(time))));
+		SceneGraph::SetLocalMatrix(scene, context->bunnyNode, model);
+	}
+	SceneGraph::Update(scene);
+
+	context->drawCalls.clear();
+	if (context->solarSystem)
+	{
+		for (Uint32 i = 0; i < context->instanceNodes.size(); ++i)
+		{
+			AddDrawCall(context, context->instanceNodes[i], context->instanceEmissive[i], context->instanceShadingRates[i]);
+		}
+	}
+	else
+	{
+		AddDrawCall(context, context->cubeNode, false, DRAW_SHADING_RATE_CONTEXT);
+		AddDrawCall(context, context->sphereNode, false, DRAW_SHADING_RATE_CONTEXT);
+		AddDrawCall(context, context->bunnyNode, false, DRAW_SHADING_RATE_CONTEXT);
+	}
 
-			if (i == 0)	// sun
-				U::sunMesh = true;
+	for (Uint32 i = 0; i < context->objectTransforms.size(); ++i)
+	{
+		const ObjectTransform &transform = context->objectTransforms[i];
+		if (transform.drawIndex >= context->drawCalls.size())
+			continue;
+		DrawCall &drawCall = context->drawCalls[transform.drawIndex];
+		drawCall.modelMatrix = transform.modelMatrix;
+		SceneGraph::TransformBounds(drawCall.modelMatrix, drawCall.localBoundsMin, drawCall.localBoundsMax,
+			drawCall.worldBoundsMin, drawCall.worldBoundsMax);
+	}
 
-			if (object.orbitalPeriod != 0.0f)
-				object.currentSunRotation += 1.5f * dt / object.orbitalPeriod;
+	// Draws keep their index from frame to frame, only the ones that moved refit the tree
+	Bvh *bvh = &context->drawBvh;
+	if (BoundingVolumes::ItemCount(bvh) != context->drawCalls.size())
+		BoundingVolumes::SetItemCount(bvh, Uint32(context->drawCalls.size()));
+	for (Uint32 i = 0; i < context->drawCalls.size(); ++i)
+	{
+		BoundingVolumes::SetBounds(bvh, i, context->drawCalls[i].worldBoundsMin, context->drawCalls[i].worldBoundsMax);
+	}
+	if (BoundingVolumes::NeedsRebuild(bvh))
+		BoundingVolumes::Build(bvh);
+	else
+		BoundingVolumes::Refit(bvh);
 
-			float s = (object.diameter / 2.0f);
-			mat4 scaleMat = scale(mat4(1.0f), vec3(s, s, s));
-			mat4 translMat = translate(mat4(1.0f), vec3(1, 0, 0) * object.distanceFromSun);
-			mat4 rotateMat = rotate(mat4(1.0f), float(object.currentSunRotation), vec3(0, 1, 0));
-			mat4 model = rotateMat * translMat * scaleMat;
+	// Once per frame rather than per draw
+	context->viewProjectionMatrix = context->camera.projectionMatrix * context->camera.viewMatrix;
+	vec4 frustumPlanes[5];
+	SceneGraph::FrustumPlanes(context->viewProjectionMatrix, frustumPlanes);
+	BoundingVolumes::QueryFrustum(bvh, frustumPlanes, context->camera.position, context->visibleDraws);
 
-			DrawTriangleMesh(context, &object.mesh, model);
+	for (Uint32 i = 0; i < context->drawCalls.size(); ++i)
+	{
+		context->drawCalls[i].culled = true;
+	}
+	for (Uint32 i = 0; i < context->visibleDraws.size(); ++i)
+	{
+		DrawCall &drawCall = context->drawCalls[context->visibleDraws[i].item];
+		drawCall.mvpMatrix = context->viewProjectionMatrix * drawCall.modelMatrix;
+		drawCall.culled = false;
+	}
+	context->culledDraws = Uint32(context->drawCalls.size() - context->visibleDraws.size());
+}
 
-			if (i == 0)
-				U::sunMesh = false;
+// Depth only pass from the light: the directional light of the scene or all 6 cube faces around the sun.
+// Emissive meshes hold the point light, they do not cast shadows.
+static void RenderShadows(RenderContext *context)
+{
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	uniforms->shadowMap = NULL;
+	if (!context->shadowsOn)
+		return;
+
+	ShadowMap *shadowMap = uniforms->directionalLightOn ? &context->directionalShadowMap : &context->pointShadowMap;
+	if (shadowMap->size != context->shadowMapSize)
+		Shadows::Resize(shadowMap, context->shadowMapSize);
+
+	const std::vector<BvhNode> &nodes = context->drawBvh.nodes;
+	if (!uniforms->directionalLightOn)
+		Shadows::SetPoint(shadowMap, uniforms->worldLightPosition, 2.0f, 60.0f);
+	else if (!context->solarSystem)
+		Shadows::SetDirectional(shadowMap, uniforms->worldLightDirection, vec3(1.0f, 0.0f, -1.0f), 9.0f);
+	else if (!nodes.empty())
+	{
+		// Around all draws, from the root of their bounding volume hierarchy
+		vec3 center = (nodes[0].boundsMin + nodes[0].boundsMax) * 0.5f;
+		Shadows::SetDirectional(shadowMap, uniforms->worldLightDirection, center, glm::length(nodes[0].boundsMax - center));
+	}
+
+	Shadows::Clear(shadowMap);
+	for (Uint32 face = 0; face < shadowMap->faceCount; ++face)
+	{
+		for (Uint32 i = 0; i < context->drawCalls.size(); ++i)
+		{
+			DrawCall &drawCall = context->drawCalls[i];
+			if (!drawCall.sun)
+				Rasterization::DrawDepthMesh(shadowMap, face, drawCall.mesh, drawCall.modelMatrix);
 		}
 	}
+	uniforms->shadowMap = shadowMap;
+}
+
+static void RenderObjects(RenderContext *context)
+{
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	// Reprojection pairs the draws of consecutive frames by index, with checkerboarding every draw takes its tag in
+	// index order before the visible ones are drawn
+	for (Uint32 i = 0; i < context->drawCalls.size() && context->checkerboard != CHECKERBOARD_OFF; ++i)
+	{
+		DrawCall &drawCall = context->drawCalls[i];
+		if (drawCall.culled)
+			drawCall.mvpMatrix = context->viewProjectionMatrix * drawCall.modelMatrix;
+		drawCall.drawTag = Temporal::AddDraw(&context->temporal, drawCall.mesh, drawCall.mvpMatrix);
+	}
+
+	// Near to far, the depth test rejects most of what is hidden before it is shaded
+	for (Uint32 i = 0; i < context->visibleDraws.size(); ++i)
+	{
+		DrawCall &drawCall = context->drawCalls[context->visibleDraws[i].item];
+		if (context->checkerboard == CHECKERBOARD_OFF && !Rasterization::NeedsRender(&context->rasterizer, drawCall.screenRect))
+			continue;
+
+		uniforms->sunMesh = drawCall.sun;
+		uniforms->shadingRate = drawCall.shadingRate;
+		DrawTriangleMesh(context, drawCall);
+	}
+	uniforms->sunMesh = false;
+	uniforms->shadingRate = SHADING_RATE_1X1;
+	uniforms->drawTag = 0;
+}
+
+// Screen pixels a draw may cover, empty when the mesh is off screen
+static SDL_Rect DrawRect(RenderContext *context, const DrawCall &drawCall)
+{
+	Rasterizer *rasterizer = &context->rasterizer;
+	SDL_Rect screen = { 0, 0, Sint32(rasterizer->width), Sint32(rasterizer->height) };
+	const vec3 &boundsMin = drawCall.localBoundsMin;
+	const vec3 &boundsMax = drawCall.localBoundsMax;
+	if (drawCall.culled || boundsMin.x > boundsMax.x)
+		return SDL_Rect{ 0, 0, 0, 0 };
+
+	const mat4 &mvpMatrix = drawCall.mvpMatrix;
+	vec2 ndcMin = vec2(FLT_MAX);
+	vec2 ndcMax = vec2(-FLT_MAX);
+	for (Uint32 corner = 0; corner < 8; ++corner)
+	{
+		vec3 position = vec3(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z);
+		vec4 clip = mvpMatrix * vec4(position, 1.0f);
+
+		// Triangles crossing the near plane are clipped, the projection of the box no longer bounds them
+		if (clip.w < Z_NEAR)
+			return screen;
+		ndcMin = glm::min(ndcMin, vec2(clip) / clip.w);
+		ndcMax = glm::max(ndcMax, vec2(clip) / clip.w);
+	}
+
+	// Same viewport transform as the vertex shader, y points down
+	float width = float(rasterizer->width);
+	float height = float(rasterizer->height);
+	float x0 = glm::clamp((ndcMin.x * 0.5f + 0.5f) * width, -1.0f, width + 1.0f);
+	float x1 = glm::clamp((ndcMax.x * 0.5f + 0.5f) * width, -1.0f, width + 1.0f);
+	float y0 = glm::clamp((ndcMax.y * -0.5f + 0.5f) * height, -1.0f, height + 1.0f);
+	float y1 = glm::clamp((ndcMin.y * -0.5f + 0.5f) * height, -1.0f, height + 1.0f);
+	Sint32 left = max(Sint32(floorf(x0)) - DRAW_RECT_PADDING, 0);
+	Sint32 top = max(Sint32(floorf(y0)) - DRAW_RECT_PADDING, 0);
+	Sint32 right = min(Sint32(ceilf(x1)) + DRAW_RECT_PADDING, screen.w);
+	Sint32 bottom = min(Sint32(ceilf(y1)) + DRAW_RECT_PADDING, screen.h);
+	if (left >= right || top >= bottom)
+		return SDL_Rect{ 0, 0, 0, 0 };
+	return SDL_Rect{ left, top, right - left, bottom - top };
+}
+
+static bool SameDraw(const DrawCall &a, const DrawCall &b)
+{
+	return a.mesh == b.mesh && a.sun == b.sun && a.shadingRate == b.shadingRate && a.modelMatrix == b.modelMatrix;
+}
+
+static bool SameFrameState(const FrameState &a, const FrameState &b)
+{
+	return a.viewMatrix == b.viewMatrix && a.projectionMatrix == b.projectionMatrix && a.clearColor == b.clearColor &&
+		a.lightDirection == b.lightDirection && a.lightPosition == b.lightPosition && a.pixelFormat == b.pixelFormat &&
+		a.shading == b.shading && a.texCoordWrap == b.texCoordWrap && a.textureFilter == b.textureFilter &&
+		a.textureFormat == b.textureFormat && a.shininess == b.shininess && a.sphereSubdivisions == b.sphereSubdivisions &&
+		a.shadingRate == b.shadingRate && a.checkerboard == b.checkerboard && a.pointLightCount == b.pointLightCount &&
+		a.shadowsOn == b.shadowsOn && a.directionalLightOn == b.directionalLightOn && a.texturingOn == b.texturingOn &&
+		a.backFaceCulling == b.backFaceCulling && a.vectorShading == b.vectorShading && a.fastMath == b.fastMath;
+}
+
+/*	Marks the tiles under the draws that differ from the previous frame's draw at the same index, both where it was
+	and where it is now. Lighting that reaches across the screen (shadows, point lights) and the modes that build on
+	the previous frame (checkerboard, automatic shading rates) redraw everything. */
+static void UpdateDirtyTiles(RenderContext *context)
+{
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	Rasterizer *rasterizer = &context->rasterizer;
+	FrameState state = {};
+	state.viewMatrix = context->camera.viewMatrix;
+	state.projectionMatrix = context->camera.projectionMatrix;
+	state.clearColor = rasterizer->clearColor;
+	state.lightDirection = uniforms->worldLightDirection;
+	state.lightPosition = uniforms->worldLightPosition;
+	state.pixelFormat = rasterizer->pixelFormat;
+	state.shading = context->shading;
+	state.texCoordWrap = context->texCoordWrap;
+	state.textureFilter = context->textureFilter;
+	state.textureFormat = context->textureFormat;
+	state.shininess = context->shininess;
+	state.sphereSubdivisions = context->sphereSubdivisions;
+	state.shadingRate = context->shadingRate;
+	state.checkerboard = context->checkerboard;
+	state.pointLightCount = Uint32(context->pointLights.size());
+	state.shadowsOn = context->shadowsOn;
+	state.directionalLightOn = uniforms->directionalLightOn;
+	state.texturingOn = context->texturingOn;
+	state.backFaceCulling = context->backFaceCulling;
+	state.vectorShading = context->vectorShading;
+	state.fastMath = context->fastMath;
+
+	bool wholeFrame = !context->dirtyTracking || context->shadowsOn || !context->pointLights.empty() ||
+		context->checkerboard != CHECKERBOARD_OFF || context->shadingRate == SHADING_RATE_AUTO ||
+		!SameFrameState(state, context->previousState);
+	context->previousState = state;
+	Rasterization::BeginDirtyTiles(rasterizer, wholeFrame);
+
+	std::vector<DrawCall> &drawCalls = context->drawCalls;
+	std::vector<DrawCall> &previousDrawCalls = context->previousDrawCalls;
+	for (Uint32 i = 0; i < drawCalls.size(); ++i)
+	{
+		drawCalls[i].screenRect = DrawRect(context, drawCalls[i]);
+	}
+	for (Uint32 i = 0; i < max(drawCalls.size(), previousDrawCalls.size()) && !wholeFrame; ++i)
+	{
+		bool current = i < drawCalls.size();
+		bool previous = i < previousDrawCalls.size();
+		if (current && previous && SameDraw(drawCalls[i], previousDrawCalls[i]))
+			continue;
+
+		if (current)
+			Rasterization::MarkChanged(rasterizer, drawCalls[i].screenRect);
+		if (previous)
+			Rasterization::MarkChanged(rasterizer, previousDrawCalls[i].screenRect);
+	}
+	previousDrawCalls = drawCalls;
+	Rasterization::ResolveDirtyTiles(rasterizer);
+}
+
+static float Fraction(float x)
+{
+	return x - floorf(x);
+}
+
+// Lights are spread over the orbits with low discrepancy sequences, followed by the lights of the scene, and binned
+// into the screen tiles of this frame
+static void UpdatePointLights(RenderContext *context)
+{
+	const vec3 colors[6] = { vec3(1.0f, 0.3f, 0.2f), vec3(0.2f, 1.0f, 0.3f), vec3(0.3f, 0.4f, 1.0f),
+							 vec3(1.0f, 0.9f, 0.2f), vec3(0.2f, 0.9f, 1.0f), vec3(1.0f, 0.3f, 0.9f) };
+
+	context->pointLights.resize(context->solarSystem ? context->pointLightCount : 0);
+	for (Uint32 i = 0; i < context->pointLights.size(); ++i)
+	{
+		float orbit = 3.0f + 21.0f * Fraction(i * 0.618034f);
+		float speed = 0.2f + 0.6f * Fraction(i * 0.414214f);
+		float angle = i * 2.399963f + speed * float(context->time);
+		float height = 2.0f * Fraction(i * 0.732051f) - 1.0f;
+
+		PointLight &light = context->pointLights[i];
+		light.position = vec3(cosf(angle) * orbit, height, sinf(angle) * orbit);
+		light.color = colors[i % 6];
+		light.radius = 2.5f;
+	}
+	if (context->solarSystem)
+		context->pointLights.insert(context->pointLights.end(), context->solarPointLights.begin(), context->solarPointLights.end());
+
+	Rasterization::SetPointLights(&context->rasterizer, context->pointLights.data(), Uint32(context->pointLights.size()),
+		context->camera.viewMatrix, context->camera.projectionMatrix);
+}
+
+/*  Shading cost is roughly proportional to the pixel count, so the scale of both axes moves by the square root of
+	the frame time ratio. Frames within a few percent of the target are left alone, and a change waits for the average
+	of the new resolution before the next one, otherwise the scale would oscillate. Drops are taken faster than
+	raises. */
+static void UpdateResolutionScale(RenderContext *context, double dt)
+{
+	if (!context->dynamicResolution)
+	{
+		context->resolutionScale = 1.0f;
+		context->averageFrameTime = 0.0f;
+		return;
+	}
+
+	// Stalls such as dragging the window are not the renderer's doing
+	float frameTime = min(float(dt), 0.25f);
+	if (context->averageFrameTime == 0.0f)
+		context->averageFrameTime = frameTime;
 	else
+		context->averageFrameTime += RESOLUTION_FRAME_TIME_SMOOTHING * (frameTime - context->averageFrameTime);
+
+	if (context->resolutionCooldown > 0)
 	{
-		mat4 model = rotate(translate(mat4(1.0f), vec3(0.0f, 0.0f, -4.0f)), 0.0f, vec3(0.0f, 1.0f, 0.0f));
-		DrawTriangleMesh(context, &context->cubeMesh, model);
-		
-		model = rotate(scale(translate(mat4(1.0f), vec3(5, 0, 0)), vec3(2.f, 2.f, 2.f)), 1.8f*float(time), vec3(0, 1, 0));
-		DrawTriangleMesh(context, &context->sphereMesh, model);
+		context->resolutionCooldown--;
+		return;
+	}
 
-		model = rotate(scale(translate(mat4(1.0f), vec3(0.0f, 0.0f, 0.0f)), vec3(1.4f, 1.4f, 1.4f)), 0.2f*float(time), glm::normalize(vec3(cosf(time), cosf(time), sinf(time))));
-		DrawTriangleMesh(context, &context->bunnyMesh, model);
+	float ratio = context->targetFrameTime / context->averageFrameTime;
+	if (ratio > 0.95f && ratio < 1.1f)
+		return;
+
+	float scale = context->resolutionScale * sqrtf(glm::clamp(ratio, 0.5f, 1.2f));
+	scale = glm::clamp(scale, context->minResolutionScale, context->maxResolutionScale);
+	if (fabsf(scale - context->resolutionScale) > 0.01f)
+	{
+		context->resolutionScale = scale;
+		context->resolutionCooldown = RESOLUTION_COOLDOWN_FRAMES;
+	}
+}
+
+Uint32* Renderer::Present(RenderContext *context)
+{
+	Rasterizer *rasterizer = &context->rasterizer;
+	Uint32 width = context->width;
+	Uint32 height = context->height;
+	if (rasterizer->width == width && rasterizer->height == height)
+		return rasterizer->frameBuffer;
+
+	// The upscaler's row buffer follows the frame
+	Uint32 index = rasterizer->frameIndex;
+	Uint32 size = width * height + rasterizer->width + 1;
+	if (size > context->presentCapacities[index])
+	{
+		free(context->presentBuffers[index]);
+		context->presentCapacities[index] = size;
+		context->presentBuffers[index] = (Uint32*)malloc(size * sizeof(Uint32));
 	}
+	Uint32 *presentBuffer = context->presentBuffers[index];
+	Rasterization::Upscale(rasterizer, presentBuffer, width, height, presentBuffer + width * height);
+	return presentBuffer;
+}
+
+Uint32 Renderer::ChangedRects(RenderContext *context, SDL_Rect *rects, Uint32 maxRects)
+{
+	Rasterizer *rasterizer = &context->rasterizer;
+	if (rasterizer->width != Uint32(context->width) || rasterizer->height != Uint32(context->height))
+		return 0;
+	return Rasterization::ChangedRects(rasterizer, rects, maxRects);
+}
+
+bool Renderer::HandleKey(RenderContext *context, SDL_Keycode key)
+{
+	switch (key)
+	{
+	case SDLK_1:
+		switch (context->shading)
+		{
+		case FLAT_SHADING:
+			context->shading = GOURAUD_SHADING;
+			break;
+		case GOURAUD_SHADING:
+			context->shading = PHONG_SHADING;
+			break;
+		case PHONG_SHADING:
+			context->shading = FLAT_SHADING;
+			break;
+		}
+		break;
+	case SDLK_2:
+		context->shininess = (context->shininess == 2) ? context->shininess : context->shininess / 2;
+		break;
+	case SDLK_3:
+		context->shininess = (context->shininess == 2 << 10) ? context->shininess : context->shininess *2;
+		break;
+	case SDLK_4:
+		context->sphereSubdivisions = (context->sphereSubdivisions == 5) ? context->sphereSubdivisions : context->sphereSubdivisions - 5;
+		break;
+	case SDLK_5:
+		context->sphereSubdivisions = (context->sphereSubdivisions == 150) ? context->sphereSubdivisions : context->sphereSubdivisions + 5;
+		break;
+	case SDLK_6:
+		context->textureFormat = (context->textureFormat == TEX_FORMAT_BC4) ? TEX_FORMAT_R8 : context->textureFormat + 1;
+		break;
+	case SDLK_7:
+		context->texCoordWrap = (context->texCoordWrap == TEX_COORD_CLAMP) ? TEX_COORD_REPEAT : TEX_COORD_CLAMP;
+		break;
+	case SDLK_8:
+		context->backFaceCulling = !context->backFaceCulling;
+		break;
+	case SDLK_9:
+		context->textureFilter = (context->textureFilter == TEX_FILTER_MIPMAP) ? TEX_FILTER_NEAREST : context->textureFilter + 1;
+		break;
+	case SDLK_l:
+		if (context->pointLightCount >= 1024)
+			context->pointLightCount = 0;
+		else
+			context->pointLightCount = (context->pointLightCount == 0) ? 16 : context->pointLightCount * 4;
+		break;
+	case SDLK_h:
+		context->shadowsOn = !context->shadowsOn;
+		break;
+	case SDLK_m:
+		context->shadowMapSize = (context->shadowMapSize >= 2048) ? 256 : context->shadowMapSize * 2;
+		break;
+	case SDLK_r:
+		// 1x1, 2x2, 4x4, auto
+		if (context->shadingRate == SHADING_RATE_AUTO)
+			context->shadingRate = SHADING_RATE_1X1;
+		else if (context->shadingRate == SHADING_RATE_4X4)
+			context->shadingRate = SHADING_RATE_AUTO;
+		else
+			context->shadingRate *= 2;
+		break;
+	case SDLK_c:
+		context->checkerboard = (context->checkerboard == CHECKERBOARD_QUARTER) ? CHECKERBOARD_OFF : context->checkerboard + 1;
+		break;
+	case SDLK_d:
+		context->dynamicResolution = !context->dynamicResolution;
+		break;
+	case SDLK_t:
+		// 60, 30, 120 fps
+		if (context->targetFrameTime < 1.0f / 100.0f)
+			context->targetFrameTime = 1.0f / 60.0f;
+		else if (context->targetFrameTime < 1.0f / 50.0f)
+			context->targetFrameTime = 1.0f / 30.0f;
+		else
+			context->targetFrameTime = 1.0f / 120.0f;
+		break;
+	case SDLK_f:
+		context->fastMath = !context->fastMath;
+		break;
+	case SDLK_v:
+		context->vectorShading = !context->vectorShading;
+		break;
+	case SDLK_s:
+		context->solarSystem = !context->solarSystem;
+		break;
+	case SDLK_p:
+		context->dirtyTracking = !context->dirtyTracking;
+		break;
+	default:
+		return false;
+	}
+	return true;
 }
 
 void Renderer::Update(RenderContext *context, double dt, bool isRunning)
 {
+	context->time += dt;
+	UpdateResolutionScale(context, dt);
 	UpdateContext(context, dt);
+	UpdatePointLights(context);
+	CollectDrawCalls(context);
+	RenderShadows(context);
+	UpdateDirtyTiles(context);
 
+	Temporal::BeginFrame(&context->temporal, &context->rasterizer, context->checkerboard);
 	Rasterization::Clear(&context->rasterizer, COLOR_BIT | DEPTH_BIT);
-	RenderObjects(context, dt);
+	context->rasterizer.stats = {};
+	RenderObjects(context);
+	Temporal::EndFrame(&context->temporal, &context->rasterizer);
+
+	// Before the HUD is drawn over the frame
+	if (context->shadingRate == SHADING_RATE_AUTO)
+		Rasterization::UpdateShadingRates(&context->rasterizer);
+}
+
+void Renderer::Advance(RenderContext *context, double dt)
+{
+	context->time += dt;
+	UpdateResolutionScale(context, dt);
+	UpdateContext(context, dt);
+}
+
+void Renderer::RenderViews(RenderContext *context, const RasterView *views, Uint32 viewCount)
+{
+	Uniforms *uniforms = &context->rasterizer.uniforms;
+	for (Uint32 v = 0; v < viewCount; ++v)
+	{
+		Rasterizer *target = views[v].target;
+		Rasterization::SetPixelFormat(target, context->rasterizer.pixelFormat);
+		target->clearColor = context->rasterizer.clearColor;
+		target->zNear = context->rasterizer.zNear;
+		target->backFaceCulling = context->rasterizer.backFaceCulling;
+		target->vectorShading = context->rasterizer.vectorShading;
+		for (Uint32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+		{
+			Rasterization::SetSampler(target, unit, context->rasterizer.textureUnits[unit].sampler);
+		}
+		Rasterization::SetPointLights(target, context->pointLights.data(), Uint32(context->pointLights.size()),
+			views[v].viewMatrix, views[v].projectionMatrix);
+		Rasterization::Clear(target, COLOR_BIT | DEPTH_BIT);
+		target->stats = {};
+	}
+
+	// Every draw, the culling of the frame was for its own camera. Automatic shading rates come from the frame's
+	// contrast, the views shade every pixel instead.
+	for (Uint32 i = 0; i < context->drawCalls.size(); ++i)
+	{
+		const DrawCall &drawCall = context->drawCalls[i];
+		for (Uint32 v = 0; v < viewCount; ++v)
+		{
+			for (Uint32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+			{
+				Rasterization::BindTexture(views[v].target, unit, drawCall.mesh->textures[unit]);
+			}
+		}
+		uniforms->modelMatrix = drawCall.modelMatrix;
+		uniforms->sunMesh = drawCall.sun;
+		uniforms->shadingRate = drawCall.shadingRate == SHADING_RATE_AUTO ? SHADING_RATE_1X1 : drawCall.shadingRate;
+		Rasterization::DrawTriangleMesh(&context->rasterizer, views, viewCount, drawCall.mesh);
+	}
+	uniforms->sunMesh = false;
+	uniforms->shadingRate = SHADING_RATE_1X1;
 }
 
 void Renderer::Release(RenderContext *context)
@@ -282,10 +994,18 @@ void Renderer::Release(RenderContext *context)
 	UtilMesh::Release(context->cubeMesh);
 	UtilMesh::Release(context->sphereMesh);
 	UtilMesh::Release(context->bunnyMesh);
-
-	for (Uint32 i = 0; i < context->objects.size(); ++i)
+	UtilTexture::Release(context->sourceTexture);
+	UtilTexture::Unref(context->checkerTexture);
+	Shadows::Release(&context->directionalShadowMap);
+	Shadows::Release(&context->pointShadowMap);
+	SceneGraph::Clear(&context->scene);
+	BoundingVolumes::Clear(&context->drawBvh);
+	Temporal::Release(&context->temporal);
+	for (Uint32 i = 0; i < RASTERIZER_FRAME_BUFFERS; ++i)
 	{
-		UtilMesh::Release(context->objects[i].mesh);
+		free(context->presentBuffers[i]);
 	}
+
+	ReleaseSolarSystem(context);
 	Rasterization::Release(&context->rasterizer);
 }
@@ -9,15 +9,64 @@
 #include "Camera.h"
 #include "rasterizer.h"
 #include "mesh.h"
+#include "texture.h"
+#include "temporal.h"
+#include "scene.h"
+#include "bvh.h"
+#include "bodies.h"
+#include "scenefile.h"
 
-struct Object
+#define DRAW_SHADING_RATE_CONTEXT -1	// The draw follows RenderContext::shadingRate
+
+// A mesh drawn this frame, collected once so the shadow and the main pass draw the same thing
+struct DrawCall
+{
+	Mesh *mesh;
+	glm::mat4 modelMatrix;
+	bool sun;
+	int shadingRate;	// SHADING_RATE_*, Phong only. The material's, the context's for draws without one.
+	SDL_Rect screenRect;	// Pixels the draw may cover, from the corners of the mesh bounds
+	glm::mat4 mvpMatrix;
+	glm::vec3 localBoundsMin;	// Cached by the scene node
+	glm::vec3 localBoundsMax;
+	glm::vec3 worldBoundsMin;
+	glm::vec3 worldBoundsMax;
+	bool culled;		// Outside the view frustum, still casts shadows
+	Uint32 drawTag;		// From Temporal::AddDraw, with checkerboard rendering
+};
+
+// Replaces the model matrix of a draw call, by its index in the frame's draw calls
+struct ObjectTransform
 {
-	glm::vec3 color;
-	float diameter;
-	float distanceFromSun;
-	float orbitalPeriod;
-	double currentSunRotation;
-	Mesh mesh;
+	Uint32 drawIndex;
+	glm::mat4 modelMatrix;
+};
+
+/*	Settings that change every pixel of the frame, compared between frames to find out whether any tile can be kept.
+	SameFrameState in renderer.cpp compares them field by field, a new field goes there too. */
+struct FrameState
+{
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+	glm::vec3 clearColor;
+	glm::vec3 lightDirection;
+	glm::vec3 lightPosition;
+	Uint32 pixelFormat;
+	Uint32 shading;
+	Uint32 texCoordWrap;
+	Uint32 textureFilter;
+	Uint32 textureFormat;
+	int shininess;
+	int sphereSubdivisions;
+	int shadingRate;
+	Uint32 checkerboard;
+	Uint32 pointLightCount;
+	bool shadowsOn;
+	bool directionalLightOn;
+	bool texturingOn;
+	bool backFaceCulling;
+	bool vectorShading;
+	bool fastMath;
 };
 
 struct RenderContext
@@ -27,6 +76,9 @@ struct RenderContext
 	int height;
 
 	Camera camera;
+	bool fixedCamera;	// Set by the caller, mouse input and scene switches leave it alone
+
+	double time;		// Seconds animated so far
 
 	// User input
 	Sint32 mouseRelX;
@@ -34,11 +86,18 @@ struct RenderContext
 	Sint32 mouseWheel;
 	Uint32 shading;
 	Uint32 texCoordWrap;
+	Uint32 textureFilter;
 	bool texturingOn;
+	Uint32 textureFormat;
+	Uint32 previousTextureFormat;
 	bool backFaceCulling;
+	bool vectorShading;
 	bool solarSystem;
 	bool previousSolarSystem;
 	int shininess;
+	bool fastMath;
+	int shadingRate;
+	Uint32 checkerboard;
 	int previousSphereSubdivisions;
 	int sphereSubdivisions;
 
@@ -47,11 +106,71 @@ struct RenderContext
 	Mesh sphereMesh;
 	Mesh bunnyMesh;
 
+	// Textures
+	Texture sourceTexture;
+	Texture *checkerTexture;
+
 	// Objects
-	std::vector<Object> objects;
+	BodyStore bodies;	// The orbiting instances of the solar system scene
+	Uint32 bodyThreadCount;	// Update threads for the bodies of the scenes loaded next, Bodies::DefaultThreadCount by default
+	std::vector<Mesh> sceneMeshes;	// By SceneDescription::meshes, BodyStore::meshes indexes them too
+	std::vector<Uint32> instancePivots;	// Per instance, its placement or orbit, children hang from it
+	std::vector<Uint32> instanceNodes;	// Child of the pivot, holds the mesh and the scale
+	std::vector<bool> instanceEmissive;
+	std::vector<int> instanceShadingRates;	// SHADING_RATE_* of the material, DRAW_SHADING_RATE_CONTEXT without one
+	std::vector<Uint32> bodyPivots;	// Per body, the pivot its orbit moves
+	std::vector<glm::mat4> bodyPlacements;	// Per body, position and rotation within the orbit
+	Scene scene;		// Nodes of the test scene and the solar system
+	Uint32 cubeNode;
+	Uint32 sphereNode;
+	Uint32 bunnyNode;
+	glm::mat4 viewProjectionMatrix;
+	Uint32 culledDraws;	// Of the last frame
+	Bvh drawBvh;		// Over the world bounds of drawCalls, refitted as they move
+	std::vector<BvhHit> visibleDraws;	// Near to far
+
+	std::vector<DrawCall> drawCalls;
+	std::vector<ObjectTransform> objectTransforms;	// Applied to this frame's draw calls, out of range indices are ignored
+
+	// Partial redraw, only the tiles under draws that moved, appeared or disappeared are rendered again
+	bool dirtyTracking;
+	FrameState previousState;
+	std::vector<DrawCall> previousDrawCalls;
+
+	TemporalState temporal;
+
+	// Dynamic resolution, the frame is rendered at resolutionScale times the window size and upscaled
+	bool dynamicResolution;
+	float targetFrameTime;		// Seconds
+	float minResolutionScale;
+	float maxResolutionScale;
+	float resolutionScale;
+	float averageFrameTime;
+	Uint32 resolutionCooldown;	// Frames left until the scale may change again
+	Uint32 *presentBuffers[RASTERIZER_FRAME_BUFFERS];	// Upscaled frames, one per rasterizer frame buffer
+	Uint32 presentCapacities[RASTERIZER_FRAME_BUFFERS];
+
+	// Shadows
+	bool shadowsOn;
+	Uint32 shadowMapSize;
+	ShadowMap directionalShadowMap;
+	ShadowMap pointShadowMap;
+
+	// Point lights orbiting in the solar system
+	std::vector<PointLight> pointLights;
+	Uint32 pointLightCount;
+
+	// Lighting of the solar system scene
+	std::vector<PointLight> solarPointLights;	// Fixed, binned after the orbiting ones
+	bool solarDirectionalLight;	// Instead of the sun
+	glm::vec3 solarLightDirection;
+	glm::vec3 solarLightPosition;
+	glm::vec3 solarClearColor;
 
 	// Camera positions
 	glm::vec3 solarCameraPos;
+	glm::vec3 solarCameraTarget;
+	std::vector<SceneCameraKey> solarCameraPath;	// Replaces the mouse in the solar system when not empty
 	glm::vec3 sceneCameraPos;
 };
 
@@ -61,8 +180,25 @@ namespace Renderer
 {
 	void Init(RenderContext *context, Uint32 width, Uint32 height);
 	void Update(RenderContext *context, double deltaTime, bool isRunning);
+	// Moves the animation and the camera on like Update without rendering, for frames another context renders
+	void Advance(RenderContext *context, double deltaTime);
 	void Release(RenderContext *context);
+	/*	Renders the draws of the last Update again from each view into its target, the world space vertex work is
+		shared between the views: the faces of a cube map, a stereo pair or captures from several angles. The
+		targets are cleared and keep their own size, the lighting, samplers and near plane are the context's. */
+	void RenderViews(RenderContext *context, const RasterView *views, Uint32 viewCount);
+	// Replaces the content of the solar system, Init loads SceneFiles::MakeSolarSystem
+	void LoadScene(RenderContext *context, const SceneDescription *scene);
+	/*	The frame at the window size, upscaled when it was rendered at a lower resolution. The pixels stay valid
+		while the rasterizer renders into its other frame buffers. */
+	Uint32* Present(RenderContext *context);
+	/*	Rects of the presented frame that differ from the previous one, HUD excluded. Returns 0 when the whole frame
+		has to be shown: the frame was upscaled or the changes do not fit in maxRects. */
+	Uint32 ChangedRects(RenderContext *context, SDL_Rect *rects, Uint32 maxRects);
+	// Toggles the setting bound to the key, returns false for keys without one
+	bool HandleKey(RenderContext *context, SDL_Keycode key);
 	const char* ShadingToString(int shading);
+	const char* ShadingRateToString(int shadingRate);
 	const char* TexWrapToString(int texCoordWrap);
 }
 #endif
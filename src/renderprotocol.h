@@ -0,0 +1,91 @@
+#ifndef RENDERPROTOCOL_H
+#define RENDERPROTOCOL_H
+
+#include <stdint.h>
+
+/*  Messages of the render server (see Server in server.h) on its Unix domain socket. Both ends run on the same
+    machine, the structs are sent as they are. A client writes a RenderRequest followed by transformCount
+    RenderObjectTransforms and reads a RenderResponse followed by size bytes of the image:
+
+        RenderRequest request = { RENDER_PROTOCOL_MAGIC, RENDER_PROTOCOL_VERSION };
+        request.id = 1;
+        request.width = 640;
+        request.height = 360;
+        request.output = RENDER_OUTPUT_PNG;
+        ...
+        write(socket, &request, sizeof(request));
+
+    Requests may be pipelined, several can be sent before reading the responses. The responses of one connection
+    come back in the order the renders finish, not necessarily in the order of the requests, the id tells them
+    apart. A server that is behind answers RENDER_STATUS_OVERLOADED right away instead of queueing more work. */
+
+#define RENDER_PROTOCOL_MAGIC 0x52444E52    // "RNDR"
+#define RENDER_PROTOCOL_VERSION 1
+#define RENDER_MAX_OBJECT_TRANSFORMS 64
+#define RENDER_MIN_SIZE 16
+#define RENDER_MAX_SIZE 4096
+
+// Scenes
+#define RENDER_SCENE_TEST 0
+#define RENDER_SCENE_SOLAR 1
+
+// Outputs, the encoded ones match IMAGE_FORMAT_*
+#define RENDER_OUTPUT_SHARED 0  // Left in the server's shared memory ring, read with FrameReading from framereader.h
+#define RENDER_OUTPUT_RAW 1     // Rows of RGB triplets
+#define RENDER_OUTPUT_PPM 2
+#define RENDER_OUTPUT_PNG 3
+#define RENDER_OUTPUT_QOI 4
+
+// Statuses
+#define RENDER_STATUS_OK 0
+#define RENDER_STATUS_OVERLOADED 1  // The queue was full, nothing was rendered
+#define RENDER_STATUS_EXPIRED 2     // Waited in the queue longer than its deadline, nothing was rendered
+#define RENDER_STATUS_INVALID 3     // Unknown scene or output, size out of range or too many transforms
+#define RENDER_STATUS_FAILED 4      // Such as a shared frame larger than the ring or a server without one
+
+// Replaces the model matrix of one object, by its index in the scene's draw order
+struct RenderObjectTransform
+{
+    uint32_t drawIndex;
+    float modelMatrix[16];  // Column major
+};
+
+struct RenderRequest
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;            // Echoed in the response
+    uint32_t width;
+    uint32_t height;
+    uint32_t output;        // RENDER_OUTPUT_*
+    uint32_t scene;         // RENDER_SCENE_*
+    uint32_t shading;       // 1 flat, 2 Gouraud, 3 Phong
+    uint32_t deadlineMs;    // Dropped when it waited longer in the queue, 0 to wait as long as it takes
+    uint32_t transformCount;
+    float time;             // Animation time in seconds
+    float cameraPosition[3];
+    float cameraTarget[3];
+    float cameraUp[3];
+};
+
+struct RenderResponse
+{
+    uint32_t magic;
+    uint32_t id;
+    uint32_t status;        // RENDER_STATUS_*
+    uint32_t width;
+    uint32_t height;
+    uint32_t output;
+    uint32_t worker;        // Index of the rasterizer that rendered the frame
+    uint32_t queueMicros;   // From receiving the request to a worker taking it
+    uint32_t renderMicros;
+    uint32_t encodeMicros;
+    uint32_t totalMicros;   // From receiving the request to queueing the response
+    uint32_t frame;         // RENDER_OUTPUT_SHARED: FrameView::frame of the rendered frame
+    uint32_t slot;          // RENDER_OUTPUT_SHARED: ring slot holding it, see FrameReading::AcquireSlot
+    char ring[64];          // RENDER_OUTPUT_SHARED: shared memory name to open with FrameReading
+    uint32_t padding;
+    uint64_t size;          // Bytes of the encoded image that follow
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include <float.h>
+#include <string.h>
+#include "scene.h"
+
+using glm::vec3;
+using glm::vec4;
+using glm::mat3;
+using glm::mat4;
+
+Uint32 SceneGraph::AddNode(Scene *scene, Uint32 parent, Mesh *mesh, const mat4 &localMatrix)
+{
+    SceneNode node = {};
+    node.parent = parent;
+    node.localMatrix = localMatrix;
+    node.worldMatrix = mat4(1.0f);
+    node.localChanged = true;
+    scene->nodes.push_back(node);
+
+    Uint32 index = Uint32(scene->nodes.size() - 1);
+    SetMesh(scene, index, mesh);
+    return index;
+}
+
+void SceneGraph::SetLocalMatrix(Scene *scene, Uint32 node, const mat4 &localMatrix)
+{
+    SceneNode &sceneNode = scene->nodes[node];
+    if (memcmp(&sceneNode.localMatrix, &localMatrix, sizeof(mat4)) == 0)
+        return;
+    sceneNode.localMatrix = localMatrix;
+    sceneNode.localChanged = true;
+}
+
+void SceneGraph::SetMesh(Scene *scene, Uint32 node, Mesh *mesh)
+{
+    SceneNode &sceneNode = scene->nodes[node];
+    sceneNode.mesh = mesh;
+    sceneNode.localBoundsMin = vec3(FLT_MAX);
+    sceneNode.localBoundsMax = vec3(-FLT_MAX);
+    if (mesh)
+        UtilMesh::Bounds(mesh, sceneNode.localBoundsMin, sceneNode.localBoundsMax);
+
+    // The world bounds follow with the next update
+    sceneNode.localChanged = true;
+}
+
+void SceneGraph::Update(Scene *scene)
+{
+    scene->updatedNodes = 0;
+    for (Uint32 i = 0; i < scene->nodes.size(); ++i)
+    {
+        SceneNode &node = scene->nodes[i];
+        const SceneNode *parent = (node.parent != SCENE_NO_PARENT) ? &scene->nodes[node.parent] : NULL;
+        node.worldChanged = node.localChanged || (parent && parent->worldChanged);
+        if (!node.worldChanged)
+            continue;
+
+        // Roots take the local matrix as it is, the same bits as before there was a hierarchy
+        node.worldMatrix = parent ? parent->worldMatrix * node.localMatrix : node.localMatrix;
+        TransformBounds(node.worldMatrix, node.localBoundsMin, node.localBoundsMax, node.worldBoundsMin, node.worldBoundsMax);
+        node.localChanged = false;
+        scene->updatedNodes++;
+    }
+}
+
+void SceneGraph::Clear(Scene *scene)
+{
+    scene->nodes.clear();
+    scene->updatedNodes = 0;
+}
+
+void SceneGraph::TransformBounds(const mat4 &matrix, const vec3 &boundsMin, const vec3 &boundsMax,
+                                 vec3 &transformedMin, vec3 &transformedMax)
+{
+    if (boundsMin.x > boundsMax.x)
+    {
+        transformedMin = vec3(FLT_MAX);
+        transformedMax = vec3(-FLT_MAX);
+        return;
+    }
+
+    // The center moves with the matrix, each axis of the extent adds its absolute projection
+    vec3 center = vec3(matrix * vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    vec3 extent = (boundsMax - boundsMin) * 0.5f;
+    mat3 linear = mat3(matrix);
+    vec3 worldExtent = glm::abs(linear[0]) * extent.x + glm::abs(linear[1]) * extent.y + glm::abs(linear[2]) * extent.z;
+    transformedMin = center - worldExtent;
+    transformedMax = center + worldExtent;
+}
+
+void SceneGraph::FrustumPlanes(const mat4 &viewProjectionMatrix, vec4 planes[5])
+{
+    // Rows of the matrix, a clip space position is inside when -w <= x, y, z <= w
+    mat4 transposed = glm::transpose(viewProjectionMatrix);
+    planes[0] = transposed[3] + transposed[0];
+    planes[1] = transposed[3] - transposed[0];
+    planes[2] = transposed[3] + transposed[1];
+    planes[3] = transposed[3] - transposed[1];
+    planes[4] = transposed[3] + transposed[2];
+}
+
+bool SceneGraph::IsVisible(const vec4 planes[5], const vec3 &boundsMin, const vec3 &boundsMax)
+{
+    if (boundsMin.x > boundsMax.x)
+        return false;
+
+    for (Uint32 i = 0; i < 5; ++i)
+    {
+        // The corner furthest along the plane normal
+        vec3 corner = vec3(planes[i].x >= 0.0f ? boundsMax.x : boundsMin.x,
+                           planes[i].y >= 0.0f ? boundsMax.y : boundsMin.y,
+                           planes[i].z >= 0.0f ? boundsMax.z : boundsMin.z);
+        if (glm::dot(vec3(planes[i]), corner) + planes[i].w < 0.0f)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+#include <vector>
+#include "mesh.h"
+
+#define SCENE_NO_PARENT 0xFFFFFFFFu
+
+// A transform in the hierarchy, optionally with a mesh drawn at it
+struct SceneNode
+{
+    Uint32 parent;              // Index of the parent node, SCENE_NO_PARENT for roots
+    Mesh *mesh;                 // NULL for pivots that only carry their children
+    glm::mat4 localMatrix;      // Relative to the parent
+    glm::mat4 worldMatrix;      // Parent's world matrix times the local matrix
+    glm::vec3 localBoundsMin;   // Of the mesh vertices, empty (min > max) without a mesh
+    glm::vec3 localBoundsMax;
+    glm::vec3 worldBoundsMin;   // Axis aligned box around the transformed local bounds
+    glm::vec3 worldBoundsMax;
+    bool localChanged;          // Since the last Update
+    bool worldChanged;          // By the last Update, the node's or an ancestor's local matrix changed
+};
+
+/*  Hierarchy of transforms such as moons orbiting planets orbiting the sun. The world matrices and bounds are
+    cached, setting a local matrix only flags the node and Update recomputes the flagged nodes and their
+    descendants. Parents are added before their children, so a single pass in index order sees every parent
+    updated before its children. */
+struct Scene
+{
+    std::vector<SceneNode> nodes;
+    Uint32 updatedNodes;        // World matrices recomputed by the last Update
+};
+
+namespace SceneGraph
+{
+    // Returns the index of the node, the parent has to exist already
+    Uint32 AddNode(Scene *scene, Uint32 parent, Mesh *mesh, const glm::mat4 &localMatrix);
+    // Flags the node only when the matrix differs from the current one
+    void SetLocalMatrix(Scene *scene, Uint32 node, const glm::mat4 &localMatrix);
+    // Also when the mesh's vertices were rebuilt, its bounds are cached
+    void SetMesh(Scene *scene, Uint32 node, Mesh *mesh);
+    void Update(Scene *scene);
+    void Clear(Scene *scene);
+
+    // Axis aligned box around the 8 transformed corners of a box, empty stays empty
+    void TransformBounds(const glm::mat4 &matrix, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+                         glm::vec3 &transformedMin, glm::vec3 &transformedMax);
+    // Left, right, bottom, top and near planes of a view projection, pointing inside. The far plane is left out,
+    // the rasterizer only clips at the near plane.
+    void FrustumPlanes(const glm::mat4 &viewProjectionMatrix, glm::vec4 planes[5]);
+    // False when the box is empty or entirely behind one of the planes
+    bool IsVisible(const glm::vec4 planes[5], const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+}
+
+#endif
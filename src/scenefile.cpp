@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include "scenefile.h"
+
+using glm::vec3;
+
+#define SCENE_LINE_LENGTH 1024
+#define SCENE_MAX_TOKENS 32
+
+struct SceneFileHeader
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint32 materialCount;
+    Uint32 meshCount;
+    Uint32 instanceCount;
+    Uint32 lightCount;
+    Uint32 cameraKeyCount;
+    glm::vec3 clearColor;
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraTarget;
+};
+
+// Names of the text variant, by kind
+struct SceneNames
+{
+    std::unordered_map<std::string, Uint32> materials;
+    std::unordered_map<std::string, Uint32> meshes;
+    std::unordered_map<std::string, Uint32> instances;
+};
+
+static void Reset(SceneDescription *scene)
+{
+    scene->materials.clear();
+    scene->meshes.clear();
+    scene->instances.clear();
+    scene->lights.clear();
+    scene->cameraKeys.clear();
+    scene->clearColor = vec3(0.0f);
+    scene->cameraPosition = vec3(-22.0f, 15.0f, 33.0f);
+    scene->cameraTarget = vec3(0.0f);
+}
+
+static bool ValidMesh(const SceneMesh &mesh)
+{
+    if (mesh.type == SCENE_MESH_CUBE)
+        return mesh.size > 0.0f;
+    if (mesh.type == SCENE_MESH_SPHERE)
+        return mesh.subdivisions >= 3 && mesh.subdivisions <= 1000;
+    return mesh.type == SCENE_MESH_BUNNY;
+}
+
+// Keys in strictly increasing time order
+static bool ValidCameraKey(const std::vector<SceneCameraKey> &keys, Uint32 key)
+{
+    return key == 0 || keys[key - 1].time < keys[key].time;
+}
+
+// References point at earlier records, so instances are built after their parents
+static bool Validate(const SceneDescription *scene)
+{
+    for (Uint32 i = 0; i < scene->materials.size(); ++i)
+    {
+        Uint32 rates = scene->materials[i].flags & SCENE_MATERIAL_RATES;
+        if (rates & (rates - 1))
+            return false;
+    }
+    for (Uint32 i = 0; i < scene->meshes.size(); ++i)
+    {
+        const SceneMesh &mesh = scene->meshes[i];
+        if (!ValidMesh(mesh) || (mesh.material != SCENE_FILE_NONE && mesh.material >= scene->materials.size()))
+            return false;
+    }
+    for (Uint32 i = 0; i < scene->instances.size(); ++i)
+    {
+        const SceneInstance &instance = scene->instances[i];
+        if (instance.mesh >= scene->meshes.size() || (instance.parent != SCENE_FILE_NONE && instance.parent >= i))
+            return false;
+    }
+    for (Uint32 i = 0; i < scene->lights.size(); ++i)
+    {
+        if (scene->lights[i].type > SCENE_LIGHT_POINT)
+            return false;
+    }
+    for (Uint32 i = 0; i < scene->cameraKeys.size(); ++i)
+    {
+        if (!ValidCameraKey(scene->cameraKeys, i))
+            return false;
+    }
+    // The camera time is taken modulo the last key's, a single key stands still
+    if (scene->cameraKeys.size() > 1 && !(scene->cameraKeys.back().time > 0.0f))
+        return false;
+    return true;
+}
+
+static bool ParseFloats(char **tokens, Uint32 tokenCount, Uint32 first, Uint32 count, float *values)
+{
+    if (first + count > tokenCount)
+        return false;
+    for (Uint32 i = 0; i < count; ++i)
+    {
+        char *end;
+        values[i] = strtof(tokens[first + i], &end);
+        if (end == tokens[first + i] || *end != 0)
+            return false;
+    }
+    return true;
+}
+
+static bool ParseVector(char **tokens, Uint32 tokenCount, Uint32 first, vec3 &value)
+{
+    float values[3];
+    if (!ParseFloats(tokens, tokenCount, first, 3, values))
+        return false;
+    value = vec3(values[0], values[1], values[2]);
+    return true;
+}
+
+static bool Find(const std::unordered_map<std::string, Uint32> &names, const char *name, Uint32 &index)
+{
+    auto found = names.find(name);
+    if (found == names.end())
+        return false;
+    index = found->second;
+    return true;
+}
+
+// Uniform in [0, 1), a 64 bit LCG so scattered scenes come out the same everywhere
+static float Random(Uint64 &state)
+{
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return float(state >> 40) / float(1 << 24);
+}
+
+static bool ParseInstance(SceneDescription *scene, SceneNames &names, char **tokens, Uint32 tokenCount)
+{
+    SceneInstance instance = {};
+    instance.parent = SCENE_FILE_NONE;
+    instance.scale = vec3(1.0f);
+    if (tokenCount < 3 || !Find(names.meshes, tokens[2], instance.mesh))
+        return false;
+
+    for (Uint32 i = 3; i < tokenCount;)
+    {
+        const char *key = tokens[i++];
+        if (strcmp(key, "parent") == 0)
+        {
+            if (i >= tokenCount || !Find(names.instances, tokens[i++], instance.parent))
+                return false;
+        }
+        else if (strcmp(key, "position") == 0 || strcmp(key, "rotation") == 0)
+        {
+            if (!ParseVector(tokens, tokenCount, i, key[0] == 'p' ? instance.position : instance.rotation))
+                return false;
+            i += 3;
+        }
+        else if (strcmp(key, "scale") == 0)
+        {
+            // One value or three
+            if (ParseVector(tokens, tokenCount, i, instance.scale))
+                i += 3;
+            else if (ParseFloats(tokens, tokenCount, i++, 1, &instance.scale.x))
+                instance.scale = vec3(instance.scale.x);
+            else
+                return false;
+        }
+        else if (strcmp(key, "orbit") == 0)
+        {
+            float values[2];
+            if (!ParseFloats(tokens, tokenCount, i, 2, values))
+                return false;
+            i += 2;
+            instance.flags |= SCENE_INSTANCE_ORBIT;
+            instance.orbitDistance = values[0];
+            instance.orbitPeriod = values[1];
+            // The phase is optional
+            if (i < tokenCount && strcmp(tokens[i], "random") == 0)
+            {
+                instance.flags |= SCENE_INSTANCE_RANDOM_PHASE;
+                ++i;
+            }
+            else if (ParseFloats(tokens, tokenCount, i, 1, &instance.orbitPhase))
+                ++i;
+        }
+        else
+            return false;
+    }
+
+    names.instances[tokens[1]] = Uint32(scene->instances.size());
+    scene->instances.push_back(instance);
+    return true;
+}
+
+static bool ParseScatter(SceneDescription *scene, SceneNames &names, char **tokens, Uint32 tokenCount)
+{
+    Uint32 mesh;
+    float ranges[7] = {};
+    if (tokenCount < 9 || tokenCount > 11)
+        return false;
+    char *end;
+    Uint32 count = Uint32(strtoul(tokens[1], &end, 10));
+    if (*end != 0 || !Find(names.meshes, tokens[2], mesh) ||
+        !ParseFloats(tokens, tokenCount, 3, std::min(tokenCount - 3, 7u), ranges))
+        return false;
+
+    Uint64 state = 1;
+    if (tokenCount == 11)
+    {
+        state = strtoull(tokens[10], &end, 10);
+        if (*end != 0)
+            return false;
+    }
+    for (Uint32 i = 0; i < count; ++i)
+    {
+        SceneInstance instance = {};
+        instance.mesh = mesh;
+        instance.parent = SCENE_FILE_NONE;
+        instance.flags = SCENE_INSTANCE_ORBIT;
+        instance.orbitDistance = ranges[0] + (ranges[1] - ranges[0]) * Random(state);
+        instance.orbitPeriod = ranges[2] + (ranges[3] - ranges[2]) * Random(state);
+        instance.scale = vec3(ranges[4] + (ranges[5] - ranges[4]) * Random(state));
+        instance.position.y = ranges[6] * (2.0f * Random(state) - 1.0f);
+        instance.orbitPhase = 6.2831853f * Random(state);
+        scene->instances.push_back(instance);
+    }
+    return true;
+}
+
+static bool ParseLine(SceneDescription *scene, SceneNames &names, char *line)
+{
+    char *comment = strchr(line, '#');
+    if (comment)
+        *comment = 0;
+
+    char *tokens[SCENE_MAX_TOKENS];
+    Uint32 tokenCount = 0;
+    for (char *token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n"))
+    {
+        if (tokenCount == SCENE_MAX_TOKENS)
+            return false;
+        tokens[tokenCount++] = token;
+    }
+    if (tokenCount == 0)
+        return true;
+
+    const char *statement = tokens[0];
+    if (strcmp(statement, "clear") == 0)
+        return tokenCount == 4 && ParseVector(tokens, tokenCount, 1, scene->clearColor);
+    if (strcmp(statement, "camera") == 0)
+        return tokenCount == 7 && ParseVector(tokens, tokenCount, 1, scene->cameraPosition) &&
+            ParseVector(tokens, tokenCount, 4, scene->cameraTarget);
+    if (strcmp(statement, "camera-key") == 0)
+    {
+        SceneCameraKey key;
+        if (tokenCount != 8 || !ParseFloats(tokens, tokenCount, 1, 1, &key.time) ||
+            !ParseVector(tokens, tokenCount, 2, key.position) || !ParseVector(tokens, tokenCount, 5, key.target))
+            return false;
+        scene->cameraKeys.push_back(key);
+        return ValidCameraKey(scene->cameraKeys, Uint32(scene->cameraKeys.size() - 1));
+    }
+    if (strcmp(statement, "light") == 0)
+    {
+        SceneLight light = {};
+        light.color = vec3(1.0f);
+        if (tokenCount < 5 || !ParseVector(tokens, tokenCount, 2, light.vector))
+            return false;
+        if (strcmp(tokens[1], "directional") == 0 && tokenCount == 5)
+        {
+            light.type = SCENE_LIGHT_DIRECTIONAL;
+            if (glm::dot(light.vector, light.vector) == 0.0f)
+                return false;
+            light.vector = glm::normalize(light.vector);
+        }
+        else if (strcmp(tokens[1], "sun") == 0 && tokenCount == 5)
+            light.type = SCENE_LIGHT_SUN;
+        else if (strcmp(tokens[1], "point") == 0 && tokenCount == 9)
+        {
+            light.type = SCENE_LIGHT_POINT;
+            if (!ParseVector(tokens, tokenCount, 5, light.color) || !ParseFloats(tokens, tokenCount, 8, 1, &light.radius))
+                return false;
+        }
+        else
+            return false;
+        scene->lights.push_back(light);
+        return true;
+    }
+    if (strcmp(statement, "material") == 0)
+    {
+        SceneMaterial material = {};
+        if (tokenCount < 5 || !ParseVector(tokens, tokenCount, 2, material.color))
+            return false;
+        for (Uint32 i = 5; i < tokenCount; ++i)
+        {
+            if (strcmp(tokens[i], "textured") == 0)
+                material.flags |= SCENE_MATERIAL_TEXTURED;
+            else if (strcmp(tokens[i], "emissive") == 0)
+                material.flags |= SCENE_MATERIAL_EMISSIVE;
+            else if (strcmp(tokens[i], "rate") == 0 && i + 1 < tokenCount && !(material.flags & SCENE_MATERIAL_RATES))
+            {
+                const char *rate = tokens[++i];
+                if (strcmp(rate, "1x1") == 0)
+                    material.flags |= SCENE_MATERIAL_RATE_1X1;
+                else if (strcmp(rate, "2x2") == 0)
+                    material.flags |= SCENE_MATERIAL_RATE_2X2;
+                else if (strcmp(rate, "4x4") == 0)
+                    material.flags |= SCENE_MATERIAL_RATE_4X4;
+                else
+                    return false;
+            }
+            else
+                return false;
+        }
+        names.materials[tokens[1]] = Uint32(scene->materials.size());
+        scene->materials.push_back(material);
+        return true;
+    }
+    if (strcmp(statement, "mesh") == 0)
+    {
+        // mesh NAME TYPE [PARAMETER] [MATERIAL]
+        SceneMesh mesh = {};
+        mesh.material = SCENE_FILE_NONE;
+        Uint32 next = 3;
+        if (tokenCount < 3)
+            return false;
+        if (strcmp(tokens[2], "cube") == 0)
+        {
+            mesh.type = SCENE_MESH_CUBE;
+            if (!ParseFloats(tokens, tokenCount, next++, 1, &mesh.size))
+                return false;
+        }
+        else if (strcmp(tokens[2], "sphere") == 0)
+        {
+            // 20 subdivisions unless given
+            mesh.type = SCENE_MESH_SPHERE;
+            mesh.subdivisions = 20;
+            char *end;
+            Uint32 subdivisions = next < tokenCount ? Uint32(strtoul(tokens[next], &end, 10)) : 0;
+            if (next < tokenCount && *end == 0)
+            {
+                mesh.subdivisions = subdivisions;
+                ++next;
+            }
+        }
+        else if (strcmp(tokens[2], "bunny") == 0)
+            mesh.type = SCENE_MESH_BUNNY;
+        else
+            return false;
+
+        if (next < tokenCount && !Find(names.materials, tokens[next++], mesh.material))
+            return false;
+        if (next != tokenCount || !ValidMesh(mesh))
+            return false;
+        names.meshes[tokens[1]] = Uint32(scene->meshes.size());
+        scene->meshes.push_back(mesh);
+        return true;
+    }
+    if (strcmp(statement, "instance") == 0)
+        return ParseInstance(scene, names, tokens, tokenCount);
+    if (strcmp(statement, "scatter") == 0)
+        return ParseScatter(scene, names, tokens, tokenCount);
+    return false;
+}
+
+template<typename T>
+static bool ReadRecords(FILE *file, std::vector<T> &records, Uint32 count)
+{
+    records.resize(count);
+    return count == 0 || fread(records.data(), sizeof(T), count, file) == count;
+}
+
+template<typename T>
+static bool WriteRecords(FILE *file, const std::vector<T> &records)
+{
+    return records.empty() || fwrite(records.data(), sizeof(T), records.size(), file) == records.size();
+}
+
+static bool LoadBinary(FILE *file, SceneDescription *scene)
+{
+    SceneFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.version != SCENE_FILE_VERSION)
+        return false;
+
+    // The counts have to match the size of the file before anything is allocated for them
+    long start = ftell(file);
+    fseek(file, 0, SEEK_END);
+    Uint64 size = Uint64(ftell(file) - start);
+    fseek(file, start, SEEK_SET);
+    Uint64 expected = Uint64(header.materialCount) * sizeof(SceneMaterial) + Uint64(header.meshCount) * sizeof(SceneMesh) +
+        Uint64(header.instanceCount) * sizeof(SceneInstance) + Uint64(header.lightCount) * sizeof(SceneLight) +
+        Uint64(header.cameraKeyCount) * sizeof(SceneCameraKey);
+    if (size != expected)
+        return false;
+
+    scene->clearColor = header.clearColor;
+    scene->cameraPosition = header.cameraPosition;
+    scene->cameraTarget = header.cameraTarget;
+    return ReadRecords(file, scene->materials, header.materialCount) && ReadRecords(file, scene->meshes, header.meshCount) &&
+        ReadRecords(file, scene->instances, header.instanceCount) && ReadRecords(file, scene->lights, header.lightCount) &&
+        ReadRecords(file, scene->cameraKeys, header.cameraKeyCount);
+}
+
+bool SceneFiles::Load(const char *fileName, SceneDescription *scene)
+{
+    Reset(scene);
+    FILE *file = fopen(fileName, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Could not open %s\n", fileName);
+        return false;
+    }
+
+    Uint32 magic = 0;
+    bool binary = fread(&magic, sizeof(magic), 1, file) == 1 && magic == SCENE_FILE_MAGIC;
+    rewind(file);
+    bool loaded;
+    if (binary)
+    {
+        loaded = LoadBinary(file, scene) && Validate(scene);
+        if (!loaded)
+            fprintf(stderr, "%s: corrupt binary scene\n", fileName);
+    }
+    else
+    {
+        SceneNames names;
+        char line[SCENE_LINE_LENGTH];
+        Uint32 lineNumber = 0;
+        loaded = true;
+        while (loaded && fgets(line, sizeof(line), file))
+        {
+            ++lineNumber;
+            loaded = ParseLine(scene, names, line);
+        }
+        if (!loaded)
+            fprintf(stderr, "%s:%u: invalid statement\n", fileName, lineNumber);
+        else if (!Validate(scene))
+        {
+            fprintf(stderr, "%s: the last camera-key needs a time above 0\n", fileName);
+            loaded = false;
+        }
+    }
+    fclose(file);
+
+    if (!loaded)
+        Reset(scene);
+    return loaded;
+}
+
+bool SceneFiles::WriteBinary(const char *fileName, const SceneDescription *scene)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (!file)
+        return false;
+
+    SceneFileHeader header = {};
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+    header.materialCount = Uint32(scene->materials.size());
+    header.meshCount = Uint32(scene->meshes.size());
+    header.instanceCount = Uint32(scene->instances.size());
+    header.lightCount = Uint32(scene->lights.size());
+    header.cameraKeyCount = Uint32(scene->cameraKeys.size());
+    header.clearColor = scene->clearColor;
+    header.cameraPosition = scene->cameraPosition;
+    header.cameraTarget = scene->cameraTarget;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && WriteRecords(file, scene->materials) &&
+        WriteRecords(file, scene->meshes) && WriteRecords(file, scene->instances) && WriteRecords(file, scene->lights) &&
+        WriteRecords(file, scene->cameraKeys);
+    return (fclose(file) == 0) && written;
+}
+
+static void AddPlanet(SceneDescription *scene, vec3 color, float diameter, float distFromSun, float orbitalPeriod)
+{
+    SceneMaterial material = { color, scene->meshes.empty() ? Uint32(SCENE_MATERIAL_EMISSIVE) : 0u };
+    SceneMesh mesh = { SCENE_MESH_SPHERE, 20, 1.0f, Uint32(scene->materials.size()) };
+    scene->materials.push_back(material);
+
+    SceneInstance instance = {};
+    instance.mesh = Uint32(scene->meshes.size());
+    instance.parent = SCENE_FILE_NONE;
+    instance.flags = SCENE_INSTANCE_ORBIT | SCENE_INSTANCE_RANDOM_PHASE;
+    instance.scale = vec3(diameter / 2.0f);
+    instance.orbitDistance = distFromSun;
+    instance.orbitPeriod = orbitalPeriod;
+    scene->meshes.push_back(mesh);
+    scene->instances.push_back(instance);
+}
+
+void SceneFiles::MakeSolarSystem(SceneDescription *scene)
+{
+    Reset(scene);
+    scene->lights.push_back(SceneLight{ SCENE_LIGHT_SUN, vec3(0.0f), vec3(1.0f), 0.0f });
+
+    AddPlanet(scene, vec3(252 / 255.f, 224 / 255.0f, 32 / 255.0f), 4.2f, 0.0f, 0.0f);  // sun
+    AddPlanet(scene, vec3(250 / 255.f, 251 / 255.0f, 186 / 255.0f), 0.8f, 4.0f, 0.241f);  // mercury
+    AddPlanet(scene, vec3(234 / 255.f, 201 / 255.0f, 134 / 255.0f), 1.2f, 6.0f, 0.615f);  // venus
+    AddPlanet(scene, vec3(51 / 255.f, 62 / 255.0f, 91 / 255.0f), 1.3f, 8.0f, 1.0f);  // earth
+    AddPlanet(scene, vec3(116 / 255.f, 18 / 255.0f, 3 / 255.0f), 0.7f, 10.0f, 1.88f);  // mars
+    AddPlanet(scene, vec3(125 / 255.f, 58 / 255.0f, 26 / 255.0f), 2.3f, 13.0f, 11.9f);  // jupiter
+    AddPlanet(scene, vec3(251 / 255.f, 238 / 255.0f, 186 / 255.0f), 2.1f, 17.0f, 29.4f);  // saturn
+    AddPlanet(scene, vec3(110 / 255.f, 207 / 255.0f, 250 / 255.0f), 1.8f, 20.0f, 83.7f);  // uranus
+    AddPlanet(scene, vec3(99 / 255.f, 138 / 255.0f, 241 / 255.0f), 1.6f, 23.0f, 163.7f);  // neptune
+}
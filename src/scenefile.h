@@ -0,0 +1,128 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+#include <vector>
+
+#define SCENE_FILE_MAGIC 0x43535753     // "SWSC", starts the binary variant
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_NONE 0xFFFFFFFFu     // No material, no parent
+
+// Mesh types
+#define SCENE_MESH_CUBE 0       // Edge length size
+#define SCENE_MESH_SPHERE 1     // Unit radius, subdivisions
+#define SCENE_MESH_BUNNY 2
+
+// Material flags
+#define SCENE_MATERIAL_TEXTURED 1   // Checkerboard in texture unit 0, for the meshes with texture coordinates
+#define SCENE_MATERIAL_EMISSIVE 2   // Unlit and holding the sun light, not casting shadows
+#define SCENE_MATERIAL_RATE_1X1 4   // Phong shading rate of the material's draws in place of the R key's, one at most
+#define SCENE_MATERIAL_RATE_2X2 8
+#define SCENE_MATERIAL_RATE_4X4 16
+#define SCENE_MATERIAL_RATES (SCENE_MATERIAL_RATE_1X1 | SCENE_MATERIAL_RATE_2X2 | SCENE_MATERIAL_RATE_4X4)
+
+// Instance flags
+#define SCENE_INSTANCE_ORBIT 1          // Orbits its parent, or the origin without one
+#define SCENE_INSTANCE_RANDOM_PHASE 2   // The orbit starts at a rand() angle when the scene is built
+
+// Light types
+#define SCENE_LIGHT_DIRECTIONAL 0   // vector is the direction the light travels
+#define SCENE_LIGHT_SUN 1           // vector is the position, the main light of emissive meshes
+#define SCENE_LIGHT_POINT 2         // vector is the position, binned into screen tiles with its radius
+
+// The records below are written to binary files as they are, every field is 4 bytes
+struct SceneMaterial
+{
+    glm::vec3 color;        // Of the vertices, replaces the mesh's own colors
+    Uint32 flags;           // SCENE_MATERIAL_*
+};
+
+struct SceneMesh
+{
+    Uint32 type;            // SCENE_MESH_*
+    Uint32 subdivisions;
+    float size;
+    Uint32 material;        // SCENE_FILE_NONE keeps the colors of the mesh
+};
+
+/*  Placed at position with rotation (degrees about x, then y, then z) under its parent, or where its orbit takes
+    it. Children follow the position and rotation of their parent, not its scale. */
+struct SceneInstance
+{
+    Uint32 mesh;
+    Uint32 parent;          // Index of an earlier instance, SCENE_FILE_NONE for roots
+    Uint32 flags;           // SCENE_INSTANCE_*
+    glm::vec3 position;
+    glm::vec3 rotation;
+    glm::vec3 scale;
+    float orbitDistance;
+    float orbitPeriod;      // Seconds of animation per turn / 1.5, 0 stands still
+    float orbitPhase;       // Radians at time 0
+};
+
+struct SceneLight
+{
+    Uint32 type;            // SCENE_LIGHT_*
+    glm::vec3 vector;
+    glm::vec3 color;        // Point lights only
+    float radius;
+};
+
+// The camera moves linearly between keys and starts over after the last one. Times increase, the last one above 0.
+struct SceneCameraKey
+{
+    float time;
+    glm::vec3 position;
+    glm::vec3 target;
+};
+
+/*  Content of the solar system slot of the renderer (the S key, --solar): meshes, their instances, lights and
+    the camera. The text variant has one statement per line, # starts a comment and names are declared before
+    they are used:
+
+        clear 0 0 0
+        camera -22 15 33  0 0 0
+        camera-key 0  -22 15 33  0 0 0
+        camera-key 10  30 8 -20  0 0 0
+        light sun 0 0 0
+        light directional 0 -1 0
+        light point 6 1 0  1 0.3 0.2  2.5
+        material yellow 0.99 0.88 0.13 emissive
+        material rock 0.5 0.45 0.4 textured rate 2x2
+        mesh ball sphere 20 yellow
+        mesh box cube 2 rock
+        mesh bunny bunny
+        instance sun ball scale 2.1 orbit 0 0 random
+        instance earth ball scale 0.65 orbit 8 1.0 random
+        instance moon ball parent earth scale 0.2 orbit 1.3 0.075
+        instance crate box position 0 -3 0 rotation 0 45 0
+        scatter 5000 box 30 60 20 90 0.05 0.2 2 7
+
+    material takes textured, emissive and rate 1x1|2x2|4x4. instance takes any of parent NAME, position X Y Z, rotation X Y Z, scale S or scale X Y Z and
+    orbit DISTANCE PERIOD [PHASE|random]. scatter COUNT MESH DMIN DMAX PMIN PMAX SMIN SMAX [HEIGHT [SEED]] adds
+    COUNT orbiting instances with distances, periods and scales drawn from the ranges and heights from
+    [-HEIGHT, HEIGHT], the same for the same seed. The binary variant (WriteBinary) holds the expanded records
+    and loads without parsing. */
+struct SceneDescription
+{
+    std::vector<SceneMaterial> materials;
+    std::vector<SceneMesh> meshes;
+    std::vector<SceneInstance> instances;
+    std::vector<SceneLight> lights;
+    std::vector<SceneCameraKey> cameraKeys;
+    glm::vec3 clearColor;
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraTarget;
+};
+
+namespace SceneFiles
+{
+    // Text or binary, told apart by the magic. Prints the first error with its line and returns false.
+    bool Load(const char *fileName, SceneDescription *scene);
+    bool WriteBinary(const char *fileName, const SceneDescription *scene);
+    // The built-in content, the sun and eight planets at random phases
+    void MakeSolarSystem(SceneDescription *scene);
+}
+
+#endif
@@ -0,0 +1,792 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "server.h"
+#include "renderprotocol.h"
+#include "renderer.h"
+#include "image.h"
+#include "sharedframes.h"
+
+#define SERVER_MAX_WORKERS 16
+#define SERVER_MAX_CONNECTIONS 64
+#define SERVER_MAX_IN_FLIGHT 8          // Requests of one connection queued or rendering, more are read once one is answered
+#define SERVER_QUEUE_PER_WORKER 2       // Default queue length
+#define SERVER_DEFAULT_MAX_WIDTH 1920   // Of the shared memory rings
+#define SERVER_DEFAULT_MAX_HEIGHT 1080
+#define SERVER_LATENCY_SAMPLES 4096     // Latest rendered requests the percentiles are taken from
+#define SERVER_REPORT_SECONDS 10
+#define SERVER_RANDOM_SEED 1            // Every worker builds the same solar system
+
+bool Server::IsRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--server") == 0)
+            return true;
+    }
+    return false;
+}
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct ServerOptions
+{
+    const char *socketPath;
+    Uint32 workerCount;
+    Uint32 queueLength;
+    const char *exportName;     // Prefix of the workers' shared memory rings, NULL for encoded frames only
+    Uint32 maxWidth;
+    Uint32 maxHeight;
+    const char *sceneFile;      // Solar system scene of the workers, NULL for the built-in one
+};
+
+// A request waiting for a worker
+struct ServerJob
+{
+    Uint32 connection;
+    Uint32 generation;          // Of the connection, the answer is dropped when the client went away meanwhile
+    Uint64 receivedTicks;
+    RenderRequest request;
+    RenderObjectTransform transforms[RENDER_MAX_OBJECT_TRANSFORMS];
+};
+
+struct ServerConnection
+{
+    int fd;                     // -1 when the slot is free
+    Uint32 generation;
+    Uint8 input[sizeof(RenderRequest) + RENDER_MAX_OBJECT_TRANSFORMS * sizeof(RenderObjectTransform)];
+    Uint32 inputSize;
+    Uint8 *output;              // Answers not sent yet, written as the socket takes them
+    Uint64 outputSize;
+    Uint64 outputSent;
+    Uint64 outputCapacity;
+    Uint32 inFlight;
+    bool hungUp;                // The client is done sending, closed once its answers are out
+};
+
+// Since the last report
+struct ServerStats
+{
+    Uint32 queueMicros[SERVER_LATENCY_SAMPLES];
+    Uint32 renderMicros[SERVER_LATENCY_SAMPLES];
+    Uint32 totalMicros[SERVER_LATENCY_SAMPLES];
+    Uint32 rendered;
+    Uint32 overloaded;
+    Uint32 expired;
+    Uint32 invalid;
+    Uint32 failed;
+};
+
+struct RenderServer;
+
+// Owns a RenderContext, created and released on the worker's thread
+struct ServerWorker
+{
+    RenderServer *server;
+    Uint32 index;
+    SDL_Thread *thread;
+    RenderContext context;
+    SharedFrames sharedFrames;
+    ImageBuffer image;
+    ServerJob job;
+    bool started;
+    bool failed;
+};
+
+struct RenderServer
+{
+    ServerOptions options;
+    SceneDescription scene;     // Loaded from sceneFile once, each worker builds its own meshes from it
+    int listenFd;
+    int wakeFds[2];             // Read end polled with the sockets, written when answers are queued
+
+    SDL_mutex *mutex;
+    SDL_cond *jobQueued;
+    SDL_cond *workerStarted;
+    bool quit;
+
+    ServerJob *jobs;            // Ring of queueLength requests
+    Uint32 jobHead;
+    Uint32 jobCount;
+    ServerConnection *connections;
+    std::vector<ServerWorker> workers;
+    ServerStats stats;
+    double frequency;
+};
+
+static volatile sig_atomic_t gQuit = 0;
+static int gWakeFd = -1;
+
+static void OnSignal(int)
+{
+    gQuit = 1;
+    char byte = 0;
+    ssize_t written = write(gWakeFd, &byte, 1);
+    (void)written;
+}
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "Usage: SWRasterizer --server PATH [options]\n"
+        "  --workers N         Rasterizers rendering requests at once (%d)\n"
+        "  --queue N           Requests waiting for a worker before new ones are turned away (%u per worker)\n"
+        "  --export NAME       Shared memory rings NAME-0, NAME-1, ... for frames requested without encoding\n"
+        "  --max-size WxH      Largest frame the rings hold (%ux%u)\n"
+        "  --scene FILE        Text or binary scene file replacing the solar system\n",
+        std::max(1, std::min(SDL_GetCPUCount(), SERVER_MAX_WORKERS)), SERVER_QUEUE_PER_WORKER,
+        SERVER_DEFAULT_MAX_WIDTH, SERVER_DEFAULT_MAX_HEIGHT);
+}
+
+static bool ParseOptions(int argc, char *argv[], ServerOptions &options)
+{
+    options.socketPath = NULL;
+    options.workerCount = Uint32(std::max(1, std::min(SDL_GetCPUCount(), SERVER_MAX_WORKERS)));
+    options.queueLength = 0;
+    options.exportName = NULL;
+    options.maxWidth = SERVER_DEFAULT_MAX_WIDTH;
+    options.maxHeight = SERVER_DEFAULT_MAX_HEIGHT;
+    options.sceneFile = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[++i] : "";
+        bool valid = true;
+        if (strcmp(arg, "--server") == 0)
+            valid = (options.socketPath = value)[0] != 0;
+        else if (strcmp(arg, "--workers") == 0)
+            valid = sscanf(value, "%u", &options.workerCount) == 1 && options.workerCount >= 1 && options.workerCount <= SERVER_MAX_WORKERS;
+        else if (strcmp(arg, "--queue") == 0)
+            valid = sscanf(value, "%u", &options.queueLength) == 1 && options.queueLength >= 1;
+        else if (strcmp(arg, "--export") == 0)
+            valid = (options.exportName = value)[0] != 0;
+        else if (strcmp(arg, "--max-size") == 0)
+            valid = sscanf(value, "%ux%u", &options.maxWidth, &options.maxHeight) == 2 &&
+                    options.maxWidth >= RENDER_MIN_SIZE && options.maxWidth <= RENDER_MAX_SIZE &&
+                    options.maxHeight >= RENDER_MIN_SIZE && options.maxHeight <= RENDER_MAX_SIZE;
+        else if (strcmp(arg, "--scene") == 0)
+            valid = (options.sceneFile = value)[0] != 0;
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid option %s %s\n", arg, value);
+            return false;
+        }
+    }
+
+    if (!options.socketPath)
+        return false;
+    if (options.queueLength == 0)
+        options.queueLength = options.workerCount * SERVER_QUEUE_PER_WORKER;
+    return true;
+}
+
+static Uint32 Micros(RenderServer *server, Uint64 ticks)
+{
+    return Uint32(std::min(double(ticks) * 1000000.0 / server->frequency, 4294967295.0));
+}
+
+static void Wake(RenderServer *server)
+{
+    // A full pipe already has the IO loop awake
+    char byte = 0;
+    ssize_t written = write(server->wakeFds[1], &byte, 1);
+    (void)written;
+}
+
+static void QueueOutput(ServerConnection *connection, const void *data, Uint64 size)
+{
+    if (size == 0)
+        return;
+    if (connection->outputSent > 0)
+    {
+        memmove(connection->output, connection->output + connection->outputSent, connection->outputSize - connection->outputSent);
+        connection->outputSize -= connection->outputSent;
+        connection->outputSent = 0;
+    }
+    if (connection->outputSize + size > connection->outputCapacity)
+    {
+        connection->outputCapacity = std::max(connection->outputSize + size, connection->outputCapacity * 2);
+        connection->output = (Uint8*)realloc(connection->output, connection->outputCapacity);
+    }
+    memcpy(connection->output + connection->outputSize, data, size);
+    connection->outputSize += size;
+}
+
+static RenderResponse MakeResponse(const RenderRequest &request, Uint32 status)
+{
+    RenderResponse response = {};
+    response.magic = RENDER_PROTOCOL_MAGIC;
+    response.id = request.id;
+    response.status = status;
+    response.width = request.width;
+    response.height = request.height;
+    response.output = request.output;
+    return response;
+}
+
+static Uint32 ValidateRequest(const RenderRequest &request)
+{
+    bool valid = request.width >= RENDER_MIN_SIZE && request.width <= RENDER_MAX_SIZE &&
+                 request.height >= RENDER_MIN_SIZE && request.height <= RENDER_MAX_SIZE &&
+                 request.output <= RENDER_OUTPUT_QOI &&
+                 (request.scene == RENDER_SCENE_TEST || request.scene == RENDER_SCENE_SOLAR) &&
+                 request.shading >= FLAT_SHADING && request.shading <= PHONG_SHADING;
+    return valid ? RENDER_STATUS_OK : RENDER_STATUS_INVALID;
+}
+
+// Renders the worker's job into the response, followed by the encoded image in worker->image
+static void Render(ServerWorker *worker, RenderResponse *response)
+{
+    RenderServer *server = worker->server;
+    const RenderRequest &request = worker->job.request;
+    RenderContext *context = &worker->context;
+    Uint64 startTicks = SDL_GetPerformanceCounter();
+
+    context->width = request.width;
+    context->height = request.height;
+    context->solarSystem = request.scene == RENDER_SCENE_SOLAR;
+    context->shading = request.shading;
+    CameraControl::SetCameraViewMatrix(&context->camera, glm::make_vec3(request.cameraPosition),
+        glm::make_vec3(request.cameraTarget), glm::make_vec3(request.cameraUp));
+    context->objectTransforms.resize(request.transformCount);
+    for (Uint32 i = 0; i < request.transformCount; ++i)
+    {
+        context->objectTransforms[i].drawIndex = worker->job.transforms[i].drawIndex;
+        context->objectTransforms[i].modelMatrix = glm::make_mat4(worker->job.transforms[i].modelMatrix);
+    }
+
+    // The animation is a function of the time, whatever the worker rendered before
+    context->time = request.time;
+    FrameSharing::BeginFrame(&worker->sharedFrames, &context->rasterizer);
+    Renderer::Update(context, 0.0, true);
+    Uint32 *pixels = Renderer::Present(context);
+    Uint64 renderedTicks = SDL_GetPerformanceCounter();
+    response->renderMicros = Micros(server, renderedTicks - startTicks);
+
+    if (request.output == RENDER_OUTPUT_SHARED)
+    {
+        Uint32 slot = context->rasterizer.frameIndex;
+        if (FrameSharing::Publish(&worker->sharedFrames, &context->rasterizer))
+        {
+            response->slot = slot;
+            response->frame = worker->sharedFrames.publishedFrames - 1;
+            strncpy(response->ring, worker->sharedFrames.name, sizeof(response->ring) - 1);
+            Rasterization::SetFrameBuffer(&context->rasterizer, (slot + 1) % RASTERIZER_FRAME_BUFFERS);
+        }
+        else
+        {
+            response->status = RENDER_STATUS_FAILED;
+        }
+    }
+    else
+    {
+        UtilImage::Encode(&worker->image, request.output, pixels, request.width, request.height);
+        response->encodeMicros = Micros(server, SDL_GetPerformanceCounter() - renderedTicks);
+    }
+    response->size = worker->image.size;
+}
+
+static int WorkerThread(void *data)
+{
+    ServerWorker *worker = (ServerWorker*)data;
+    RenderServer *server = worker->server;
+
+    // The main thread starts one worker at a time, so rand() runs in the same order for each
+    srand(SERVER_RANDOM_SEED);
+    Renderer::Init(&worker->context, RENDER_MIN_SIZE, RENDER_MIN_SIZE);
+    worker->context.fixedCamera = true;
+    if (server->options.sceneFile)
+        Renderer::LoadScene(&worker->context, &server->scene);
+    bool failed = false;
+    if (server->options.exportName)
+    {
+        char name[256];
+        snprintf(name, sizeof(name), "%s-%u", server->options.exportName, worker->index);
+        failed = !FrameSharing::Init(&worker->sharedFrames, name, server->options.maxWidth, server->options.maxHeight,
+                                     &worker->context.rasterizer);
+    }
+
+    SDL_LockMutex(server->mutex);
+    worker->started = true;
+    worker->failed = failed;
+    SDL_CondBroadcast(server->workerStarted);
+    while (!failed)
+    {
+        while (server->jobCount == 0 && !server->quit)
+        {
+            SDL_CondWait(server->jobQueued, server->mutex);
+        }
+        if (server->quit)
+            break;
+
+        // Copied out so the slot takes the next request while this one renders
+        ServerJob *job = &worker->job;
+        *job = server->jobs[server->jobHead];
+        server->jobHead = (server->jobHead + 1) % server->options.queueLength;
+        server->jobCount--;
+        SDL_UnlockMutex(server->mutex);
+
+        Uint64 takenTicks = SDL_GetPerformanceCounter();
+        RenderResponse response = MakeResponse(job->request, RENDER_STATUS_OK);
+        response.worker = worker->index;
+        response.queueMicros = Micros(server, takenTicks - job->receivedTicks);
+        worker->image.size = 0;
+        if (job->request.deadlineMs && response.queueMicros > job->request.deadlineMs * 1000ull)
+            response.status = RENDER_STATUS_EXPIRED;
+        else
+            Render(worker, &response);
+        response.totalMicros = Micros(server, SDL_GetPerformanceCounter() - job->receivedTicks);
+
+        SDL_LockMutex(server->mutex);
+        ServerStats &stats = server->stats;
+        if (response.status == RENDER_STATUS_OK)
+        {
+            Uint32 sample = stats.rendered++ % SERVER_LATENCY_SAMPLES;
+            stats.queueMicros[sample] = response.queueMicros;
+            stats.renderMicros[sample] = response.renderMicros;
+            stats.totalMicros[sample] = response.totalMicros;
+        }
+        else if (response.status == RENDER_STATUS_EXPIRED)
+        {
+            stats.expired++;
+        }
+        else
+        {
+            stats.failed++;
+        }
+
+        ServerConnection *connection = &server->connections[job->connection];
+        if (connection->fd >= 0 && connection->generation == job->generation)
+        {
+            QueueOutput(connection, &response, sizeof(response));
+            QueueOutput(connection, worker->image.data, worker->image.size);
+            connection->inFlight--;
+            Wake(server);
+        }
+    }
+    SDL_UnlockMutex(server->mutex);
+
+    FrameSharing::Release(&worker->sharedFrames);
+    UtilImage::Release(&worker->image);
+    Renderer::Release(&worker->context);
+    return 0;
+}
+
+static void CloseConnection(ServerConnection *connection)
+{
+    close(connection->fd);
+    connection->fd = -1;
+    connection->generation++;
+    connection->inputSize = 0;
+    connection->outputSize = 0;
+    connection->outputSent = 0;
+    connection->inFlight = 0;
+    connection->hungUp = false;
+}
+
+// A whole request is in the connection's input, answered right away unless it is queued for a worker
+static void Accept(RenderServer *server, Uint32 index)
+{
+    ServerConnection *connection = &server->connections[index];
+    const RenderRequest &request = *(const RenderRequest*)connection->input;
+    Uint32 status = ValidateRequest(request);
+    if (status == RENDER_STATUS_OK && server->jobCount == server->options.queueLength)
+        status = RENDER_STATUS_OVERLOADED;
+
+    if (status != RENDER_STATUS_OK)
+    {
+        if (status == RENDER_STATUS_OVERLOADED)
+            server->stats.overloaded++;
+        else
+            server->stats.invalid++;
+        RenderResponse response = MakeResponse(request, status);
+        QueueOutput(connection, &response, sizeof(response));
+        return;
+    }
+
+    ServerJob *job = &server->jobs[(server->jobHead + server->jobCount) % server->options.queueLength];
+    job->connection = index;
+    job->generation = connection->generation;
+    job->receivedTicks = SDL_GetPerformanceCounter();
+    job->request = request;
+    memcpy(job->transforms, connection->input + sizeof(RenderRequest), request.transformCount * sizeof(RenderObjectTransform));
+    server->jobCount++;
+    connection->inFlight++;
+    SDL_CondSignal(server->jobQueued);
+}
+
+// Reads until the socket is drained or the connection has as many requests in flight as it may
+static void ReadRequests(RenderServer *server, Uint32 index)
+{
+    ServerConnection *connection = &server->connections[index];
+    while (connection->inFlight < SERVER_MAX_IN_FLIGHT)
+    {
+        // The header first, it tells how many transforms follow
+        Uint32 needed = sizeof(RenderRequest);
+        if (connection->inputSize >= sizeof(RenderRequest))
+            needed += ((const RenderRequest*)connection->input)->transformCount * sizeof(RenderObjectTransform);
+
+        ssize_t received = recv(connection->fd, connection->input + connection->inputSize, needed - connection->inputSize, 0);
+        if (received == 0)
+        {
+            connection->hungUp = true;
+            return;
+        }
+        if (received < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                CloseConnection(connection);
+            return;
+        }
+        connection->inputSize += Uint32(received);
+
+        // The stream cannot be followed past a broken header
+        const RenderRequest *request = (const RenderRequest*)connection->input;
+        if (connection->inputSize == sizeof(RenderRequest) &&
+            (request->magic != RENDER_PROTOCOL_MAGIC || request->version != RENDER_PROTOCOL_VERSION ||
+             request->transformCount > RENDER_MAX_OBJECT_TRANSFORMS))
+        {
+            fprintf(stderr, "Closing a connection sending an unknown protocol\n");
+            CloseConnection(connection);
+            return;
+        }
+        if (connection->inputSize == sizeof(RenderRequest) + request->transformCount * sizeof(RenderObjectTransform))
+        {
+            Accept(server, index);
+            connection->inputSize = 0;
+        }
+    }
+}
+
+static void WriteResponses(ServerConnection *connection)
+{
+    while (connection->outputSent < connection->outputSize)
+    {
+        ssize_t sent = send(connection->fd, connection->output + connection->outputSent,
+                            connection->outputSize - connection->outputSent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                CloseConnection(connection);
+            return;
+        }
+        connection->outputSent += sent;
+    }
+    connection->outputSize = 0;
+    connection->outputSent = 0;
+}
+
+static Uint32 Percentile(Uint32 *samples, Uint32 count, Uint32 percent)
+{
+    Uint32 *nth = samples + std::min(count - 1, count * percent / 100);
+    std::nth_element(samples, nth, samples + count);
+    return *nth;
+}
+
+static void Report(RenderServer *server, double seconds)
+{
+    ServerStats &stats = server->stats;
+    Uint32 count = std::min(stats.rendered, Uint32(SERVER_LATENCY_SAMPLES));
+    fprintf(stderr, "%.1f requests/s rendered, turned away %u overloaded, %u expired, %u invalid, %u failed\n",
+            stats.rendered / seconds, stats.overloaded, stats.expired, stats.invalid, stats.failed);
+    if (count > 0)
+    {
+        fprintf(stderr, "  queue p50 %.2f p99 %.2f ms, render p50 %.2f p99 %.2f ms, total p50 %.2f p95 %.2f p99 %.2f ms\n",
+                Percentile(stats.queueMicros, count, 50) / 1000.0, Percentile(stats.queueMicros, count, 99) / 1000.0,
+                Percentile(stats.renderMicros, count, 50) / 1000.0, Percentile(stats.renderMicros, count, 99) / 1000.0,
+                Percentile(stats.totalMicros, count, 50) / 1000.0, Percentile(stats.totalMicros, count, 95) / 1000.0,
+                Percentile(stats.totalMicros, count, 99) / 1000.0);
+    }
+    stats = {};
+}
+
+static bool Listen(RenderServer *server)
+{
+    const char *path = server->options.socketPath;
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    // A socket left behind by a server that did not shut down is replaced, any other file is not
+    struct stat status;
+    if (lstat(path, &status) == 0)
+    {
+        if (!S_ISSOCK(status.st_mode))
+        {
+            fprintf(stderr, "%s exists and is not a socket\n", path);
+            return false;
+        }
+        unlink(path);
+    }
+
+    server->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listenFd < 0 || bind(server->listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server->listenFd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Could not listen on %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Accepts clients, reads requests and writes answers until a signal asks to quit
+static void RunLoop(RenderServer *server)
+{
+    struct pollfd fds[2 + SERVER_MAX_CONNECTIONS];
+    Uint32 connectionOfFd[2 + SERVER_MAX_CONNECTIONS];
+    Uint64 reportTicks = SDL_GetPerformanceCounter();
+    while (!gQuit)
+    {
+        SDL_LockMutex(server->mutex);
+        Uint32 fdCount = 2;
+        bool full = true;
+        for (Uint32 i = 0; i < SERVER_MAX_CONNECTIONS; ++i)
+        {
+            ServerConnection *connection = &server->connections[i];
+            if (connection->fd < 0)
+            {
+                full = false;
+                continue;
+            }
+            if (connection->hungUp && connection->outputSize == 0)
+            {
+                if (connection->inFlight == 0)
+                {
+                    CloseConnection(connection);
+                    full = false;
+                }
+                continue;
+            }
+
+            // Not reading is the back pressure on a client with enough requests in flight
+            short events = 0;
+            if (!connection->hungUp && connection->inFlight < SERVER_MAX_IN_FLIGHT)
+                events |= POLLIN;
+            if (connection->outputSent < connection->outputSize)
+                events |= POLLOUT;
+            fds[fdCount] = { connection->fd, events, 0 };
+            connectionOfFd[fdCount++] = i;
+        }
+        SDL_UnlockMutex(server->mutex);
+        fds[0] = { full ? -1 : server->listenFd, POLLIN, 0 };
+        fds[1] = { server->wakeFds[0], POLLIN, 0 };
+
+        int timeout = SERVER_REPORT_SECONDS * 1000;
+        if (poll(fds, fdCount, timeout) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char bytes[256];
+            while (read(server->wakeFds[0], bytes, sizeof(bytes)) > 0)
+            {
+            }
+        }
+
+        SDL_LockMutex(server->mutex);
+        if (fds[0].revents & POLLIN)
+        {
+            int fd;
+            while ((fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+            {
+                ServerConnection *connection = NULL;
+                for (Uint32 i = 0; i < SERVER_MAX_CONNECTIONS && !connection; ++i)
+                {
+                    if (server->connections[i].fd < 0)
+                        connection = &server->connections[i];
+                }
+                if (!connection)
+                {
+                    close(fd);
+                    break;
+                }
+                connection->fd = fd;
+            }
+        }
+
+        for (Uint32 i = 2; i < fdCount; ++i)
+        {
+            ServerConnection *connection = &server->connections[connectionOfFd[i]];
+            if (connection->fd != fds[i].fd)
+                continue;
+            // Hung up without anything left to read, the answers could not be delivered either
+            if ((fds[i].revents & (POLLERR | POLLNVAL)) || (fds[i].revents & (POLLIN | POLLHUP)) == POLLHUP)
+            {
+                CloseConnection(connection);
+                continue;
+            }
+            if (fds[i].revents & POLLIN)
+                ReadRequests(server, connectionOfFd[i]);
+        }
+
+        // Answers the workers queued since the last poll are written too
+        for (Uint32 i = 0; i < SERVER_MAX_CONNECTIONS; ++i)
+        {
+            ServerConnection *connection = &server->connections[i];
+            if (connection->fd >= 0 && connection->outputSent < connection->outputSize)
+                WriteResponses(connection);
+        }
+
+        double seconds = (SDL_GetPerformanceCounter() - reportTicks) / server->frequency;
+        if (seconds >= SERVER_REPORT_SECONDS)
+        {
+            Report(server, seconds);
+            reportTicks = SDL_GetPerformanceCounter();
+        }
+        SDL_UnlockMutex(server->mutex);
+    }
+
+    double seconds = (SDL_GetPerformanceCounter() - reportTicks) / server->frequency;
+    SDL_LockMutex(server->mutex);
+    Report(server, std::max(seconds, 0.001));
+    SDL_UnlockMutex(server->mutex);
+}
+
+static void Shutdown(RenderServer *server)
+{
+    if (server->mutex)
+    {
+        SDL_LockMutex(server->mutex);
+        server->quit = true;
+        SDL_CondBroadcast(server->jobQueued);
+        SDL_UnlockMutex(server->mutex);
+    }
+    for (Uint32 i = 0; i < server->workers.size(); ++i)
+    {
+        if (server->workers[i].thread)
+            SDL_WaitThread(server->workers[i].thread, NULL);
+    }
+    server->workers.clear();
+
+    for (Uint32 i = 0; i < SERVER_MAX_CONNECTIONS && server->connections; ++i)
+    {
+        if (server->connections[i].fd >= 0)
+            close(server->connections[i].fd);
+        free(server->connections[i].output);
+    }
+    free(server->connections);
+    free(server->jobs);
+    if (server->listenFd >= 0)
+    {
+        close(server->listenFd);
+        unlink(server->options.socketPath);
+    }
+    for (Uint32 i = 0; i < 2; ++i)
+    {
+        if (server->wakeFds[i] >= 0)
+            close(server->wakeFds[i]);
+    }
+    gWakeFd = -1;
+    if (server->workerStarted)
+        SDL_DestroyCond(server->workerStarted);
+    if (server->jobQueued)
+        SDL_DestroyCond(server->jobQueued);
+    if (server->mutex)
+        SDL_DestroyMutex(server->mutex);
+}
+
+int Server::Run(int argc, char *argv[])
+{
+    RenderServer server = {};
+    server.listenFd = -1;
+    server.wakeFds[0] = server.wakeFds[1] = -1;
+    server.frequency = double(SDL_GetPerformanceFrequency());
+    if (!ParseOptions(argc, argv, server.options))
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (server.options.sceneFile && !SceneFiles::Load(server.options.sceneFile, &server.scene))
+        return 1;
+
+    server.jobs = (ServerJob*)calloc(server.options.queueLength, sizeof(ServerJob));
+    server.connections = (ServerConnection*)calloc(SERVER_MAX_CONNECTIONS, sizeof(ServerConnection));
+    for (Uint32 i = 0; i < SERVER_MAX_CONNECTIONS; ++i)
+    {
+        server.connections[i].fd = -1;
+    }
+    server.mutex = SDL_CreateMutex();
+    server.jobQueued = SDL_CreateCond();
+    server.workerStarted = SDL_CreateCond();
+    if (!server.mutex || !server.jobQueued || !server.workerStarted ||
+        pipe2(server.wakeFds, O_NONBLOCK | O_CLOEXEC) != 0 || !Listen(&server))
+    {
+        Shutdown(&server);
+        return 1;
+    }
+
+    gQuit = 0;
+    gWakeFd = server.wakeFds[1];
+    struct sigaction action = {};
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // One at a time, each worker seeds rand() before building its scene
+    server.workers.resize(server.options.workerCount);
+    bool failed = false;
+    for (Uint32 i = 0; i < server.options.workerCount && !failed; ++i)
+    {
+        ServerWorker *worker = &server.workers[i];
+        worker->server = &server;
+        worker->index = i;
+        worker->thread = SDL_CreateThread(WorkerThread, "RenderWorker", worker);
+        if (!worker->thread)
+        {
+            failed = true;
+            break;
+        }
+        SDL_LockMutex(server.mutex);
+        while (!worker->started)
+        {
+            SDL_CondWait(server.workerStarted, server.mutex);
+        }
+        failed = worker->failed;
+        SDL_UnlockMutex(server.mutex);
+    }
+    if (failed)
+    {
+        fprintf(stderr, "Could not start the render workers\n");
+        Shutdown(&server);
+        return 1;
+    }
+
+    fprintf(stderr, "Listening on %s with %u workers, queue of %u\n", server.options.socketPath,
+            server.options.workerCount, server.options.queueLength);
+    RunLoop(&server);
+    Shutdown(&server);
+    return 0;
+}
+
+#else
+
+// Unix domain sockets and the shared memory rings are only implemented for Linux
+int Server::Run(int, char *[])
+{
+    fprintf(stderr, "The render server is only supported on Linux\n");
+    return 1;
+}
+
+#endif
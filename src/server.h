@@ -0,0 +1,22 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*  Renders frames on request for other processes on the same machine. Clients connect to a Unix domain socket and
+    send the camera, scene and object transforms of a frame (see renderprotocol.h). A pool of workers, each with its
+    own RenderContext, renders the queued requests and answers with the encoded image or with the slot of the
+    worker's shared memory ring:
+
+        SWRasterizer --server /tmp/swrasterizer.sock --workers 4 --queue 8
+        SWRasterizer --server /tmp/swrasterizer.sock --export /swrasterizer --max-size 1920x1080
+
+    The queue is bounded, requests arriving while it is full are answered as overloaded at once, and requests that
+    waited longer than their deadline are dropped unrendered. Runs until SIGINT or SIGTERM, printing the latencies
+    every few seconds. */
+namespace Server
+{
+    bool IsRequested(int argc, char *argv[]);
+    // Returns the process exit code
+    int Run(int argc, char *argv[]);
+}
+
+#endif
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <assert.h>
+#include <stdlib.h>
+#include "shading.h"
+#include "rasterizer.h"
+
+using glm::vec3;
+using glm::normalize;
+using glm::clamp;
+using std::min;
+using std::max;
+
+/*  Fast math: the specular term x^shininess is read from a table per shininess value and vectors are normalized
+    with Simd::Rsqrt. Each table covers x in [lo, 1], lo = max(0, 1 - 6.5 / shininess), sampled uniformly and
+    linearly interpolated. Below lo x^shininess < e^-6.5, so clamping to the first entry costs at most 1.5e-3.
+    Measured max absolute error of the specular term is 1.5e-3 (under half an 8 bit step) for every shininess,
+    normalization adds a relative error below 3e-7. */
+#define SPECULAR_LUT_SIZE 128
+#define SPECULAR_LUT_COUNT 11   // Shininess 2, 4, ..., 2048
+
+struct SpecularTable
+{
+    float lo[SPECULAR_LUT_COUNT];
+    float scale[SPECULAR_LUT_COUNT];   // Entries per unit of x
+    float values[SPECULAR_LUT_COUNT][SPECULAR_LUT_SIZE + 1];
+
+    constexpr SpecularTable() : lo(), scale(), values()
+    {
+        for (int i = 0; i < SPECULAR_LUT_COUNT; ++i)
+        {
+            float shininess = float(2 << i);
+            float start = 1.0f - 6.5f / shininess;
+            if (start < 0.0f)
+                start = 0.0f;
+            lo[i] = start;
+            scale[i] = SPECULAR_LUT_SIZE / (1.0f - start);
+
+            for (int j = 0; j <= SPECULAR_LUT_SIZE; ++j)
+            {
+                // x^(2^(i + 1)) by repeated squaring
+                double x = start + (1.0 - start) * j / SPECULAR_LUT_SIZE;
+                for (int k = 0; k <= i; ++k)
+                    x *= x;
+                values[i][j] = float(x);
+            }
+        }
+    }
+};
+
+static constexpr SpecularTable gSpecularTable;
+
+// Table row for the shininess, -1 if it is not a tabulated power of two
+static int SpecularRow(int shininess)
+{
+    for (int i = 0; i < SPECULAR_LUT_COUNT; ++i)
+    {
+        if (shininess == 2 << i)
+            return i;
+    }
+    return -1;
+}
+
+static float Specular(const Uniforms *uniforms, float RVdot)
+{
+    int row = uniforms->fastMath ? SpecularRow(uniforms->shininess) : -1;
+    if (row < 0)
+        return pow(RVdot, uniforms->shininess);
+
+    float t = clamp((RVdot - gSpecularTable.lo[row]) * gSpecularTable.scale[row], 0.0f, float(SPECULAR_LUT_SIZE));
+    int index = min(int(t), SPECULAR_LUT_SIZE - 1);
+    const float *values = gSpecularTable.values[row];
+    return values[index] + (t - float(index)) * (values[index + 1] - values[index]);
+}
+
+static vec3 Normalize(const Uniforms *uniforms, vec3 v)
+{
+    return uniforms->fastMath ? v * Simd::Rsqrt(dot(v, v)) : normalize(v);
+}
+
+static VFloat RecSqrt(const Uniforms *uniforms, VFloat lengthSquared)
+{
+    using namespace Simd;
+    return uniforms->fastMath ? Rsqrt(lengthSquared) : Div(Set(1.0f), Sqrt(lengthSquared));
+}
+
+static VFloat RecLength(const Uniforms *uniforms, VFloat x, VFloat y, VFloat z)
+{
+    return RecSqrt(uniforms, Simd::Dot(x, y, z, x, y, z));
+}
+
+static VFloat Specular(const Uniforms *uniforms, VFloat RVdot)
+{
+    using namespace Simd;
+    int row = uniforms->fastMath ? SpecularRow(uniforms->shininess) : -1;
+    if (row < 0)
+        return Pow(RVdot, Set(float(uniforms->shininess)));
+
+    VFloat t = Clamp(Mul(Sub(RVdot, Set(gSpecularTable.lo[row])), Set(gSpecularTable.scale[row])), 0.0f, float(SPECULAR_LUT_SIZE));
+    VInt index = Truncate(Min(t, Set(float(SPECULAR_LUT_SIZE - 1))));
+    VFloat fraction = Sub(t, ToFloat(index));
+    const float *values = gSpecularTable.values[row];
+    VFloat v0 = Gather(values, index);
+    VFloat v1 = Gather(values + 1, index);
+    return MulAdd(fraction, Sub(v1, v0), v0);
+}
+
+// Diffuse only, the falloff (1 - d^2 / r^2)^2 reaches zero at the light radius
+static vec3 PointLighting(const Uniforms *uniforms, const LightList *lights, vec3 worldPos, vec3 N)
+{
+    vec3 result = vec3(0.0f);
+    for (Uint32 i = 0; lights && i < lights->count; ++i)
+    {
+        const PointLight &light = lights->lights[lights->indices[i]];
+        vec3 L = light.position - worldPos;
+        float distanceSquared = max(dot(L, L), 1e-8f);
+        float falloff = max(1.0f - distanceSquared / (light.radius * light.radius), 0.0f);
+        float recDistance = uniforms->fastMath ? Simd::Rsqrt(distanceSquared) : 1.0f / sqrtf(distanceSquared);
+        float NLdot = max(dot(N, L) * recDistance, 0.0f);
+        result += light.color * (NLdot * falloff * falloff);
+    }
+    return result;
+}
+
+// The sun mesh holds the point light, it is never in shadow
+static float ShadowVisibility(const Uniforms *uniforms, vec3 worldPos, vec3 worldNormal)
+{
+    if (!uniforms->shadowMap || uniforms->sunMesh)
+        return 1.0f;
+    return Shadows::Visibility(uniforms->shadowMap, worldPos, worldNormal);
+}
+
+// Define to check every vectorized fragment against the scalar model (differences of at most 1 per channel)
+// #define VALIDATE_SIMD_SHADING
+
+vec3 Shading::Phong(const Uniforms *uniforms, vec3 albedo, vec3 worldPos, vec3 worldNormal, const LightList *lights)
+{
+    vec3 N = Normalize(uniforms, worldNormal);
+    vec3 V = Normalize(uniforms, uniforms->worldCameraPosition - worldPos);
+    vec3 specColor = vec3(1.0f, 1.0f, 1.0f);
+    float ambient = 0.2f;
+    vec3 L;
+
+    if (uniforms->directionalLightOn)
+    {
+        L = uniforms->worldLightDirection;
+    }
+    else // Solar system
+    {
+        L = Normalize(uniforms, worldPos - uniforms->worldLightPosition);
+        if (uniforms->sunMesh)
+        {
+            L = -V;
+            ambient += 0.4f;
+        }
+        specColor = vec3(0, 0, 0);
+    }
+
+    float NLdot = max(dot(-L, N), 0.0f) * ShadowVisibility(uniforms, worldPos, worldNormal);
+    float diffuse = NLdot;
+
+    vec3 R = Normalize(uniforms, glm::reflect(L, N));
+    float specular = NLdot * Specular(uniforms, max(dot(R, V), 0.0f));
+    vec3 shadedColor = (ambient + diffuse + PointLighting(uniforms, lights, worldPos, N)) * albedo + specular * specColor;
+
+    return clamp(shadedColor, 0.0f, 1.0f);
+}
+
+void Shading::SetLights(PhongBatch *batch, Uint32 tile, const LightList *lights)
+{
+    if (batch->tile != tile)
+    {
+        Flush(batch);
+        batch->tile = tile;
+        batch->lights = *lights;
+    }
+}
+
+void Shading::WriteCoverage(Uint32 *origin, Uint32 stride, Uint32 coverage, Uint32 color)
+{
+    // Rows of smooth surfaces are mostly fully covered
+    for (; coverage; coverage >>= 4, origin += stride)
+    {
+        Uint32 row = coverage & 0xf;
+        if (row == 0xf)
+        {
+            origin[0] = origin[1] = origin[2] = origin[3] = color;
+            continue;
+        }
+        for (Uint32 column = 0; column < 4; ++column)
+        {
+            if (row & (1 << column))
+                origin[column] = color;
+        }
+    }
+}
+
+void Shading::AddFragment(PhongBatch *batch, vec3 albedo, vec3 worldPos, vec3 worldNormal, Uint32 *destination, Uint32 coverage)
+{
+    const Uniforms *uniforms = batch->uniforms;
+    Uint32 lane = batch->count;
+    batch->worldPosX[lane] = worldPos.x;
+    batch->worldPosY[lane] = worldPos.y;
+    batch->worldPosZ[lane] = worldPos.z;
+    batch->worldNormalX[lane] = worldNormal.x;
+    batch->worldNormalY[lane] = worldNormal.y;
+    batch->worldNormalZ[lane] = worldNormal.z;
+    batch->albedoR[lane] = albedo.r;
+    batch->albedoG[lane] = albedo.g;
+    batch->albedoB[lane] = albedo.b;
+    batch->shadow[lane] = ShadowVisibility(uniforms, worldPos, worldNormal);
+    batch->destinations[lane] = destination;
+    batch->coverage[lane] = Uint16(coverage);
+
+    if (++batch->count == SIMD_WIDTH)
+        Flush(batch);
+}
+
+#ifdef VALIDATE_SIMD_SHADING
+static void ValidateBatch(PhongBatch *batch, Sint32 *colors)
+{
+    for (Uint32 lane = 0; lane < batch->count; ++lane)
+    {
+        vec3 albedo = vec3(batch->albedoR[lane], batch->albedoG[lane], batch->albedoB[lane]);
+        vec3 worldPos = vec3(batch->worldPosX[lane], batch->worldPosY[lane], batch->worldPosZ[lane]);
+        vec3 worldNormal = vec3(batch->worldNormalX[lane], batch->worldNormalY[lane], batch->worldNormalZ[lane]);
+        vec3 expected = Shading::Phong(batch->uniforms, albedo, worldPos, worldNormal, &batch->lights) * 255.0f;
+
+        assert(abs(Sint32(expected.r) - ((colors[lane] >> batch->redShift) & 0xff)) <= 1);
+        assert(abs(Sint32(expected.g) - ((colors[lane] >> 8) & 0xff)) <= 1);
+        assert(abs(Sint32(expected.b) - ((colors[lane] >> batch->blueShift) & 0xff)) <= 1);
+    }
+}
+#endif
+
+// Same model as Shading::Phong, one fragment per lane. The light setup is uniform so it is branched on once per batch.
+void Shading::Flush(PhongBatch *batch)
+{
+    using namespace Simd;
+
+    if (batch->count == 0)
+        return;
+
+    const Uniforms *uniforms = batch->uniforms;
+
+    VFloat posX = Load(batch->worldPosX);
+    VFloat posY = Load(batch->worldPosY);
+    VFloat posZ = Load(batch->worldPosZ);
+
+    VFloat nX = Load(batch->worldNormalX);
+    VFloat nY = Load(batch->worldNormalY);
+    VFloat nZ = Load(batch->worldNormalZ);
+    VFloat recLength = RecLength(uniforms, nX, nY, nZ);
+    nX = Mul(nX, recLength);
+    nY = Mul(nY, recLength);
+    nZ = Mul(nZ, recLength);
+
+    VFloat vX = Sub(Set(uniforms->worldCameraPosition.x), posX);
+    VFloat vY = Sub(Set(uniforms->worldCameraPosition.y), posY);
+    VFloat vZ = Sub(Set(uniforms->worldCameraPosition.z), posZ);
+    recLength = RecLength(uniforms, vX, vY, vZ);
+    vX = Mul(vX, recLength);
+    vY = Mul(vY, recLength);
+    vZ = Mul(vZ, recLength);
+
+    VFloat lX, lY, lZ;
+    float ambient = 0.2f;
+    bool specularOn = true;
+    if (uniforms->directionalLightOn)
+    {
+        lX = Set(uniforms->worldLightDirection.x);
+        lY = Set(uniforms->worldLightDirection.y);
+        lZ = Set(uniforms->worldLightDirection.z);
+    }
+    else if (uniforms->sunMesh)
+    {
+        lX = Sub(Set(0.0f), vX);
+        lY = Sub(Set(0.0f), vY);
+        lZ = Sub(Set(0.0f), vZ);
+        ambient += 0.4f;
+        specularOn = false;
+    }
+    else
+    {
+        lX = Sub(posX, Set(uniforms->worldLightPosition.x));
+        lY = Sub(posY, Set(uniforms->worldLightPosition.y));
+        lZ = Sub(posZ, Set(uniforms->worldLightPosition.z));
+        recLength = RecLength(uniforms, lX, lY, lZ);
+        lX = Mul(lX, recLength);
+        lY = Mul(lY, recLength);
+        lZ = Mul(lZ, recLength);
+        specularOn = false;
+    }
+
+    VFloat NLdot = Dot(nX, nY, nZ, lX, lY, lZ);
+    VFloat diffuse = Mul(Max(Sub(Set(0.0f), NLdot), Set(0.0f)), Load(batch->shadow));
+    VFloat lighting = Add(Set(ambient), diffuse);
+    VFloat lightingR = lighting;
+    VFloat lightingG = lighting;
+    VFloat lightingB = lighting;
+
+    // Point lights of the tile, same for all lanes
+    for (Uint32 i = 0; i < batch->lights.count; ++i)
+    {
+        const PointLight &light = batch->lights.lights[batch->lights.indices[i]];
+        VFloat plX = Sub(Set(light.position.x), posX);
+        VFloat plY = Sub(Set(light.position.y), posY);
+        VFloat plZ = Sub(Set(light.position.z), posZ);
+        VFloat distanceSquared = Max(Dot(plX, plY, plZ, plX, plY, plZ), Set(1e-8f));
+        VFloat falloff = Max(Sub(Set(1.0f), Mul(distanceSquared, Set(1.0f / (light.radius * light.radius)))), Set(0.0f));
+        VFloat pointNLdot = Max(Mul(Dot(nX, nY, nZ, plX, plY, plZ), RecSqrt(uniforms, distanceSquared)), Set(0.0f));
+        VFloat intensity = Mul(pointNLdot, Mul(falloff, falloff));
+        lightingR = MulAdd(intensity, Set(light.color.r), lightingR);
+        lightingG = MulAdd(intensity, Set(light.color.g), lightingG);
+        lightingB = MulAdd(intensity, Set(light.color.b), lightingB);
+    }
+
+    VFloat r = Mul(lightingR, Load(batch->albedoR));
+    VFloat g = Mul(lightingG, Load(batch->albedoG));
+    VFloat b = Mul(lightingB, Load(batch->albedoB));
+
+    // The solar system lights have a black specular color, skip the pow entirely there
+    if (specularOn)
+    {
+        // R = L - 2 * dot(N, L) * N
+        VFloat twoNLdot = Add(NLdot, NLdot);
+        VFloat rX = Sub(lX, Mul(twoNLdot, nX));
+        VFloat rY = Sub(lY, Mul(twoNLdot, nY));
+        VFloat rZ = Sub(lZ, Mul(twoNLdot, nZ));
+        recLength = RecLength(uniforms, rX, rY, rZ);
+
+        VFloat RVdot = Max(Mul(Dot(rX, rY, rZ, vX, vY, vZ), recLength), Set(0.0f));
+        VFloat specular = Mul(diffuse, Specular(uniforms, RVdot));
+        r = Add(r, specular);
+        g = Add(g, specular);
+        b = Add(b, specular);
+    }
+
+    // Clamp and pack (alpha is not used)
+    VFloat scale = Set(255.0f);
+    VInt r8 = Truncate(Mul(Clamp(r, 0.0f, 1.0f), scale));
+    VInt g8 = Truncate(Mul(Clamp(g, 0.0f, 1.0f), scale));
+    VInt b8 = Truncate(Mul(Clamp(b, 0.0f, 1.0f), scale));
+    VInt packed = Or(ShiftLeft(r8, batch->redShift), Or(ShiftLeft(g8, 8), ShiftLeft(b8, batch->blueShift)));
+
+    Sint32 colors[SIMD_WIDTH];
+    Store(colors, packed);
+
+#ifdef VALIDATE_SIMD_SHADING
+    ValidateBatch(batch, colors);
+#endif
+
+    for (Uint32 lane = 0; lane < batch->count; ++lane)
+    {
+        if (batch->coverage[lane] == 1)
+            *batch->destinations[lane] = Uint32(colors[lane]);
+        else
+            WriteCoverage(batch->destinations[lane], batch->stride, batch->coverage[lane], Uint32(colors[lane]));
+    }
+    batch->count = 0;
+    batch->generation++;
+}
@@ -0,0 +1,91 @@
+#ifndef SHADING_H
+#define SHADING_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+#include "simd.h"
+
+struct ShadowMap;
+
+// Shader uniforms, owned by the rasterizer and set before each draw, so several contexts can render at once
+struct Uniforms
+{
+    glm::mat4 modelMatrix;
+    glm::mat4 viewMatrix;
+    glm::mat4 mvpMatrix;
+    glm::vec3 worldCameraPosition;
+    glm::vec3 worldLightDirection;
+    glm::vec3 worldLightPosition;
+    bool directionalLightOn;
+    bool sunMesh;
+    int shading;
+    bool texturingOn;
+    int shininess;
+    bool fastMath;
+    ShadowMap *shadowMap;       // NULL when shadows are off
+    int shadingRate;
+    Uint32 drawTag;
+};
+
+// Point lights fade out smoothly and reach zero at their radius, so they can be culled per screen tile
+struct PointLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float radius;
+};
+
+// The point lights that may affect one screen tile
+struct LightList
+{
+    const PointLight *lights;
+    const Uint32 *indices;
+    Uint32 count;
+};
+
+/*  Phong fragments waiting to be lit, stored as a structure of arrays so that one batch maps to one vector
+    register per component. Only the first count lanes hold fragments, the rest are masked off when the batch
+    is written back. Fragments are written in the order they were added, so a later fragment to the same pixel
+    (which has already passed the depth test against the earlier one) still wins. */
+struct PhongBatch
+{
+    float worldPosX[SIMD_WIDTH];
+    float worldPosY[SIMD_WIDTH];
+    float worldPosZ[SIMD_WIDTH];
+    float worldNormalX[SIMD_WIDTH];
+    float worldNormalY[SIMD_WIDTH];
+    float worldNormalZ[SIMD_WIDTH];
+    float albedoR[SIMD_WIDTH];
+    float albedoG[SIMD_WIDTH];
+    float albedoB[SIMD_WIDTH];
+    float shadow[SIMD_WIDTH];   // Shadow map visibility, looked up when the fragment is added
+    Uint32 *destinations[SIMD_WIDTH];
+    Uint16 coverage[SIMD_WIDTH];    // Pixels of the 4x4 block at the destination written with the lane's color
+    Uint32 stride;                  // Framebuffer row length
+    Uint32 redShift;                // Channel order of the framebuffer
+    Uint32 blueShift;
+    Uint32 count;
+    Uint32 generation;              // Incremented by every flush
+
+    // All fragments of a batch come from the same light tile
+    Uint32 tile;
+    LightList lights;
+    const Uniforms *uniforms;       // Of the draw the fragments belong to
+};
+
+namespace Shading
+{
+    // Scalar Phong reflection model, used per vertex for flat/Gouraud shading and as the reference for the batches
+    glm::vec3 Phong(const Uniforms *uniforms, glm::vec3 albedo, glm::vec3 worldPos, glm::vec3 worldNormal, const LightList *lights);
+
+    // Switching to another tile lights the pending fragments first
+    void SetLights(PhongBatch *batch, Uint32 tile, const LightList *lights);
+    // Lights a full batch as soon as it fills up
+    void AddFragment(PhongBatch *batch, glm::vec3 albedo, glm::vec3 worldPos, glm::vec3 worldNormal, Uint32 *destination, Uint32 coverage);
+    void Flush(PhongBatch *batch);
+
+    // Writes color to the pixels of a 4x4 block selected by coverage (bit = row * 4 + column)
+    void WriteCoverage(Uint32 *origin, Uint32 stride, Uint32 coverage, Uint32 color);
+}
+
+#endif
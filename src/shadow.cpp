@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "shadow.h"
+
+using glm::vec3;
+using glm::vec4;
+using glm::mat4;
+
+#define SHADOW_DEPTH_BIAS 1e-4f     // NDC depth, on top of the normal offset
+
+void Shadows::Init(ShadowMap *shadowMap, Uint32 size, Uint32 faceCount)
+{
+    *shadowMap = {};
+    shadowMap->faceCount = faceCount;
+    Resize(shadowMap, size);
+}
+
+void Shadows::Resize(ShadowMap *shadowMap, Uint32 size)
+{
+    free(shadowMap->depth);
+    shadowMap->size = size;
+    shadowMap->depth = (float*)malloc(shadowMap->faceCount * size * size * sizeof(float));
+    Clear(shadowMap);
+}
+
+void Shadows::Release(ShadowMap *shadowMap)
+{
+    free(shadowMap->depth);
+    shadowMap->depth = NULL;
+}
+
+void Shadows::Clear(ShadowMap *shadowMap)
+{
+    Uint32 texelCount = shadowMap->faceCount * shadowMap->size * shadowMap->size;
+    std::fill(shadowMap->depth, shadowMap->depth + texelCount, FLT_MAX);
+}
+
+void Shadows::SetDirectional(ShadowMap *shadowMap, vec3 direction, vec3 center, float radius)
+{
+    vec3 up = fabsf(direction.y) > 0.99f ? vec3(0.0f, 0.0f, 1.0f) : vec3(0.0f, 1.0f, 0.0f);
+    mat4 view = glm::lookAt(center - direction * 2.0f * radius, center, up);
+    mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius);
+
+    shadowMap->viewProjection[0] = projection * view;
+    shadowMap->lightPosition = center - direction * 2.0f * radius;
+    shadowMap->normalOffset = 1.5f * 2.0f * radius / float(shadowMap->size);
+    shadowMap->normalOffsetPerDistance = 0.0f;
+}
+
+void Shadows::SetPoint(ShadowMap *shadowMap, vec3 position, float zNear, float zFar)
+{
+    const vec3 targets[SHADOW_MAX_FACES] = { vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+    const vec3 ups[SHADOW_MAX_FACES] = { vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0) };
+
+    mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, zNear, zFar);
+    for (Uint32 face = 0; face < SHADOW_MAX_FACES; ++face)
+    {
+        shadowMap->viewProjection[face] = projection * glm::lookAt(position, position + targets[face], ups[face]);
+    }
+
+    // A texel spans 2 / size of the distance to the light
+    shadowMap->lightPosition = position;
+    shadowMap->normalOffset = 0.0f;
+    shadowMap->normalOffsetPerDistance = 1.5f * 2.0f / float(shadowMap->size);
+}
+
+// Cube face whose frustum contains the direction (the major axis)
+static Uint32 CubeFace(vec3 direction)
+{
+    vec3 a = glm::abs(direction);
+    if (a.x >= a.y && a.x >= a.z)
+        return direction.x > 0.0f ? 0 : 1;
+    if (a.y >= a.z)
+        return direction.y > 0.0f ? 2 : 3;
+    return direction.z > 0.0f ? 4 : 5;
+}
+
+float Shadows::Visibility(ShadowMap *shadowMap, vec3 worldPos, vec3 worldNormal)
+{
+    vec3 toLight = shadowMap->lightPosition - worldPos;
+    float offset = shadowMap->normalOffset + shadowMap->normalOffsetPerDistance * glm::length(toLight);
+    vec3 position = worldPos + glm::normalize(worldNormal) * offset;
+
+    Uint32 face = shadowMap->faceCount == SHADOW_MAX_FACES ? CubeFace(position - shadowMap->lightPosition) : 0;
+    vec4 clip = shadowMap->viewProjection[face] * vec4(position, 1.0f);
+    if (clip.w <= 0.0f)
+        return 1.0f;
+
+    // Same viewport transform as the rasterizer
+    Sint32 size = shadowMap->size;
+    float recW = 1.0f / clip.w;
+    Sint32 x = Sint32(floorf((clip.x * recW * 0.5f + 0.5f) * size + 0.5f));
+    Sint32 y = Sint32(floorf((clip.y * recW * -0.5f + 0.5f) * size + 0.5f));
+    float depth = clip.z * recW - SHADOW_DEPTH_BIAS;
+    if (x < 0 || y < 0 || x >= size || y >= size)
+        return 1.0f;
+
+    const float *texels = shadowMap->depth + face * size * size;
+    Uint32 lit = 0;
+    for (Sint32 dy = -1; dy <= 1; ++dy)
+    {
+        Sint32 ty = std::min(std::max(y + dy, 0), size - 1);
+        for (Sint32 dx = -1; dx <= 1; ++dx)
+        {
+            Sint32 tx = std::min(std::max(x + dx, 0), size - 1);
+            lit += depth <= texels[ty * size + tx];
+        }
+    }
+    return lit / 9.0f;
+}
@@ -0,0 +1,39 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+
+#define SHADOW_MAX_FACES 6  // Cube maps use the faces +X, -X, +Y, -Y, +Z, -Z
+
+/*  Depth maps rendered from the light with Rasterization::DrawDepthMesh. Texel (x, y) of a face holds the nearest
+    NDC depth at raster position (x, y), the same sample positions RasterizeTriangles uses. */
+struct ShadowMap
+{
+    float *depth;           // faceCount * size * size
+    Uint32 size;
+    Uint32 faceCount;       // 1 for the directional light, 6 for the point light cube map
+    glm::mat4 viewProjection[SHADOW_MAX_FACES];
+    glm::vec3 lightPosition;
+
+    // The lookup position is pushed along the normal by about a texel to avoid shadow acne
+    float normalOffset;
+    float normalOffsetPerDistance;
+};
+
+namespace Shadows
+{
+    void Init(ShadowMap *shadowMap, Uint32 size, Uint32 faceCount);
+    void Resize(ShadowMap *shadowMap, Uint32 size);
+    void Release(ShadowMap *shadowMap);
+    void Clear(ShadowMap *shadowMap);
+
+    // Orthographic map covering a sphere of the given radius around center
+    void SetDirectional(ShadowMap *shadowMap, glm::vec3 direction, glm::vec3 center, float radius);
+    void SetPoint(ShadowMap *shadowMap, glm::vec3 position, float zNear, float zFar);
+
+    // Fraction of a 3x3 percentage closer filter that is lit, 1 outside the map
+    float Visibility(ShadowMap *shadowMap, glm::vec3 worldPos, glm::vec3 worldNormal);
+}
+
+#endif
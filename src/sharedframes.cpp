@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include "sharedframes.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(FRAME_RING_SLOTS == RASTERIZER_FRAME_BUFFERS, "One ring slot per frame buffer");
+
+static Uint64 AlignUp(Uint64 size)
+{
+    return (size + FRAME_RING_ALIGNMENT - 1) & ~Uint64(FRAME_RING_ALIGNMENT - 1);
+}
+
+// The slot the rasterizer renders into, -1 when it went back to its own buffers
+static int CurrentSlot(const SharedFrames *frames, const Rasterizer *rasterizer)
+{
+    Uint32 slot = rasterizer->frameIndex;
+    const Uint8 *pixels = (const Uint8*)frames->header + frames->header->slots[slot].offset;
+    if (!rasterizer->externalFrameBuffers || (const Uint8*)rasterizer->frameBuffer != pixels)
+        return -1;
+    return int(slot);
+}
+
+// Unlinks the ring a crashed renderer left behind, its readers keep the old memory. False for anything else.
+static bool RemoveStaleRing(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    bool stale = false;
+    struct stat status;
+    if (fstat(fd, &status) == 0 && Uint64(status.st_size) >= sizeof(FrameRingHeader))
+    {
+        void *memory = mmap(NULL, sizeof(FrameRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (memory != MAP_FAILED)
+        {
+            const FrameRingHeader *header = (const FrameRingHeader*)memory;
+            pid_t writer = pid_t(header->writerPid);
+            stale = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == FRAME_RING_MAGIC && writer > 0 &&
+                kill(writer, 0) != 0 && errno == ESRCH;
+            munmap(memory, sizeof(FrameRingHeader));
+        }
+    }
+    close(fd);
+    return stale && shm_unlink(name) == 0;
+}
+
+bool FrameSharing::Init(SharedFrames *frames, const char *name, Uint32 maxWidth, Uint32 maxHeight, Rasterizer *rasterizer)
+{
+    *frames = {};
+    Uint32 capacity = maxWidth * maxHeight;
+    Uint64 slotSize = AlignUp(Uint64(capacity) * sizeof(Uint32));
+    Uint64 size = AlignUp(sizeof(FrameRingHeader)) + FRAME_RING_SLOTS * slotSize;
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    bool exists = fd < 0 && errno == EEXIST;
+    if (exists && RemoveStaleRing(name))
+    {
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        exists = fd < 0 && errno == EEXIST;
+    }
+    if (fd < 0)
+    {
+        if (exists)
+            fprintf(stderr, "Could not create the shared frames %s, the name is held by a running renderer or another program\n", name);
+        else
+            fprintf(stderr, "Could not create the shared frames %s\n", name);
+        return false;
+    }
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0)
+        memory = mmap(NULL, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %llu bytes of shared frames\n", (unsigned long long)size);
+        shm_unlink(name);
+        return false;
+    }
+
+    // The new file is zeroed, so readers that open it early see no magic and no frame yet
+    FrameRingHeader *header = (FrameRingHeader*)memory;
+    header->version = FRAME_RING_VERSION;
+    header->slotCount = FRAME_RING_SLOTS;
+    header->slotCapacity = capacity;
+    header->size = size;
+    header->latestSlot = -1;
+    header->writerPid = Sint32(getpid());
+    Uint32 *buffers[RASTERIZER_FRAME_BUFFERS];
+    for (Uint32 i = 0; i < FRAME_RING_SLOTS; ++i)
+    {
+        header->slots[i].offset = AlignUp(sizeof(FrameRingHeader)) + i * slotSize;
+        buffers[i] = (Uint32*)((Uint8*)memory + header->slots[i].offset);
+    }
+    __atomic_store_n(&header->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+
+    strncpy(frames->name, name, sizeof(frames->name) - 1);
+    frames->header = header;
+    frames->size = size;
+    Rasterization::SetFrameBuffers(rasterizer, buffers, capacity);
+    return true;
+}
+
+void FrameSharing::Release(SharedFrames *frames)
+{
+    if (!frames->header)
+        return;
+
+    __atomic_fetch_or(&frames->header->published, FRAME_RING_CLOSED, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &frames->header->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    // Readers keep their mapping until they close it
+    munmap(frames->header, size_t(frames->size));
+    shm_unlink(frames->name);
+    *frames = {};
+}
+
+void FrameSharing::BeginFrame(SharedFrames *frames, const Rasterizer *rasterizer)
+{
+    if (!frames->header)
+        return;
+    int slot = CurrentSlot(frames, rasterizer);
+    if (slot < 0)
+        return;
+
+    // Odd until Publish, the pixel writes must not become visible before it
+    Uint32 *sequence = &frames->header->slots[slot].sequence;
+    Uint32 value = __atomic_load_n(sequence, __ATOMIC_RELAXED);
+    if ((value & 1) == 0)
+        __atomic_store_n(sequence, value + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+bool FrameSharing::Publish(SharedFrames *frames, const Rasterizer *rasterizer)
+{
+    if (!frames->header)
+        return false;
+    int slot = CurrentSlot(frames, rasterizer);
+    if (slot < 0)
+        return false;
+
+    FrameRingHeader *header = frames->header;
+    FrameRingSlot &ringSlot = header->slots[slot];
+    BeginFrame(frames, rasterizer);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    __atomic_store_n(&ringSlot.frame, frames->publishedFrames++, __ATOMIC_RELAXED);
+    __atomic_store_n(&ringSlot.width, rasterizer->width, __ATOMIC_RELAXED);
+    __atomic_store_n(&ringSlot.height, rasterizer->height, __ATOMIC_RELAXED);
+    __atomic_store_n(&ringSlot.pitch, rasterizer->width * Uint32(sizeof(Uint32)), __ATOMIC_RELAXED);
+    __atomic_store_n(&ringSlot.format, rasterizer->pixelFormat, __ATOMIC_RELAXED);
+    __atomic_store_n(&ringSlot.timestamp, Uint64(now.tv_sec) * 1000000000ull + Uint64(now.tv_nsec), __ATOMIC_RELAXED);
+    __atomic_store_n(&ringSlot.sequence, ringSlot.sequence + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&header->latestSlot, slot, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&header->published, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &header->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return true;
+}
+
+#else
+
+// Shared memory export is only implemented for Linux
+bool FrameSharing::Init(SharedFrames *frames, const char *name, Uint32, Uint32, Rasterizer *)
+{
+    *frames = {};
+    fprintf(stderr, "Could not create the shared frames %s, only supported on Linux\n", name);
+    return false;
+}
+
+void FrameSharing::Release(SharedFrames *frames)
+{
+    *frames = {};
+}
+
+void FrameSharing::BeginFrame(SharedFrames *, const Rasterizer *)
+{
+}
+
+bool FrameSharing::Publish(SharedFrames *, const Rasterizer *)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SHAREDFRAMES_H
+#define SHAREDFRAMES_H
+
+#include <SDL2/SDL.h>
+#include "rasterizer.h"
+#include "framereader.h"
+
+/*  Exports the rendered frames to other processes. The rasterizer's frame buffers are the slots of a POSIX shared
+    memory ring, so it renders straight into memory the readers map. Publishing a frame only fills in the slot
+    header and wakes the readers, the pixels are never copied. Readers use FrameReading from framereader.h. */
+struct SharedFrames
+{
+    char name[256];
+    FrameRingHeader *header;
+    Uint64 size;
+    Uint32 publishedFrames;
+};
+
+namespace FrameSharing
+{
+    // Creates the ring for frames up to maxWidth x maxHeight and has the rasterizer render into it
+    bool Init(SharedFrames *frames, const char *name, Uint32 maxWidth, Uint32 maxHeight, Rasterizer *rasterizer);
+    // Tells the readers no more frames follow and removes the ring, once the rasterizer is done with it
+    void Release(SharedFrames *frames);
+    // Call before rendering into the rasterizer's current frame buffer
+    void BeginFrame(SharedFrames *frames, const Rasterizer *rasterizer);
+    // Makes the current frame buffer the latest frame, false when the frame outgrew the ring
+    bool Publish(SharedFrames *frames, const Rasterizer *rasterizer);
+}
+
+#endif
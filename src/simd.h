@@ -0,0 +1,275 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <math.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#endif
+
+/*  Thin wrappers over the widest vector unit the compiler targets. AVX-512 (/arch:AVX512, -mavx512f) gives
+    16 lanes, AVX2 (/arch:AVX2, -mavx2) 8 lanes. Without either the lanes are plain arrays which the compiler
+    is free to auto-vectorize. Comparisons return masks with all bits set in the lanes where they hold.
+    StoreBytes writes the low byte of every lane, the lanes have to be in [0, 255]. Deinterleave splits the
+    2 * SIMD_WIDTH lanes of a followed by b into the even and the odd ones. */
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_WIDTH 16
+struct VFloat { __m512 v; };
+struct VInt { __m512i v; };
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+struct VFloat { __m256 v; };
+struct VInt { __m256i v; };
+#else
+#define SIMD_WIDTH 8
+struct VFloat { float v[SIMD_WIDTH]; };
+struct VInt { Sint32 v[SIMD_WIDTH]; };
+#endif
+
+namespace Simd
+{
+#if defined(__AVX512F__)
+    inline VFloat Load(const float *p) { return VFloat{ _mm512_loadu_ps(p) }; }
+    inline void Store(float *p, VFloat a) { _mm512_storeu_ps(p, a.v); }
+    inline void Store(Sint32 *p, VInt a) { _mm512_storeu_si512(p, a.v); }
+    inline VInt LoadInt(const Sint32 *p) { return VInt{ _mm512_loadu_si512(p) }; }
+    inline void StoreBytes(Uint8 *p, VInt a) { _mm_storeu_si128((__m128i*)p, _mm512_cvtepi32_epi8(a.v)); }
+    inline void Deinterleave(VInt a, VInt b, VInt &even, VInt &odd)
+    {
+        __m512i evenIndices = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+        even.v = _mm512_permutex2var_epi32(a.v, evenIndices, b.v);
+        odd.v = _mm512_permutex2var_epi32(a.v, _mm512_add_epi32(evenIndices, _mm512_set1_epi32(1)), b.v);
+    }
+    inline VFloat Set(float a) { return VFloat{ _mm512_set1_ps(a) }; }
+    inline VFloat Add(VFloat a, VFloat b) { return VFloat{ _mm512_add_ps(a.v, b.v) }; }
+    inline VFloat Sub(VFloat a, VFloat b) { return VFloat{ _mm512_sub_ps(a.v, b.v) }; }
+    inline VFloat Mul(VFloat a, VFloat b) { return VFloat{ _mm512_mul_ps(a.v, b.v) }; }
+    inline VFloat Div(VFloat a, VFloat b) { return VFloat{ _mm512_div_ps(a.v, b.v) }; }
+    inline VFloat Min(VFloat a, VFloat b) { return VFloat{ _mm512_min_ps(a.v, b.v) }; }
+    inline VFloat Max(VFloat a, VFloat b) { return VFloat{ _mm512_max_ps(a.v, b.v) }; }
+    inline VFloat Sqrt(VFloat a) { return VFloat{ _mm512_sqrt_ps(a.v) }; }
+    inline VFloat RsqrtEstimate(VFloat a) { return VFloat{ _mm512_rsqrt14_ps(a.v) }; }
+    inline VFloat Gather(const float *table, VInt index) { return VFloat{ _mm512_i32gather_ps(index.v, table, 4) }; }
+    inline VFloat Floor(VFloat a) { return VFloat{ _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC) }; }
+    inline VInt SetInt(Sint32 a) { return VInt{ _mm512_set1_epi32(a) }; }
+    inline VInt AddInt(VInt a, VInt b) { return VInt{ _mm512_add_epi32(a.v, b.v) }; }
+    inline VInt SubInt(VInt a, VInt b) { return VInt{ _mm512_sub_epi32(a.v, b.v) }; }
+    inline VInt MulInt(VInt a, VInt b) { return VInt{ _mm512_mullo_epi32(a.v, b.v) }; }
+    inline VInt And(VInt a, VInt b) { return VInt{ _mm512_and_si512(a.v, b.v) }; }
+    inline VInt Or(VInt a, VInt b) { return VInt{ _mm512_or_si512(a.v, b.v) }; }
+    inline VInt ShiftLeft(VInt a, int n) { return VInt{ _mm512_sll_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+    inline VInt ShiftRight(VInt a, int n) { return VInt{ _mm512_srl_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+    inline VInt Truncate(VFloat a) { return VInt{ _mm512_cvttps_epi32(a.v) }; }
+    inline VFloat ToFloat(VInt a) { return VFloat{ _mm512_cvtepi32_ps(a.v) }; }
+    inline VInt AsInt(VFloat a) { return VInt{ _mm512_castps_si512(a.v) }; }
+    inline VFloat AsFloat(VInt a) { return VFloat{ _mm512_castsi512_ps(a.v) }; }
+    inline VInt GatherInt(const Sint32 *table, VInt index) { return VInt{ _mm512_i32gather_epi32(index.v, table, 4) }; }
+    inline VInt Equal(VInt a, VInt b) { return VInt{ _mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(a.v, b.v), _mm512_set1_epi32(-1)) }; }
+    inline VInt Less(VFloat a, VFloat b) { return VInt{ _mm512_maskz_mov_epi32(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ), _mm512_set1_epi32(-1)) }; }
+    inline VInt LessEqual(VFloat a, VFloat b) { return VInt{ _mm512_maskz_mov_epi32(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ), _mm512_set1_epi32(-1)) }; }
+#elif defined(__AVX2__)
+    inline VFloat Load(const float *p) { return VFloat{ _mm256_loadu_ps(p) }; }
+    inline void Store(float *p, VFloat a) { _mm256_storeu_ps(p, a.v); }
+    inline void Store(Sint32 *p, VInt a) { _mm256_storeu_si256((__m256i*)p, a.v); }
+    inline VInt LoadInt(const Sint32 *p) { return VInt{ _mm256_loadu_si256((const __m256i*)p) }; }
+    inline void StoreBytes(Uint8 *p, VInt a)
+    {
+        // Packing works within the 128 bit halves, so each half ends up with 4 of the bytes
+        __m256i words = _mm256_packus_epi32(a.v, a.v);
+        __m256i bytes = _mm256_packus_epi16(words, words);
+        Uint32 low = Uint32(_mm256_extract_epi32(bytes, 0)), high = Uint32(_mm256_extract_epi32(bytes, 4));
+        memcpy(p, &low, 4);
+        memcpy(p + 4, &high, 4);
+    }
+    inline void Deinterleave(VInt a, VInt b, VInt &even, VInt &odd)
+    {
+        // The shuffles work within the 128 bit halves, the permute puts the 64 bit pairs back in order
+        __m256 fa = _mm256_castsi256_ps(a.v), fb = _mm256_castsi256_ps(b.v);
+        even.v = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, 0x88)), 0xd8);
+        odd.v = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, 0xdd)), 0xd8);
+    }
+    inline VFloat Set(float a) { return VFloat{ _mm256_set1_ps(a) }; }
+    inline VFloat Add(VFloat a, VFloat b) { return VFloat{ _mm256_add_ps(a.v, b.v) }; }
+    inline VFloat Sub(VFloat a, VFloat b) { return VFloat{ _mm256_sub_ps(a.v, b.v) }; }
+    inline VFloat Mul(VFloat a, VFloat b) { return VFloat{ _mm256_mul_ps(a.v, b.v) }; }
+    inline VFloat Div(VFloat a, VFloat b) { return VFloat{ _mm256_div_ps(a.v, b.v) }; }
+    inline VFloat Min(VFloat a, VFloat b) { return VFloat{ _mm256_min_ps(a.v, b.v) }; }
+    inline VFloat Max(VFloat a, VFloat b) { return VFloat{ _mm256_max_ps(a.v, b.v) }; }
+    inline VFloat Sqrt(VFloat a) { return VFloat{ _mm256_sqrt_ps(a.v) }; }
+    inline VFloat RsqrtEstimate(VFloat a) { return VFloat{ _mm256_rsqrt_ps(a.v) }; }
+    inline VFloat Gather(const float *table, VInt index) { return VFloat{ _mm256_i32gather_ps(table, index.v, 4) }; }
+    inline VFloat Floor(VFloat a) { return VFloat{ _mm256_floor_ps(a.v) }; }
+    inline VInt SetInt(Sint32 a) { return VInt{ _mm256_set1_epi32(a) }; }
+    inline VInt AddInt(VInt a, VInt b) { return VInt{ _mm256_add_epi32(a.v, b.v) }; }
+    inline VInt SubInt(VInt a, VInt b) { return VInt{ _mm256_sub_epi32(a.v, b.v) }; }
+    inline VInt MulInt(VInt a, VInt b) { return VInt{ _mm256_mullo_epi32(a.v, b.v) }; }
+    inline VInt And(VInt a, VInt b) { return VInt{ _mm256_and_si256(a.v, b.v) }; }
+    inline VInt Or(VInt a, VInt b) { return VInt{ _mm256_or_si256(a.v, b.v) }; }
+    inline VInt ShiftLeft(VInt a, int n) { return VInt{ _mm256_sll_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+    inline VInt ShiftRight(VInt a, int n) { return VInt{ _mm256_srl_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+    inline VInt Truncate(VFloat a) { return VInt{ _mm256_cvttps_epi32(a.v) }; }
+    inline VFloat ToFloat(VInt a) { return VFloat{ _mm256_cvtepi32_ps(a.v) }; }
+    inline VInt AsInt(VFloat a) { return VInt{ _mm256_castps_si256(a.v) }; }
+    inline VFloat AsFloat(VInt a) { return VFloat{ _mm256_castsi256_ps(a.v) }; }
+    inline VInt GatherInt(const Sint32 *table, VInt index) { return VInt{ _mm256_i32gather_epi32((const int*)table, index.v, 4) }; }
+    inline VInt Equal(VInt a, VInt b) { return VInt{ _mm256_cmpeq_epi32(a.v, b.v) }; }
+    inline VInt Less(VFloat a, VFloat b) { return VInt{ _mm256_castps_si256(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)) }; }
+    inline VInt LessEqual(VFloat a, VFloat b) { return VInt{ _mm256_castps_si256(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)) }; }
+#else
+#define SIMD_LANES(expr) for (int i = 0; i < SIMD_WIDTH; ++i) { expr; }
+    inline VFloat Load(const float *p) { VFloat r; SIMD_LANES(r.v[i] = p[i]); return r; }
+    inline void Store(float *p, VFloat a) { SIMD_LANES(p[i] = a.v[i]); }
+    inline void Store(Sint32 *p, VInt a) { SIMD_LANES(p[i] = a.v[i]); }
+    inline VInt LoadInt(const Sint32 *p) { VInt r; SIMD_LANES(r.v[i] = p[i]); return r; }
+    inline void StoreBytes(Uint8 *p, VInt a) { SIMD_LANES(p[i] = Uint8(a.v[i])); }
+    inline void Deinterleave(VInt a, VInt b, VInt &even, VInt &odd)
+    {
+        for (int i = 0; i < SIMD_WIDTH / 2; ++i)
+        {
+            even.v[i] = a.v[2 * i];
+            odd.v[i] = a.v[2 * i + 1];
+            even.v[i + SIMD_WIDTH / 2] = b.v[2 * i];
+            odd.v[i + SIMD_WIDTH / 2] = b.v[2 * i + 1];
+        }
+    }
+    inline VFloat Set(float a) { VFloat r; SIMD_LANES(r.v[i] = a); return r; }
+    inline VFloat Add(VFloat a, VFloat b) { VFloat r; SIMD_LANES(r.v[i] = a.v[i] + b.v[i]); return r; }
+    inline VFloat Sub(VFloat a, VFloat b) { VFloat r; SIMD_LANES(r.v[i] = a.v[i] - b.v[i]); return r; }
+    inline VFloat Mul(VFloat a, VFloat b) { VFloat r; SIMD_LANES(r.v[i] = a.v[i] * b.v[i]); return r; }
+    inline VFloat Div(VFloat a, VFloat b) { VFloat r; SIMD_LANES(r.v[i] = a.v[i] / b.v[i]); return r; }
+    inline VFloat Min(VFloat a, VFloat b) { VFloat r; SIMD_LANES(r.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]); return r; }
+    inline VFloat Max(VFloat a, VFloat b) { VFloat r; SIMD_LANES(r.v[i] = b.v[i] > a.v[i] ? b.v[i] : a.v[i]); return r; }
+    inline VFloat Sqrt(VFloat a) { VFloat r; SIMD_LANES(r.v[i] = sqrtf(a.v[i])); return r; }
+    inline VFloat RsqrtEstimate(VFloat a) { VFloat r; SIMD_LANES(r.v[i] = 1.0f / sqrtf(a.v[i])); return r; }
+    inline VFloat Gather(const float *table, VInt index) { VFloat r; SIMD_LANES(r.v[i] = table[index.v[i]]); return r; }
+    inline VFloat Floor(VFloat a) { VFloat r; SIMD_LANES(r.v[i] = floorf(a.v[i])); return r; }
+    inline VInt SetInt(Sint32 a) { VInt r; SIMD_LANES(r.v[i] = a); return r; }
+    inline VInt AddInt(VInt a, VInt b) { VInt r; SIMD_LANES(r.v[i] = Sint32(Uint32(a.v[i]) + Uint32(b.v[i]))); return r; }
+    inline VInt SubInt(VInt a, VInt b) { VInt r; SIMD_LANES(r.v[i] = Sint32(Uint32(a.v[i]) - Uint32(b.v[i]))); return r; }
+    inline VInt MulInt(VInt a, VInt b) { VInt r; SIMD_LANES(r.v[i] = Sint32(Uint32(a.v[i]) * Uint32(b.v[i]))); return r; }
+    inline VInt And(VInt a, VInt b) { VInt r; SIMD_LANES(r.v[i] = a.v[i] & b.v[i]); return r; }
+    inline VInt Or(VInt a, VInt b) { VInt r; SIMD_LANES(r.v[i] = a.v[i] | b.v[i]); return r; }
+    inline VInt ShiftLeft(VInt a, int n) { VInt r; SIMD_LANES(r.v[i] = Sint32(Uint32(a.v[i]) << n)); return r; }
+    inline VInt ShiftRight(VInt a, int n) { VInt r; SIMD_LANES(r.v[i] = Sint32(Uint32(a.v[i]) >> n)); return r; }
+    inline VInt Truncate(VFloat a) { VInt r; SIMD_LANES(r.v[i] = Sint32(a.v[i])); return r; }
+    inline VFloat ToFloat(VInt a) { VFloat r; SIMD_LANES(r.v[i] = float(a.v[i])); return r; }
+    inline VInt AsInt(VFloat a) { VInt r; memcpy(r.v, a.v, sizeof(r.v)); return r; }
+    inline VFloat AsFloat(VInt a) { VFloat r; memcpy(r.v, a.v, sizeof(r.v)); return r; }
+    inline VInt GatherInt(const Sint32 *table, VInt index) { VInt r; SIMD_LANES(r.v[i] = table[index.v[i]]); return r; }
+    inline VInt Equal(VInt a, VInt b) { VInt r; SIMD_LANES(r.v[i] = a.v[i] == b.v[i] ? -1 : 0); return r; }
+    inline VInt Less(VFloat a, VFloat b) { VInt r; SIMD_LANES(r.v[i] = a.v[i] < b.v[i] ? -1 : 0); return r; }
+    inline VInt LessEqual(VFloat a, VFloat b) { VInt r; SIMD_LANES(r.v[i] = a.v[i] <= b.v[i] ? -1 : 0); return r; }
+#undef SIMD_LANES
+#endif
+
+    inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return Add(Mul(a, b), c); }
+
+    // 1/sqrt(a) from the hardware estimate refined by one Newton-Raphson step. The estimate has a relative error
+    // of at most 1.5 * 2^-12 (2^-14 with AVX-512), after the step the error is below 3e-7.
+    inline VFloat Rsqrt(VFloat a)
+    {
+        VFloat y = RsqrtEstimate(a);
+        VFloat halfAyy = Mul(Mul(Set(0.5f), a), Mul(y, y));
+        return Mul(y, Sub(Set(1.5f), halfAyy));
+    }
+
+    inline float Rsqrt(float a)
+    {
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+        float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(a)));
+        return y * (1.5f - 0.5f * a * y * y);
+#else
+        return 1.0f / sqrtf(a);
+#endif
+    }
+
+    inline VFloat Clamp(VFloat a, float lo, float hi) { return Min(Max(a, Set(lo)), Set(hi)); }
+    inline VFloat Dot(VFloat ax, VFloat ay, VFloat az, VFloat bx, VFloat by, VFloat bz)
+    {
+        return MulAdd(ax, bx, MulAdd(ay, by, Mul(az, bz)));
+    }
+
+    // log2 of positive, normal x. The mantissa m in [1, 2) goes through log(m) = 2 * atanh((m - 1) / (m + 1)),
+    // whose series is truncated after the s^13 term (absolute error below 2e-7).
+    inline VFloat Log2(VFloat x)
+    {
+        VInt bits = AsInt(x);
+        VFloat exponent = ToFloat(AddInt(ShiftRight(bits, 23), SetInt(-127)));
+        VFloat m = AsFloat(Or(And(bits, SetInt(0x007fffff)), SetInt(0x3f800000)));
+
+        VFloat s = Div(Sub(m, Set(1.0f)), Add(m, Set(1.0f)));
+        VFloat s2 = Mul(s, s);
+        VFloat series = Set(1.0f / 13.0f);
+        series = MulAdd(series, s2, Set(1.0f / 11.0f));
+        series = MulAdd(series, s2, Set(1.0f / 9.0f));
+        series = MulAdd(series, s2, Set(1.0f / 7.0f));
+        series = MulAdd(series, s2, Set(1.0f / 5.0f));
+        series = MulAdd(series, s2, Set(1.0f / 3.0f));
+        series = MulAdd(series, s2, Set(1.0f));
+        const float twoOverLn2 = 2.0f / 0.69314718f;
+        return MulAdd(Mul(series, s), Set(twoOverLn2), exponent);
+    }
+
+    // 2^x for x in [-126, 126]. The fraction uses the degree 7 Taylor polynomial of e^(f ln2), relative
+    // error below 1.5e-6.
+    inline VFloat Exp2(VFloat x)
+    {
+        x = Clamp(x, -126.0f, 126.0f);
+        VFloat whole = Floor(x);
+        VFloat f = Mul(Sub(x, whole), Set(0.69314718f));
+
+        VFloat p = Set(1.0f / 5040.0f);
+        p = MulAdd(p, f, Set(1.0f / 720.0f));
+        p = MulAdd(p, f, Set(1.0f / 120.0f));
+        p = MulAdd(p, f, Set(1.0f / 24.0f));
+        p = MulAdd(p, f, Set(1.0f / 6.0f));
+        p = MulAdd(p, f, Set(0.5f));
+        p = MulAdd(p, f, Set(1.0f));
+        p = MulAdd(p, f, Set(1.0f));
+
+        VFloat scale = AsFloat(ShiftLeft(AddInt(Truncate(whole), SetInt(127)), 23));
+        return Mul(p, scale);
+    }
+
+    // x^y for x >= 0. Zero (and denormal) x returns (nearly) zero for positive y.
+    inline VFloat Pow(VFloat x, VFloat y)
+    {
+        return Exp2(Mul(y, Log2(Max(x, Set(1e-30f)))));
+    }
+
+    // Sine and cosine of x for |x| up to a few thousand. The nearest multiple of pi/2 is subtracted in three parts
+    // (Cody-Waite), the remainder in [-pi/4, pi/4] goes through the minimax polynomials of Cephes' sinf and cosf,
+    // absolute error below 1e-7.
+    inline void SinCos(VFloat x, VFloat &sine, VFloat &cosine)
+    {
+        VFloat quadrant = Floor(MulAdd(x, Set(0.63661977f), Set(0.5f)));
+        VFloat r = MulAdd(quadrant, Set(-1.5703125f), x);
+        r = MulAdd(quadrant, Set(-4.837512969970703125e-4f), r);
+        r = MulAdd(quadrant, Set(-7.54978995489188216e-8f), r);
+        VFloat r2 = Mul(r, r);
+
+        VFloat s = Set(-1.9515295891e-4f);
+        s = MulAdd(s, r2, Set(8.3321608736e-3f));
+        s = MulAdd(s, r2, Set(-1.6666654611e-1f));
+        s = MulAdd(Mul(s, r2), r, r);
+
+        VFloat c = Set(2.443315711809948e-5f);
+        c = MulAdd(c, r2, Set(-1.388731625493765e-3f));
+        c = MulAdd(c, r2, Set(4.166664568298827e-2f));
+        c = MulAdd(Mul(c, r2), r2, MulAdd(r2, Set(-0.5f), Set(1.0f)));
+
+        // Odd quadrants swap the two, the sine is negative in quadrants 2 and 3, the cosine in 1 and 2
+        VInt q = Truncate(quadrant);
+        VInt swap = SubInt(SetInt(0), And(q, SetInt(1)));
+        VInt keep = SubInt(SetInt(-1), swap);
+        VFloat swappedSine = AsFloat(Or(And(swap, AsInt(c)), And(keep, AsInt(s))));
+        VFloat swappedCosine = AsFloat(Or(And(swap, AsInt(s)), And(keep, AsInt(c))));
+        sine = Mul(swappedSine, Sub(Set(1.0f), ToFloat(And(q, SetInt(2)))));
+        cosine = Mul(swappedCosine, Sub(Set(1.0f), ToFloat(And(AddInt(q, SetInt(1)), SetInt(2)))));
+    }
+}
+
+#endif
@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "temporal.h"
+#include "simd.h"
+
+using glm::vec4;
+using glm::mat4;
+
+// Accepted difference of the reprojected and the previous NDC depth, relative to 1 - depth. For a perspective
+// projection that is about the relative difference of the view depths.
+#define TEMPORAL_DEPTH_TOLERANCE 0.02f
+
+void Temporal::Init(TemporalState *temporal)
+{
+    *temporal = {};
+}
+
+void Temporal::Release(TemporalState *temporal)
+{
+    free(temporal->tags);
+    free(temporal->historyColor);
+    free(temporal->historyDepth);
+    free(temporal->historyTags);
+    free(temporal->spans);
+    free(temporal->historySpans);
+    free(temporal->draws);
+    free(temporal->historyDraws);
+    free(temporal->reprojections);
+    *temporal = {};
+}
+
+// Quad lanes shaded this frame. The half pattern alternates the diagonals, the quarter one visits the lanes in
+// the order 0, 3, 1, 2 so that consecutive frames are far apart.
+static Uint32 ShadePattern(Uint32 mode, Uint32 frame)
+{
+    if (mode == CHECKERBOARD_HALF)
+        return (frame & 1) ? 0x6 : 0x9;
+    if (mode == CHECKERBOARD_QUARTER)
+    {
+        const Uint32 lanes[4] = { 0, 3, 1, 2 };
+        return 1 << lanes[frame & 3];
+    }
+    return 0xf;
+}
+
+static void ClearSpans(Sint32 *spans, Uint32 width, Uint32 height)
+{
+    for (Uint32 y = 0; y < height; ++y)
+    {
+        spans[2 * y] = Sint32(width);
+        spans[2 * y + 1] = -1;
+    }
+}
+
+void Temporal::BeginFrame(TemporalState *temporal, Rasterizer *rasterizer, Uint32 mode)
+{
+    temporal->mode = mode;
+    temporal->drawCount = 0;
+    if (mode == CHECKERBOARD_OFF)
+    {
+        rasterizer->pixelTags = NULL;
+        rasterizer->shadePattern = 0xf;
+        temporal->historyValid = false;
+        return;
+    }
+
+    Uint32 width = rasterizer->width;
+    Uint32 height = rasterizer->height;
+    Uint32 pixelCount = width * height;
+    if (rasterizer->pixelCapacity > temporal->pixelCapacity)
+    {
+        Uint32 capacity = rasterizer->pixelCapacity;
+        temporal->pixelCapacity = capacity;
+        temporal->tags = (Uint32*)realloc(temporal->tags, capacity * sizeof(Uint32));
+        temporal->historyColor = (Uint32*)realloc(temporal->historyColor, capacity * sizeof(Uint32));
+        temporal->historyDepth = (float*)realloc(temporal->historyDepth, capacity * sizeof(float));
+        temporal->historyTags = (Uint32*)realloc(temporal->historyTags, capacity * sizeof(Uint32));
+    }
+    if (height > temporal->rowCapacity)
+    {
+        temporal->rowCapacity = height;
+        temporal->spans = (Sint32*)realloc(temporal->spans, 2 * height * sizeof(Sint32));
+        temporal->historySpans = (Sint32*)realloc(temporal->historySpans, 2 * height * sizeof(Sint32));
+    }
+    if (temporal->width != width || temporal->height != height)
+    {
+        temporal->width = width;
+        temporal->height = height;
+        memset(temporal->tags, 0, pixelCount * sizeof(Uint32));
+        memset(temporal->historyTags, 0, pixelCount * sizeof(Uint32));
+        ClearSpans(temporal->spans, width, height);
+        ClearSpans(temporal->historySpans, width, height);
+        temporal->historyValid = false;
+    }
+
+    // Tags are only ever written inside the spans, clearing those clears the buffer. The buffer was last used two
+    // frames ago and still has that frame's spans.
+    for (Uint32 y = 0; y < height; ++y)
+    {
+        Sint32 first = temporal->spans[2 * y];
+        Sint32 last = temporal->spans[2 * y + 1];
+        if (first <= last)
+            memset(temporal->tags + y * width + first, 0, (last - first + 1) * sizeof(Uint32));
+    }
+    ClearSpans(temporal->spans, width, height);
+
+    rasterizer->pixelTags = temporal->tags;
+    rasterizer->tagSpans = temporal->spans;
+    rasterizer->shadePattern = ShadePattern(mode, temporal->frame);
+}
+
+Uint32 Temporal::AddDraw(TemporalState *temporal, const Mesh *mesh, const mat4 &mvpMatrix)
+{
+    if (temporal->mode == CHECKERBOARD_OFF)
+        return 0;
+
+    if (temporal->drawCount == temporal->drawCapacity)
+    {
+        temporal->drawCapacity = std::max(temporal->drawCapacity * 2, 16u);
+        temporal->draws = (TemporalDraw*)realloc(temporal->draws, temporal->drawCapacity * sizeof(TemporalDraw));
+    }
+    temporal->draws[temporal->drawCount] = TemporalDraw{ mesh, mvpMatrix };
+    return ++temporal->drawCount;
+}
+
+// Screen position and NDC depth of the current frame to the clip space position of the previous frame. Draws that
+// did not exist in the previous frame get a zero matrix, which fails the w > 0 test.
+static void UpdateReprojections(TemporalState *temporal)
+{
+    mat4 screenToNdc = mat4(1.0f);
+    screenToNdc[0][0] = 2.0f / float(temporal->width);
+    screenToNdc[1][1] = -2.0f / float(temporal->height);
+    screenToNdc[3][0] = -1.0f;
+    screenToNdc[3][1] = 1.0f;
+
+    temporal->reprojections = (mat4*)realloc(temporal->reprojections, std::max(temporal->drawCount, 1u) * sizeof(mat4));
+    for (Uint32 i = 0; i < temporal->drawCount; ++i)
+    {
+        TemporalDraw &draw = temporal->draws[i];
+        if (temporal->historyValid && i < temporal->historyDrawCount && temporal->historyDraws[i].mesh == draw.mesh)
+            temporal->reprojections[i] = temporal->historyDraws[i].mvpMatrix * glm::inverse(draw.mvpMatrix) * screenToNdc;
+        else
+            temporal->reprojections[i] = mat4(0.0f);
+    }
+}
+
+// clip is the previous clip space position of the pixel
+static bool Reproject(TemporalState *temporal, Uint32 tag, vec4 clip, Uint32 &color)
+{
+    if (clip.w <= 0.0f)
+        return false;
+
+    // Position in the previous frame, the same viewport transform as the rasterizer
+    float recW = 1.0f / clip.w;
+    float px = (clip.x * recW * 0.5f + 0.5f) * float(temporal->width);
+    float py = (clip.y * recW * -0.5f + 0.5f) * float(temporal->height);
+    float previousDepth = clip.z * recW;
+    float tolerance = TEMPORAL_DEPTH_TOLERANCE * (1.0f - previousDepth);
+    if (!(px > -1.0f && py > -1.0f && px < float(temporal->width) && py < float(temporal->height)))
+        return false;
+
+    /*  Bilinear filter over the pixels the previous frame shaded itself. Its reconstructed pixels are left out,
+        otherwise a color could be carried along for many frames while the lighting changes under it. The taps
+        alternate between shaded and not in a checkerboard, so they are weighted without branches. The small bias
+        keeps taps with a zero weight usable when they are the only valid ones. */
+    Sint32 width = temporal->width;
+    Sint32 height = temporal->height;
+    Sint32 x0 = Sint32(floorf(px));
+    Sint32 y0 = Sint32(floorf(py));
+    float fx = px - float(x0);
+    float fy = py - float(y0);
+    float r = 0.0f, g = 0.0f, b = 0.0f, weightSum = 0.0f;
+    for (Uint32 tap = 0; tap < 4; ++tap)
+    {
+        Sint32 tx = std::min(std::max(x0 + Sint32(tap & 1), 0), width - 1);
+        Sint32 ty = std::min(std::max(y0 + Sint32(tap >> 1), 0), height - 1);
+        Uint32 index = ty * width + tx;
+        bool valid = temporal->historyTags[index] == (tag | PIXEL_TAG_SHADED) &&
+                     fabsf(temporal->historyDepth[index] - previousDepth) <= tolerance;
+
+        float weight = ((tap & 1) ? fx : 1.0f - fx) * ((tap >> 1) ? fy : 1.0f - fy) + 1e-3f;
+        weight = valid ? weight : 0.0f;
+        Uint32 c = temporal->historyColor[index];
+        r += weight * float(c & 0xff);
+        g += weight * float((c >> 8) & 0xff);
+        b += weight * float((c >> 16) & 0xff);
+        weightSum += weight;
+    }
+    if (weightSum == 0.0f)
+        return false;
+
+    float recWeight = 1.0f / weightSum;
+    color = Uint32(b * recWeight + 0.5f) << 16 | Uint32(g * recWeight + 0.5f) << 8 | Uint32(r * recWeight + 0.5f);
+    return true;
+}
+
+// Average of the pixels of the same draw shaded this frame in the 3x3 neighbourhood
+static bool Fill(TemporalState *temporal, Uint32 *frameBuffer, Uint32 tag, Uint32 x, Uint32 y, Uint32 &color)
+{
+    Uint32 r = 0, g = 0, b = 0, count = 0;
+    Uint32 minX = x > 0 ? x - 1 : x;
+    Uint32 minY = y > 0 ? y - 1 : y;
+    Uint32 maxX = std::min(x + 1, temporal->width - 1);
+    Uint32 maxY = std::min(y + 1, temporal->height - 1);
+    for (Uint32 ny = minY; ny <= maxY; ++ny)
+    {
+        for (Uint32 nx = minX; nx <= maxX; ++nx)
+        {
+            Uint32 index = ny * temporal->width + nx;
+            if (temporal->tags[index] != (tag | PIXEL_TAG_SHADED))
+                continue;
+            Uint32 c = frameBuffer[index];
+            r += c & 0xff;
+            g += (c >> 8) & 0xff;
+            b += (c >> 16) & 0xff;
+            count++;
+        }
+    }
+    if (count == 0)
+        return false;
+
+    color = (b / count) << 16 | (g / count) << 8 | (r / count);
+    return true;
+}
+
+// Vector version of Reproject for SIMD_WIDTH pixels of the same draw, returns the mask of the reprojected lanes
+static VInt ReprojectBatch(TemporalState *temporal, Uint32 tag, VFloat clipX, VFloat clipY, VFloat clipZ, VFloat clipW, VInt &colors)
+{
+    using namespace Simd;
+    float width = float(temporal->width);
+    float height = float(temporal->height);
+
+    // Lanes behind the camera end up with NaN or out of range positions, the comparisons reject both
+    VFloat recW = Div(Set(1.0f), clipW);
+    VFloat px = Mul(MulAdd(Mul(clipX, recW), Set(0.5f), Set(0.5f)), Set(width));
+    VFloat py = Mul(MulAdd(Mul(clipY, recW), Set(-0.5f), Set(0.5f)), Set(height));
+    VFloat previousDepth = Mul(clipZ, recW);
+    VFloat tolerance = Mul(Sub(Set(1.0f), previousDepth), Set(TEMPORAL_DEPTH_TOLERANCE));
+    VInt inside = And(And(Less(Set(0.0f), clipW), And(Less(Set(-1.0f), px), Less(Set(-1.0f), py))),
+                      And(Less(px, Set(width)), Less(py, Set(height))));
+
+    // Rejected lanes are moved to the origin, a NaN position would turn into a wild gather index
+    px = AsFloat(And(AsInt(px), inside));
+    py = AsFloat(And(AsInt(py), inside));
+    VFloat x0 = Floor(px);
+    VFloat y0 = Floor(py);
+    VFloat fx = Sub(px, x0);
+    VFloat fy = Sub(py, y0);
+    VInt shadedTag = SetInt(Sint32(tag | PIXEL_TAG_SHADED));
+    VFloat r = Set(0.0f), g = Set(0.0f), b = Set(0.0f), weightSum = Set(0.0f);
+    for (Uint32 tap = 0; tap < 4; ++tap)
+    {
+        VFloat tx = Clamp(Add(x0, Set(float(tap & 1))), 0.0f, width - 1.0f);
+        VFloat ty = Clamp(Add(y0, Set(float(tap >> 1))), 0.0f, height - 1.0f);
+        VInt index = Truncate(MulAdd(ty, Set(width), tx));
+
+        VFloat difference = Sub(Gather(temporal->historyDepth, index), previousDepth);
+        VInt valid = And(Equal(GatherInt((const Sint32*)temporal->historyTags, index), shadedTag), inside);
+        valid = And(valid, And(LessEqual(difference, tolerance), LessEqual(Sub(Set(0.0f), difference), tolerance)));
+
+        VFloat weight = Mul((tap & 1) ? fx : Sub(Set(1.0f), fx), (tap >> 1) ? fy : Sub(Set(1.0f), fy));
+        weight = AsFloat(And(AsInt(Add(weight, Set(1e-3f))), valid));
+        VInt c = GatherInt((const Sint32*)temporal->historyColor, index);
+        r = MulAdd(weight, ToFloat(And(c, SetInt(0xff))), r);
+        g = MulAdd(weight, ToFloat(And(ShiftRight(c, 8), SetInt(0xff))), g);
+        b = MulAdd(weight, ToFloat(And(ShiftRight(c, 16), SetInt(0xff))), b);
+        weightSum = Add(weightSum, weight);
+    }
+
+    VFloat recWeight = Div(Set(1.0f), weightSum);
+    VInt red = Truncate(MulAdd(r, recWeight, Set(0.5f)));
+    VInt green = Truncate(MulAdd(g, recWeight, Set(0.5f)));
+    VInt blue = Truncate(MulAdd(b, recWeight, Set(0.5f)));
+    colors = Or(Or(ShiftLeft(blue, 16), ShiftLeft(green, 8)), red);
+    return Less(Set(0.0f), weightSum);
+}
+
+static void ReconstructPixel(TemporalState *temporal, Rasterizer *rasterizer, Uint32 tag, Uint32 x, Uint32 y, vec4 clip)
+{
+    Uint32 index = y * temporal->width + x;
+    Uint32 color;
+    if (Reproject(temporal, tag, clip, color))
+    {
+        temporal->reprojectedPixels++;
+        rasterizer->frameBuffer[index] = color;
+    }
+    else if (Fill(temporal, rasterizer->frameBuffer, tag, x, y, color))
+    {
+        temporal->filledPixels++;
+        rasterizer->frameBuffer[index] = color;
+    }
+}
+
+void Temporal::EndFrame(TemporalState *temporal, Rasterizer *rasterizer)
+{
+    temporal->reprojectedPixels = 0;
+    temporal->filledPixels = 0;
+    if (temporal->mode == CHECKERBOARD_OFF)
+        return;
+
+    /*  Runs of SIMD_WIDTH pixels are reprojected together when the pixels to reconstruct all belong to one draw,
+        which is the case away from the silhouettes. The matrix product is split into the part of the row, of x
+        and of the depth. */
+    UpdateReprojections(temporal);
+    Uint32 width = temporal->width;
+    float laneOffsets[SIMD_WIDTH];
+    for (Uint32 lane = 0; lane < SIMD_WIDTH; ++lane)
+    {
+        laneOffsets[lane] = float(lane);
+    }
+
+    for (Uint32 y = 0; y < temporal->height; ++y)
+    {
+        const Uint32 *tags = temporal->tags + y * width;
+        const float *depths = rasterizer->depthBuffer + y * width;
+        Uint32 end = Uint32(temporal->spans[2 * y + 1] + 1);
+        for (Uint32 x = Uint32(std::min(temporal->spans[2 * y], Sint32(width))); x < end; x += SIMD_WIDTH)
+        {
+            // Background (0) and shaded pixels are done, the test is branchless as they alternate with the others
+            Uint32 count = std::min(Uint32(SIMD_WIDTH), end - x);
+            Uint32 laneMask = 0;
+            for (Uint32 lane = 0; lane < count; ++lane)
+            {
+                laneMask |= Uint32(tags[x + lane] - 1 < PIXEL_TAG_SHADED - 1) << lane;
+            }
+            if (!laneMask)
+                continue;
+
+            Uint32 runTag = 0;
+            bool mixed = false;
+            for (Uint32 lane = 0; lane < count; ++lane)
+            {
+                if (!(laneMask & (1 << lane)))
+                    continue;
+                mixed |= runTag != 0 && tags[x + lane] != runTag;
+                runTag = tags[x + lane];
+            }
+
+            if (mixed || count < SIMD_WIDTH)
+            {
+                for (Uint32 lane = 0; lane < count; ++lane)
+                {
+                    if (!(laneMask & (1 << lane)))
+                        continue;
+                    Uint32 tag = tags[x + lane];
+                    const mat4 &reprojection = temporal->reprojections[tag - 1];
+                    vec4 clip = reprojection * vec4(float(x + lane), float(y), depths[x + lane], 1.0f);
+                    ReconstructPixel(temporal, rasterizer, tag, x + lane, y, clip);
+                }
+                continue;
+            }
+
+            const mat4 &m = temporal->reprojections[runTag - 1];
+            VFloat px = Simd::Add(Simd::Load(laneOffsets), Simd::Set(float(x)));
+            VFloat depth = Simd::Load(depths + x);
+            VFloat clip[4];
+            for (Uint32 row = 0; row < 4; ++row)
+            {
+                VFloat rowPart = Simd::Set(m[1][row] * float(y) + m[3][row]);
+                clip[row] = Simd::MulAdd(px, Simd::Set(m[0][row]), Simd::MulAdd(depth, Simd::Set(m[2][row]), rowPart));
+            }
+
+            VInt colors;
+            VInt found = ReprojectBatch(temporal, runTag, clip[0], clip[1], clip[2], clip[3], colors);
+            Sint32 laneColors[SIMD_WIDTH];
+            Sint32 laneFound[SIMD_WIDTH];
+            Simd::Store(laneColors, colors);
+            Simd::Store(laneFound, found);
+
+            Uint32 *frameBuffer = rasterizer->frameBuffer + y * width + x;
+            for (Uint32 lane = 0; lane < SIMD_WIDTH; ++lane)
+            {
+                if (!(laneMask & (1 << lane)))
+                    continue;
+                Uint32 color;
+                if (laneFound[lane])
+                {
+                    temporal->reprojectedPixels++;
+                    frameBuffer[lane] = Uint32(laneColors[lane]);
+                }
+                else if (Fill(temporal, rasterizer->frameBuffer, runTag, x + lane, y, color))
+                {
+                    temporal->filledPixels++;
+                    frameBuffer[lane] = color;
+                }
+            }
+        }
+    }
+
+    // Only the tagged pixels are ever read back. The depth buffer is cleared by the next frame anyway, keep it
+    // instead of copying.
+    for (Uint32 y = 0; y < temporal->height; ++y)
+    {
+        Sint32 first = temporal->spans[2 * y];
+        Sint32 last = temporal->spans[2 * y + 1];
+        if (first <= last)
+            memcpy(temporal->historyColor + y * width + first, rasterizer->frameBuffer + y * width + first, (last - first + 1) * sizeof(Uint32));
+    }
+    std::swap(temporal->historyDepth, rasterizer->depthBuffer);
+    std::swap(temporal->historyTags, temporal->tags);
+    std::swap(temporal->historySpans, temporal->spans);
+    std::swap(temporal->historyDraws, temporal->draws);
+    std::swap(temporal->historyDrawCapacity, temporal->drawCapacity);
+    temporal->historyDrawCount = temporal->drawCount;
+    temporal->historyValid = true;
+    temporal->frame++;
+}
+
+const char* Temporal::ModeToString(Uint32 mode)
+{
+    switch (mode)
+    {
+    case CHECKERBOARD_OFF:
+        return "off";
+    case CHECKERBOARD_HALF:
+        return "half";
+    case CHECKERBOARD_QUARTER:
+        return "quarter";
+    default:
+        return NULL;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef TEMPORAL_H
+#define TEMPORAL_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+#include "rasterizer.h"
+
+#define CHECKERBOARD_OFF 0
+#define CHECKERBOARD_HALF 1     // Two diagonal pixels of every quad per frame
+#define CHECKERBOARD_QUARTER 2  // One pixel of every quad per frame
+
+// A draw of the frame, the pixels it covers are tagged with its index + 1
+struct TemporalDraw
+{
+    const Mesh *mesh;
+    glm::mat4 mvpMatrix;
+};
+
+/*  Checkerboard rendering shades a different part of the pixels every frame. The other covered pixels are
+    reprojected from the previous frame with the matrices of the draw covering them, so moving objects are followed
+    as well as the camera. A reprojected pixel is only accepted when the previous frame had the same draw at about
+    the same depth there. Disoccluded pixels are filled in from the shaded neighbours of the same draw. */
+struct TemporalState
+{
+    Uint32 mode;
+    Uint32 frame;           // Selects the shaded pixels
+    Uint32 width;
+    Uint32 height;
+    Uint32 pixelCapacity;   // Matches Rasterizer::pixelCapacity, the depth buffers are swapped with the rasterizer's
+    Uint32 rowCapacity;
+
+    Uint32 *tags;           // Rasterizer::pixelTags of the current frame
+    Sint32 *spans;          // Rasterizer::tagSpans of the current frame
+    Uint32 *historyColor;   // Only valid inside the history spans
+    float *historyDepth;
+    Uint32 *historyTags;
+    Sint32 *historySpans;
+    bool historyValid;
+
+    TemporalDraw *draws;
+    TemporalDraw *historyDraws;
+    glm::mat4 *reprojections;   // Current screen position and depth to the previous one, per draw
+    Uint32 drawCount;
+    Uint32 historyDrawCount;
+    Uint32 drawCapacity;
+    Uint32 historyDrawCapacity;
+
+    // Pixels reconstructed by the last frame
+    Uint32 reprojectedPixels;
+    Uint32 filledPixels;
+};
+
+namespace Temporal
+{
+    void Init(TemporalState *temporal);
+    void Release(TemporalState *temporal);
+
+    // Call before the frame is cleared, sets the rasterizer's shade pattern and pixel tags
+    void BeginFrame(TemporalState *temporal, Rasterizer *rasterizer, Uint32 mode);
+    // Returns the tag for Uniforms::drawTag, 0 when checkerboard rendering is off
+    Uint32 AddDraw(TemporalState *temporal, const Mesh *mesh, const glm::mat4 &mvpMatrix);
+    // Reconstructs the pixels that were not shaded and keeps the frame for the next one
+    void EndFrame(TemporalState *temporal, Rasterizer *rasterizer);
+
+    const char* ModeToString(Uint32 mode);
+}
+
+#endif
@@ -0,0 +1,599 @@
+#include <algorithm>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "texture.h"
+#include "common.h"
+
+using glm::vec2;
+using glm::vec3;
+
+#define BLOCK_CACHE_SIZE 64
+
+static std::atomic<Uint32> gNextTextureId(1);
+
+// Decoded 4x4 blocks. Each sampling thread has its own cache so no locking is needed. Entries are keyed by
+// the texture id and the block index, id 0 marks an empty entry.
+struct DecodedBlock
+{
+    Uint32 textureId;
+    Uint32 blockIndex;
+    Uint8 texels[16][4];
+};
+
+static thread_local DecodedBlock tBlockCache[BLOCK_CACHE_SIZE];
+
+bool UtilTexture::IsBlockCompressed(Uint32 format)
+{
+    return format == TEX_FORMAT_BC1 || format == TEX_FORMAT_BC3 || format == TEX_FORMAT_BC4;
+}
+
+static Uint32 BlockSize(Uint32 format)
+{
+    return (format == TEX_FORMAT_BC3) ? 16 : 8;
+}
+
+static Uint32 LevelWidth(Texture *texture, Uint32 level)
+{
+    return SDL_max(texture->width >> level, 1u);
+}
+
+static Uint32 LevelHeight(Texture *texture, Uint32 level)
+{
+    return SDL_max(texture->height >> level, 1u);
+}
+
+static Uint32 LevelSize(Uint32 format, Uint32 width, Uint32 height)
+{
+    switch (format)
+    {
+    case TEX_FORMAT_R8:
+        return width * height;
+    case TEX_FORMAT_RGBA8:
+        return width * height * 4;
+    default:
+        return ((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+    }
+}
+
+// Levels are stored one after another in data, starting with the full resolution one.
+static void SetLevelCount(Texture *texture, Uint32 levelCount)
+{
+    Uint32 offset = 0;
+    texture->levelCount = levelCount;
+    for (Uint32 level = 0; level < levelCount; ++level)
+    {
+        texture->levelOffsets[level] = offset;
+        offset += LevelSize(texture->format, LevelWidth(texture, level), LevelHeight(texture, level));
+    }
+}
+
+Uint32 UtilTexture::DataSize(Texture *texture)
+{
+    Uint32 lastLevel = texture->levelCount - 1;
+    return texture->levelOffsets[lastLevel] +
+           LevelSize(texture->format, LevelWidth(texture, lastLevel), LevelHeight(texture, lastLevel));
+}
+
+const char* UtilTexture::FormatToString(Uint32 format)
+{
+    switch (format)
+    {
+    case TEX_FORMAT_R8:
+        return "R8";
+    case TEX_FORMAT_RGBA8:
+        return "RGBA8";
+    case TEX_FORMAT_BC1:
+        return "BC1";
+    case TEX_FORMAT_BC3:
+        return "BC3";
+    case TEX_FORMAT_BC4:
+        return "BC4";
+    default:
+        return NULL;
+    }
+}
+
+Texture UtilTexture::MakeCheckerboard(Uint32 width, Uint32 height, Uint32 checkerSize)
+{
+    Texture texture = {};
+    texture.width = width;
+    texture.height = height;
+    texture.format = TEX_FORMAT_R8;
+    texture.id = gNextTextureId++;
+    SetLevelCount(&texture, 1);
+    texture.data = (Uint8*)malloc(width * height * sizeof(Uint8));
+    for (Uint32 j = 0; j < height; ++j)
+    {
+        Uint8 *P = &texture.data[j * width];
+        for (Uint32 i = 0; i < width; ++i)
+        {
+            int c = (((i / checkerSize) & 1) ^ ((j / checkerSize) & 1)) * 0xff;
+            *P++ = (Uint8)c;
+        }
+    }
+    return texture;
+}
+
+const char* UtilTexture::FilterToString(Uint32 filter)
+{
+    switch (filter)
+    {
+    case TEX_FILTER_NEAREST:
+        return "Nearest";
+    case TEX_FILTER_BILINEAR:
+        return "Bilinear";
+    case TEX_FILTER_MIPMAP:
+        return "Mipmap";
+    default:
+        return NULL;
+    }
+}
+
+Texture UtilTexture::MakeTextureCopy(Texture *original)
+{
+    Texture texture = *original;
+    texture.refCount.value = 0;
+    Uint32 size = DataSize(original);
+    texture.data = (Uint8*)malloc(size);
+    memcpy(texture.data, original->data, size);
+    return texture;
+}
+
+void UtilTexture::Release(Texture texture)
+{
+    free(texture.data);
+}
+
+Texture* UtilTexture::Upload(Texture *source)
+{
+    Texture *texture = (Texture*)malloc(sizeof(Texture));
+    *texture = MakeTextureCopy(source);
+    texture->refCount.value = 1;
+    return texture;
+}
+
+void UtilTexture::AddRef(Texture *texture)
+{
+    if (texture)
+        SDL_AtomicIncRef(&texture->refCount);
+}
+
+void UtilTexture::Unref(Texture *texture)
+{
+    if (texture && SDL_AtomicDecRef(&texture->refCount))
+    {
+        Release(*texture);
+        free(texture);
+    }
+}
+
+/// Uncompressed access
+
+// Out of range coordinates are clamped so that partial blocks at the right and bottom edge can be encoded.
+static void ReadTexel(Texture *texture, Uint32 level, Uint32 x, Uint32 y, Uint8 rgba[4])
+{
+    Uint32 width = LevelWidth(texture, level);
+    x = SDL_min(x, width - 1);
+    y = SDL_min(y, LevelHeight(texture, level) - 1);
+    Uint32 index = y * width + x;
+
+    if (texture->format == TEX_FORMAT_R8)
+    {
+        rgba[0] = rgba[1] = rgba[2] = texture->data[texture->levelOffsets[level] + index];
+        rgba[3] = 0xff;
+    }
+    else // TEX_FORMAT_RGBA8
+    {
+        memcpy(rgba, &texture->data[texture->levelOffsets[level] + index * 4], 4);
+    }
+}
+
+static void WriteTexel(Texture *texture, Uint32 level, Uint32 x, Uint32 y, Uint8 rgba[4])
+{
+    Uint32 bytesPerTexel = (texture->format == TEX_FORMAT_RGBA8) ? 4 : 1;
+    Uint32 index = y * LevelWidth(texture, level) + x;
+    memcpy(&texture->data[texture->levelOffsets[level] + index * bytesPerTexel], rgba, bytesPerTexel);
+}
+
+/// Block decoding
+
+static Uint16 Pack565(const Uint8 rgba[4])
+{
+    Uint16 r = Uint16((rgba[0] * 31 + 127) / 255);
+    Uint16 g = Uint16((rgba[1] * 63 + 127) / 255);
+    Uint16 b = Uint16((rgba[2] * 31 + 127) / 255);
+    return Uint16(r << 11 | g << 5 | b);
+}
+
+static void Unpack565(Uint16 c, Uint8 rgba[4])
+{
+    Uint8 r = (c >> 11) & 31;
+    Uint8 g = (c >> 5) & 63;
+    Uint8 b = c & 31;
+    rgba[0] = Uint8(r << 3 | r >> 2);
+    rgba[1] = Uint8(g << 2 | g >> 4);
+    rgba[2] = Uint8(b << 3 | b >> 2);
+    rgba[3] = 0xff;
+}
+
+// Endpoints c0 > c1 select the 4 color mode, otherwise the 3 color + transparent black mode is used.
+// BC3 color blocks always use the 4 color mode.
+static void ColorPalette(Uint16 c0, Uint16 c1, bool fourColor, Uint8 palette[4][4])
+{
+    fourColor = fourColor || c0 > c1;
+    Unpack565(c0, palette[0]);
+    Unpack565(c1, palette[1]);
+    for (Uint32 ch = 0; ch < 3; ++ch)
+    {
+        if (fourColor)
+        {
+            palette[2][ch] = Uint8((2 * palette[0][ch] + palette[1][ch]) / 3);
+            palette[3][ch] = Uint8((palette[0][ch] + 2 * palette[1][ch]) / 3);
+        }
+        else
+        {
+            palette[2][ch] = Uint8((palette[0][ch] + palette[1][ch]) / 2);
+            palette[3][ch] = 0;
+        }
+    }
+    palette[2][3] = 0xff;
+    palette[3][3] = fourColor ? 0xff : 0;
+}
+
+// Endpoints a0 > a1 select 8 interpolated values, otherwise 6 interpolated values plus 0 and 255.
+static void AlphaPalette(Uint8 a0, Uint8 a1, Uint8 palette[8])
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1)
+    {
+        for (Uint32 i = 1; i < 7; ++i)
+            palette[i + 1] = Uint8(((7 - i) * a0 + i * a1) / 7);
+    }
+    else
+    {
+        for (Uint32 i = 1; i < 5; ++i)
+            palette[i + 1] = Uint8(((5 - i) * a0 + i * a1) / 5);
+        palette[6] = 0;
+        palette[7] = 0xff;
+    }
+}
+
+static void DecodeColorBlock(const Uint8 *block, bool fourColor, Uint8 texels[16][4])
+{
+    Uint16 c0 = Uint16(block[0] | block[1] << 8);
+    Uint16 c1 = Uint16(block[2] | block[3] << 8);
+    Uint32 indices = block[4] | block[5] << 8 | block[6] << 16 | Uint32(block[7]) << 24;
+
+    Uint8 palette[4][4];
+    ColorPalette(c0, c1, fourColor, palette);
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        memcpy(texels[i], palette[(indices >> (2 * i)) & 3], 4);
+    }
+}
+
+// Decodes a BC4 style block into the given channel of the texels.
+static void DecodeAlphaBlock(const Uint8 *block, Uint8 texels[16][4], Uint32 channel)
+{
+    Uint8 palette[8];
+    AlphaPalette(block[0], block[1], palette);
+
+    Uint64 indices = 0;
+    for (Uint32 i = 0; i < 6; ++i)
+        indices |= Uint64(block[2 + i]) << (8 * i);
+
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        texels[i][channel] = palette[(indices >> (3 * i)) & 7];
+    }
+}
+
+static void DecodeBlock(Texture *texture, Uint32 blockIndex, Uint8 texels[16][4])
+{
+    const Uint8 *block = texture->data + blockIndex * BlockSize(texture->format);
+    switch (texture->format)
+    {
+    case TEX_FORMAT_BC1:
+        DecodeColorBlock(block, false, texels);
+        break;
+    case TEX_FORMAT_BC3:
+        DecodeColorBlock(block + 8, true, texels);
+        DecodeAlphaBlock(block, texels, 3);
+        break;
+    case TEX_FORMAT_BC4:
+        DecodeAlphaBlock(block, texels, 0);
+        for (Uint32 i = 0; i < 16; ++i)
+        {
+            texels[i][1] = texels[i][2] = texels[i][0];
+            texels[i][3] = 0xff;
+        }
+        break;
+    }
+}
+
+static const Uint8* FetchCompressed(Texture *texture, Uint32 level, Uint32 u, Uint32 v)
+{
+    // Index of the block across all levels
+    Uint32 blocksWide = (LevelWidth(texture, level) + 3) / 4;
+    Uint32 blockIndex = texture->levelOffsets[level] / BlockSize(texture->format) + (v / 4) * blocksWide + (u / 4);
+
+    // Direct mapped, neighbouring blocks land in different entries
+    DecodedBlock &entry = tBlockCache[(blockIndex ^ texture->id * 7) & (BLOCK_CACHE_SIZE - 1)];
+    if (entry.textureId != texture->id || entry.blockIndex != blockIndex)
+    {
+        DecodeBlock(texture, blockIndex, entry.texels);
+        entry.textureId = texture->id;
+        entry.blockIndex = blockIndex;
+    }
+
+    return entry.texels[(v & 3) * 4 + (u & 3)];
+}
+
+vec3 UtilTexture::Fetch(Texture *texture, Uint32 level, Uint32 u, Uint32 v)
+{
+    const float toFloat = 1.0f / 255.0f;
+    const Uint8 *levelData = texture->data + texture->levelOffsets[level];
+    switch (texture->format)
+    {
+    case TEX_FORMAT_R8:
+    {
+        float c = float(levelData[v * LevelWidth(texture, level) + u]) * toFloat;
+        return vec3(c, c, c);
+    }
+    case TEX_FORMAT_RGBA8:
+    {
+        const Uint8 *texel = &levelData[(v * LevelWidth(texture, level) + u) * 4];
+        return vec3(texel[0], texel[1], texel[2]) * toFloat;
+    }
+    default:
+    {
+        const Uint8 *texel = FetchCompressed(texture, level, u, v);
+        return vec3(texel[0], texel[1], texel[2]) * toFloat;
+    }
+    }
+}
+
+static float WrapCoord(float t, Uint32 wrap)
+{
+    if (wrap == TEX_COORD_CLAMP)
+        return glm::clamp(t, 0.0f, 1.0f);
+    else // TEX_COORD_REPEAT
+        return t - floorf(t);
+}
+
+// Picks the level whose texel footprint best matches the screen space derivatives of the texture coordinates.
+static Uint32 SelectLevel(Texture *texture, vec2 ddx, vec2 ddy)
+{
+    vec2 size = vec2(float(texture->width), float(texture->height));
+    vec2 dx = ddx * size;
+    vec2 dy = ddy * size;
+    float rho2 = SDL_max(glm::dot(dx, dx), glm::dot(dy, dy));
+    if (rho2 <= 1.0f)
+        return 0;
+
+    float lod = 0.5f * log2f(rho2);
+    return SDL_min(Uint32(lod + 0.5f), texture->levelCount - 1);
+}
+
+// ddx and ddy are the derivatives of texCoords, only used for level selection by TEX_FILTER_MIPMAP.
+vec3 UtilTexture::Sample(Texture *texture, Sampler *sampler, vec2 texCoords, vec2 ddx, vec2 ddy)
+{
+    Uint32 level = (sampler->filter == TEX_FILTER_MIPMAP) ? SelectLevel(texture, ddx, ddy) : 0;
+    Uint32 width = LevelWidth(texture, level);
+    Uint32 height = LevelHeight(texture, level);
+
+    float s = WrapCoord(texCoords.x, sampler->wrap) * (width - 1);
+    float t = WrapCoord(texCoords.y, sampler->wrap) * (height - 1);
+
+    if (sampler->filter == TEX_FILTER_NEAREST)
+        return Fetch(texture, level, Uint32(s), Uint32(t));
+
+    // TEX_FILTER_BILINEAR and TEX_FILTER_MIPMAP
+    Uint32 u0 = Uint32(s);
+    Uint32 v0 = Uint32(t);
+    Uint32 u1 = u0 + 1;
+    Uint32 v1 = v0 + 1;
+    if (sampler->wrap == TEX_COORD_CLAMP)
+    {
+        u1 = SDL_min(u1, width - 1);
+        v1 = SDL_min(v1, height - 1);
+    }
+    else // TEX_COORD_REPEAT
+    {
+        u1 = (u1 == width) ? 0 : u1;
+        v1 = (v1 == height) ? 0 : v1;
+    }
+
+    float fs = s - float(u0);
+    float ft = t - float(v0);
+    vec3 top = glm::mix(Fetch(texture, level, u0, v0), Fetch(texture, level, u1, v0), fs);
+    vec3 bottom = glm::mix(Fetch(texture, level, u0, v1), Fetch(texture, level, u1, v1), fs);
+    return glm::mix(top, bottom, ft);
+}
+
+/// Block encoding
+
+static Uint32 ColorDistance(const Uint8 *a, const Uint8 *b)
+{
+    int dr = a[0] - b[0];
+    int dg = a[1] - b[1];
+    int db = a[2] - b[2];
+    return Uint32(dr * dr + dg * dg + db * db);
+}
+
+// Endpoints are the darkest and brightest texel of the block, which is exact for two color blocks (e.g. the
+// checkerboard) and close for gradients. The block is always written in the 4 color mode.
+static void EncodeColorBlock(Uint8 texels[16][4], Uint8 *block)
+{
+    Uint32 minIndex = 0, maxIndex = 0;
+    Uint32 minLuma = UINT32_MAX, maxLuma = 0;
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        Uint32 luma = 2 * texels[i][0] + 5 * texels[i][1] + texels[i][2];
+        if (luma < minLuma) { minLuma = luma; minIndex = i; }
+        if (luma >= maxLuma) { maxLuma = luma; maxIndex = i; }
+    }
+
+    Uint16 c0 = Pack565(texels[maxIndex]);
+    Uint16 c1 = Pack565(texels[minIndex]);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    Uint8 palette[4][4];
+    ColorPalette(c0, c1, false, palette);
+    Uint32 paletteSize = (c0 > c1) ? 4 : 3;
+
+    Uint32 indices = 0;
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        Uint32 best = 0;
+        for (Uint32 p = 1; p < paletteSize; ++p)
+        {
+            if (ColorDistance(texels[i], palette[p]) < ColorDistance(texels[i], palette[best]))
+                best = p;
+        }
+        indices |= best << (2 * i);
+    }
+
+    block[0] = Uint8(c0);
+    block[1] = Uint8(c0 >> 8);
+    block[2] = Uint8(c1);
+    block[3] = Uint8(c1 >> 8);
+    for (Uint32 i = 0; i < 4; ++i)
+        block[4 + i] = Uint8(indices >> (8 * i));
+}
+
+// Encodes the given channel of the texels, always in the 8 value mode.
+static void EncodeAlphaBlock(Uint8 texels[16][4], Uint32 channel, Uint8 *block)
+{
+    Uint8 a0 = 0, a1 = 0xff;
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        a0 = SDL_max(a0, texels[i][channel]);
+        a1 = SDL_min(a1, texels[i][channel]);
+    }
+
+    Uint8 palette[8];
+    AlphaPalette(a0, a1, palette);
+
+    Uint64 indices = 0;
+    for (Uint32 i = 0; i < 16; ++i)
+    {
+        Uint32 best = 0;
+        for (Uint32 p = 1; p < 8; ++p)
+        {
+            if (abs(texels[i][channel] - palette[p]) < abs(texels[i][channel] - palette[best]))
+                best = p;
+        }
+        indices |= Uint64(best) << (3 * i);
+    }
+
+    block[0] = a0;
+    block[1] = a1;
+    for (Uint32 i = 0; i < 6; ++i)
+        block[2 + i] = Uint8(indices >> (8 * i));
+}
+
+// Source has to be uncompressed (R8 or RGBA8). R8 and BC4 store the red channel. All levels are converted.
+Texture UtilTexture::MakeConverted(Texture *source, Uint32 format)
+{
+    Texture texture = {};
+    texture.width = source->width;
+    texture.height = source->height;
+    texture.format = format;
+    texture.id = gNextTextureId++;
+    SetLevelCount(&texture, source->levelCount);
+    texture.data = (Uint8*)malloc(DataSize(&texture));
+
+    for (Uint32 level = 0; level < texture.levelCount; ++level)
+    {
+        Uint32 width = LevelWidth(&texture, level);
+        Uint32 height = LevelHeight(&texture, level);
+
+        if (!IsBlockCompressed(format))
+        {
+            for (Uint32 y = 0; y < height; ++y)
+            {
+                for (Uint32 x = 0; x < width; ++x)
+                {
+                    Uint8 rgba[4];
+                    ReadTexel(source, level, x, y, rgba);
+                    WriteTexel(&texture, level, x, y, rgba);
+                }
+            }
+            continue;
+        }
+
+        Uint8 *block = texture.data + texture.levelOffsets[level];
+        for (Uint32 by = 0; by < (height + 3) / 4; ++by)
+        {
+            for (Uint32 bx = 0; bx < (width + 3) / 4; ++bx)
+            {
+                Uint8 texels[16][4];
+                for (Uint32 i = 0; i < 16; ++i)
+                    ReadTexel(source, level, bx * 4 + (i & 3), by * 4 + (i >> 2), texels[i]);
+
+                switch (format)
+                {
+                case TEX_FORMAT_BC1:
+                    EncodeColorBlock(texels, block);
+                    break;
+                case TEX_FORMAT_BC3:
+                    EncodeAlphaBlock(texels, 3, block);
+                    EncodeColorBlock(texels, block + 8);
+                    break;
+                case TEX_FORMAT_BC4:
+                    EncodeAlphaBlock(texels, 0, block);
+                    break;
+                }
+                block += BlockSize(format);
+            }
+        }
+    }
+
+    return texture;
+}
+
+// Builds the full level chain down to 1x1 by averaging 2x2 texels. Source has to be uncompressed, only its
+// first level is used.
+Texture UtilTexture::MakeMipmapped(Texture *source)
+{
+    Uint32 levelCount = 1;
+    while ((source->width >> levelCount) > 0 || (source->height >> levelCount) > 0)
+        levelCount++;
+    levelCount = SDL_min(levelCount, Uint32(MAX_TEXTURE_LEVELS));
+
+    Texture texture = {};
+    texture.width = source->width;
+    texture.height = source->height;
+    texture.format = source->format;
+    texture.id = gNextTextureId++;
+    SetLevelCount(&texture, levelCount);
+    texture.data = (Uint8*)malloc(DataSize(&texture));
+    memcpy(texture.data, source->data, LevelSize(source->format, source->width, source->height));
+
+    for (Uint32 level = 1; level < levelCount; ++level)
+    {
+        for (Uint32 y = 0; y < LevelHeight(&texture, level); ++y)
+        {
+            for (Uint32 x = 0; x < LevelWidth(&texture, level); ++x)
+            {
+                Uint8 texels[4][4];
+                ReadTexel(&texture, level - 1, 2 * x, 2 * y, texels[0]);
+                ReadTexel(&texture, level - 1, 2 * x + 1, 2 * y, texels[1]);
+                ReadTexel(&texture, level - 1, 2 * x, 2 * y + 1, texels[2]);
+                ReadTexel(&texture, level - 1, 2 * x + 1, 2 * y + 1, texels[3]);
+
+                Uint8 rgba[4];
+                for (Uint32 ch = 0; ch < 4; ++ch)
+                    rgba[ch] = Uint8((texels[0][ch] + texels[1][ch] + texels[2][ch] + texels[3][ch] + 2) / 4);
+                WriteTexel(&texture, level, x, y, rgba);
+            }
+        }
+    }
+
+    return texture;
+}
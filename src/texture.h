@@ -0,0 +1,62 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+
+// Texel layouts. The block compressed formats store 4x4 texel blocks (8 or 16 bytes per block).
+#define TEX_FORMAT_R8 1
+#define TEX_FORMAT_RGBA8 2
+#define TEX_FORMAT_BC1 3    // RGB 5:6:5 endpoints, 2 bit indices (8 bytes/block)
+#define TEX_FORMAT_BC3 4    // BC4 style alpha block + BC1 color block (16 bytes/block)
+#define TEX_FORMAT_BC4 5    // Single channel, 3 bit indices (8 bytes/block)
+
+#define TEX_COORD_CLAMP 1
+#define TEX_COORD_REPEAT 2
+
+#define TEX_FILTER_NEAREST 1
+#define TEX_FILTER_BILINEAR 2
+#define TEX_FILTER_MIPMAP 3     // Bilinear within the level selected from the texture coordinate derivatives
+
+#define MAX_TEXTURE_UNITS 4
+#define MAX_TEXTURE_LEVELS 16
+
+struct Texture
+{
+    Uint8 *data;
+    Uint32 width;
+    Uint32 height;
+    Uint32 format;
+    Uint32 levelCount;
+    Uint32 levelOffsets[MAX_TEXTURE_LEVELS];   // In bytes from the start of data
+    Uint32 id;      // Unique per payload, used to key the decoded block cache
+    SDL_atomic_t refCount;  // Only used by texture objects created with Upload
+};
+
+struct Sampler
+{
+    Uint32 wrap;
+    Uint32 filter;
+};
+
+namespace UtilTexture
+{
+    Texture MakeCheckerboard(Uint32 width, Uint32 height, Uint32 checkerSize);
+    Texture MakeConverted(Texture *source, Uint32 format);
+    Texture MakeMipmapped(Texture *source);
+    Texture MakeTextureCopy(Texture *original);
+    Uint32 DataSize(Texture *texture);
+    bool IsBlockCompressed(Uint32 format);
+    glm::vec3 Fetch(Texture *texture, Uint32 level, Uint32 u, Uint32 v);
+    glm::vec3 Sample(Texture *texture, Sampler *sampler, glm::vec2 texCoords, glm::vec2 ddx, glm::vec2 ddy);
+    const char* FormatToString(Uint32 format);
+    void Release(Texture texture);
+
+    // Texture objects are uploaded once and shared by reference (texture units, meshes, owners).
+    Texture* Upload(Texture *source);
+    void AddRef(Texture *texture);
+    void Unref(Texture *texture);
+    const char* FilterToString(Uint32 filter);
+}
+
+#endif